@@ -0,0 +1,330 @@
+/*
+ * Keystroke-to-idle latency benchmark.
+ *
+ * Documents of increasing size are loaded into a GtkTextView in a real
+ * window, with the toolbar and the editor's own autosave from
+ * document_save.c. A script of typing, Enter, toolbar toggles, paste
+ * and undo is then played into the view. Each event is timed from the
+ * moment it is injected until a frame showing it has been painted and the
+ * main loop has nothing left to do, so idle work is included. Autosave
+ * waits for the autosave delay, as when typing, so it doesn't run
+ * between scripted events. p50, p95 and p99 are printed per document size
+ * and event kind.
+ *
+ * Needs a display; without a desktop session use a virtual one:
+ *
+ *   make bench                    (runs under xvfb-run when installed)
+ *   xvfb-run -a ./bench/bin/bench_latency [SIZE_KB...]
+ *   broadwayd :5 & GDK_BACKEND=broadway BROADWAY_DISPLAY=:5 ./bench/bin/bench_latency
+ *
+ * GTKTEXT_BENCH_ROUNDS sets how often the script is played per document.
+ */
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtktext_cmark.h"
+#include "parallel_parse.h"
+#include "document_save.h"
+#include "export_cache.h"
+#include "perf_policy.h"
+#include "toolbar.h"
+
+#define BENCH_DEFAULT_ROUNDS 20
+#define BENCH_TYPED_WORD "latency "
+
+static const guint default_sizes_kb[] = { 16, 128, 1024, 4096 };
+
+typedef enum {
+    EVENT_TYPE,
+    EVENT_ENTER,
+    EVENT_BOLD,
+    EVENT_ITALIC,
+    EVENT_PASTE,
+    EVENT_UNDO,
+    EVENT_KIND_COUNT
+} EventKind;
+
+static const char *const event_names[EVENT_KIND_COUNT] = {
+    "type", "enter", "bold", "italic", "paste", "undo",
+};
+
+typedef struct {
+    GtkWidget *window;
+    GtkTextView *text_view;
+    GtkTextBuffer *buffer;
+    GtkWidget *bold_button;
+    GtkWidget *italic_button;
+    guint typed;                // Characters typed so far
+
+    GArray *script;             // EventKind, played in order
+    guint next_event;
+    EventKind current;
+    gint64 started;             // Monotonic time the current event was injected
+    gboolean waiting_for_paint;
+    gboolean done;
+    GArray *samples[EVENT_KIND_COUNT]; // gint64 latencies in µs
+} Bench;
+
+// A document of about size_kb KiB mixing the blocks and inline markup the editor renders
+static gchar *generate_document(guint size_kb) {
+    GString *markdown = g_string_new(NULL);
+    for (guint i = 0; markdown->len < (gsize)size_kb * 1024; i++) {
+        g_string_append_printf(markdown,
+            "## Section %u\n\n"
+            "Paragraph %u has **bold** and *italic* words, some `inline code` and enough plain "
+            "text to wrap across the width of the editor window at its default size.\n\n"
+            "* First item of list %u\n* Second item with *emphasis*\n\n"
+            "```\nfor (int i = 0; i < %u; i++) {}\n```\n\n",
+            i, i, i, i);
+    }
+    return g_string_free(markdown, FALSE);
+}
+
+static GtkWidget *find_button(GtkWidget *widget, const char *label) {
+    if (GTK_IS_BUTTON(widget) && g_strcmp0(gtk_button_get_label(GTK_BUTTON(widget)), label) == 0) {
+        return widget;
+    }
+    for (GtkWidget *child = gtk_widget_get_first_child(widget); child; child = gtk_widget_get_next_sibling(child)) {
+        GtkWidget *found = find_button(child, label);
+        if (found) return found;
+    }
+    return NULL;
+}
+
+// The same buffer calls GtkTextView makes for a key press
+static void type_text(GtkTextBuffer *buffer, const char *text) {
+    gtk_text_buffer_begin_user_action(buffer);
+    gtk_text_buffer_insert_interactive_at_cursor(buffer, text, -1, TRUE);
+    gtk_text_buffer_end_user_action(buffer);
+}
+
+// Selects the word typed last, for the toolbar toggles
+static void select_typed_word(GtkTextBuffer *buffer) {
+    GtkTextIter end, start;
+    gtk_text_buffer_get_iter_at_mark(buffer, &end, gtk_text_buffer_get_insert(buffer));
+    gtk_text_iter_backward_line(&end);
+    gtk_text_iter_forward_to_line_end(&end);
+    start = end;
+    gtk_text_iter_backward_chars(&start, (gint)strlen(BENCH_TYPED_WORD));
+    gtk_text_buffer_select_range(buffer, &start, &end);
+}
+
+static void wait_for_paint(Bench *bench) {
+    bench->waiting_for_paint = TRUE;
+    // Events that change nothing visible still get a frame to wait for
+    gtk_widget_queue_draw(GTK_WIDGET(bench->text_view));
+}
+
+static void on_paste_done(G_GNUC_UNUSED GtkTextBuffer *buffer, G_GNUC_UNUSED GdkClipboard *clipboard,
+                          gpointer user_data) {
+    wait_for_paint(user_data);
+}
+
+static void play_next_event(Bench *bench);
+
+static gboolean on_idle(gpointer user_data) {
+    Bench *bench = user_data;
+    gint64 latency = g_get_monotonic_time() - bench->started;
+    g_array_append_val(bench->samples[bench->current], latency);
+    play_next_event(bench);
+    return G_SOURCE_REMOVE;
+}
+
+// After the paint, everything of higher priority than G_PRIORITY_LOW has run once the idle fires
+static void on_after_paint(G_GNUC_UNUSED GdkFrameClock *frame_clock, gpointer user_data) {
+    Bench *bench = user_data;
+    if (!bench->waiting_for_paint) return;
+    bench->waiting_for_paint = FALSE;
+    g_idle_add_full(G_PRIORITY_LOW, on_idle, bench, NULL);
+}
+
+static void play_next_event(Bench *bench) {
+    if (bench->next_event >= bench->script->len) {
+        bench->done = TRUE;
+        return;
+    }
+    bench->current = g_array_index(bench->script, EventKind, bench->next_event++);
+    if (bench->current == EVENT_BOLD) {
+        select_typed_word(bench->buffer);
+    } else if (bench->current == EVENT_PASTE) {
+        // Paste after the formatted word instead of over it
+        GtkTextIter end;
+        gtk_text_buffer_get_iter_at_mark(bench->buffer, &end, gtk_text_buffer_get_selection_bound(bench->buffer));
+        gtk_text_buffer_place_cursor(bench->buffer, &end);
+    }
+
+    bench->started = g_get_monotonic_time();
+    switch (bench->current) {
+    case EVENT_TYPE: {
+        char c[2] = { BENCH_TYPED_WORD[bench->typed++ % strlen(BENCH_TYPED_WORD)], 0 };
+        type_text(bench->buffer, c);
+        break;
+    }
+    case EVENT_ENTER:
+        type_text(bench->buffer, "\n");
+        break;
+    case EVENT_BOLD:
+        g_signal_emit_by_name(bench->bold_button, "clicked");
+        break;
+    case EVENT_ITALIC:
+        g_signal_emit_by_name(bench->italic_button, "clicked");
+        break;
+    case EVENT_PASTE:
+        // The clipboard is read asynchronously; the wait starts once the text is in
+        gtk_text_buffer_paste_clipboard(bench->buffer, gtk_widget_get_clipboard(GTK_WIDGET(bench->text_view)),
+                                        NULL, TRUE);
+        return;
+    case EVENT_UNDO:
+        gtk_text_buffer_undo(bench->buffer);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    wait_for_paint(bench);
+}
+
+static GArray *build_script(guint rounds) {
+    GArray *script = g_array_new(FALSE, FALSE, sizeof(EventKind));
+    const EventKind round[] = {
+        EVENT_TYPE, EVENT_TYPE, EVENT_TYPE, EVENT_TYPE, EVENT_TYPE, EVENT_TYPE, EVENT_TYPE, EVENT_TYPE,
+        EVENT_ENTER, EVENT_BOLD, EVENT_ITALIC, EVENT_PASTE, EVENT_UNDO, EVENT_UNDO,
+    };
+    for (guint i = 0; i < rounds; i++) {
+        g_array_append_vals(script, round, G_N_ELEMENTS(round));
+    }
+    return script;
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b) {
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples, in milliseconds
+static double percentile(GArray *sorted, double p) {
+    if (sorted->len == 0) return 0.0;
+    guint rank = (guint)(p / 100.0 * sorted->len + 0.5);
+    rank = CLAMP(rank, 1, sorted->len);
+    return g_array_index(sorted, gint64, rank - 1) / 1000.0;
+}
+
+static void print_row(const char *size, const char *kind, GArray *samples) {
+    g_array_sort(samples, compare_samples);
+    printf("%-10s %-8s %6u %9.2f %9.2f %9.2f\n", size, kind, samples->len,
+           percentile(samples, 50), percentile(samples, 95), percentile(samples, 99));
+}
+
+static void run_document(guint size_kb, guint rounds, GFile *save_file) {
+    Bench bench = { 0 };
+
+    bench.window = gtk_window_new();
+    gtk_window_set_default_size(GTK_WINDOW(bench.window), 900, 700);
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    GtkWidget *scrolled_window = gtk_scrolled_window_new();
+    gtk_widget_set_vexpand(scrolled_window, TRUE);
+    bench.text_view = GTK_TEXT_VIEW(gtk_text_view_new_with_buffer(create_headless_buffer_cmark()));
+    g_object_unref(gtk_text_view_get_buffer(bench.text_view));
+    gtk_text_view_set_wrap_mode(bench.text_view, GTK_WRAP_WORD);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_window), GTK_WIDGET(bench.text_view));
+    gtk_box_append(GTK_BOX(box), scrolled_window);
+    gtk_window_set_child(GTK_WINDOW(bench.window), box);
+    create_toolbar(GTK_WIDGET(bench.text_view));
+    bench.bold_button = find_button(box, "Fed");
+    bench.italic_button = find_button(box, "Kursiv");
+    g_assert(bench.bold_button && bench.italic_button);
+
+    bench.buffer = gtk_text_view_get_buffer(bench.text_view);
+    g_autofree gchar *markdown = generate_document(size_kb);
+    if (!import_markdown_to_buffer_parallel(bench.buffer, markdown, NULL)) {
+        g_printerr("bench: import of %u KiB failed\n", size_kb);
+        exit(EXIT_FAILURE);
+    }
+    export_cache_attach(bench.buffer);
+    document_save_attach(bench.buffer, save_file);
+    document_save_now(bench.buffer);
+    g_signal_connect(bench.buffer, "paste-done", G_CALLBACK(on_paste_done), &bench);
+
+    // Typing goes into the middle of the document, where layout above and below both matter
+    GtkTextIter middle;
+    gtk_text_buffer_get_iter_at_line(bench.buffer, &middle, gtk_text_buffer_get_line_count(bench.buffer) / 2);
+    gtk_text_buffer_place_cursor(bench.buffer, &middle);
+    gdk_clipboard_set_text(gtk_widget_get_clipboard(GTK_WIDGET(bench.text_view)),
+                           "Pasted text with *markup* that stays plain,\nover two lines.\n");
+
+    gtk_window_present(GTK_WINDOW(bench.window));
+    while (!gtk_widget_get_mapped(GTK_WIDGET(bench.text_view)) || !gtk_widget_get_frame_clock(GTK_WIDGET(bench.text_view))) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    gtk_text_view_scroll_to_mark(bench.text_view, gtk_text_buffer_get_insert(bench.buffer), 0.2, FALSE, 0, 0);
+    GdkFrameClock *frame_clock = gtk_widget_get_frame_clock(GTK_WIDGET(bench.text_view));
+    gulong paint_id = g_signal_connect(frame_clock, "after-paint", G_CALLBACK(on_after_paint), &bench);
+
+    for (guint i = 0; i < EVENT_KIND_COUNT; i++) {
+        bench.samples[i] = g_array_new(FALSE, FALSE, sizeof(gint64));
+    }
+    bench.script = build_script(rounds);
+    play_next_event(&bench);
+    while (!bench.done) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    g_signal_handler_disconnect(frame_clock, paint_id);
+    // A pending autosave holds the buffer; finish it outside the timed events
+    document_save_flush(bench.buffer);
+
+    g_autofree gchar *size = g_strdup_printf("%u KiB", size_kb);
+    GArray *all = g_array_new(FALSE, FALSE, sizeof(gint64));
+    for (guint i = 0; i < EVENT_KIND_COUNT; i++) {
+        g_array_append_vals(all, bench.samples[i]->data, bench.samples[i]->len);
+        print_row(size, event_names[i], bench.samples[i]);
+        g_array_unref(bench.samples[i]);
+    }
+    print_row(size, "all", all);
+    g_array_unref(all);
+    g_array_unref(bench.script);
+    gtk_window_destroy(GTK_WINDOW(bench.window));
+}
+
+int main(int argc, char *argv[]) {
+    if (!gtk_init_check()) {
+        g_printerr("bench: no display; run under xvfb-run or GDK_BACKEND=broadway\n");
+        return EXIT_FAILURE;
+    }
+    // The autosave delay adapts to slow saves as it does in the editor
+    perf_policy_init();
+
+    guint rounds = BENCH_DEFAULT_ROUNDS;
+    const char *rounds_env = g_getenv("GTKTEXT_BENCH_ROUNDS");
+    if (rounds_env) {
+        rounds = MAX(1, (guint)g_ascii_strtoull(rounds_env, NULL, 10));
+    }
+
+    GArray *sizes = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (int i = 1; i < argc; i++) {
+        guint size_kb = (guint)g_ascii_strtoull(argv[i], NULL, 10);
+        if (size_kb == 0) {
+            g_printerr("Usage: %s [SIZE_KB...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        g_array_append_val(sizes, size_kb);
+    }
+    if (sizes->len == 0) {
+        g_array_append_vals(sizes, default_sizes_kb, G_N_ELEMENTS(default_sizes_kb));
+    }
+
+    g_autofree gchar *dir = g_dir_make_tmp("gtktext-bench-XXXXXX", NULL);
+    g_autofree gchar *path = g_build_filename(dir, "bench.md", NULL);
+    GFile *save_file = g_file_new_for_path(path);
+
+    printf("%-10s %-8s %6s %9s %9s %9s\n", "size", "event", "count", "p50 ms", "p95 ms", "p99 ms");
+    for (guint i = 0; i < sizes->len; i++) {
+        run_document(g_array_index(sizes, guint, i), rounds, save_file);
+    }
+
+    g_file_delete(save_file, NULL, NULL);
+    g_rmdir(dir);
+    g_object_unref(save_file);
+    g_array_unref(sizes);
+    return EXIT_SUCCESS;
+}
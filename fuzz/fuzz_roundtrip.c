@@ -0,0 +1,158 @@
+/*
+ * Round-trip fuzzer for the Markdown import and export paths.
+ *
+ * Every input is imported into a headless GtkTextBuffer, exported, imported
+ * again and exported again. With a display available the cmrender renderer
+ * is exercised too. Besides crashes (and GLib criticals, which are made
+ * fatal), an input fails when the round trip takes longer than
+ * GTKTEXT_FUZZ_NS_PER_BYTE nanoseconds per input byte, so algorithmic
+ * blowups show up as findings instead of silently slow runs.
+ *
+ * libFuzzer:      make fuzz && ./fuzz/bin/fuzz_roundtrip fuzz/corpus
+ * AFL / replay:   make fuzz-regress, or ./fuzz/bin/fuzz_roundtrip_replay FILE...
+ */
+#include <gtk/gtk.h>
+#include <adwaita.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gtktext_cmark.h"
+#include "cmrender.h"
+
+// Runtime budget per input byte; inputs shorter than the floor are charged
+// as if they had FUZZ_MIN_CHARGED_BYTES so fixed setup cost is not flagged.
+#define FUZZ_DEFAULT_NS_PER_BYTE 20000
+#define FUZZ_MIN_CHARGED_BYTES 256
+
+static gint64 ns_per_byte_limit = FUZZ_DEFAULT_NS_PER_BYTE;
+static gboolean have_display = FALSE;
+
+static void fuzz_init(void) {
+    const char *limit = g_getenv("GTKTEXT_FUZZ_NS_PER_BYTE");
+    if (limit) {
+        ns_per_byte_limit = g_ascii_strtoll(limit, NULL, 10);
+    }
+
+    // cmrender applies theme colours through AdwStyleManager, which needs a
+    // display; without one only the cmark.c import/export path is fuzzed.
+    if (gtk_init_check()) {
+        adw_init();
+        have_display = TRUE;
+    }
+    g_log_set_always_fatal(G_LOG_LEVEL_CRITICAL);
+}
+
+static void run_one(const uint8_t *data, size_t size) {
+    // The editor only ever holds valid UTF-8; GtkTextBuffer rejects anything else
+    g_autofree gchar *markdown = g_utf8_make_valid((const gchar *)data, (gssize)size);
+
+    gint64 start_ns = g_get_monotonic_time() * 1000;
+
+    GtkTextBuffer *first = create_headless_buffer_cmark();
+    if (!import_markdown_to_buffer_cmark(first, markdown)) {
+        abort();
+    }
+    g_autofree char *exported = export_buffer_to_markdown_cmark(first);
+    if (!exported) {
+        abort();
+    }
+
+    GtkTextBuffer *second = create_headless_buffer_cmark();
+    if (!import_markdown_to_buffer_cmark(second, exported)) {
+        abort();
+    }
+    g_autofree char *reexported = export_buffer_to_markdown_cmark(second);
+    if (!reexported) {
+        abort();
+    }
+
+    if (have_display) {
+        GtkTextBuffer *rendered = gtk_text_buffer_new(NULL);
+        if (!cm_render_markdown_to_buffer(rendered, markdown, TRUE)) {
+            abort();
+        }
+        g_object_unref(rendered);
+    }
+
+    g_object_unref(second);
+    g_object_unref(first);
+
+    gint64 elapsed_ns = g_get_monotonic_time() * 1000 - start_ns;
+    gint64 charged_bytes = MAX((gint64)size, FUZZ_MIN_CHARGED_BYTES);
+    if (ns_per_byte_limit > 0 && elapsed_ns / charged_bytes > ns_per_byte_limit) {
+        fprintf(stderr, "fuzz_roundtrip: %zu bytes took %.1f ms (%" G_GINT64_FORMAT " ns/byte, limit %"
+                G_GINT64_FORMAT ")\n", size, elapsed_ns / 1e6, elapsed_ns / charged_bytes, ns_per_byte_limit);
+        abort();
+    }
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerInitialize(G_GNUC_UNUSED int *argc, G_GNUC_UNUSED char ***argv) {
+    fuzz_init();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run_one(data, size);
+    return 0;
+}
+
+#ifdef GTKTEXT_FUZZ_STANDALONE
+// Replays files (the regression corpus, AFL queue entries) or stdin for AFL.
+static int replay_file(const char *path) {
+    g_autofree gchar *contents = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+
+    if (!g_file_get_contents(path, &contents, &length, &error)) {
+        fprintf(stderr, "fuzz_roundtrip: %s\n", error->message);
+        g_clear_error(&error);
+        return 1;
+    }
+    printf("Running %s (%zu bytes)...\n", path, (size_t)length);
+    run_one((const uint8_t *)contents, length);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int failures = 0;
+
+    fuzz_init();
+    // Warm-up run so type registration and font setup are not charged to the first input
+    run_one((const uint8_t *)"*warm* **up**\n", 14);
+
+    if (argc < 2) {
+        GString *input = g_string_new(NULL);
+        char chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+            g_string_append_len(input, chunk, (gssize)n);
+        }
+        run_one((const uint8_t *)input->str, input->len);
+        g_string_free(input, TRUE);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (g_file_test(argv[i], G_FILE_TEST_IS_DIR)) {
+            GDir *dir = g_dir_open(argv[i], 0, NULL);
+            const gchar *name;
+            while (dir && (name = g_dir_read_name(dir)) != NULL) {
+                g_autofree gchar *path = g_build_filename(argv[i], name, NULL);
+                failures += replay_file(path);
+            }
+            if (dir) g_dir_close(dir);
+        } else {
+            failures += replay_file(argv[i]);
+        }
+    }
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    printf("All inputs passed.\n");
+    return EXIT_SUCCESS;
+}
+#endif // GTKTEXT_FUZZ_STANDALONE
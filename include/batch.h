@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Normalize every Markdown file below a directory without a display
+ *
+ * Each file is parsed into a render plan and exported again, giving the
+ * same Markdown as loading it in the editor and saving it. Files are
+ * spread over a pool of worker threads, each with its own cmark arena; no
+ * GTK objects are used. Per-file throughput and a summary are printed to
+ * stdout.
+ *
+ * @param directory The directory to scan recursively for *.md files
+ * @param jobs Number of worker threads; 0 or less uses one per CPU
+ * @param check_only TRUE to report files that would change without writing them
+ * @return 0 on success; 1 if a file failed, or would change in check mode
+ */
+int batch_normalize_directory(const char *directory, int jobs, gboolean check_only);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATCH_H
@@ -0,0 +1,47 @@
+#ifndef CMARK_ARENA_H
+#define CMARK_ARENA_H
+
+#include <cmark.h>
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Acquire the calling thread's bump-pointer arena as a cmark allocator
+ *
+ * Parsing with it makes a few large block allocations that are kept and
+ * reused by the next parse on the same thread. free() is a no-op, so the
+ * document must not be freed with cmark_node_free(); release the arena
+ * instead once the tree is no longer needed.
+ *
+ * @return The allocator to pass to cmark_parser_new_with_mem(), or NULL if
+ *         this thread's arena still backs a live document (use the default
+ *         allocator then)
+ */
+cmark_mem *cmark_arena_acquire(void);
+
+/**
+ * Release an arena acquired with cmark_arena_acquire()
+ *
+ * Every node, parser and iterator allocated from it becomes invalid. The
+ * memory is kept for the next parse, so this is O(1) unless the arena grew
+ * past its retention limit.
+ *
+ * @param mem The allocator returned by cmark_arena_acquire()
+ */
+void cmark_arena_release(cmark_mem *mem);
+
+/**
+ * Get the number of bytes held by the calling thread's arena
+ *
+ * @return Total size of the retained blocks, 0 if none are allocated
+ */
+gsize cmark_arena_get_retained_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMARK_ARENA_H
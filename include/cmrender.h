@@ -13,9 +13,11 @@
  *
  * @param buffer The GtkTextBuffer to render into.
  * @param markdown_text The CommonMark text to parse and render.
+ * @param validated TRUE if markdown_text is known to be valid UTF-8, e.g. from
+ *                  text_scan(); otherwise cmark checks it while parsing.
  * @return TRUE on success, FALSE on failure (e.g., invalid input, parse error).
  */
-gboolean cm_render_markdown_to_buffer(GtkTextBuffer *buffer, const char *markdown_text);
+gboolean cm_render_markdown_to_buffer(GtkTextBuffer *buffer, const char *markdown_text, gboolean validated);
 
 /**
  * @brief Updates theme-dependent GtkTextTags in the buffer.
@@ -0,0 +1,80 @@
+#ifndef DOCUMENT_IO_H
+#define DOCUMENT_IO_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Called on the main thread as a load or save makes progress
+ *
+ * @param fraction Completed part from 0.0 to 1.0, or a negative value
+ *        while the amount of remaining work is unknown
+ * @param user_data The data passed to the async call
+ */
+typedef void (*DocumentIoProgressFunc)(double fraction, gpointer user_data);
+
+/**
+ * Read and import a Markdown file without blocking the main loop
+ *
+ * The file is read in chunks with async GIO and parsed into a render plan
+ * on a worker thread; the plan is inserted into a new headless buffer on
+ * the main thread a few milliseconds at a time. Show the result by setting
+ * it on the text view, then call update_code_tags_for_theme() on it.
+ *
+ * @param file The file to open
+ * @param cancellable Optional cancellable
+ * @param progress Optional progress callback
+ * @param callback Called when the buffer is ready or the load failed
+ * @param user_data Data for progress and callback
+ */
+void document_io_load_async(GFile *file, GCancellable *cancellable, DocumentIoProgressFunc progress,
+                            GAsyncReadyCallback callback, gpointer user_data);
+
+/**
+ * Finish document_io_load_async()
+ *
+ * @param result The result passed to the callback
+ * @param digest Optional return location for the SHA-256 of the file as read
+ * @param error Return location for an error
+ * @return The new buffer (caller must unref), or NULL on error
+ */
+GtkTextBuffer *document_io_load_finish(GAsyncResult *result, gchar **digest, GError **error);
+
+/**
+ * Export a buffer as Markdown to a file without blocking the main loop
+ *
+ * A few lines are exported per main loop iteration and written with
+ * async GIO through g_file_replace_async(), so the old file is only
+ * replaced once everything has been written. Cancelling stops the save
+ * before its next slice. The buffer must not be modified until the
+ * callback runs; a cancelled or failed save leaves the old file in place.
+ *
+ * @param buffer The buffer to save
+ * @param file The file to write
+ * @param cancellable Optional cancellable
+ * @param progress Optional progress callback
+ * @param callback Called when the save completed or failed
+ * @param user_data Data for progress and callback
+ */
+void document_io_save_async(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable,
+                            DocumentIoProgressFunc progress, GAsyncReadyCallback callback,
+                            gpointer user_data);
+
+/**
+ * Finish document_io_save_async()
+ *
+ * @param result The result passed to the callback
+ * @param digest Optional return location for the SHA-256 of the written Markdown
+ * @param error Return location for an error
+ * @return TRUE if the file was written
+ */
+gboolean document_io_save_finish(GAsyncResult *result, gchar **digest, GError **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOCUMENT_IO_H
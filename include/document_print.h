@@ -0,0 +1,132 @@
+#ifndef DOCUMENT_PRINT_H
+#define DOCUMENT_PRINT_H
+
+#include <gtk/gtk.h>
+#include "document_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A document broken into pages of a fixed size
+ *
+ * Every line of the buffer is a block, laid out with Pango from its text
+ * and format tags. Layouts are cached per buffer, keyed by a block's text,
+ * formatting and width, so paginating again after an edit only lays out
+ * the blocks that changed; the page breaks are then summed from cached
+ * line heights. Main thread only.
+ */
+typedef struct _PrintPages PrintPages;
+
+/**
+ * Start paginating a buffer
+ *
+ * The buffer is read by print_pages_paginate() a slice at a time, so it
+ * may change while the pages are made: edits to lines already read are
+ * picked up until every line is, and later ones are left out.
+ *
+ * @param buffer The rendered document
+ * @param width Width of the printable area in points
+ * @param height Height of the printable area in points
+ * @return New pages (free with print_pages_free()); paginate them before use
+ */
+PrintPages *print_pages_new(GtkTextBuffer *buffer, double width, double height);
+
+/**
+ * Free pages
+ *
+ * @param pages The pages, or NULL
+ */
+void print_pages_free(PrintPages *pages);
+
+/**
+ * Lay out blocks and find page breaks until a deadline
+ *
+ * @param pages The pages
+ * @param deadline_us Monotonic time after which to stop, or 0 to finish.
+ *        At least one line is read or one block laid out per call.
+ * @return TRUE once every block is placed
+ */
+gboolean print_pages_paginate(PrintPages *pages, gint64 deadline_us);
+
+/**
+ * Get how far pagination is
+ *
+ * @param pages The pages
+ * @return Part of the work done, from 0.0 to 1.0; reading the buffer is
+ *         the first half and placing blocks the second
+ */
+double print_pages_get_progress(const PrintPages *pages);
+
+/**
+ * Get the number of pages
+ *
+ * @param pages Paginated pages
+ * @return Number of pages, at least 1
+ */
+guint print_pages_get_n_pages(const PrintPages *pages);
+
+/**
+ * Get the number of blocks that weren't in the cache and were laid out
+ *
+ * @param pages The pages
+ * @return Number of blocks laid out so far
+ */
+guint print_pages_get_n_laid_out(const PrintPages *pages);
+
+/**
+ * Draw a page with its printable area at the origin, in points
+ *
+ * @param pages Paginated pages
+ * @param page Page number, from 0
+ * @param cr The target
+ */
+void print_pages_draw(const PrintPages *pages, guint page, cairo_t *cr);
+
+/**
+ * Show the print dialog and print a buffer
+ *
+ * Runs asynchronously: pagination happens a few milliseconds at a time in
+ * GtkPrintOperation::paginate, with GTK's progress dialog, which can cancel
+ * it. The print settings and page setup are kept for the next print.
+ *
+ * @param parent The window the dialog belongs to
+ * @param buffer The rendered document
+ */
+void document_print(GtkWindow *parent, GtkTextBuffer *buffer);
+
+/**
+ * Export a buffer as PDF without blocking the main loop
+ *
+ * Pages get the default page setup, or the one from the last print. The
+ * buffer is read, paginated and drawn to a cairo PDF surface in slices on
+ * the scheduler's background lane, so it can be edited meanwhile, and the file is written with
+ * g_file_replace_contents_bytes_async(), so a cancelled or failed export
+ * leaves the old file in place.
+ *
+ * @param buffer The rendered document
+ * @param file The PDF file to write
+ * @param cancellable Optional cancellable
+ * @param progress Optional progress callback
+ * @param callback Called when the export completed or failed
+ * @param user_data Data for progress and callback
+ */
+void document_print_export_pdf_async(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable,
+                                     DocumentIoProgressFunc progress, GAsyncReadyCallback callback,
+                                     gpointer user_data);
+
+/**
+ * Finish document_print_export_pdf_async()
+ *
+ * @param result The result passed to the callback
+ * @param error Return location for an error
+ * @return TRUE if the file was written
+ */
+gboolean document_print_export_pdf_finish(GAsyncResult *result, GError **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOCUMENT_PRINT_H
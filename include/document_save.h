@@ -0,0 +1,59 @@
+#ifndef DOCUMENT_SAVE_H
+#define DOCUMENT_SAVE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Autosave a buffer to its file
+ *
+ * Every edit and every change of a formatting tag restarts the wait for
+ * the autosave delay, which the performance policy lengthens when saves
+ * are slow. The save then waits behind visible work on the scheduler's
+ * background lane, and after a paste that is still being inserted. The
+ * export cache must already be attached; changes a file monitor applies
+ * from disk are not saved.
+ *
+ * @param buffer The buffer showing the document
+ * @param file The file to save to
+ */
+void document_save_attach(GtkTextBuffer *buffer, GFile *file);
+
+/**
+ * Change the file autosave writes to, after a Save As
+ *
+ * @param buffer A buffer with autosave attached
+ * @param file The new file
+ */
+void document_save_set_file(GtkTextBuffer *buffer, GFile *file);
+
+/**
+ * Save the buffer as Markdown now
+ *
+ * The Markdown is streamed to a temporary file in fixed-size chunks, which
+ * replaces the document only once everything has been written. Lines that
+ * haven't changed since the last save come from the export cache, and the
+ * Markdown is hashed while it is written. When it hashes the same as the
+ * file on disk the temporary file is dropped; when the buffer hasn't
+ * changed since the last write nothing is exported at all.
+ *
+ * @param buffer A buffer with autosave attached
+ */
+void document_save_now(GtkTextBuffer *buffer);
+
+/**
+ * Save now instead of when the pending autosave runs; use before the
+ * document is left or its file is replaced
+ *
+ * @param buffer A buffer with autosave attached
+ */
+void document_save_flush(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOCUMENT_SAVE_H
@@ -0,0 +1,78 @@
+#ifndef DOCUMENT_VIEWS_H
+#define DOCUMENT_VIEWS_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Register a view of the document, in any window or pane
+ *
+ * Views of one document share its buffer, with its tags, autosave and
+ * caches; a view only adds its own layout. A buffer has one cursor and
+ * selection, so each view keeps its own in marks: they are saved when the
+ * view loses focus and restored when it gets it back. A new view starts
+ * at the cursor of the buffer. The view is unregistered when destroyed.
+ *
+ * @param view The view
+ */
+void document_views_add(GtkTextView *view);
+
+/**
+ * Show another buffer in every view of a buffer
+ *
+ * @param old_buffer The buffer being replaced
+ * @param buffer The buffer to show instead
+ */
+void document_views_set_buffer(GtkTextBuffer *old_buffer, GtkTextBuffer *buffer);
+
+/**
+ * Set whether the user can edit a buffer, in every view of it
+ *
+ * @param buffer The buffer
+ * @param editable FALSE to make every view of it read-only
+ */
+void document_views_set_editable(GtkTextBuffer *buffer, gboolean editable);
+
+/**
+ * Set whether every view of a buffer uses a monospace font
+ *
+ * @param buffer The buffer
+ * @param monospace TRUE for a monospace font
+ */
+void document_views_set_monospace(GtkTextBuffer *buffer, gboolean monospace);
+
+/**
+ * Remember the first visible line of every view of a buffer
+ *
+ * Each view keeps the spot in a mark, so it follows the text while lines
+ * above it are replaced. Call document_views_restore_scroll() afterwards.
+ *
+ * @param buffer The buffer about to be changed
+ */
+void document_views_keep_scroll(GtkTextBuffer *buffer);
+
+/**
+ * Scroll every view of a buffer back to the line remembered by
+ * document_views_keep_scroll()
+ *
+ * @param buffer The buffer
+ */
+void document_views_restore_scroll(GtkTextBuffer *buffer);
+
+/**
+ * Check whether a buffer is shown outside a window
+ *
+ * @param buffer The buffer
+ * @param window The window to ignore
+ * @return TRUE if a view in another window shows the buffer
+ */
+gboolean document_views_shown_elsewhere(GtkTextBuffer *buffer, GtkWindow *window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOCUMENT_VIEWS_H
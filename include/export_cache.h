@@ -0,0 +1,137 @@
+#ifndef EXPORT_CACHE_H
+#define EXPORT_CACHE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Keep the exported Markdown of every line of a buffer between saves
+ *
+ * Edits and changes of formatting tags mark the lines they touch dirty.
+ * A cached line is reused as long as it is clean and the line before it
+ * leaves the exporter in the same state as when it was cached, so a save
+ * after typing in one paragraph re-exports only that paragraph. Attach
+ * once the document is loaded; the cache lives as long as the buffer.
+ *
+ * @param buffer The buffer to track
+ */
+void export_cache_attach(GtkTextBuffer *buffer);
+
+/**
+ * Export a buffer as Markdown, reusing cached lines
+ *
+ * Produces the same output as export_buffer_to_stream_cmark(), which is
+ * used when no cache is attached. The stream is not closed. The Markdown
+ * is hashed as it is written, so a save can compare it with the file on
+ * disk without exporting twice.
+ *
+ * @param buffer The buffer to export
+ * @param stream The stream to write to
+ * @param digest Optional return location for the hex SHA-256 of what was
+ *        written (free with g_free()); NULL without a cache
+ * @param cancellable Optional cancellable for the writes
+ * @param error Return location for a write error
+ * @return TRUE on success
+ */
+gboolean export_cache_write(GtkTextBuffer *buffer, GOutputStream *stream, gchar **digest,
+                            GCancellable *cancellable, GError **error);
+
+/**
+ * Get the digest of the last write's Markdown, as long as nothing has
+ * changed the buffer's Markdown since. Costs no export.
+ *
+ * @param buffer The buffer
+ * @return The hex digest, or NULL if the buffer changed or has no cache
+ */
+const gchar *export_cache_get_written_digest(GtkTextBuffer *buffer);
+
+/**
+ * Compute the SHA-256 of the buffer's Markdown without keeping the Markdown
+ *
+ * Exports only when export_cache_get_written_digest() doesn't know it.
+ *
+ * @param buffer The buffer to hash
+ * @return The hex digest (caller must free)
+ */
+gchar *export_cache_compute_digest(GtkTextBuffer *buffer);
+
+/**
+ * Remember the digest of the Markdown last written to or read from disk
+ *
+ * The buffer counts as unmodified until its next edit.
+ *
+ * @param buffer A buffer with a cache attached
+ * @param digest The hex digest, or NULL if nothing is on disk
+ */
+void export_cache_set_saved_digest(GtkTextBuffer *buffer, const gchar *digest);
+
+/**
+ * Get the digest set with export_cache_set_saved_digest()
+ *
+ * @param buffer A buffer with a cache attached
+ * @return The digest, or NULL if none is known
+ */
+const gchar *export_cache_get_saved_digest(GtkTextBuffer *buffer);
+
+/**
+ * Check whether the buffer was edited since the saved digest was set, that
+ * is, whether it holds edits that are not on disk yet
+ *
+ * @param buffer The buffer
+ * @return TRUE if it has unsaved edits
+ */
+gboolean export_cache_is_modified(GtkTextBuffer *buffer);
+
+/**
+ * The part of a buffer's Markdown that a write changed
+ *
+ * The Markdown of the previous write with start characters kept at the
+ * front and suffix characters at the back, and text put in between, is
+ * the Markdown of this one.
+ */
+typedef struct {
+    gint start;              // Characters before the change
+    gint suffix;             // Characters after the change
+    const gchar *text;       // The Markdown in between
+    gsize length;            // Length of text in bytes
+    gint first_line;         // First buffer line whose Markdown starts in text
+    guint n_lines;           // Number of lines whose Markdown starts in text
+    const gint *line_starts; // Character offset in text where each of those lines starts
+} ExportCacheChange;
+
+/**
+ * Called at the end of every successful export_cache_write()
+ *
+ * @param buffer The buffer that was written
+ * @param change What changed since the previous write, or NULL if nothing did
+ * @param user_data Data passed to export_cache_set_change_func()
+ */
+typedef void (*ExportCacheChangeFunc)(GtkTextBuffer *buffer, const ExportCacheChange *change, gpointer user_data);
+
+/**
+ * Be told how each write changes the Markdown
+ *
+ * The first write after export_cache_invalidate(), or after the cache
+ * lost track of the lines, reports all of the Markdown as changed.
+ *
+ * @param buffer A buffer with a cache attached
+ * @param func The function to call, or NULL to stop
+ * @param user_data Data to pass to func
+ */
+void export_cache_set_change_func(GtkTextBuffer *buffer, ExportCacheChangeFunc func, gpointer user_data);
+
+/**
+ * Drop every cached line, so the next write exports the whole buffer
+ *
+ * @param buffer A buffer with a cache attached
+ */
+void export_cache_invalidate(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EXPORT_CACHE_H
@@ -0,0 +1,52 @@
+#ifndef FILE_MONITOR_H
+#define FILE_MONITOR_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reload a buffer when its file is changed by another program
+ *
+ * On a change the file is read and parsed on a worker thread. The result
+ * is then compared line by line with the buffer on the main thread and
+ * only the lines that differ are replaced, so the cursor, scroll position
+ * and undo history survive. Our own saves are recognized by the digest
+ * kept in the export cache, which must already be attached. A buffer with
+ * unsaved edits is not reloaded; its next save replaces the change.
+ *
+ * @param buffer The buffer showing the file
+ * @param file The file to watch
+ */
+void file_monitor_attach(GtkTextBuffer *buffer, GFile *file);
+
+/**
+ * Check the file against the buffer now, without waiting for a change
+ *
+ * Runs the same background reload as a change notification. Use it when
+ * the buffer was filled from something other than the file itself, such
+ * as the render cache; nothing happens if the file still hashes to the
+ * saved digest.
+ *
+ * @param buffer A buffer with a file monitor attached
+ */
+void file_monitor_verify(GtkTextBuffer *buffer);
+
+/**
+ * Check whether an external change is being applied to a buffer
+ *
+ * The buffer emits "changed" for every replaced line while this is TRUE;
+ * it already matches the file, so those changes should not be saved.
+ *
+ * @param buffer The buffer
+ * @return TRUE while a reload is modifying the buffer
+ */
+gboolean file_monitor_is_reloading(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FILE_MONITOR_H
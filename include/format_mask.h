@@ -0,0 +1,129 @@
+#ifndef FORMAT_MASK_H
+#define FORMAT_MASK_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Formatting tags known to the Markdown importers and exporters, as bit
+ * positions in a format mask. The order must match the name table in
+ * format_mask.c.
+ */
+typedef enum {
+    FORMAT_BOLD,
+    FORMAT_ITALIC,
+    FORMAT_CODE,
+    FORMAT_CODEBLOCK,
+    FORMAT_H1,
+    FORMAT_H2,
+    FORMAT_H3,
+    FORMAT_H4,
+    FORMAT_H5,
+    FORMAT_H6,
+    FORMAT_HR,
+    FORMAT_BLOCKQUOTE,
+    FORMAT_COUNT
+} FormatBit;
+
+#define FORMAT_MASK(bit) (1u << (bit))
+#define FORMAT_MASK_HEADINGS \
+    (FORMAT_MASK(FORMAT_H1) | FORMAT_MASK(FORMAT_H2) | FORMAT_MASK(FORMAT_H3) | \
+     FORMAT_MASK(FORMAT_H4) | FORMAT_MASK(FORMAT_H5) | FORMAT_MASK(FORMAT_H6))
+
+/**
+ * Active formatting during a traversal. A bit stays set until every
+ * nested node that pushed it has been exited, so "**a **b** c**" keeps
+ * bold on "c".
+ */
+typedef struct {
+    guint32 mask;
+    guint16 depth[FORMAT_COUNT];
+} FormatState;
+
+/**
+ * Resolved tag objects for a buffer, indexed by FormatBit. Entries may be
+ * NULL when a renderer does not use that format.
+ */
+typedef GtkTextTag *FormatTags[FORMAT_COUNT];
+
+static inline void format_state_push(FormatState *state, FormatBit bit) {
+    if (state->depth[bit]++ == 0) {
+        state->mask |= FORMAT_MASK(bit);
+    }
+}
+
+static inline void format_state_pop(FormatState *state, FormatBit bit) {
+    if (state->depth[bit] > 0 && --state->depth[bit] == 0) {
+        state->mask &= ~FORMAT_MASK(bit);
+    }
+}
+
+/**
+ * Get the heading bit for a heading level
+ *
+ * @param level The heading level; clamped to 1..6
+ * @return FORMAT_H1 .. FORMAT_H6
+ */
+static inline FormatBit format_bit_for_heading(int level) {
+    return (FormatBit)(FORMAT_H1 + CLAMP(level, 1, 6) - 1);
+}
+
+/**
+ * Get the GtkTextTag name used for a format bit
+ *
+ * @param bit The format bit
+ * @return A static string such as "bold" or "h2"
+ */
+const char *format_bit_get_tag_name(FormatBit bit);
+
+/**
+ * Get the format bit a GtkTextTag stands for
+ *
+ * @param tag The tag to look up
+ * @return The bit, or -1 if the tag is anonymous or not a formatting tag
+ */
+int format_bit_from_tag(GtkTextTag *tag);
+
+/**
+ * Look up the format tags a buffer already has
+ *
+ * Unlike resolve_format_tags_cmark() no tags are created; bits without a
+ * tag in the buffer's table are set to NULL.
+ *
+ * @param buffer The buffer
+ * @param tags Filled with the tag for every bit
+ */
+void format_tags_lookup(GtkTextBuffer *buffer, FormatTags tags);
+
+/**
+ * Get the format bits of the tags at an iterator
+ *
+ * @param iter The position
+ * @param tags Tags from format_tags_lookup()
+ * @return Mask of the bits whose tag applies at iter
+ */
+guint32 format_mask_at_iter(const GtkTextIter *iter, FormatTags tags);
+
+/**
+ * Insert text at an iterator and apply the tag of every bit in a mask
+ *
+ * Uses character offsets rather than a temporary mark, so no buffer
+ * objects are allocated per call.
+ *
+ * @param buffer The buffer to insert into
+ * @param iter Insert position; moved to the end of the inserted text
+ * @param text UTF-8 text; nothing happens when it is NULL or empty
+ * @param mask Format bits to apply to the inserted range
+ * @param tags Resolved tags for the buffer
+ */
+void format_insert_text(GtkTextBuffer *buffer, GtkTextIter *iter, const char *text,
+                        guint32 mask, FormatTags tags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FORMAT_MASK_H
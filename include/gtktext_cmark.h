@@ -3,11 +3,28 @@
 
 #include <cmark.h>
 #include <gtk/gtk.h>
+#include "format_mask.h"
+#include "render_plan.h"
+#include "text_scan.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Parse Markdown into a render plan using cmark
+ *
+ * Uses no GTK objects, so it may run on any thread; show the plan on the
+ * main thread with render_plan_apply() or render_plan_insert().
+ *
+ * @param markdown NUL-terminated UTF-8 Markdown
+ * @param lines Optional line index of markdown from text_scan(); built
+ *        here for the source map when NULL
+ * @return A new plan with a source map (free with render_plan_free()), or
+ *         NULL if cmark failed
+ */
+RenderPlan *parse_markdown_to_plan_cmark(const char *markdown, const TextLineIndex *lines);
+
 /**
  * Import Markdown from a string to a GtkTextBuffer using cmark
  * 
@@ -25,6 +42,49 @@ gboolean import_markdown_to_buffer_cmark(GtkTextBuffer *buffer, const char *mark
  */
 char *export_buffer_to_markdown_cmark(GtkTextBuffer *buffer);
 
+/**
+ * Export a render plan as Markdown
+ *
+ * Gives the same Markdown as exporting a buffer showing the plan, and uses
+ * no GTK objects, so it may run on any thread.
+ *
+ * @param plan The plan to export
+ * @return A newly allocated string with the markdown content (caller must free)
+ */
+char *export_plan_to_markdown_cmark(const RenderPlan *plan);
+
+/**
+ * Export Markdown from a GtkTextBuffer to an output stream
+ * 
+ * The Markdown is written in fixed-size chunks, so memory use does not grow
+ * with the document. The stream is not closed.
+ * 
+ * @param buffer The GtkTextBuffer to export from
+ * @param stream The stream to write to, e.g. from g_file_replace() or an MdHashOutputStream
+ * @param cancellable Optional GCancellable
+ * @param error Return location for a write error
+ * @return TRUE if everything was written, FALSE with error set otherwise
+ */
+gboolean export_buffer_to_stream_cmark(GtkTextBuffer *buffer, GOutputStream *stream,
+                                       GCancellable *cancellable, GError **error);
+
+/**
+ * Look up the tag of every format bit, creating the missing ones with the
+ * same styles an import would use
+ * 
+ * @param buffer The GtkTextBuffer whose tag table to use
+ * @param tags Filled with one tag per FormatBit; the blockquote entry is left as is
+ */
+void resolve_format_tags_cmark(GtkTextBuffer *buffer, FormatTags tags);
+
+/**
+ * Create a GtkTextBuffer that can be imported into and exported from
+ * without a display or libadwaita, e.g. in batch mode or worker threads
+ * 
+ * @return A new buffer with the code tags already created (caller must unref)
+ */
+GtkTextBuffer *create_headless_buffer_cmark(void);
+
 /**
  * Update code-related tags to match the current theme
  * 
@@ -0,0 +1,35 @@
+#ifndef LIVE_FORMAT_H
+#define LIVE_FORMAT_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Turn Markdown typed into a buffer into formatting as it is written
+ *
+ * Typing a delimiter ('*', '_', '`' or '#') marks its paragraph. The next
+ * keystroke that is not a delimiter submits a job on the scheduler's
+ * input lane that reads that paragraph alone as Markdown: its existing
+ * formatting as markup, the text typed since the delimiter as it is and
+ * the rest escaped, so delimiters that were already text stay text. The
+ * syntax characters are then taken out and the format tags set in one
+ * undoable step before the next frame; the other tags of the paragraph,
+ * such as spelling marks, are kept. A heading is converted when its
+ * line is ended; a span still open, an empty heading or a code fence is
+ * left as typed until it is complete. A keystroke arriving before the job
+ * runs makes it stale and submits its own, so the cost of a keystroke
+ * depends on the paragraph, not the document. Only single keystrokes
+ * count; pastes and loads are left alone.
+ *
+ * @param buffer The document buffer
+ */
+void live_format_attach(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIVE_FORMAT_H
@@ -0,0 +1,63 @@
+#ifndef MARKDOWN_PASTE_H
+#define MARKDOWN_PASTE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Paste the clipboard into a view as formatted Markdown
+ *
+ * The clipboard is read asynchronously and handed to
+ * markdown_paste_text(). Nothing happens while the view isn't editable or
+ * its buffer is still pasting.
+ *
+ * @param view The view to paste into
+ */
+void markdown_paste(GtkTextView *view);
+
+/**
+ * Insert Markdown at the cursor of a buffer as formatting
+ *
+ * The text is parsed into a render plan on the scheduler's worker pool,
+ * without any trailing line breaks, and replaces the selection. The first
+ * slice of the insertion runs on the input lane, so a short paste lands
+ * before the next frame; the rest of a long one continues on the visible
+ * lane, a few milliseconds per frame. The views of the buffer are read-only
+ * until it is done, and the whole paste is one user action. Inserted text
+ * gets the formatting of the Markdown on top of what it inherits where it
+ * lands; the text around it is left as it was. Text that cmark can't
+ * parse is inserted as it is.
+ *
+ * @param buffer The document buffer
+ * @param markdown UTF-8 Markdown text
+ * @return FALSE if the buffer is still pasting, and nothing is done
+ */
+gboolean markdown_paste_text(GtkTextBuffer *buffer, const char *markdown);
+
+/**
+ * Check whether a paste into a buffer is being read, parsed or inserted
+ *
+ * @param buffer The document buffer
+ * @return TRUE until the pasted text is in the buffer
+ */
+gboolean markdown_paste_is_pending(GtkTextBuffer *buffer);
+
+/**
+ * Insert the rest of a paste now, so the buffer can be saved or exported
+ * without half of it
+ *
+ * A paste that is still being read or parsed hasn't changed the buffer
+ * and carries on as before.
+ *
+ * @param buffer The document buffer
+ */
+void markdown_paste_flush(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MARKDOWN_PASTE_H
@@ -0,0 +1,60 @@
+#ifndef MD_ESCAPE_H
+#define MD_ESCAPE_H
+
+#include "md_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where a run of text is written; bit flags
+typedef enum {
+    MD_ESCAPE_LINE_START = 1 << 0,  // The run starts a line of Markdown
+    MD_ESCAPE_VERBATIM = 1 << 1,    // Inside code: copied unchanged
+    MD_ESCAPE_AFTER_MARKER = 1 << 2,   // An emphasis or code marker was written right before the run
+    MD_ESCAPE_BEFORE_MARKER = 1 << 3,  // One is written right after it
+} MdEscapeContext;
+
+/**
+ * Append a run of buffer text as Markdown, escaping what would otherwise
+ * be read as markup
+ *
+ * Emphasis, code and link brackets are escaped everywhere, except '_'
+ * inside a word and inline HTML tags, which the importer keeps as literal
+ * text. A '_' next to a marker is at the edge of a word, where it could
+ * open or close emphasis, so it is escaped. At the start of a line, '#',
+ * '>', '-', '+', '~', lines of '=' and ordered list markers such as "1."
+ * or "2)" are escaped when they would start a block, also after up to
+ * three spaces. Then, and when four spaces or a tab would make the line
+ * indented code, the first space is written as "&#32;" instead, which
+ * keeps the indentation as text. The "* " bullet is left alone, as the
+ * importer writes bullet items as that text.
+ *
+ * Runs without special characters are copied in bulk, 16 bytes at a time
+ * with SSE2.
+ *
+ * @param md The writer to append to
+ * @param text UTF-8 text without line terminators, except as its last byte
+ * @param length Length of text in bytes
+ * @param context Where the run is written
+ * @param next The byte following the run: '\n' at the end of a line or the
+ *        buffer, 0 if it isn't known
+ */
+void md_escape_append(MdWriter *md, const char *text, gsize length, MdEscapeContext context, char next);
+
+/**
+ * Choose the delimiter for a code span so its content can't close it
+ *
+ * @param text The code span's content
+ * @param length Length of text in bytes
+ * @param pad Set when a space must go inside both delimiters, because the
+ *        content begins or ends with a backtick or with spaces on both sides
+ * @return Number of backticks to delimit the span with
+ */
+gsize md_escape_code_delimiter(const char *text, gsize length, gboolean *pad);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MD_ESCAPE_H
@@ -0,0 +1,62 @@
+#ifndef MD_EXPORT_H
+#define MD_EXPORT_H
+
+#include <gtk/gtk.h>
+#include "md_writer.h"
+#include "render_plan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Markers left open at the end of a line; bit flags of MdExportState
+enum {
+    MD_EXPORT_IN_BOLD = 1 << 0,
+    MD_EXPORT_IN_ITALIC = 1 << 1,
+    MD_EXPORT_IN_CODE = 1 << 2,
+    MD_EXPORT_IN_CODEBLOCK = 1 << 3,
+};
+
+typedef guint8 MdExportState;
+
+/**
+ * Export one line of a buffer as Markdown
+ *
+ * The output of a line depends only on its own text and tags, the state
+ * left by the previous line and the last MD_WRITER_TAIL bytes written.
+ * Export a whole buffer by calling this from the start until the end
+ * iterator is reached, then md_export_finish().
+ *
+ * @param buffer The buffer being exported
+ * @param iter Start of the line; moved past its line terminator
+ * @param state Open markers, updated for the next line
+ * @param md The writer to append to
+ */
+void md_export_line(GtkTextBuffer *buffer, GtkTextIter *iter, MdExportState *state, MdWriter *md);
+
+/**
+ * Export one line of a render plan as Markdown
+ *
+ * Writes exactly what md_export_line() writes for the same line of a
+ * buffer showing the plan, without touching GTK objects.
+ *
+ * @param plan The plan being exported
+ * @param line Line number, from 0
+ * @param state Open markers, updated for the next line
+ * @param md The writer to append to
+ */
+void md_export_plan_line(const RenderPlan *plan, guint line, MdExportState *state, MdWriter *md);
+
+/**
+ * Close markers still open at the end of the buffer and end with a newline
+ *
+ * @param state Open markers after the last line
+ * @param md The writer to append to
+ */
+void md_export_finish(MdExportState state, MdWriter *md);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MD_EXPORT_H
@@ -0,0 +1,47 @@
+#ifndef MD_HASH_STREAM_H
+#define MD_HASH_STREAM_H
+
+#include <gio/gio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD_TYPE_HASH_OUTPUT_STREAM (md_hash_output_stream_get_type())
+G_DECLARE_FINAL_TYPE(MdHashOutputStream, md_hash_output_stream, MD, HASH_OUTPUT_STREAM, GOutputStream)
+
+/**
+ * Create an output stream that hashes and counts what is written to it
+ * and then discards it
+ *
+ * Exporting into it gives the checksum and size of a document's Markdown
+ * without holding the Markdown in memory.
+ *
+ * @param checksum_type The hash to compute, e.g. G_CHECKSUM_SHA256
+ * @return A new stream (caller must unref)
+ */
+GOutputStream *md_hash_output_stream_new(GChecksumType checksum_type);
+
+/**
+ * Get the hex digest of everything written so far
+ *
+ * After this the checksum is finalized and further writes fail.
+ *
+ * @param stream The hash stream
+ * @return The digest, owned by the stream
+ */
+const char *md_hash_output_stream_get_digest(MdHashOutputStream *stream);
+
+/**
+ * Get the number of bytes written so far
+ *
+ * @param stream The hash stream
+ * @return The byte count
+ */
+guint64 md_hash_output_stream_get_size(MdHashOutputStream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MD_HASH_STREAM_H
@@ -0,0 +1,95 @@
+#ifndef MD_WRITER_H
+#define MD_WRITER_H
+
+#include <gio/gio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the chunks handed to the output stream while exporting
+#define MD_WRITER_CHUNK_SIZE (64 * 1024)
+// Bytes held back on flush; the exporter looks back at and may drop up to this many
+#define MD_WRITER_TAIL 2
+
+/**
+ * Buffered writer the Markdown exporter appends to
+ *
+ * Only MD_WRITER_CHUNK_SIZE bytes are held in memory; everything before the
+ * last MD_WRITER_TAIL bytes is written to the stream as the chunk fills up.
+ * While a capture array is set, appended bytes are also copied into it so
+ * the export cache can keep the output of a single line.
+ */
+typedef struct {
+    GOutputStream *stream;
+    GCancellable *cancellable;
+    char *chunk;
+    gsize len;              // Bytes pending in chunk
+    gsize total_len;        // Bytes appended so far, flushed or not
+    GError *error;          // First write error; later output is dropped
+    GByteArray *capture;    // Not owned; NULL when not capturing
+    guint capture_dropped;  // Bytes truncated from before the capture started
+    GChecksum *checksum;    // Not owned; fed what is written to the stream, or NULL
+} MdWriter;
+
+/**
+ * Prepare a writer for a stream
+ *
+ * @param md The writer to initialize
+ * @param stream The stream to write to; not closed by the writer
+ * @param cancellable Optional cancellable for the writes
+ */
+void md_writer_init(MdWriter *md, GOutputStream *stream, GCancellable *cancellable);
+
+/**
+ * Flush the remaining output and free the chunk
+ *
+ * @param md The writer
+ * @param error Return location for the first write error
+ * @return TRUE if everything was written
+ */
+gboolean md_writer_finish(MdWriter *md, GError **error);
+
+// Append text, a byte or a character; output is dropped once a write has failed
+void md_writer_append_len(MdWriter *md, const char *text, gsize text_len);
+void md_writer_append(MdWriter *md, const char *text);
+void md_writer_append_c(MdWriter *md, char c);
+void md_writer_append_unichar(MdWriter *md, gunichar c);
+
+/**
+ * Get a byte from the end of the output
+ *
+ * @param md The writer
+ * @param back Position from the end, 1 = last byte; at most MD_WRITER_TAIL
+ * @return The byte, or 0 if there is none
+ */
+char md_writer_last_char(const MdWriter *md, gsize back);
+
+/**
+ * Drop the last byte of the output, if any
+ *
+ * @param md The writer
+ */
+void md_writer_truncate_last(MdWriter *md);
+
+/**
+ * Start copying appended bytes into an array
+ *
+ * @param md The writer
+ * @param capture The array to append to; it is not cleared
+ */
+void md_writer_begin_capture(MdWriter *md, GByteArray *capture);
+
+/**
+ * Stop capturing
+ *
+ * @param md The writer
+ * @return Number of bytes truncated that were written before the capture began
+ */
+guint md_writer_end_capture(MdWriter *md);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MD_WRITER_H
@@ -0,0 +1,102 @@
+#ifndef OUTLINE_H
+#define OUTLINE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Name of the tag that hides folded sections */
+#define OUTLINE_FOLDED_TAG "folded"
+
+/**
+ * Keep the outline of a buffer: its h1-h6 headings in order, each with the
+ * fold state of its section
+ *
+ * A section runs from its heading to the next heading of the same or a
+ * higher level. Folding it applies the invisible OUTLINE_FOLDED_TAG to
+ * everything after the heading's line, so views skip laying the section
+ * out; the text stays in the buffer, and export and save still write it.
+ * Headings are followed with marks, so fold states stay with their
+ * headings through edits. Edits that don't touch a heading's line leave
+ * the outline as it is. After one that does, the outline is rebuilt and the
+ * folds whose sections changed are reapplied by a job on the scheduler's
+ * background lane, or at once by the next call that reads the outline.
+ *
+ * Other outline functions attach the outline when needed.
+ *
+ * @param buffer The document buffer
+ */
+void outline_attach(GtkTextBuffer *buffer);
+
+/**
+ * Get the number of headings in a buffer
+ *
+ * @param buffer The document buffer
+ * @return Number of headings
+ */
+guint outline_get_n_headings(GtkTextBuffer *buffer);
+
+/**
+ * Get a heading
+ *
+ * @param buffer The document buffer
+ * @param index Heading number, from 0
+ * @param iter Optional return location for the start of the heading's line
+ * @return The heading level, 1 to 6
+ */
+guint outline_get_heading(GtkTextBuffer *buffer, guint index, GtkTextIter *iter);
+
+/**
+ * Find the section an iterator is in
+ *
+ * @param buffer The document buffer
+ * @param iter A position in buffer
+ * @return Number of the last heading at or before iter, or -1 before the
+ *         first heading
+ */
+gint outline_find_section(GtkTextBuffer *buffer, const GtkTextIter *iter);
+
+/**
+ * Check whether a heading's section is folded
+ *
+ * @param buffer The document buffer
+ * @param index Heading number, from 0
+ * @return TRUE if the section is folded
+ */
+gboolean outline_is_folded(GtkTextBuffer *buffer, guint index);
+
+/**
+ * Fold or unfold a heading's section
+ *
+ * A cursor that would be hidden moves to the end of the heading's line.
+ *
+ * @param buffer The document buffer
+ * @param index Heading number, from 0
+ * @param folded TRUE to fold
+ */
+void outline_set_folded(GtkTextBuffer *buffer, guint index, gboolean folded);
+
+/**
+ * Fold every section except the one at an iterator, the sections it is
+ * part of and the sections in it, so only the text being worked on is laid
+ * out
+ *
+ * @param buffer The document buffer
+ * @param iter A position in the section to keep open
+ */
+void outline_fold_others(GtkTextBuffer *buffer, const GtkTextIter *iter);
+
+/**
+ * Unfold every section
+ *
+ * @param buffer The document buffer
+ */
+void outline_unfold_all(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OUTLINE_H
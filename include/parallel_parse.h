@@ -0,0 +1,73 @@
+#ifndef PARALLEL_PARSE_H
+#define PARALLEL_PARSE_H
+
+#include <gtk/gtk.h>
+#include "render_plan.h"
+#include "text_scan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Find where a Markdown document can be cut into chunks that parse the
+ * same on their own as they do in the whole document
+ *
+ * A chunk starts at an unindented line after a blank line, outside fenced
+ * code and the HTML blocks that may contain blank lines, and not at a list
+ * item, so every container has been closed. Cuts are placed at the first
+ * such line after each of n_chunks - 1 evenly spaced offsets.
+ *
+ * Link reference definitions apply to the whole document, so the labels
+ * of all definitions are collected; prepend them to every chunk. Whether a
+ * line is a definition can't always be told without parsing, such as
+ * inside containers or after a paragraph line; then NULL is returned.
+ *
+ * @param markdown The document
+ * @param length Length of markdown in bytes
+ * @param lines Optional line index of markdown from text_scan(), used to
+ *        step through the lines without searching for each '\n'
+ * @param n_chunks Number of chunks wanted
+ * @param definitions Appended with one "[label]: #" line per definition
+ * @return Byte offsets of the chunk starts, beginning with 0 (free with
+ *         g_array_unref()), or NULL if the document must be parsed whole
+ */
+GArray *parallel_parse_split(const char *markdown, gsize length, const TextLineIndex *lines,
+                             guint n_chunks, GString *definitions);
+
+/**
+ * Parse a Markdown document into a render plan, in chunks on all cores
+ *
+ * Each chunk is parsed into its own plan on a thread pool and the plans are
+ * appended in order, giving the same plan as a parse of the whole
+ * document. No GTK objects are used, so it may run on any thread; it
+ * blocks until every chunk is done, so call it from a worker thread where
+ * possible.
+ *
+ * @param markdown NUL-terminated UTF-8 document
+ * @param lines Optional line index of markdown from text_scan()
+ * @param n_chunks Number of chunks, or 0 to choose from the document size
+ *        and the number of processors
+ * @return A new plan (free with render_plan_free()), or NULL if cmark failed
+ */
+RenderPlan *parallel_parse_markdown(const char *markdown, const TextLineIndex *lines, guint n_chunks);
+
+/**
+ * Import a Markdown document into a buffer, parsing it in parallel
+ *
+ * Small documents go straight to import_markdown_to_buffer_cmark(); larger
+ * ones are parsed with parallel_parse_markdown() and applied as a plan.
+ *
+ * @param buffer The buffer to fill; its contents are replaced
+ * @param markdown NUL-terminated UTF-8 document
+ * @param lines Optional line index of markdown from text_scan()
+ * @return TRUE on success
+ */
+gboolean import_markdown_to_buffer_parallel(GtkTextBuffer *buffer, const char *markdown,
+                                            const TextLineIndex *lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PARALLEL_PARSE_H
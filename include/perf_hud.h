@@ -0,0 +1,33 @@
+#ifndef PERF_HUD_H
+#define PERF_HUD_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Attach a hidden performance HUD to a text view
+ *
+ * The HUD is placed as an overlay child and shows keystroke-to-paint
+ * latency, missed frames, the last parse/render/export/save durations,
+ * buffer size, tag count and RSS. It is freed with the text view.
+ *
+ * @param text_view The GtkTextView whose frame clock and buffer are sampled
+ * @param overlay The GtkOverlay that contains the text view
+ */
+void perf_hud_attach(GtkWidget *text_view, GtkWidget *overlay);
+
+/**
+ * Show or hide the HUD attached to a text view
+ *
+ * @param text_view The GtkTextView passed to perf_hud_attach()
+ */
+void perf_hud_toggle(GtkWidget *text_view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_HUD_H
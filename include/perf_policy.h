@@ -0,0 +1,98 @@
+#ifndef PERF_POLICY_H
+#define PERF_POLICY_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** GSettings schema holding the performance settings */
+#define PERF_POLICY_SCHEMA_ID "org.gtk.gtktext"
+
+/**
+ * How much of a document is checked and highlighted in the background.
+ * Matches the org.gtk.gtktext.HighlightScope enum of the schema.
+ */
+typedef enum {
+    PERF_HIGHLIGHT_DOCUMENT,
+    PERF_HIGHLIGHT_VISIBLE,
+    PERF_HIGHLIGHT_NONE,
+} PerfHighlightScope;
+
+/**
+ * Load the performance settings and start measuring the latencies the
+ * policy adapts to
+ *
+ * The schema is looked up among the installed ones and then in the build
+ * tree. Without it, or before this is called, every getter returns the
+ * schema's defaults. Call once at startup from the main thread.
+ */
+void perf_policy_init(void);
+
+/**
+ * Get the settings the policy reads, for binding them to widgets
+ *
+ * @return The settings (owned by the policy), or NULL if the schema isn't
+ *         installed
+ */
+GSettings *perf_policy_get_settings(void);
+
+/**
+ * Get the delay before edits are autosaved
+ *
+ * The setting is a minimum: when adapting, the delay grows with the time
+ * recent saves took, so saving never takes more than a small share of the
+ * time spent typing.
+ *
+ * @return The delay in milliseconds
+ */
+guint perf_policy_get_autosave_delay(void);
+
+/**
+ * Check whether a document should be edited in large-document mode
+ *
+ * It is when its text is over the size threshold or, when adapting,
+ * when recent saves or loads were slow.
+ *
+ * @param buffer The document buffer
+ * @return TRUE for large-document mode
+ */
+gboolean perf_policy_is_large_document(GtkTextBuffer *buffer);
+
+/**
+ * Get how much of a document to highlight in the background; the whole
+ * document narrows to the visible text in large-document mode
+ *
+ * @param buffer The document buffer
+ * @return The scope
+ */
+PerfHighlightScope perf_policy_get_highlight_scope(GtkTextBuffer *buffer);
+
+/**
+ * Get the number of threads for parsing a document. Safe from any thread.
+ *
+ * @return The number of threads, at least 1
+ */
+guint perf_policy_get_worker_threads(void);
+
+/**
+ * Get the most disk space the render cache may use
+ *
+ * @return The limit in bytes; 0 means the cache is off
+ */
+guint64 perf_policy_get_render_cache_size(void);
+
+/**
+ * Get how much parser memory a thread keeps between parses. Safe from any
+ * thread.
+ *
+ * @return The limit in bytes
+ */
+gsize perf_policy_get_parser_retain_size(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_POLICY_H
@@ -0,0 +1,127 @@
+#ifndef PERF_TRACE_H
+#define PERF_TRACE_H
+
+#include <glib.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Operations that are instrumented with trace spans.
+ * The order must match the name table in perf_trace.c.
+ */
+typedef enum {
+    PERF_OP_IMPORT,          // Parsing Markdown on load, reload or import, on any thread
+    PERF_OP_RENDER,          // cm_render_markdown_to_buffer
+    PERF_OP_EXPORT,          // export_buffer_to_markdown_cmark
+    PERF_OP_SAVE,            // save_buffer_as_markdown
+    PERF_OP_CLIPBOARD_COPY,  // Ctrl+C copy as markdown
+    PERF_OP_TOOLBAR_ITALIC,
+    PERF_OP_TOOLBAR_BOLD,
+    PERF_OP_TOOLBAR_HEADING,
+    PERF_OP_TOOLBAR_HR,
+    PERF_OP_RELOAD,          // Applying an external change to the open document
+    PERF_OP_CACHE_LOAD,      // render_cache_load hit
+    PERF_OP_CLIPBOARD_PASTE, // Ctrl+V paste as formatted Markdown, until the last piece is inserted
+    PERF_OP_COUNT
+} PerfOp;
+
+/**
+ * Consumers that want span timings. Tracing is active while at least one
+ * consumer is enabled; otherwise a span is a single branch on a flag.
+ */
+typedef enum {
+    PERF_CONSUMER_SYSPROF = 1 << 0, // Marks written to a running Sysprof capture
+    PERF_CONSUMER_STATS   = 1 << 1, // Counts and histograms for --stats
+    PERF_CONSUMER_HUD     = 1 << 2, // Last durations shown by the in-app HUD
+    PERF_CONSUMER_POLICY  = 1 << 3, // Smoothed durations the performance policy adapts to
+} PerfConsumer;
+
+/**
+ * A running span. start_us is 0 when tracing was inactive at the start,
+ * in which case ending the span does nothing.
+ */
+typedef struct {
+    PerfOp op;
+    gint64 start_us;
+} PerfSpan;
+
+// Bitmask of enabled PerfConsumer values. Read through perf_span_begin().
+extern gint perf_trace_consumers;
+
+/**
+ * Detect a Sysprof collector and enable the matching consumer.
+ * Call once at startup before the first span.
+ */
+void perf_trace_init(void);
+
+/**
+ * Enable or disable a consumer of span timings
+ *
+ * @param consumer The consumer to toggle
+ * @param enabled TRUE to start recording for it
+ */
+void perf_trace_set_consumer(PerfConsumer consumer, gboolean enabled);
+
+/**
+ * Start a span for an operation
+ *
+ * @param op The operation being timed
+ * @return The span to pass to perf_span_end()
+ */
+static inline PerfSpan perf_span_begin(PerfOp op) {
+    PerfSpan span = { op, 0 };
+#ifndef GTKTEXT_DISABLE_TRACING
+    if (G_UNLIKELY(g_atomic_int_get(&perf_trace_consumers) != 0)) {
+        span.start_us = g_get_monotonic_time();
+    }
+#endif
+    return span;
+}
+
+/**
+ * Finish a span and hand its duration to the enabled consumers
+ *
+ * @param span The span returned by perf_span_begin()
+ */
+void perf_span_end(PerfSpan *span);
+
+/**
+ * Get the duration of the most recent completed span of an operation
+ *
+ * @param op The operation
+ * @return The duration in microseconds, or -1 if none was recorded
+ */
+gint64 perf_trace_get_last_duration(PerfOp op);
+
+/**
+ * Get the recent typical duration of an operation, an exponential moving
+ * average over its spans while the policy consumer is enabled
+ *
+ * @param op The operation
+ * @return The duration in microseconds, or -1 if none was recorded
+ */
+gint64 perf_trace_get_smoothed_duration(PerfOp op);
+
+/**
+ * Get the stable name of an operation, as used in marks and JSON
+ *
+ * @param op The operation
+ * @return A static string
+ */
+const char *perf_op_get_name(PerfOp op);
+
+/**
+ * Write per-operation counts and latency histograms as JSON
+ *
+ * @param out The stream to write to
+ */
+void perf_trace_write_stats_json(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PERF_TRACE_H
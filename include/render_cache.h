@@ -0,0 +1,46 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Load a document from the on-disk render cache
+ *
+ * The cache lives in $XDG_CACHE_HOME/gtktext with one file per document
+ * path. It holds the rendered plain text and an array of format tag spans
+ * and is mapped into memory, so a hit costs one text insert plus one
+ * apply per span instead of a cmark parse. A hit requires the file's
+ * current size and modification time to match; the content hash it
+ * returns should still be checked against the file in the background.
+ *
+ * @param buffer The buffer to fill; left untouched on a miss
+ * @param file The document
+ * @return The SHA-256 of the file the cache was made from (caller must
+ *         free), or NULL on a miss
+ */
+gchar *render_cache_load(GtkTextBuffer *buffer, GFile *file);
+
+/**
+ * Write the render cache for a document
+ *
+ * The buffer must show exactly the current contents of the file, as after
+ * a load or save. The cache file is replaced atomically, then the least
+ * recently written caches are removed until all fit in the size the
+ * performance policy allows. With a size of 0 nothing is loaded or stored.
+ *
+ * @param buffer The buffer showing the document
+ * @param file The document
+ * @param digest The SHA-256 of the file's contents
+ * @return TRUE if the cache was written
+ */
+gboolean render_cache_store(GtkTextBuffer *buffer, GFile *file, const gchar *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RENDER_CACHE_H
@@ -0,0 +1,257 @@
+#ifndef RENDER_PLAN_H
+#define RENDER_PLAN_H
+
+#include <gtk/gtk.h>
+#include "format_mask.h"
+#include "source_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Snapshot of what a buffer shows: the text of every line and the runs of
+ * formatting tags on it, and a copy of its source map. Only the tags in
+ * format_mask.h are recorded.
+ */
+typedef struct _RenderPlan RenderPlan;
+
+/**
+ * Characters of a line sharing one set of format tags; offsets are in
+ * characters from the line start
+ */
+typedef struct {
+    gint start;
+    gint end;
+    guint32 mask;
+} RenderPlanRun;
+
+/**
+ * Where render_plan_insert() carries on; zero it before the first call
+ */
+typedef struct {
+    guint line;    // Line of the plan
+    guint run;     // Run of that line
+    gint offset;   // Characters of the line already inserted
+    gsize byte;    // The same in bytes
+} RenderPlanPosition;
+
+/**
+ * Builds a plan from text appended in order, without a buffer
+ *
+ * Uses no GTK objects, so a parser on a worker thread can fill it and
+ * hand the plan to the main thread.
+ */
+typedef struct _RenderPlanBuilder RenderPlanBuilder;
+
+/**
+ * Start building a plan
+ *
+ * @return A new builder, empty like a new buffer (finish with
+ *         render_plan_builder_finish())
+ */
+RenderPlanBuilder *render_plan_builder_new(void);
+
+/**
+ * Append text as if it were inserted at the end of a buffer
+ *
+ * @param builder The builder
+ * @param text UTF-8 text; nothing happens when it is NULL or empty
+ * @param mask Format bits of the text
+ */
+void render_plan_builder_append(RenderPlanBuilder *builder, const char *text, guint32 mask);
+
+/**
+ * Get the number of characters appended so far
+ *
+ * @param builder The builder
+ * @return The buffer offset the next text would be inserted at
+ */
+gint render_plan_builder_get_offset(const RenderPlanBuilder *builder);
+
+/**
+ * Finish building a plan
+ *
+ * @param builder The builder; freed
+ * @param source_map Optional source map of the text, taken over by the plan
+ * @return The plan (free with render_plan_free())
+ */
+RenderPlan *render_plan_builder_finish(RenderPlanBuilder *builder, SourceMap *source_map);
+
+/**
+ * Take a snapshot of a buffer
+ *
+ * Only reads the buffer; must run on the main thread like any other use
+ * of it.
+ *
+ * @param buffer The buffer to snapshot
+ * @return A new plan (free with render_plan_free())
+ */
+RenderPlan *render_plan_new_from_buffer(GtkTextBuffer *buffer);
+
+/**
+ * A snapshot of a buffer taken a slice at a time
+ *
+ * Lines already read are read again when an edit or a change of format
+ * tags reaches them, so the plan is the buffer as it is when the last
+ * slice completes it. Main thread only.
+ */
+typedef struct _RenderPlanSnapshot RenderPlanSnapshot;
+
+/**
+ * Start a snapshot of a buffer; nothing is read yet
+ *
+ * @param buffer The buffer to snapshot; referenced until the snapshot is
+ *        finished or freed
+ * @return A new snapshot (finish with render_plan_snapshot_finish() or free
+ *         with render_plan_snapshot_free())
+ */
+RenderPlanSnapshot *render_plan_snapshot_new(GtkTextBuffer *buffer);
+
+/**
+ * Read lines of the buffer until a deadline
+ *
+ * @param snapshot The snapshot
+ * @param deadline_us Monotonic time after which to stop, or 0 to finish.
+ *        At least one line is read per call.
+ * @return TRUE once every line is read; finish the snapshot before the
+ *         buffer can change again
+ */
+gboolean render_plan_snapshot_read(RenderPlanSnapshot *snapshot, gint64 deadline_us);
+
+/**
+ * Get how far a snapshot is
+ *
+ * @param snapshot The snapshot
+ * @return Part of the buffer's lines read, from 0.0 to 1.0
+ */
+double render_plan_snapshot_get_progress(const RenderPlanSnapshot *snapshot);
+
+/**
+ * Finish a snapshot that has read every line
+ *
+ * @param snapshot The snapshot; freed
+ * @return The plan (free with render_plan_free())
+ */
+RenderPlan *render_plan_snapshot_finish(RenderPlanSnapshot *snapshot);
+
+/**
+ * Free an unfinished snapshot
+ *
+ * @param snapshot The snapshot, or NULL
+ */
+void render_plan_snapshot_free(RenderPlanSnapshot *snapshot);
+
+/**
+ * Read a line of a buffer the way a plan records it
+ *
+ * @param iter Start of the line; moved to the start of the next one
+ * @param tags Tags from format_tags_lookup()
+ * @param runs Filled with the RenderPlanRuns of the line, in order and
+ *        covering all of it; emptied first
+ * @return The text of the line, including its terminator (free with g_free())
+ */
+gchar *render_plan_read_line(GtkTextIter *iter, FormatTags tags, GArray *runs);
+
+/**
+ * Free a plan
+ *
+ * @param plan The plan, or NULL
+ */
+void render_plan_free(RenderPlan *plan);
+
+/**
+ * Get the number of lines in a plan
+ *
+ * @param plan The plan
+ * @return Number of lines; an empty buffer has one
+ */
+guint render_plan_get_n_lines(const RenderPlan *plan);
+
+/**
+ * Get a line of a plan
+ *
+ * @param plan The plan
+ * @param line Line number, from 0
+ * @param runs Optional return location for the line's runs, in order and
+ *        covering the whole line (owned by the plan)
+ * @param n_runs Optional return location for the number of runs
+ * @return The text of the line, including its terminator (owned by the plan)
+ */
+const gchar *render_plan_get_line(const RenderPlan *plan, guint line, const RenderPlanRun **runs, guint *n_runs);
+
+/**
+ * Get the source map of a plan
+ *
+ * @param plan The plan
+ * @return The map owned by the plan, or NULL if it has none
+ */
+const SourceMap *render_plan_get_source_map(const RenderPlan *plan);
+
+/**
+ * Replace the source map of a plan
+ *
+ * @param plan The plan
+ * @param source_map The new map, taken over by the plan, or NULL
+ */
+void render_plan_set_source_map(RenderPlan *plan, SourceMap *source_map);
+
+/**
+ * Append a plan to another, as if their buffers were concatenated
+ *
+ * The last line of plan, which has no line terminator, is joined with the
+ * first line of tail. The result has a source map only if both had one.
+ *
+ * @param plan The plan to extend
+ * @param tail The plan to append; consumed
+ */
+void render_plan_append(RenderPlan *plan, RenderPlan *tail);
+
+/**
+ * Remove the line terminators and empty lines at the end of a plan, so it
+ * can be inserted into the middle of a line. The source map is dropped.
+ *
+ * @param plan The plan
+ */
+void render_plan_trim_end(RenderPlan *plan);
+
+/**
+ * Insert a plan at an iterator, a piece at a time until a deadline
+ *
+ * Each piece carries the format tags of its run on top of any it inherits
+ * at the insertion point. Long runs are split, so a call never takes much
+ * longer than inserting a few kilobytes. The caller groups the calls into
+ * a user action if they should undo as one.
+ *
+ * @param plan The plan to insert
+ * @param buffer The buffer; missing format tags are created
+ * @param iter Insert position; moved to the end of the inserted text
+ * @param position Where to carry on; updated
+ * @param deadline_us Monotonic time after which to stop, or 0 to insert
+ *        everything. At least one piece is inserted per call.
+ * @return TRUE once the whole plan is inserted
+ */
+gboolean render_plan_insert(const RenderPlan *plan, GtkTextBuffer *buffer, GtkTextIter *iter,
+                            RenderPlanPosition *position, gint64 deadline_us);
+
+/**
+ * Make a buffer show a plan, touching only the lines that differ
+ *
+ * The lines shared at the start and at the end are kept, and between them
+ * the lines are matched as in patience diff, so only the blocks that
+ * changed are replaced. The replacements form one user action, so they
+ * can be undone and the undo history is kept. A cursor inside replaced
+ * lines stays on the same line and column where that still exists. The
+ * buffer's source map is replaced with a copy of the plan's.
+ *
+ * @param plan The plan to show
+ * @param buffer The buffer to update; missing format tags are created
+ * @return Number of lines that were replaced or inserted
+ */
+guint render_plan_apply(const RenderPlan *plan, GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RENDER_PLAN_H
@@ -0,0 +1,161 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Priority lanes for background work, most urgent first. A lane only runs
+ * when the lanes above it have nothing waiting. Jobs are added and
+ * cancelled from the main thread.
+ */
+typedef enum {
+    SCHEDULER_LANE_INPUT,       // The response to a keystroke; lands before the next frame is laid out
+    SCHEDULER_LANE_VISIBLE,     // Work on the text on screen
+    SCHEDULER_LANE_BACKGROUND,  // Work on the rest of the document
+    SCHEDULER_LANE_IDLE,        // Only when nothing else is waiting
+    SCHEDULER_LANE_COUNT
+} SchedulerLane;
+
+typedef struct _SchedulerJob SchedulerJob;
+
+/**
+ * A slice of work on the main thread
+ *
+ * @param job The job, for scheduler_job_is_cancelled()
+ * @param deadline_us Monotonic time by which the slice should return
+ * @param user_data The job's data
+ * @return TRUE to be called again, FALSE when the job is done
+ */
+typedef gboolean (*SchedulerSliceFunc)(SchedulerJob *job, gint64 deadline_us, gpointer user_data);
+
+/**
+ * Computation run on a worker thread; it must not touch widgets or
+ * buffers. Long work should poll scheduler_job_is_cancelled().
+ *
+ * @param job The job
+ * @param user_data The job's data
+ */
+typedef void (*SchedulerWorkFunc)(SchedulerJob *job, gpointer user_data);
+
+/**
+ * Called on the main thread once work is done, unless it was cancelled
+ *
+ * @param user_data The job's data
+ */
+typedef void (*SchedulerDoneFunc)(gpointer user_data);
+
+/**
+ * Run work on the main thread in slices
+ *
+ * Jobs of a lane take turns, one slice per main loop iteration, so input
+ * and drawing are never held up by more than a slice. The lanes below
+ * input share a budget of main thread time per frame; once it is spent
+ * they wait for the next frame, as told by the frame clock from
+ * scheduler_follow_frame_clock(), or every 16.7 ms without one.
+ *
+ * A job for a buffer belongs to the buffer's current generation, which
+ * every insertion or deletion advances: typing cancels the job before its
+ * next slice. Submit from "insert-text" or "delete-range" handlers
+ * connected after the default one, which see the new generation.
+ *
+ * @param buffer The buffer the work is for, or NULL for work that doesn't
+ *        go stale
+ * @param lane The lane
+ * @param slice The work
+ * @param user_data Data for slice
+ * @param destroy Frees user_data when the job finishes or is cancelled
+ * @return The job's id, never 0
+ */
+guint scheduler_add_slice(GtkTextBuffer *buffer, SchedulerLane lane, SchedulerSliceFunc slice,
+                          gpointer user_data, GDestroyNotify destroy);
+
+/**
+ * Run computation on the shared worker pool and hand its result back
+ *
+ * Waiting jobs are taken in lane order. The pool has as many threads as
+ * the performance policy's worker thread count, see
+ * scheduler_update_worker_threads().
+ * Cancellation, including by an edit of buffer, skips work that hasn't
+ * started and done in any case.
+ *
+ * @param buffer The buffer the work is for, or NULL
+ * @param lane The lane
+ * @param work The computation, run on a worker thread
+ * @param done Called on the main thread with the result in user_data
+ * @param user_data Data for work and done
+ * @param destroy Frees user_data once the job is over, on the main thread
+ * @return The job's id, never 0
+ */
+guint scheduler_add_work(GtkTextBuffer *buffer, SchedulerLane lane, SchedulerWorkFunc work,
+                         SchedulerDoneFunc done, gpointer user_data, GDestroyNotify destroy);
+
+/**
+ * Pace the lanes below input by a widget's frame clock
+ *
+ * Their budget is renewed when the clock starts a frame, and lanes that
+ * have spent it resume once the frame is painted, asking the clock for a
+ * frame if nothing else does. The clock is followed while the widget is
+ * realized and taken over by whichever followed widget last got focus.
+ *
+ * @param widget The editor's text view
+ */
+void scheduler_follow_frame_clock(GtkWidget *widget);
+
+/**
+ * Resize the worker pool to the performance policy's worker thread
+ * count, which the policy calls when the setting changes. Work already
+ * running finishes on the threads it has.
+ */
+void scheduler_update_worker_threads(void);
+
+/**
+ * Cancel a job. A waiting slice job is freed at once; a running one is
+ * freed when it returns. Ids of finished jobs are ignored.
+ *
+ * @param job_id The id from scheduler_add_slice() or scheduler_add_work()
+ */
+void scheduler_cancel(guint job_id);
+
+/**
+ * Check whether a job is still waiting or running
+ *
+ * @param job_id A job id, or 0
+ * @return TRUE until the job has finished or been cancelled
+ */
+gboolean scheduler_is_pending(guint job_id);
+
+/**
+ * Check whether a job was cancelled, directly or by an edit of its
+ * buffer. Safe from any thread.
+ *
+ * @param job The job passed to its slice or work function
+ * @return TRUE if its result would be dropped
+ */
+gboolean scheduler_job_is_cancelled(SchedulerJob *job);
+
+/**
+ * Move a slice job to another lane, from its slice, such as once the
+ * visible part of the work is done
+ *
+ * @param job The job passed to its slice function
+ * @param lane The lane for its next slice
+ */
+void scheduler_job_set_lane(SchedulerJob *job, SchedulerLane lane);
+
+/**
+ * Get the generation of a buffer, which every edit advances
+ *
+ * @param buffer The buffer
+ * @return The generation
+ */
+guint scheduler_get_generation(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCHEDULER_H
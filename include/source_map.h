@@ -0,0 +1,147 @@
+#ifndef SOURCE_MAP_H
+#define SOURCE_MAP_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Correspondence between the characters of a buffer and the bytes of the
+ * Markdown it was imported from
+ *
+ * The map is a sorted array of anchors, each pairing the buffer offset
+ * where an imported node's text starts with the byte offset of that text
+ * in the Markdown; both columns only grow, so lookups are binary searches
+ * either way. Between anchors one character is taken as one byte, capped
+ * at the next anchor. Markdown offsets describe the source as imported:
+ * edits move the buffer side of the anchors, and text typed since has no
+ * anchor of its own.
+ */
+typedef struct _SourceMap SourceMap;
+
+/**
+ * Create an empty map
+ *
+ * @return A new map (free with source_map_free())
+ */
+SourceMap *source_map_new(void);
+
+/**
+ * Copy a map
+ *
+ * @param map The map
+ * @return A new map (free with source_map_free())
+ */
+SourceMap *source_map_copy(const SourceMap *map);
+
+/**
+ * Free a map
+ *
+ * @param map The map, or NULL
+ */
+void source_map_free(SourceMap *map);
+
+/**
+ * Add an anchor after the existing ones
+ *
+ * An anchor that would go back on either side is dropped; one at the same
+ * buffer offset as the last replaces it.
+ *
+ * @param map The map
+ * @param buffer_offset Character offset in the buffer
+ * @param source_offset Byte offset in the Markdown
+ */
+void source_map_add(SourceMap *map, gint buffer_offset, gsize source_offset);
+
+/**
+ * Append the anchors of another map, moved by fixed amounts
+ *
+ * @param map The map to extend
+ * @param tail The map whose anchors to append
+ * @param buffer_shift Added to the buffer offsets of tail
+ * @param source_shift Added to the Markdown offsets of tail
+ */
+void source_map_append(SourceMap *map, const SourceMap *tail, gint buffer_shift, gssize source_shift);
+
+/**
+ * Get the number of anchors in a map
+ *
+ * @param map The map
+ * @return Number of anchors
+ */
+guint source_map_get_n_anchors(const SourceMap *map);
+
+/**
+ * Find the Markdown byte offset a buffer character came from
+ *
+ * @param map The map
+ * @param buffer_offset Character offset in the buffer
+ * @return Byte offset in the Markdown, or 0 before the first anchor
+ */
+gsize source_map_to_source(const SourceMap *map, gint buffer_offset);
+
+/**
+ * Find the buffer character a Markdown byte offset was rendered as
+ *
+ * @param map The map
+ * @param source_offset Byte offset in the Markdown
+ * @return Character offset in the buffer, or 0 before the first anchor
+ */
+gint source_map_to_buffer(const SourceMap *map, gsize source_offset);
+
+/**
+ * Move anchors for text inserted into the buffer
+ *
+ * @param map The map
+ * @param offset Character offset of the insertion
+ * @param n_chars Number of characters inserted
+ */
+void source_map_insert(SourceMap *map, gint offset, gint n_chars);
+
+/**
+ * Move and drop anchors for text deleted from the buffer
+ *
+ * @param map The map
+ * @param start Character offset of the first deleted character
+ * @param end Character offset just after the deleted text
+ */
+void source_map_delete(SourceMap *map, gint start, gint end);
+
+/**
+ * Replace the anchors of a range of buffer text
+ *
+ * The anchors from buffer_start up to buffer_end are dropped and those of
+ * anchors put in their place; the anchors after them move by source_shift.
+ * The caller keeps both columns sorted.
+ *
+ * @param map The map
+ * @param buffer_start Character offset where the range starts
+ * @param buffer_end Character offset just after the range; G_MAXINT for the end
+ * @param anchors The anchors to put in the range, at their own offsets
+ * @param source_shift Added to the Markdown offsets of the anchors after the range
+ */
+void source_map_replace(SourceMap *map, gint buffer_start, gint buffer_end, const SourceMap *anchors, gssize source_shift);
+
+/**
+ * Give a buffer a source map, kept up to date as the buffer is edited
+ *
+ * @param buffer The buffer
+ * @param map The map, taken over by the buffer; NULL drops the buffer's map
+ */
+void source_map_attach(GtkTextBuffer *buffer, SourceMap *map);
+
+/**
+ * Get the source map of a buffer
+ *
+ * @param buffer The buffer
+ * @return The map owned by the buffer, or NULL if it has none
+ */
+SourceMap *source_map_get(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOURCE_MAP_H
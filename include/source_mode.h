@@ -0,0 +1,57 @@
+#ifndef SOURCE_MODE_H
+#define SOURCE_MODE_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Switch the views of a document between the rendered text and its Markdown
+ *
+ * The Markdown lives in a second buffer that follows the rendered one: each
+ * export reports the lines it wrote again, and only those are replaced in
+ * the source buffer, so switching is a swap of the buffer the views show.
+ * The cursor moves to the same place in the other buffer. Edits made to the
+ * source are parsed in the background and applied to the rendered buffer a
+ * block at a time; the rendered buffer stays the document that is saved.
+ * Switching back after an edit of the source waits for its parse, which
+ * starts at once, and the views keep showing the source until it lands;
+ * toggling again meanwhile stays on the source. The first switch builds
+ * the source buffer from a full export. The document's buffer needs an
+ * export cache.
+ *
+ * @param view A view showing the document, rendered or as source
+ */
+void source_mode_toggle(GtkTextView *view);
+
+/**
+ * Check whether a buffer is the Markdown source of a document
+ *
+ * @param buffer The buffer
+ * @return TRUE if views show it in place of the document's buffer
+ */
+gboolean source_mode_is_source(GtkTextBuffer *buffer);
+
+/**
+ * Get the document buffer behind a buffer a view shows
+ *
+ * @param buffer A document buffer or the source buffer of one
+ * @return The document buffer, owned by its views
+ */
+GtkTextBuffer *source_mode_get_document(GtkTextBuffer *buffer);
+
+/**
+ * Apply source edits still waiting to be parsed, so the document buffer
+ * has them before it is saved
+ *
+ * @param buffer A document buffer or the source buffer of one
+ */
+void source_mode_flush(GtkTextBuffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOURCE_MODE_H
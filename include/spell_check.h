@@ -0,0 +1,36 @@
+#ifndef SPELL_CHECK_H
+#define SPELL_CHECK_H
+
+#include <gtk/gtk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Tag marking misspelled words; view-only, never exported or cached */
+#define SPELL_CHECK_ERROR_TAG "spelling-error"
+
+/**
+ * Check the spelling of a text view's buffer in the background
+ *
+ * Edited paragraphs are marked unchecked with a tag that moves with the
+ * text, and are rechecked in scheduler slices once typing pauses: visible
+ * paragraphs on the visible lane, the rest on the idle lane. Text
+ * tagged code or codeblock is skipped. The checker follows the view when
+ * its buffer is replaced. The highlight scope of the performance policy
+ * can limit checking to the visible text, which is then checked as it is
+ * scrolled into view, or turn it off.
+ *
+ * The word list is loaded on a worker thread from $GTKTEXT_SPELL_DICT, a
+ * Hunspell dictionary for the current locale or /usr/share/dict/words;
+ * without one, spell checking stays off.
+ *
+ * @param view The text view
+ */
+void spell_check_attach(GtkTextView *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPELL_CHECK_H
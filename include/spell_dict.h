@@ -0,0 +1,62 @@
+#ifndef SPELL_DICT_H
+#define SPELL_DICT_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Word list for spell checking: the list file is mapped into memory and
+ * indexed by an open-addressing hash set of offsets into the mapping, so
+ * no word is copied. Read-only once built; lookups are safe from any thread.
+ */
+typedef struct _SpellDict SpellDict;
+
+/**
+ * Map and index a word list
+ *
+ * Takes one UTF-8 word per line, as in /usr/share/dict/words. Hunspell
+ * .dic files also work: affix flags after a '/' are ignored, so only the
+ * stems are known.
+ *
+ * @param path The word list
+ * @param error Return location for an error
+ * @return A new dictionary (free with spell_dict_free()), or NULL on error
+ */
+SpellDict *spell_dict_new_from_file(const char *path, GError **error);
+
+/**
+ * Free a dictionary
+ *
+ * @param dict The dictionary, or NULL
+ */
+void spell_dict_free(SpellDict *dict);
+
+/**
+ * Look up a word
+ *
+ * A word that isn't listed as written is also tried in lower case, so
+ * capitalized words at the start of a sentence are found.
+ *
+ * @param dict The dictionary
+ * @param word UTF-8 word
+ * @param len Length of word in bytes, or -1 if it is NUL-terminated
+ * @return TRUE if the word is spelled correctly
+ */
+gboolean spell_dict_contains(const SpellDict *dict, const char *word, gssize len);
+
+/**
+ * Get the number of distinct words in a dictionary
+ *
+ * @param dict The dictionary
+ * @return Number of words
+ */
+guint spell_dict_get_n_words(const SpellDict *dict);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPELL_DICT_H
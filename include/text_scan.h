@@ -0,0 +1,104 @@
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start offsets of the lines of a text, stored as 32-bit offsets. Lines
+ * end with '\n'; text ending with '\n' has an empty last line, as in a
+ * GtkTextBuffer.
+ */
+typedef struct _TextLineIndex TextLineIndex;
+
+/**
+ * Validate, normalize and index loaded text in one pass
+ *
+ * Checks that the text is UTF-8 without NUL bytes. CRLF and lone CR line
+ * endings are rewritten in place as '\n', so the text may get shorter. On
+ * x86 the pass runs 16 bytes at a time with SSE2 through ASCII text,
+ * falling back to a scalar decoder around other bytes.
+ *
+ * @param text The text; rewritten in place. When it gets shorter, a NUL is
+ *        written after the new end
+ * @param length Length of text in bytes; updated to the normalized length
+ * @param lines Optional return location for the line index of the
+ *        normalized text (free with text_line_index_free())
+ * @param error Return location for an error naming the offset of the
+ *        first invalid byte
+ * @return TRUE if the text is valid; when FALSE it is left partly rewritten
+ */
+gboolean text_scan(gchar *text, gsize *length, TextLineIndex **lines, GError **error);
+
+/**
+ * Check that text is UTF-8 without NUL bytes, using the same kernel as
+ * text_scan() but without changing anything
+ *
+ * @param text The text
+ * @param length Length of text in bytes
+ * @return TRUE if the text is valid
+ */
+gboolean text_scan_validate(const gchar *text, gsize length);
+
+/**
+ * Index the lines of text without checking or changing it
+ *
+ * Only '\n' ends a line, as in text that has been through text_scan().
+ *
+ * @param text The text
+ * @param length Length of text in bytes
+ * @return A new index (free with text_line_index_free()), or NULL if the
+ *         text is over 4 GiB
+ */
+TextLineIndex *text_line_index_new(const gchar *text, gsize length);
+
+/**
+ * Free a line index
+ *
+ * @param lines The index, or NULL
+ */
+void text_line_index_free(TextLineIndex *lines);
+
+/**
+ * Get the number of lines in an index
+ *
+ * @param lines The index
+ * @return Number of lines; empty text has one
+ */
+guint text_line_index_get_n_lines(const TextLineIndex *lines);
+
+/**
+ * Get the byte offset at which a line starts
+ *
+ * @param lines The index
+ * @param line Line number, from 0
+ * @return Offset of the line's first byte
+ */
+gsize text_line_index_get_line_start(const TextLineIndex *lines, guint line);
+
+/**
+ * Get the byte offset just after a line's text, excluding its '\n'
+ *
+ * @param lines The index
+ * @param line Line number, from 0
+ * @return Offset of the line's '\n', or the text length for the last line
+ */
+gsize text_line_index_get_line_end(const TextLineIndex *lines, guint line);
+
+/**
+ * Find the line containing a byte offset
+ *
+ * @param lines The index
+ * @param offset A byte offset into the text
+ * @return The line number
+ */
+guint text_line_index_get_line_at_offset(const TextLineIndex *lines, gsize offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TEXT_SCAN_H
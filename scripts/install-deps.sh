@@ -8,15 +8,15 @@ if command -v apt-get &> /dev/null; then
     echo "Debian/Ubuntu detected"
     echo "Installing dependencies..."
     sudo apt-get update
-    sudo apt-get install -y build-essential pkg-config libgtk-4-dev libadwaita-1-dev libcmark-dev
+    sudo apt-get install -y build-essential pkg-config libgtk-4-dev libadwaita-1-dev libcmark-dev libsysprof-capture-4-dev
 elif command -v dnf &> /dev/null; then
     echo "Fedora detected"
     echo "Installing dependencies..."
-    sudo dnf install -y gcc make pkgconfig gtk4-devel libadwaita-devel libcmark-devel
+    sudo dnf install -y gcc make pkgconfig gtk4-devel libadwaita-devel libcmark-devel sysprof-capture-devel
 elif command -v pacman &> /dev/null; then
     echo "Arch Linux detected"
     echo "Installing dependencies..."
-    sudo pacman -S --needed base-devel gtk4 libadwaita cmark
+    sudo pacman -S --needed base-devel gtk4 libadwaita cmark libsysprof-capture
 else
     echo "Unsupported distribution. Please install these packages manually:"
     echo "- GTK4 development package"
@@ -0,0 +1,168 @@
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "batch.h"
+#include "gtktext_cmark.h"
+#include "text_scan.h"
+
+typedef struct {
+    gchar *path;        // Not owned
+    gsize input_bytes;
+    gint64 elapsed_us;  // Import + export time, excluding file I/O
+    gboolean changed;
+    gchar *error;       // NULL on success
+} BatchJob;
+
+static void collect_markdown_files(const char *directory, GPtrArray *paths) {
+    GError *error = NULL;
+    GDir *dir = g_dir_open(directory, 0, &error);
+    if (!dir) {
+        g_printerr("gtktext: %s\n", error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    const gchar *name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        if (name[0] == '.') continue; // Skip .git and friends
+
+        gchar *path = g_build_filename(directory, name, NULL);
+        if (g_file_test(path, G_FILE_TEST_IS_DIR) && !g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+            collect_markdown_files(path, paths);
+            g_free(path);
+        } else if (g_str_has_suffix(name, ".md") && g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+            g_ptr_array_add(paths, path);
+        } else {
+            g_free(path);
+        }
+    }
+    g_dir_close(dir);
+}
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+    return g_strcmp0(*(const gchar *const *)a, *(const gchar *const *)b);
+}
+
+// Largest files first, so a big file picked up last does not leave the other workers idle
+static gint compare_jobs_by_size_desc(gconstpointer a, gconstpointer b) {
+    const BatchJob *job_a = *(const BatchJob *const *)a;
+    const BatchJob *job_b = *(const BatchJob *const *)b;
+    if (job_a->input_bytes == job_b->input_bytes) return 0;
+    return job_a->input_bytes < job_b->input_bytes ? 1 : -1;
+}
+
+static void batch_worker(gpointer data, gpointer user_data) {
+    BatchJob *job = data;
+    gboolean check_only = GPOINTER_TO_INT(user_data);
+    GError *error = NULL;
+
+    g_autofree gchar *contents = NULL;
+    if (!g_file_get_contents(job->path, &contents, &job->input_bytes, &error)) {
+        job->error = g_strdup(error->message);
+        g_clear_error(&error);
+        return;
+    }
+    // Validate only: normalizing line endings would hide them from the comparison below
+    if (!text_scan_validate(contents, job->input_bytes)) {
+        job->error = g_strdup("Not valid UTF-8");
+        return;
+    }
+
+    // Same Markdown as loading a document in the editor and saving it again, through
+    // a render plan rather than a buffer, as GTK objects must stay on the main thread
+    gint64 start_us = g_get_monotonic_time();
+    RenderPlan *plan = parse_markdown_to_plan_cmark(contents, NULL);
+    if (!plan) {
+        job->error = g_strdup("Failed to import markdown");
+        return;
+    }
+    g_autofree char *normalized = export_plan_to_markdown_cmark(plan);
+    render_plan_free(plan);
+    job->elapsed_us = g_get_monotonic_time() - start_us;
+
+    job->changed = (strcmp(normalized, contents) != 0);
+    if (job->changed && !check_only && !g_file_set_contents(job->path, normalized, -1, &error)) {
+        job->error = g_strdup(error->message);
+        g_clear_error(&error);
+    }
+}
+
+static double megabytes_per_second(gsize bytes, gint64 elapsed_us) {
+    return elapsed_us > 0 ? (double)bytes / (double)elapsed_us : 0.0; // bytes/µs == MB/s
+}
+
+int batch_normalize_directory(const char *directory, int jobs, gboolean check_only) {
+    if (!g_file_test(directory, G_FILE_TEST_IS_DIR)) {
+        g_printerr("gtktext: %s is not a directory\n", directory);
+        return 1;
+    }
+    if (jobs <= 0) {
+        jobs = (int)g_get_num_processors();
+    }
+
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    collect_markdown_files(directory, paths);
+    g_ptr_array_sort(paths, compare_paths);
+
+    BatchJob *batch_jobs = g_new0(BatchJob, paths->len);
+    GPtrArray *queue = g_ptr_array_sized_new(paths->len);
+    for (guint i = 0; i < paths->len; i++) {
+        GStatBuf st;
+        batch_jobs[i].path = g_ptr_array_index(paths, i);
+        if (g_stat(batch_jobs[i].path, &st) == 0) {
+            batch_jobs[i].input_bytes = (gsize)st.st_size;
+        }
+        g_ptr_array_add(queue, &batch_jobs[i]);
+    }
+    g_ptr_array_sort(queue, compare_jobs_by_size_desc);
+
+    gint64 start_us = g_get_monotonic_time();
+    GError *error = NULL;
+    GThreadPool *pool = g_thread_pool_new(batch_worker, GINT_TO_POINTER(check_only), jobs, TRUE, &error);
+    if (!pool) {
+        g_printerr("gtktext: Failed to start workers: %s\n", error->message);
+        g_clear_error(&error);
+        g_ptr_array_unref(queue);
+        g_free(batch_jobs);
+        g_ptr_array_unref(paths);
+        return 1;
+    }
+    for (guint i = 0; i < queue->len; i++) {
+        g_thread_pool_push(pool, g_ptr_array_index(queue, i), NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE); // Waits for every queued file
+    gint64 wall_us = g_get_monotonic_time() - start_us;
+
+    gsize total_bytes = 0;
+    gint64 busy_us = 0;
+    guint changed = 0, failed = 0;
+    for (guint i = 0; i < paths->len; i++) {
+        BatchJob *job = &batch_jobs[i];
+        if (job->error) {
+            printf("%10s %10s %10s  %s: %s\n", "-", "-", "-", job->path, job->error);
+            failed++;
+            g_free(job->error);
+            continue;
+        }
+        g_autofree gchar *size = g_format_size(job->input_bytes);
+        printf("%7.1f MB/s %7.2f ms %10s  %s%s\n",
+               megabytes_per_second(job->input_bytes, job->elapsed_us), job->elapsed_us / 1000.0,
+               size, job->path, job->changed ? (check_only ? " (would change)" : " (normalized)") : "");
+        total_bytes += job->input_bytes;
+        busy_us += job->elapsed_us;
+        if (job->changed) changed++;
+    }
+
+    g_autofree gchar *total_size = g_format_size(total_bytes);
+    printf("%u files, %s in %.2f s with %d workers: %.1f MB/s, %.1fx parallel; %u %s, %u failed\n",
+           paths->len, total_size, wall_us / 1e6, jobs, megabytes_per_second(total_bytes, wall_us),
+           wall_us > 0 ? (double)busy_us / (double)wall_us : 0.0,
+           changed, check_only ? "would change" : "normalized", failed);
+
+    g_ptr_array_unref(queue);
+    g_free(batch_jobs);
+    g_ptr_array_unref(paths);
+    return (failed > 0 || (check_only && changed > 0)) ? 1 : 0;
+}
@@ -1,4 +1,10 @@
 #include "gtktext_cmark.h"
+#include "perf_trace.h"
+#include "format_mask.h"
+#include "cmark_arena.h"
+#include "md_export.h"
+#include "md_escape.h"
+#include "source_map.h"
 #include <string.h>
 #include <stdio.h>
 #include <adwaita.h>
@@ -109,276 +115,265 @@ static GtkTextTag* get_or_create_tag(GtkTextBuffer *buffer, const char *tag_name
 }
 
 
-// Forward declaration for the recursive helper
-static void apply_tags_for_node_recursive(cmark_node *node, GtkTextBuffer *buffer, GtkTextIter *iter, GSList *active_tags);
+// The Markdown being imported, for recording where nodes came from
+typedef struct {
+    SourceMap *map;
+    const TextLineIndex *lines;
+    const char *markdown;
+    gsize length;
+} ImportSource;
 
-// Helper to apply tags from a GSList of tag names
-// Inserts text and then applies all specified tags to the inserted range.
-static void insert_with_active_tags(GtkTextBuffer *buffer, GtkTextIter *iter, const char *text, GSList *active_tags) {
-    if (!text || strlen(text) == 0) return;
-
-    // Create a mark at the current iterator position (before insertion)
-    // Use a left-gravity mark so it stays at the beginning of inserted text.
-    GtkTextMark *start_mark = gtk_text_buffer_create_mark(buffer, NULL, iter, TRUE);
-
-    // Insert text. 'iter' is updated to the end of the inserted text.
-    gtk_text_buffer_insert(buffer, iter, text, -1);
-
-    // Apply tags to the range [mark, *iter)
-    if (active_tags) {
-        GtkTextIter start_insert_iter;
-        // Get a fresh iterator to the mark (this is the start of the inserted text)
-        gtk_text_buffer_get_iter_at_mark(buffer, &start_insert_iter, start_mark);
-
-        GSList *l;
-        for (l = active_tags; l != NULL; l = l->next) {
-            const char* tag_name = (const char*)l->data;
-            if (tag_name) { // Ensure tag_name is not NULL
-                GtkTextTag *tag_object = get_or_create_tag(buffer, tag_name);
-                if (tag_object) { // Ensure tag creation/lookup was successful
-                    // Apply tags using the fresh start_insert_iter and the updated iter
-                    gtk_text_buffer_apply_tag(buffer, tag_object, &start_insert_iter, iter);
-                } else {
-                    g_warning("Failed to get or create tag: %s", tag_name);
-                }
-            }
-        }
+// Byte offset of a line and column from cmark, both counted from 1; G_MAXSIZE if out of range
+static gsize import_source_offset(const ImportSource *source, int line, int column) {
+    if (line <= 0 || column <= 0 || (guint)line > text_line_index_get_n_lines(source->lines)) {
+        return G_MAXSIZE;
     }
+    gsize offset = text_line_index_get_line_start(source->lines, (guint)line - 1) + (gsize)column - 1;
+    return offset <= text_line_index_get_line_end(source->lines, (guint)line - 1) ? offset : G_MAXSIZE;
+}
 
-    // Delete the mark
-    gtk_text_buffer_delete_mark(buffer, start_mark);
+// Anchors the text about to be appended to the plan to where its node starts in the Markdown
+static void import_source_mark(const ImportSource *source, const RenderPlanBuilder *plan, cmark_node *node) {
+    gsize offset = import_source_offset(source, cmark_node_get_start_line(node), cmark_node_get_start_column(node));
+    if (offset == G_MAXSIZE) return;
+    if (cmark_node_get_type(node) == CMARK_NODE_CODE) {
+        // The position is that of the opening backticks
+        while (offset < source->length && source->markdown[offset] == '`') offset++;
+    }
+    source_map_add(source->map, render_plan_builder_get_offset(plan), offset);
 }
 
+// Anchors every line of a code block's content, which the Markdown indents or puts after a fence
+static void import_source_mark_code_block(const ImportSource *source, const RenderPlanBuilder *plan,
+                                          cmark_node *node, const char *content) {
+    int line = cmark_node_get_start_line(node);
+    gsize start = import_source_offset(source, line, 1);
+    if (start == G_MAXSIZE) return;
+
+    gsize indent = 0;
+    while (start + indent < source->length && source->markdown[start + indent] == ' ') indent++;
+    char first = start + indent < source->length ? source->markdown[start + indent] : '\0';
+    gboolean fenced = (first == '`' || first == '~');
+    if (fenced) {
+        line++;
+    } else {
+        indent = 4;
+    }
 
-static void apply_tags_for_node_recursive(cmark_node *node, GtkTextBuffer *buffer, GtkTextIter *iter, GSList *active_tags) {
-    if (!node) return;
+    gint buffer_offset = render_plan_builder_get_offset(plan);
+    for (const char *text = content; *text; line++) {
+        gsize line_start = import_source_offset(source, line, 1);
+        if (line_start == G_MAXSIZE) return;
+        // Content lines lose up to the fence's indentation, or the four spaces of indented code
+        gsize skipped = 0;
+        while (skipped < indent && line_start + skipped < source->length &&
+               source->markdown[line_start + skipped] == ' ') {
+            skipped++;
+        }
+        source_map_add(source->map, buffer_offset, line_start + skipped);
 
-    // Ensure standard tags are created if they don't exist yet.
-    // This is a good place to ensure common tags are available.
-    get_or_create_tag(buffer, "bold");
-    get_or_create_tag(buffer, "italic");
-    for (int i = 1; i <= 6; i++) {
-        char h_tag[3];
-        g_snprintf(h_tag, sizeof(h_tag), "h%d", i);
-        get_or_create_tag(buffer, h_tag);
+        const char *eol = strchr(text, '\n');
+        const char *next = eol ? eol + 1 : text + strlen(text);
+        buffer_offset += (gint)g_utf8_strlen(text, next - text);
+        text = next;
     }
-    get_or_create_tag(buffer, "code");
-    get_or_create_tag(buffer, "codeblock");
+}
 
+// Walks the document with cmark_iter ENTER/EXIT events. Active formatting is
+// kept as a bitmask, so nothing is allocated per node and stack use does not
+// depend on how deeply the input is nested. With a source, the start of each
+// node's text is recorded in its source map. Touches no GTK objects.
+static void build_plan_for_document(cmark_node *document, RenderPlanBuilder *plan, const ImportSource *source) {
+    FormatState state = { 0 };
+    cmark_iter *walker = cmark_iter_new(document);
+    cmark_event_type ev_type;
 
-    cmark_node *child;
-    for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-        cmark_node_type type = cmark_node_get_type(child);
-        GSList *current_tags = active_tags;
-        gboolean pushed_tag = FALSE;
-        char *tag_name_alloc = NULL; // For dynamically created tag names like "h1"
+    while ((ev_type = cmark_iter_next(walker)) != CMARK_EVENT_DONE) {
+        cmark_node *node = cmark_iter_get_node(walker);
+        gboolean entering = (ev_type == CMARK_EVENT_ENTER);
 
-        switch (type) {
+        switch (cmark_node_get_type(node)) {
             case CMARK_NODE_TEXT:
-            case CMARK_NODE_CODE: // Inline code
-                {
-                    const char *literal = cmark_node_get_literal(child);
-                    if (literal) {
-                        GSList *tags_for_this_segment = active_tags;
-                        GSList *temp_prepended_list = NULL; // To manage the lifetime of the list if "code" is added
-
-                        if (type == CMARK_NODE_CODE) {
-                            // For inline code, prepend the "code" tag to the current list of active tags.
-                            // The "code" tag itself should already be created by get_or_create_tag.
-                            get_or_create_tag(buffer, "code"); // Ensure "code" tag exists
-                            temp_prepended_list = g_slist_prepend(active_tags, (gpointer)"code");
-                            tags_for_this_segment = temp_prepended_list;
-                        }
-                        
-                        insert_with_active_tags(buffer, iter, literal, tags_for_this_segment);
-                        
-                        if (temp_prepended_list) {
-                            // Free only the list cell we added, not the data (string literal "code")
-                            // and not the rest of the list (original active_tags).
-                            g_slist_free_1(temp_prepended_list);
-                        }
-                    }
-                }
-                break;
             case CMARK_NODE_HTML_INLINE:
-                {
-                    const char *literal = cmark_node_get_literal(child);
-                    if (literal) {
-                        insert_with_active_tags(buffer, iter, literal, current_tags);
-                    }
-                }
+                if (source) import_source_mark(source, plan, node);
+                render_plan_builder_append(plan, cmark_node_get_literal(node), state.mask);
+                break;
+            case CMARK_NODE_CODE: // Inline code
+                if (source) import_source_mark(source, plan, node);
+                render_plan_builder_append(plan, cmark_node_get_literal(node), state.mask | FORMAT_MASK(FORMAT_CODE));
                 break;
             case CMARK_NODE_STRONG:
-                current_tags = g_slist_prepend(current_tags, (gpointer)"bold");
-                pushed_tag = TRUE;
-                get_or_create_tag(buffer, "bold"); // Ensure tag exists
-                apply_tags_for_node_recursive(child, buffer, iter, current_tags);
+                if (entering) format_state_push(&state, FORMAT_BOLD);
+                else format_state_pop(&state, FORMAT_BOLD);
                 break;
             case CMARK_NODE_EMPH:
-                current_tags = g_slist_prepend(current_tags, (gpointer)"italic");
-                pushed_tag = TRUE;
-                get_or_create_tag(buffer, "italic"); // Ensure tag exists
-                apply_tags_for_node_recursive(child, buffer, iter, current_tags);
+                if (entering) format_state_push(&state, FORMAT_ITALIC);
+                else format_state_pop(&state, FORMAT_ITALIC);
                 break;
             case CMARK_NODE_HEADING:
                 {
-                    int level = cmark_node_get_heading_level(child);
-                    tag_name_alloc = g_strdup_printf("h%d", level);
-                    current_tags = g_slist_prepend(current_tags, (gpointer)tag_name_alloc);
-                    pushed_tag = TRUE;
-                    get_or_create_tag(buffer, tag_name_alloc); // Ensure tag exists
-                    apply_tags_for_node_recursive(child, buffer, iter, current_tags);
-                    gtk_text_buffer_insert(buffer, iter, "\n\n", -1); // Ensure two newlines after heading
+                    FormatBit heading = format_bit_for_heading(cmark_node_get_heading_level(node));
+                    if (entering) {
+                        format_state_push(&state, heading);
+                    } else {
+                        format_state_pop(&state, heading);
+                        render_plan_builder_append(plan, "\n\n", 0); // Ensure two newlines after heading
+                    }
                 }
                 break;
             case CMARK_NODE_THEMATIC_BREAK:
-                // Insert a horizontal rule (HR)
-                get_or_create_tag(buffer, "hr");
-                // Insert a line of dashes (or a unicode line) and apply the hr tag
-                insert_with_active_tags(buffer, iter, "\u2014\u2014\u2014\n", g_slist_prepend(NULL, (gpointer)"hr"));
-                // Removed extra newline after HR
+                // A line of dashes carrying only the hr tag
+                if (source) import_source_mark(source, plan, node);
+                render_plan_builder_append(plan, "\u2014\u2014\u2014\n", FORMAT_MASK(FORMAT_HR));
                 break;
             case CMARK_NODE_PARAGRAPH:
-                apply_tags_for_node_recursive(child, buffer, iter, current_tags);
-                // Ensure block elements like paragraphs (and headings) are followed by a single newline
-                // in the buffer, rather than two, to prevent excessive blank lines in round-tripped Markdown.
-                if (cmark_node_parent(node) && cmark_node_get_type(cmark_node_parent(node)) != CMARK_NODE_ITEM) {
-                     gtk_text_buffer_insert(buffer, iter, "\n", -1); // Changed from \\n\\n
-                } else if (!cmark_node_parent(node)) { // Root document's direct child paragraph
-                     gtk_text_buffer_insert(buffer, iter, "\n", -1); // Changed from \\n\\n
-                } else { // Paragraph within a list item, etc.
-                    // No extra newline needed here by the paragraph itself
+                // Paragraphs end with a single newline, rather than two, to prevent excessive
+                // blank lines in round-tripped Markdown. Paragraphs nested one level below a
+                // list item get none.
+                if (!entering) {
+                    cmark_node *parent = cmark_node_parent(node);
+                    cmark_node *grandparent = parent ? cmark_node_parent(parent) : NULL;
+                    if (!grandparent || cmark_node_get_type(grandparent) != CMARK_NODE_ITEM) {
+                        render_plan_builder_append(plan, "\n", 0);
+                    }
                 }
                 break;
-            case CMARK_NODE_LIST:
-                apply_tags_for_node_recursive(child, buffer, iter, current_tags);
-                // Add a newline after the entire list if it's not followed by one.
-                // Paragraphs/headings after list will add their own \n\n.
-                // This ensures list itself is separated if it's the last item.
-                // if (!gtk_text_iter_ends_line(iter)) {
-                //    gtk_text_buffer_insert(buffer, iter, "\n", -1);
-                // }
-                break;
             case CMARK_NODE_ITEM:
-                {
-                    cmark_node *parent_list = cmark_node_parent(child); // Corrected function name
-                    if (parent_list) { // Should always have a parent if it\'s an item
+                if (entering) {
+                    cmark_node *parent_list = cmark_node_parent(node);
+                    if (source) import_source_mark(source, plan, node);
+                    if (parent_list) {
                         cmark_list_type lt = cmark_node_get_list_type(parent_list);
                         if (lt == CMARK_BULLET_LIST) {
-                            insert_with_active_tags(buffer, iter, "* ", current_tags);
+                            render_plan_builder_append(plan, "* ", state.mask);
                         } else if (lt == CMARK_ORDERED_LIST) {
-                            // cmark doesn't easily give the item number here for CommonMark.
-                            // For simplicity, using "1."
-                            // A more complex renderer could count items.
-                            insert_with_active_tags(buffer, iter, "1. ", current_tags);
+                            // Numbering is left to the Markdown renderer reading the file
+                            render_plan_builder_append(plan, "1. ", state.mask);
                         }
                     }
-                    apply_tags_for_node_recursive(child, buffer, iter, current_tags);
-                    // Newline after item content is usually handled by paragraph inside item.
-                    // If an item is the last in a list, and the list is the last in doc, ensure newline.
-                    // The paragraph inside item will add \n. If item is simple text, it might need one.
-                    if (!gtk_text_iter_ends_line(iter)) {
-                         // gtk_text_buffer_insert(buffer, iter, "\n", -1);
-                    }
                 }
                 break;
             case CMARK_NODE_CODE_BLOCK:
                 {
-                    const char *code_content = cmark_node_get_literal(child);
-                    const char *info = cmark_node_get_fence_info(child);
-                    char *fence_info_str = (info && strlen(info) > 0) ? g_strdup(info) : g_strdup("");
-                    
-                    // Create a mark to track where the code block starts
-                    GtkTextMark *codeblock_start = gtk_text_buffer_create_mark(buffer, NULL, iter, TRUE);
-                    
-                    if (code_content && strlen(code_content) > 0) {
-                        // For the content of the code block, apply only the "codeblock" tag.
-                        // Do not inherit other tags like bold/italic into code blocks.
-                        GSList* code_block_specific_tags = NULL;
-                        get_or_create_tag(buffer, "codeblock"); // Ensure "codeblock" tag exists
-                        code_block_specific_tags = g_slist_prepend(code_block_specific_tags, (gpointer)"codeblock");
-                        
-                        insert_with_active_tags(buffer, iter, code_content, code_block_specific_tags);
-                        
-                        g_slist_free_1(code_block_specific_tags); // Free the list cell
-
-                        // If the content doesn't end with a newline, we add one
-                        if (code_content[strlen(code_content)-1] != '\n') { 
-                           insert_with_active_tags(buffer, iter, "\n", NULL);
+                    // Code block content gets only the "codeblock" tag; bold/italic are not inherited
+                    const char *code_content = cmark_node_get_literal(node);
+                    if (code_content && code_content[0] != '\0') {
+                        if (source) import_source_mark_code_block(source, plan, node, code_content);
+                        render_plan_builder_append(plan, code_content, FORMAT_MASK(FORMAT_CODEBLOCK));
+                        if (code_content[strlen(code_content) - 1] != '\n') {
+                            render_plan_builder_append(plan, "\n", 0);
                         }
                     }
-                    
-                    // Delete the mark - we used it to track where the code block started
-                    gtk_text_buffer_delete_mark(buffer, codeblock_start);
-                    
-                    g_free(fence_info_str);
                 }
                 break;
             case CMARK_NODE_LINEBREAK:
-                insert_with_active_tags(buffer, iter, "\n", current_tags); // Hard break
+                render_plan_builder_append(plan, "\n", state.mask); // Hard break
                 break;
             case CMARK_NODE_SOFTBREAK:
-                insert_with_active_tags(buffer, iter, " ", current_tags); // Render softbreak as a space (CommonMark compliant)
+                render_plan_builder_append(plan, " ", state.mask); // Render softbreak as a space (CommonMark compliant)
                 break;
             default:
-                apply_tags_for_node_recursive(child, buffer, iter, current_tags);
+                // Containers (document, lists, block quotes, links, images) only contribute their children
                 break;
         }
+    }
+
+    cmark_iter_free(walker);
+}
 
-        if (pushed_tag) {
-            current_tags = g_slist_remove(current_tags, current_tags->data);
+void resolve_format_tags_cmark(GtkTextBuffer *buffer, FormatTags tags) {
+    // get_or_create_tag only creates the theme-dependent code tags
+    // when update_code_tags_for_theme has not already.
+    for (guint bit = 0; bit < FORMAT_COUNT; bit++) {
+        if (bit != FORMAT_BLOCKQUOTE) { // Only produced by cmrender
+            tags[bit] = get_or_create_tag(buffer, format_bit_get_tag_name((FormatBit)bit));
         }
-        g_free(tag_name_alloc); // Free strduped "hX" tag name
     }
 }
 
+RenderPlan *parse_markdown_to_plan_cmark(const char *markdown_text, const TextLineIndex *lines) {
+    g_return_val_if_fail(markdown_text != NULL, NULL);
+
+    // CMARK_OPT_SMART enables smart quotes, dashes, etc.
+    // The tree is parsed into this thread's arena and dropped with one reset; the
+    // arena is only unavailable if an import is already running on this thread.
+    int options = CMARK_OPT_DEFAULT | CMARK_OPT_SMART;
+    cmark_mem *arena = cmark_arena_acquire();
+    cmark_parser *parser = arena ? cmark_parser_new_with_mem(options, arena) : cmark_parser_new(options);
+    gsize length = strlen(markdown_text);
+    cmark_parser_feed(parser, markdown_text, length);
+    cmark_node *document = cmark_parser_finish(parser);
+    cmark_parser_free(parser);
+    if (!document) {
+        if (arena) cmark_arena_release(arena);
+        return NULL;
+    }
+
+    // cmark gives node positions as lines and columns; the line index turns them into offsets
+    TextLineIndex *own_lines = lines ? NULL : text_line_index_new(markdown_text, length);
+    if (!lines) lines = own_lines;
+    ImportSource source = { lines ? source_map_new() : NULL, lines, markdown_text, length };
+    RenderPlanBuilder *builder = render_plan_builder_new();
+    build_plan_for_document(document, builder, lines ? &source : NULL);
+    text_line_index_free(own_lines);
+
+    if (arena) {
+        cmark_arena_release(arena);
+    } else {
+        cmark_node_free(document);
+    }
+    return render_plan_builder_finish(builder, source.map);
+}
 
 gboolean import_markdown_to_buffer_cmark(GtkTextBuffer *buffer, const char *markdown_text) {
     if (!buffer || !markdown_text) {
         return FALSE;
     }
-    
-    get_or_create_tag(buffer, "bold");
-    get_or_create_tag(buffer, "italic");
-    for (int i = 1; i <= 6; i++) {
-        char h_tag[3];
-        g_snprintf(h_tag, sizeof(h_tag), "h%d", i);
-        get_or_create_tag(buffer, h_tag);
-    }
-    
-    // Check if code and codeblock tags already exist
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
-    gboolean code_tag_exists = (gtk_text_tag_table_lookup(tag_table, "code") != NULL);
-    gboolean codeblock_tag_exists = (gtk_text_tag_table_lookup(tag_table, "codeblock") != NULL);
-    
-    // Only recreate tags if they don't exist - avoid removing tags that were just created by update_code_tags_for_theme
-    if (!code_tag_exists) {
-        get_or_create_tag(buffer, "code");
-    } 
-    
-    if (!codeblock_tag_exists) {
-        get_or_create_tag(buffer, "codeblock");
+
+    PerfSpan span = perf_span_begin(PERF_OP_IMPORT);
+    RenderPlan *plan = parse_markdown_to_plan_cmark(markdown_text, NULL);
+    if (!plan) {
+        perf_span_end(&span);
+        return FALSE;
     }
 
+    // The old map goes first, so it isn't patched for every deletion and insertion below
+    source_map_attach(buffer, NULL);
     GtkTextIter start_iter, end_iter;
     gtk_text_buffer_get_bounds(buffer, &start_iter, &end_iter);
     gtk_text_buffer_delete(buffer, &start_iter, &end_iter);
 
-    // CMARK_OPT_SMART enables smart quotes, dashes, etc.
-    int options = CMARK_OPT_DEFAULT | CMARK_OPT_SMART;
-    cmark_node *document = cmark_parse_document(markdown_text, strlen(markdown_text), options);
-    if (!document) {
-        return FALSE;
-    }
-
-    GtkTextIter iter;
-    gtk_text_buffer_get_start_iter(buffer, &iter);
-    apply_tags_for_node_recursive(document, buffer, &iter, NULL);
-
-    cmark_node_free(document);
+    RenderPlanPosition position = { 0 };
+    render_plan_insert(plan, buffer, &start_iter, &position, 0);
+    const SourceMap *map = render_plan_get_source_map(plan);
+    source_map_attach(buffer, map ? source_map_copy(map) : NULL);
+    render_plan_free(plan);
+    perf_span_end(&span);
     return TRUE;
 }
 
+/**
+ * Create a buffer for importing and exporting without a display
+ *
+ * The theme-dependent code tags are created up front with the light
+ * styling, so get_or_create_tag never asks AdwStyleManager about them.
+ */
+GtkTextBuffer *create_headless_buffer_cmark(void) {
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    gtk_text_buffer_create_tag(buffer, "code",
+                               "family", "monospace",
+                               "background", "#f1f1f1",
+                               "background-full-height", TRUE,
+                               NULL);
+    gtk_text_buffer_create_tag(buffer, "codeblock",
+                               "family", "monospace",
+                               "background", "#f1f1f1",
+                               "paragraph-background", "#f1f1f1",
+                               "wrap-mode", GTK_WRAP_NONE,
+                               NULL);
+    return buffer;
+}
+
 /**
  * Update code-related tags to match the current theme
  * 
@@ -476,120 +471,104 @@ void update_code_tags_for_theme(GtkTextBuffer *buffer) {
     
 }
 
-char* export_buffer_to_markdown_cmark(GtkTextBuffer *buffer) {
-    if (!buffer) {
-        return g_strdup("");
-    }
+// Format bits whose changes end a run of text in the exporter
+#define MD_EXPORT_RUN_MASK \
+    (FORMAT_MASK(FORMAT_BOLD) | FORMAT_MASK(FORMAT_ITALIC) | FORMAT_MASK(FORMAT_CODE) | FORMAT_MASK(FORMAT_CODEBLOCK))
 
-    GtkTextIter start, end;
-    gtk_text_buffer_get_bounds(buffer, &start, &end);
+// Characters of the line terminator at the end of text, which holds one line
+static gint md_export_terminator_chars(const gchar *text, gsize length) {
+    if (length >= 2 && text[length - 2] == '\r' && text[length - 1] == '\n') return 2;
+    if (length >= 1 && (text[length - 1] == '\n' || text[length - 1] == '\r')) return 1;
+    if (length >= 3 && memcmp(text + length - 3, "\xe2\x80\xa9", 3) == 0) return 1; // Paragraph separator
+    return 0;
+}
 
-    if (gtk_text_iter_equal(&start, &end)) {
-        return g_strdup("");
-    }
-    
-    GString *md = g_string_new("");
-    GtkTextIter iter;
-    gtk_text_buffer_get_start_iter(buffer, &iter);
+static void md_export_append_code_delimiter(MdWriter *md, gsize length) {
+    for (gsize i = 0; i < length; i++) md_writer_append_c(md, '`');
+}
 
-    gboolean currently_in_bold = FALSE;
-    gboolean currently_in_italic = FALSE;
-    gboolean currently_in_code = FALSE;
-    gboolean currently_in_codeblock = FALSE;
+// Exports one line from its text and format runs; shared by buffers and render plans.
+// The line is written as runs of text with the same formatting, escaped a run at a time.
+static void md_export_runs(const gchar *text, const RenderPlanRun *runs, guint n_runs,
+                           MdExportState *state, MdWriter *md) {
+    gboolean currently_in_bold = (*state & MD_EXPORT_IN_BOLD) != 0;
+    gboolean currently_in_italic = (*state & MD_EXPORT_IN_ITALIC) != 0;
+    gboolean currently_in_code = (*state & MD_EXPORT_IN_CODE) != 0;
+    gboolean currently_in_codeblock = (*state & MD_EXPORT_IN_CODEBLOCK) != 0;
     gboolean at_line_start = TRUE;
+    gboolean heading_found = FALSE;
+    // A code span opened on this line; one continued from the line before uses single backticks
+    gsize code_delimiter = 1;
+    gboolean code_padded = FALSE;
+
+    gint n_chars = n_runs > 0 ? runs[n_runs - 1].end : 0;
+    gint terminator = md_export_terminator_chars(text, strlen(text));
+    gint line_end = n_chars - terminator; // Characters before the terminator
+
+    gint pos = 0;
+    const gchar *p = text;
+    guint r = 0; // Run holding pos
+    while (pos < n_chars) {
+        while (runs[r].end <= pos) r++;
+        guint32 mask = runs[r].mask;
 
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
-
-    while(!gtk_text_iter_is_end(&iter)) {
         if (at_line_start) {
-            // Track if we found and processed a heading
-            GTKTEXT_UNUSED gboolean heading_found = FALSE;
             for (int i = 1; i <= 6; ++i) {
-                char h_tag_name[4];
-                g_snprintf(h_tag_name, sizeof(h_tag_name), "h%d", i);
-                GtkTextTag *h_tag = gtk_text_tag_table_lookup(tag_table, h_tag_name);
-                if (h_tag && gtk_text_iter_has_tag(&iter, h_tag)) {
-                    for (int j = 0; j < i; ++j) g_string_append_c(md, '#');
-                    g_string_append_c(md, ' ');
+                if (mask & FORMAT_MASK(format_bit_for_heading(i))) {
+                    for (int j = 0; j < i; ++j) md_writer_append_c(md, '#');
+                    md_writer_append_c(md, ' ');
                     heading_found = TRUE;
                     break; 
                 }
             }
             
             // Check for code block (if this text has the codeblock tag and we're at the start of a line)
-            GtkTextTag *codeblock_tag = gtk_text_tag_table_lookup(tag_table, "codeblock");
-            if (codeblock_tag && gtk_text_iter_has_tag(&iter, codeblock_tag) && !currently_in_codeblock) {
+            if ((mask & FORMAT_MASK(FORMAT_CODEBLOCK)) && !currently_in_codeblock) {
                 // This is the start of a code block, add opening fence
-                g_string_append(md, "```\n");
+                md_writer_append(md, "```\n");
                 currently_in_codeblock = TRUE;
             }
             
             // Check for horizontal rule (hr) tag at line start
-            GtkTextTag *hr_tag = gtk_text_tag_table_lookup(tag_table, "hr");
-            if (hr_tag && gtk_text_iter_has_tag(&iter, hr_tag)) {
+            if (mask & FORMAT_MASK(FORMAT_HR)) {
                 // Check if we need to remove a trailing newline from the previous content
                 // This prevents an extra blank line from appearing before the horizontal rule
-                if (md->len > 0 && md->str[md->len-1] == '\n') {
+                if (md_writer_last_char(md, 1) == '\n') {
                     // If the last char was a newline, check if the second-to-last was also a newline
-                    if (md->len > 1 && md->str[md->len-2] == '\n') {
+                    if (md_writer_last_char(md, 2) == '\n') {
                         // We have two consecutive newlines - remove one to avoid the extra blank line
-                        g_string_truncate(md, md->len - 1);
+                        md_writer_truncate_last(md);
                     }
                 }
                 
                 // Add the horizontal rule
-                g_string_append(md, "---\n");
+                md_writer_append(md, "---\n");
                 
-                // Advance to the end of the line (skip the HR line)
-                while (!gtk_text_iter_is_end(&iter) && !gtk_text_iter_ends_line(&iter)) {
-                    gtk_text_iter_forward_char(&iter);
-                }
-                // Move past the newline
-                if (!gtk_text_iter_is_end(&iter)) {
-                    gtk_text_iter_forward_char(&iter);
-                }
-                at_line_start = TRUE; // Explicitly set true after consuming a whole line block for HR
-                continue;
+                // The HR line is consumed whole, terminator included
+                pos = n_chars;
+                break;
             }
         }
 
-        GSList *tags_at_iter = gtk_text_iter_get_tags(&iter);
-        gboolean iter_is_bold = FALSE;
-        gboolean iter_is_italic = FALSE;
-        gboolean iter_is_code = FALSE;
-        gboolean iter_is_codeblock = FALSE;
-
-        for (GSList *l = tags_at_iter; l != NULL; l = l->next) {
-            GtkTextTag *tag = GTK_TEXT_TAG(l->data);
-            const char *name = NULL;
-            gchar* prop_name = NULL;
-            g_object_get(tag, "name", &prop_name, NULL);
-            name = prop_name;
-
-            if (name) {
-                if (g_strcmp0(name, "bold") == 0) iter_is_bold = TRUE;
-                else if (g_strcmp0(name, "italic") == 0) iter_is_italic = TRUE;
-                else if (g_strcmp0(name, "code") == 0) iter_is_code = TRUE;
-                else if (g_strcmp0(name, "codeblock") == 0) iter_is_codeblock = TRUE;
-            }
-            g_free(prop_name);
-        }
-        g_slist_free(tags_at_iter);
+        gboolean iter_is_bold = (mask & FORMAT_MASK(FORMAT_BOLD)) != 0;
+        gboolean iter_is_italic = (mask & FORMAT_MASK(FORMAT_ITALIC)) != 0;
+        gboolean iter_is_code = (mask & FORMAT_MASK(FORMAT_CODE)) != 0;
+        gboolean iter_is_codeblock = (mask & FORMAT_MASK(FORMAT_CODEBLOCK)) != 0;
 
-        // This variable tracks if we made a style change on this character
+        // This variable tracks if we made a style change on this run
         // which can be useful for debugging and future extensions
-        GTKTEXT_UNUSED gboolean style_transition = FALSE;
+        gboolean style_transition = FALSE;
         
         // Special case: If we're starting both bold and italic at the same time, use combined marker
         if (iter_is_bold && iter_is_italic && !currently_in_bold && !currently_in_italic) {
-            g_string_append(md, "***");
+            md_writer_append(md, "***");
             currently_in_bold = TRUE;
             currently_in_italic = TRUE;
             style_transition = TRUE;
         }
         // Special case: If we're ending both bold and italic at the same time, use combined marker
         else if (!iter_is_bold && !iter_is_italic && currently_in_bold && currently_in_italic) {
-            g_string_append(md, "***");
+            md_writer_append(md, "***");
             currently_in_bold = FALSE;
             currently_in_italic = FALSE;
             style_transition = TRUE;
@@ -597,17 +576,17 @@ char* export_buffer_to_markdown_cmark(GtkTextBuffer *buffer) {
         else {
             // Handle bold state transition
             if (iter_is_bold && !currently_in_bold) {
-                g_string_append(md, "**");
+                md_writer_append(md, "**");
                 currently_in_bold = TRUE;
                 style_transition = TRUE;
             } else if (!iter_is_bold && currently_in_bold) {
-                if (md->len > 0 && (md->str[md->len-1] != ' ' && md->str[md->len-1] != '*')) {
-                    g_string_append(md, "**");
-                } else if (md->len == 0 || (md->str[md->len-1] == ' ' || md->str[md->len-1] == '*')) {
+                if (md->total_len > 0 && (md_writer_last_char(md, 1) != ' ' && md_writer_last_char(md, 1) != '*')) {
+                    md_writer_append(md, "**");
+                } else if (md->total_len == 0 || (md_writer_last_char(md, 1) == ' ' || md_writer_last_char(md, 1) == '*')) {
                     // If previous was space or another markdown char, or empty string, append.
                     // This logic needs to be robust against creating invalid markdown like "****" for empty bold.
                 } else {
-                    g_string_append(md, "**");
+                    md_writer_append(md, "**");
                 }
                 currently_in_bold = FALSE;
                 style_transition = TRUE;
@@ -615,110 +594,142 @@ char* export_buffer_to_markdown_cmark(GtkTextBuffer *buffer) {
 
             // Handle italic state transition
             if (iter_is_italic && !currently_in_italic) {
-                g_string_append(md, "*");
+                md_writer_append(md, "*");
                 currently_in_italic = TRUE;
                 style_transition = TRUE;
             } else if (!iter_is_italic && currently_in_italic) {
-                if (md->len > 0 && (md->str[md->len-1] != ' ' && md->str[md->len-1] != '*')) {
-                    g_string_append(md, "*");
-                } else if (md->len == 0 || (md->str[md->len-1] == ' ' || md->str[md->len-1] == '*')) {
+                if (md->total_len > 0 && (md_writer_last_char(md, 1) != ' ' && md_writer_last_char(md, 1) != '*')) {
+                    md_writer_append(md, "*");
+                } else if (md->total_len == 0 || (md_writer_last_char(md, 1) == ' ' || md_writer_last_char(md, 1) == '*')) {
                     // Similar logic as bold
                 } else {
-                    g_string_append(md, "*");
+                    md_writer_append(md, "*");
                 }
                 currently_in_italic = FALSE;
                 style_transition = TRUE;
             }
         }
         
-        // Handle code span transitions
+        // Handle code span transitions; the delimiter is longer than any backtick run inside
         if (iter_is_code && !currently_in_code) {
-            g_string_append(md, "`");
+            gint code_end = pos;
+            for (guint c = r; c < n_runs && (runs[c].mask & FORMAT_MASK(FORMAT_CODE)); c++) {
+                code_end = runs[c].end;
+            }
+            code_end = MAX(pos, MIN(code_end, line_end));
+            const gchar *code_end_ptr = g_utf8_offset_to_pointer(p, code_end - pos);
+            code_delimiter = md_escape_code_delimiter(p, (gsize)(code_end_ptr - p), &code_padded);
+            md_export_append_code_delimiter(md, code_delimiter);
+            if (code_padded) md_writer_append_c(md, ' ');
             currently_in_code = TRUE;
             style_transition = TRUE;
         } else if (!iter_is_code && currently_in_code) {
-            g_string_append(md, "`");
+            if (code_padded) md_writer_append_c(md, ' ');
+            md_export_append_code_delimiter(md, code_delimiter);
+            code_delimiter = 1;
+            code_padded = FALSE;
             currently_in_code = FALSE;
             style_transition = TRUE;
         }
-        
-        gunichar c = gtk_text_iter_get_char(&iter);
-        if (c != 0) { // 0 indicates end of buffer or invalid char
-            // Inside codeblocks and code spans, just append characters verbatim
-            if (iter_is_codeblock || iter_is_code) {
-                g_string_append_unichar(md, c);
-                
-                // Check for codeblock state transitions
-                if (iter_is_codeblock && !currently_in_codeblock) {
-                    // We're entering a code block (should be handled at line start)
-                    currently_in_codeblock = TRUE;
-                }
-            } else if (currently_in_codeblock) {
-                // We're exiting a code block mid-stream
-                
-                // Since we're crossing a tag boundary, we should close the code block now
-                // Make sure there's exactly one newline before the fence
-                if (md->len > 0 && md->str[md->len-1] == '\n') {
-                    g_string_append(md, "```\n");
-                } else {
-                    g_string_append(md, "\n```\n");
-                }
-                
-                currently_in_codeblock = FALSE;
-                
-                // Now append the current character
-                g_string_append_unichar(md, c);
+
+        // The run ends where the exported formatting changes; the line terminator is a run of its own
+        gboolean line_ended = pos >= line_end;
+        gint run_end = n_chars;
+        if (!line_ended) {
+            guint last = r;
+            while (last + 1 < n_runs && runs[last + 1].start < line_end &&
+                   (runs[last + 1].mask & MD_EXPORT_RUN_MASK) == (mask & MD_EXPORT_RUN_MASK)) {
+                // Only a bit the exporter ignores, such as a heading's, changed here
+                last++;
             }
-            // Revised Markdown escaping logic for normal text (not in codeblock)
-            else if ((c == '*' || c == '_') && (iter_is_bold || iter_is_italic)) {
-                // If the character is a markdown control character AND it's part of a recognized tag,
-                // assume it's part of the content and not a new markdown sequence to be escaped.
-                g_string_append_unichar(md, c);
-            } else if (c == '`' && iter_is_code) {
-                // If we have a backtick within a code span, we need to just append it
-                // as it's part of the content, not a closing marker
-                g_string_append_unichar(md, c);
-            } else if (c == '#' && at_line_start && 
-                      gtk_text_iter_has_tag(&iter, gtk_text_tag_table_lookup(tag_table, "h1"))) {
-                // Similar logic for headings - if it's a # at line start and has a heading tag,
-                // it's part of the heading structure, not content to be escaped.
-                g_string_append_unichar(md, c);
-            } else if (c == '\\' && !iter_is_code && !iter_is_codeblock) {
-                // Only escape backslashes outside of code blocks/spans
-                // Let's do a simple check to avoid double escaping
-                if (gtk_text_iter_get_offset(&iter) + 1 < gtk_text_buffer_get_char_count(buffer)) {
-                    GtkTextIter next_iter = iter;
-                    gtk_text_iter_forward_char(&next_iter);
-                    gunichar next_c = gtk_text_iter_get_char(&next_iter);
-                    
-                    // Only escape backslash when it's followed by a character that needs escaping
-                    if (next_c == '*' || next_c == '_' || next_c == '`' || next_c == '\\') {
-                        g_string_append_c(md, '\\');
-                    }
-                }
-                g_string_append_unichar(md, c);
-            } else if ((c == '[' || c == ']' || c == '!') && !iter_is_code && !iter_is_codeblock) {
-                // Other common characters that often need escaping outside code blocks
-                g_string_append_unichar(md, c);
-            } else if (c == '`' && !iter_is_code && !iter_is_codeblock) {
-                // For backticks outside of code blocks, don't escape them - this was causing issues
-                g_string_append_unichar(md, c);
+            run_end = MIN(runs[last].end, line_end);
+        }
+        const gchar *run_end_ptr = g_utf8_offset_to_pointer(p, run_end - pos);
+        gsize text_len = (gsize)(run_end_ptr - p);
+        // The formatting changes where the run ends, unless it reaches the end of the line
+        char next = run_end == line_end ? '\n' : 0;
+        // Nothing but this run has been written on the line, not even a marker
+        gboolean starts_markdown_line = at_line_start && !heading_found &&
+                                        (md->total_len == 0 || md_writer_last_char(md, 1) == '\n');
+        MdEscapeContext context = starts_markdown_line ? MD_ESCAPE_LINE_START : 0;
+        if (style_transition) context |= MD_ESCAPE_AFTER_MARKER;
+        if (run_end != line_end) context |= MD_ESCAPE_BEFORE_MARKER;
+
+        if (iter_is_codeblock || iter_is_code) {
+            // Inside codeblocks and code spans, just append the text verbatim
+            md_escape_append(md, p, text_len, MD_ESCAPE_VERBATIM, next);
+            
+            // Check for codeblock state transitions
+            if (iter_is_codeblock && !currently_in_codeblock) {
+                // We're entering a code block (should be handled at line start)
+                currently_in_codeblock = TRUE;
+            }
+        } else if (currently_in_codeblock) {
+            // We're exiting a code block mid-stream
+            
+            // Since we're crossing a tag boundary, we should close the code block now
+            // Make sure there's exactly one newline before the fence
+            if (md_writer_last_char(md, 1) == '\n') {
+                md_writer_append(md, "```\n");
             } else {
-                // For other characters, append as is
-                g_string_append_unichar(md, c);
+                md_writer_append(md, "\n```\n");
             }
+            
+            currently_in_codeblock = FALSE;
+            
+            // The run now starts a line of its own
+            md_escape_append(md, p, text_len, MD_ESCAPE_LINE_START, next);
+        } else {
+            md_escape_append(md, p, text_len, context, next);
         }
 
-        at_line_start = gtk_text_iter_ends_line(&iter);
-        if (!gtk_text_iter_forward_char(&iter)) {
-            break; // End of buffer
+        pos = run_end;
+        p = run_end_ptr;
+        if (line_ended) {
+            break; // The next line starts with fresh line-start handling
         }
+        at_line_start = FALSE;
     }
 
+    // The document ended inside a code span opened here; close it with the matching delimiter
+    if (currently_in_code && code_delimiter > 1 && terminator == 0 && pos >= n_chars) {
+        if (code_padded) md_writer_append_c(md, ' ');
+        md_export_append_code_delimiter(md, code_delimiter);
+        currently_in_code = FALSE;
+    }
+
+    *state = (currently_in_bold ? MD_EXPORT_IN_BOLD : 0) |
+             (currently_in_italic ? MD_EXPORT_IN_ITALIC : 0) |
+             (currently_in_code ? MD_EXPORT_IN_CODE : 0) |
+             (currently_in_codeblock ? MD_EXPORT_IN_CODEBLOCK : 0);
+}
+
+void md_export_line(GtkTextBuffer *buffer, GtkTextIter *iter, MdExportState *state, MdWriter *md) {
+    FormatTags tags;
+    format_tags_lookup(buffer, tags);
+    GArray *runs = g_array_new(FALSE, FALSE, sizeof(RenderPlanRun));
+    g_autofree gchar *text = render_plan_read_line(iter, tags, runs);
+    md_export_runs(text, (const RenderPlanRun *)(void *)runs->data, runs->len, state, md);
+    g_array_unref(runs);
+}
+
+void md_export_plan_line(const RenderPlan *plan, guint line, MdExportState *state, MdWriter *md) {
+    const RenderPlanRun *runs;
+    guint n_runs;
+    const gchar *text = render_plan_get_line(plan, line, &runs, &n_runs);
+    md_export_runs(text, runs, n_runs, state, md);
+}
+
+void md_export_finish(MdExportState state, MdWriter *md) {
+    gboolean currently_in_bold = (state & MD_EXPORT_IN_BOLD) != 0;
+    gboolean currently_in_italic = (state & MD_EXPORT_IN_ITALIC) != 0;
+    gboolean currently_in_code = (state & MD_EXPORT_IN_CODE) != 0;
+    gboolean currently_in_codeblock = (state & MD_EXPORT_IN_CODEBLOCK) != 0;
+
     // Close any open tags at the very end
     // If both bold and italic are open, close them with combined marker
     if (currently_in_bold && currently_in_italic) {
-        g_string_append(md, "***"); // Combined close for both
+        md_writer_append(md, "***"); // Combined close for both
         currently_in_bold = FALSE;
         currently_in_italic = FALSE;
     } else {
@@ -726,24 +737,95 @@ char* export_buffer_to_markdown_cmark(GtkTextBuffer *buffer) {
         if (currently_in_codeblock) {
             // For codeblocks, add a closing fence without adding extra newlines
             // Trim any trailing newlines to avoid accumulation
-            if (md->len > 0 && md->str[md->len-1] == '\n') {
+            if (md_writer_last_char(md, 1) == '\n') {
                 // There's already a newline at the end, just add the fence
-                g_string_append(md, "```\n");
+                md_writer_append(md, "```\n");
             } else {
                 // No newline at the end, add one before the fence
-                g_string_append(md, "\n```\n");
+                md_writer_append(md, "\n```\n");
             }
             currently_in_codeblock = FALSE;
         }
-        if (currently_in_code) g_string_append(md, "`");
-        if (currently_in_italic) g_string_append(md, "*");
-        if (currently_in_bold) g_string_append(md, "**");
+        if (currently_in_code) md_writer_append(md, "`");
+        if (currently_in_italic) md_writer_append(md, "*");
+        if (currently_in_bold) md_writer_append(md, "**");
     }
     
     // Ensure the exported markdown ends with a newline if the buffer wasn't empty.
-    if (md->len > 0 && md->str[md->len-1] != '\n') {
-        g_string_append_c(md, '\n');
+    if (md->total_len > 0 && md_writer_last_char(md, 1) != '\n') {
+        md_writer_append_c(md, '\n');
+    }
+}
+
+gboolean export_buffer_to_stream_cmark(GtkTextBuffer *buffer, GOutputStream *stream,
+                                       GCancellable *cancellable, GError **error) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), FALSE);
+
+    PerfSpan span = perf_span_begin(PERF_OP_EXPORT);
+    MdWriter md;
+    md_writer_init(&md, stream, cancellable);
+
+    GtkTextIter iter;
+    MdExportState state = 0;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    while (!gtk_text_iter_is_end(&iter) && !md.error) {
+        md_export_line(buffer, &iter, &state, &md);
+    }
+    md_export_finish(state, &md);
+
+    gboolean ok = md_writer_finish(&md, error);
+    perf_span_end(&span);
+    return ok;
+}
+
+char *export_plan_to_markdown_cmark(const RenderPlan *plan) {
+    g_return_val_if_fail(plan != NULL, NULL);
+
+    PerfSpan span = perf_span_begin(PERF_OP_EXPORT);
+    GOutputStream *memory = g_memory_output_stream_new_resizable();
+    MdWriter md;
+    md_writer_init(&md, memory, NULL);
+    MdExportState state = 0;
+    guint n_lines = render_plan_get_n_lines(plan);
+    for (guint line = 0; line < n_lines; line++) {
+        // An empty last line is the end of the buffer, which exports nothing
+        if (line + 1 == n_lines && render_plan_get_line(plan, line, NULL, NULL)[0] == '\0') break;
+        md_export_plan_line(plan, line, &state, &md);
     }
+    md_export_finish(state, &md);
+
+    // Writes to a memory stream only fail on allocation failure, which aborts anyway
+    char *markdown = NULL;
+    if (md_writer_finish(&md, NULL) && g_output_stream_write_all(memory, "", 1, NULL, NULL, NULL) &&
+        g_output_stream_close(memory, NULL, NULL)) {
+        markdown = g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(memory));
+    } else {
+        markdown = g_strdup("");
+    }
+    g_object_unref(memory);
+    perf_span_end(&span);
+    return markdown;
+}
 
-    return g_string_free(md, FALSE); // FALSE to return the char* (caller owns it)
-}
\ No newline at end of file
+char* export_buffer_to_markdown_cmark(GtkTextBuffer *buffer) {
+    if (!buffer) {
+        return g_strdup("");
+    }
+
+    GOutputStream *memory = g_memory_output_stream_new_resizable();
+    GError *error = NULL;
+    char *md = NULL;
+    // Writes to a memory stream only fail on allocation failure, which aborts anyway
+    if (export_buffer_to_stream_cmark(buffer, memory, NULL, &error) &&
+        g_output_stream_write_all(memory, "", 1, NULL, NULL, &error) &&
+        g_output_stream_close(memory, NULL, &error)) {
+        md = g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(memory));
+    } else {
+        g_warning("export_buffer_to_markdown_cmark: %s", error->message);
+        g_clear_error(&error);
+        md = g_strdup("");
+    }
+    g_object_unref(memory);
+    return md;
+}
@@ -0,0 +1,191 @@
+#include "cmark_arena.h"
+#include "perf_policy.h"
+#include <string.h>
+
+// Allocation alignment; matches what malloc guarantees on 64-bit targets
+#define CMARK_ARENA_ALIGN 16
+#define CMARK_ARENA_ALIGN_UP(n) (((n) + (CMARK_ARENA_ALIGN - 1)) & ~(gsize)(CMARK_ARENA_ALIGN - 1))
+// First block size; each new block doubles the previous one up to the max
+#define CMARK_ARENA_FIRST_BLOCK_SIZE (64 * 1024)
+#define CMARK_ARENA_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+typedef struct CmarkArenaBlock {
+    struct CmarkArenaBlock *next;
+    gsize size;  // Usable bytes after the block header
+    gsize used;
+} CmarkArenaBlock;
+
+// Stored in front of every allocation so realloc knows how much to copy
+typedef union {
+    gsize size;
+    guint8 pad[CMARK_ARENA_ALIGN];
+} CmarkArenaHeader;
+
+typedef struct {
+    CmarkArenaBlock *head;     // Blocks in allocation order; kept across parses
+    CmarkArenaBlock *current;  // Block being bumped
+    void *last;                // Most recent allocation, which realloc may grow in place
+    gsize retained;            // Sum of block sizes
+    gboolean in_use;
+} CmarkArena;
+
+#define BLOCK_DATA(block) ((guint8 *)(block) + CMARK_ARENA_ALIGN_UP(sizeof(CmarkArenaBlock)))
+
+static void cmark_arena_free_blocks(CmarkArenaBlock *block) {
+    while (block) {
+        CmarkArenaBlock *next = block->next;
+        g_free(block);
+        block = next;
+    }
+}
+
+static void cmark_arena_destroy(gpointer data) {
+    CmarkArena *arena = data;
+    cmark_arena_free_blocks(arena->head);
+    g_free(arena);
+}
+
+// One arena per thread: cmark_mem callbacks carry no context pointer
+static GPrivate thread_arena = G_PRIVATE_INIT(cmark_arena_destroy);
+
+static CmarkArena *cmark_arena_get(void) {
+    CmarkArena *arena = g_private_get(&thread_arena);
+    if (!arena) {
+        arena = g_new0(CmarkArena, 1);
+        g_private_set(&thread_arena, arena);
+    }
+    return arena;
+}
+
+// Moves to a retained block with room for needed bytes, or allocates a new one after the current block.
+static CmarkArenaBlock *cmark_arena_next_block(CmarkArena *arena, gsize needed) {
+    CmarkArenaBlock *block = arena->current ? arena->current->next : arena->head;
+    while (block && block->size < needed) {
+        block = block->next;
+    }
+
+    if (!block) {
+        gsize size = arena->current ? MIN(arena->current->size * 2, CMARK_ARENA_MAX_BLOCK_SIZE)
+                                    : CMARK_ARENA_FIRST_BLOCK_SIZE;
+        size = MAX(size, needed);
+        block = g_malloc(CMARK_ARENA_ALIGN_UP(sizeof(CmarkArenaBlock)) + size);
+        block->size = size;
+        if (arena->current) {
+            block->next = arena->current->next;
+            arena->current->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+        arena->retained += size;
+    }
+
+    block->used = 0;
+    arena->current = block;
+    return block;
+}
+
+static void *cmark_arena_alloc(CmarkArena *arena, gsize size) {
+    gsize needed = CMARK_ARENA_ALIGN_UP(sizeof(CmarkArenaHeader) + size);
+    CmarkArenaBlock *block = arena->current;
+    if (!block || block->size - block->used < needed) {
+        block = cmark_arena_next_block(arena, needed);
+    }
+
+    CmarkArenaHeader *header = (CmarkArenaHeader *)(BLOCK_DATA(block) + block->used);
+    header->size = size;
+    block->used += needed;
+    arena->last = header + 1;
+    return arena->last;
+}
+
+static void *cmark_arena_calloc(size_t nmem, size_t size) {
+    gsize total;
+    if (!g_size_checked_mul(&total, nmem, size)) {
+        g_error("cmark_arena: calloc(%zu, %zu) overflows", nmem, size);
+    }
+    void *ptr = cmark_arena_alloc(cmark_arena_get(), total);
+    memset(ptr, 0, total);
+    return ptr;
+}
+
+static void *cmark_arena_realloc(void *ptr, size_t size) {
+    CmarkArena *arena = cmark_arena_get();
+    if (!ptr) {
+        return cmark_arena_alloc(arena, size);
+    }
+
+    CmarkArenaHeader *header = (CmarkArenaHeader *)ptr - 1;
+    if (size <= header->size) {
+        return ptr;
+    }
+
+    // cmark grows string buffers one realloc at a time; extend the newest allocation in place
+    CmarkArenaBlock *block = arena->current;
+    if (ptr == arena->last && block) {
+        gsize offset = (guint8 *)ptr - BLOCK_DATA(block);
+        gsize new_used = CMARK_ARENA_ALIGN_UP(offset + size);
+        if (new_used <= block->size) {
+            block->used = new_used;
+            header->size = size;
+            return ptr;
+        }
+    }
+
+    void *moved = cmark_arena_alloc(arena, size);
+    memcpy(moved, ptr, header->size);
+    return moved;
+}
+
+static void cmark_arena_free(G_GNUC_UNUSED void *ptr) {
+    // Everything is released at once by cmark_arena_release()
+}
+
+static cmark_mem cmark_arena_mem = {
+    cmark_arena_calloc,
+    cmark_arena_realloc,
+    cmark_arena_free,
+};
+
+cmark_mem *cmark_arena_acquire(void) {
+    CmarkArena *arena = cmark_arena_get();
+    if (arena->in_use) {
+        return NULL;
+    }
+    arena->in_use = TRUE;
+    return &cmark_arena_mem;
+}
+
+void cmark_arena_release(cmark_mem *mem) {
+    g_return_if_fail(mem == &cmark_arena_mem);
+    CmarkArena *arena = cmark_arena_get();
+    g_return_if_fail(arena->in_use);
+
+    // Blocks beyond the retain size are freed instead of being kept;
+    // keep only the first blocks after an unusually large document
+    gsize retain_max = perf_policy_get_parser_retain_size();
+    if (arena->head && arena->head->size > retain_max) {
+        cmark_arena_free_blocks(arena->head);
+        arena->head = NULL;
+        arena->retained = 0;
+    } else if (arena->retained > retain_max) {
+        gsize kept = 0;
+        CmarkArenaBlock *block = arena->head;
+        while (block->next && kept + block->size + block->next->size <= retain_max) {
+            kept += block->size;
+            block = block->next;
+        }
+        cmark_arena_free_blocks(block->next);
+        block->next = NULL;
+        arena->retained = kept + block->size;
+    }
+
+    arena->current = NULL;
+    arena->last = NULL;
+    arena->in_use = FALSE;
+}
+
+gsize cmark_arena_get_retained_size(void) {
+    CmarkArena *arena = g_private_get(&thread_arena);
+    return arena ? arena->retained : 0;
+}
@@ -1,4 +1,7 @@
 #include "cmrender.h"
+#include "perf_trace.h"
+#include "format_mask.h"
+#include "cmark_arena.h"
 // #include "gtktext_cmark.h" // Removed as per plan
 #include <adwaita.h> // For AdwStyleManager
 #include <string.h>
@@ -7,9 +10,9 @@
 // Macro to silence unused variable warnings (if needed, or manage via compiler flags)
 #define CMRENDER_UNUSED __attribute__((unused))
 
-// Forward declaration for the recursive helper
-static void cm_render_node_content_recursive(cmark_node *node, GtkTextBuffer *buffer, GtkTextIter *iter, GSList *active_tags, int *ordered_list_item_counter_ptr);
-static void cm_render_insert_with_active_tags(GtkTextBuffer *buffer, GtkTextIter *iter, const char *text, GSList *active_tags);
+// Nesting depth of lists whose item counters are tracked; ordered lists
+// nested deeper than this number their items from the list start.
+#define CM_RENDER_MAX_LIST_DEPTH 64
 
 
 /**
@@ -97,8 +100,6 @@ void cm_render_update_theme_dependent_tags(GtkTextBuffer *buffer) {
     AdwColorScheme color_scheme = adw_style_manager_get_color_scheme(style_manager);
     gboolean is_dark = (color_scheme == ADW_COLOR_SCHEME_FORCE_DARK || color_scheme == ADW_COLOR_SCHEME_PREFER_DARK);
 
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
-    
     // Ensure 'code' tag exists or create it before setting theme properties
     GtkTextTag *code_tag = cm_render_get_or_create_base_tag(buffer, "code");
     // Ensure 'codeblock' tag exists or create it
@@ -130,377 +131,231 @@ void cm_render_update_theme_dependent_tags(GtkTextBuffer *buffer) {
     }
 }
 
-static void cm_render_insert_with_active_tags(GtkTextBuffer *buffer, GtkTextIter *iter, const char *text, GSList *active_tags) {
-    if (!text || strlen(text) == 0) return;
-
-    GtkTextMark *start_mark = gtk_text_buffer_create_mark(buffer, NULL, iter, TRUE); // Left gravity
-    gtk_text_buffer_insert(buffer, iter, text, -1); // iter moves to end of inserted text
-
-    if (active_tags) {
-        GtkTextIter start_insert_iter;
-        gtk_text_buffer_get_iter_at_mark(buffer, &start_insert_iter, start_mark);
-        GSList *l;
-        for (l = active_tags; l != NULL; l = l->next) {
-            const char* tag_name = (const char*)l->data;
-            if (tag_name) {
-                GtkTextTag *tag_object = cm_render_get_or_create_base_tag(buffer, tag_name);
-                if (tag_object) {
-                    gtk_text_buffer_apply_tag(buffer, tag_object, &start_insert_iter, iter);
-                } else {
-                    g_warning("cm_render_insert_with_active_tags: Failed to get or create tag: %s", tag_name);
-                }
-            }
-        }
-    }
-    gtk_text_buffer_delete_mark(buffer, start_mark);
+/**
+ * @brief Insert position and state shared by the render traversal.
+ */
+typedef struct {
+    GtkTextBuffer *buffer;
+    GtkTextIter *iter;
+    GtkTextTag **tags;       // FormatTags resolved for the buffer
+    gboolean at_line_start;  // Rendered text ends with a newline; an empty buffer counts as one
+} CmRenderCursor;
+
+/**
+ * @brief Inserts text with the tags of a format mask and tracks whether it ended a line.
+ */
+static void cm_render_insert(CmRenderCursor *cursor, const char *text, guint32 mask) {
+    if (!text || text[0] == '\0') return;
+    format_insert_text(cursor->buffer, cursor->iter, text, mask, cursor->tags);
+    cursor->at_line_start = (text[strlen(text) - 1] == '\n');
 }
 
-// Recursive function to render content of a node and its children.
-// If 'node' is a block-level node, its rendered output (including children)
-// will end with a single newline character.
-// The 'ordered_list_item_counter_ptr' is used to pass and update the current item number for ordered lists.
-static void cm_render_node_content_recursive(cmark_node *node, GtkTextBuffer *buffer, GtkTextIter *iter, GSList *active_tags, int *ordered_list_item_counter_ptr) {
-    if (!node) return;
-
-    cmark_node_type type = cmark_node_get_type(node);
-    GSList *tags_for_children = active_tags; // Default, copy if modified for children
-    char *tag_name_alloc = NULL;
-    gboolean is_block_node = FALSE;
-
-    // Determine if current node is a block node for trailing newline logic
-    switch (type) {
-        case CMARK_NODE_PARAGRAPH:
-        case CMARK_NODE_HEADING:
-        case CMARK_NODE_CODE_BLOCK:
-        case CMARK_NODE_THEMATIC_BREAK:
+/**
+ * @brief Checks whether a block node's parent separates its children with a blank line.
+ *
+ * Top-level blocks, and blocks inside block quotes and list items, are
+ * separated by an extra newline. List items themselves are not.
+ */
+static gboolean cm_render_parent_separates_blocks(cmark_node *node) {
+    cmark_node *parent = cmark_node_parent(node);
+    if (!parent) return FALSE;
+    switch (cmark_node_get_type(parent)) {
+        case CMARK_NODE_DOCUMENT:
         case CMARK_NODE_BLOCK_QUOTE:
-        case CMARK_NODE_LIST:
-        case CMARK_NODE_ITEM: // An item is also a block in terms of structure
-        case CMARK_NODE_HTML_BLOCK:
-            is_block_node = TRUE;
-            break;
+        case CMARK_NODE_ITEM:
+            return TRUE;
         default:
-            is_block_node = FALSE;
-            break;
+            return FALSE;
     }
+}
 
-    // Specific handling for node types
-    switch (type) {
-        case CMARK_NODE_DOCUMENT:
-            // Document node itself doesn't render, its children are the top-level blocks.
-            // The main loop in cm_render_markdown_to_buffer handles iterating document children.
-            // This function should be called for each child of the document.
-            // So, if we reach here with DOCUMENT, we process its children directly.
-            {
-                cmark_node *child;
-                gboolean first_block_child_of_document = TRUE;
-                for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                    if (!first_block_child_of_document) {
-                        // Add separating newline for blank line between top-level blocks
-                        gtk_text_buffer_insert(buffer, iter, "\\n", -1);
-                    }
-                    cm_render_node_content_recursive(child, buffer, iter, active_tags, NULL); // No ordered list context here directly
-                    first_block_child_of_document = FALSE;
-                }
-            }
-            break;
-
-        case CMARK_NODE_TEXT:
-        {
-            const char *literal = cmark_node_get_literal(node);
-            if (literal) {
-                cm_render_insert_with_active_tags(buffer, iter, literal, active_tags);
-            }
-            break;
-        }
-        case CMARK_NODE_EMPH: // Italic
-        {
-            tags_for_children = g_slist_prepend(g_slist_copy(active_tags), (gpointer)"italic");
-            cmark_node *child;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                cm_render_node_content_recursive(child, buffer, iter, tags_for_children, ordered_list_item_counter_ptr);
-            }
-            g_slist_free_full(tags_for_children, NULL);
-            break;
-        }
-        case CMARK_NODE_STRONG: // Bold
-        {
-            tags_for_children = g_slist_prepend(g_slist_copy(active_tags), (gpointer)"bold");
-            cmark_node *child;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                cm_render_node_content_recursive(child, buffer, iter, tags_for_children, ordered_list_item_counter_ptr);
-            }
-            g_slist_free_full(tags_for_children, NULL);
-            break;
-        }
-        case CMARK_NODE_HEADING:
-        {
-            int level = cmark_node_get_heading_level(node);
-            tag_name_alloc = g_strdup_printf("h%d", level);
-            tags_for_children = g_slist_prepend(g_slist_copy(active_tags), (gpointer)tag_name_alloc);
-            cmark_node *child;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                cm_render_node_content_recursive(child, buffer, iter, tags_for_children, ordered_list_item_counter_ptr);
-            }
-            g_slist_free_full(tags_for_children, NULL);
-            g_free(tag_name_alloc);
-            break;
-        }
-        case CMARK_NODE_CODE: // Inline code
-        {
-            const char *literal = cmark_node_get_literal(node);
-            if (literal) {
-                GSList *code_tag_list = g_slist_prepend(g_slist_copy(active_tags), (gpointer)"code");
-                cm_render_insert_with_active_tags(buffer, iter, literal, code_tag_list);
-                g_slist_free_full(code_tag_list, NULL);
-            }
-            break;
-        }
-        case CMARK_NODE_CODE_BLOCK:
-        {
-            const char *literal = cmark_node_get_literal(node);
-            // const char *info = cmark_node_get_fence_info(node); // TODO: Use for syntax highlighting tag
-            if (literal) {
-                GSList *codeblock_tag_list = g_slist_prepend(NULL, (gpointer)"codeblock");
-                cm_render_insert_with_active_tags(buffer, iter, literal, codeblock_tag_list);
-                g_slist_free(codeblock_tag_list);
-            }
-            break;
-        }
-        case CMARK_NODE_THEMATIC_BREAK:
-        {
-            GSList *hr_tag_list = g_slist_prepend(NULL, (gpointer)"hr");
-            cm_render_insert_with_active_tags(buffer, iter, "---", hr_tag_list);
-            g_slist_free(hr_tag_list);
-            break;
-        }
-        case CMARK_NODE_LINEBREAK: // Hard break
-            gtk_text_buffer_insert(buffer, iter, "\\n", -1);
-            break;
-
-        case CMARK_NODE_SOFTBREAK:
-            gtk_text_buffer_insert(buffer, iter, " ", -1);
-            break;
-
-        case CMARK_NODE_PARAGRAPH:
-        {
-            cmark_node *child;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                cm_render_node_content_recursive(child, buffer, iter, active_tags, ordered_list_item_counter_ptr);
-            }
-            break;
-        }
-        case CMARK_NODE_LINK:
-        {
-            // const char *url = cmark_node_get_url(node);
-            // const char *title = cmark_node_get_title(node);
-            // TODO: Create a "link" tag, store URL in GObject data.
-            // For now, just render link text.
-            cmark_node *child;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                cm_render_node_content_recursive(child, buffer, iter, active_tags, ordered_list_item_counter_ptr);
-            }
-            break;
-        }
-        case CMARK_NODE_IMAGE:
-        {
-            // const char *url = cmark_node_get_url(node);
-            // TODO: Render alt text. Actual image display needs GtkImage + GtkTextChildAnchor.
-            // For now, render alt text if present, or a placeholder.
-            char *alt_text_display = NULL;
-            cmark_node *text_child = cmark_node_first_child(node);
-            if (text_child && cmark_node_get_type(text_child) == CMARK_NODE_TEXT) {
-                alt_text_display = g_strdup_printf("[Image: %s]", cmark_node_get_literal(text_child));
-            } else {
-                alt_text_display = g_strdup("[Image]");
-            }
-            cm_render_insert_with_active_tags(buffer, iter, alt_text_display, active_tags);
-            g_free(alt_text_display);
-            break;
-        }
-        case CMARK_NODE_BLOCK_QUOTE:
-        {
-            // TODO: Apply "blockquote" tag with indent/margin.
-            // The tag should be applied to the lines generated by children.
-            // This is simpler if the tag is active for children.
-            tags_for_children = g_slist_prepend(g_slist_copy(active_tags), (gpointer)"blockquote");
-            ensure_base_blockquote_tag_exists(buffer); // Ensure "blockquote" tag is defined
-
-            cmark_node *child;
-            gboolean first_child_in_bq = TRUE;
-            for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                 if (!first_child_in_bq) {
-                    gtk_text_buffer_insert(buffer, iter, "\\n", -1); // Separator between blocks inside BQ
-                }
-                cm_render_node_content_recursive(child, buffer, iter, tags_for_children, NULL);
-                first_child_in_bq = FALSE;
-            }
-            g_slist_free_full(tags_for_children, NULL);
-            break;
+/**
+ * @brief Renders a parsed document into the buffer at iter.
+ *
+ * Walks the tree with cmark_iter ENTER/EXIT events instead of recursing, so
+ * stack use is independent of nesting depth. Active formatting is a
+ * FormatState bitmask and ordered-list counters live in a fixed array; no
+ * memory is allocated per node. Every block's output ends with a single
+ * newline.
+ *
+ * @param document The root node returned by the parser.
+ * @param buffer The GtkTextBuffer to render into.
+ * @param iter Insert position; moved to the end of the rendered text.
+ * @param tags Resolved tags for the buffer.
+ */
+static void cm_render_document(cmark_node *document, GtkTextBuffer *buffer, GtkTextIter *iter, FormatTags tags) {
+    FormatState state = { 0 };
+    int list_counters[CM_RENDER_MAX_LIST_DEPTH];
+    int list_depth = 0;
+    CmRenderCursor cursor = { buffer, iter, tags, TRUE };
+    cmark_iter *walker = cmark_iter_new(document);
+    cmark_event_type ev_type;
+
+    while ((ev_type = cmark_iter_next(walker)) != CMARK_EVENT_DONE) {
+        cmark_node *node = cmark_iter_get_node(walker);
+        cmark_node_type type = cmark_node_get_type(node);
+        gboolean entering = (ev_type == CMARK_EVENT_ENTER);
+        gboolean is_block_node = (type >= CMARK_NODE_FIRST_BLOCK && type <= CMARK_NODE_LAST_BLOCK &&
+                                  type != CMARK_NODE_DOCUMENT);
+
+        // Blank line between sibling blocks of the document, a block quote or an item
+        if (entering && is_block_node && cmark_node_previous(node) && cm_render_parent_separates_blocks(node)) {
+            cm_render_insert(&cursor, "\n", 0);
         }
-        case CMARK_NODE_LIST:
-        {
-            cmark_list_type list_type = cmark_node_get_list_type(node);
-            int current_item_number = cmark_node_get_list_start(node); // For ordered lists
-
-            cmark_node *item_child;
-            gboolean first_item = TRUE;
-            for (item_child = cmark_node_first_child(node); item_child != NULL; item_child = cmark_node_next(item_child)) {
-                if (!first_item) {
-                     // CommonMark rule: "Each new list item starts on a new line."
-                     // The previous item's content (recursive call) should have ended with \n.
-                     // So, no extra \n needed here before the marker of the current item.
-                }
-                // Pass down pointer to current_item_number for ordered lists, or NULL for unordered.
-                cm_render_node_content_recursive(item_child, buffer, iter, active_tags,
-                                                 (list_type == CMARK_ORDERED_LIST) ? &current_item_number : NULL);
-                if (list_type == CMARK_ORDERED_LIST) {
-                    // current_item_number should have been incremented by the ITEM's rendering logic
-                }
-                first_item = FALSE;
+
+        switch (type) {
+            case CMARK_NODE_TEXT:
+            case CMARK_NODE_HTML_BLOCK:
+            case CMARK_NODE_HTML_INLINE:
+                cm_render_insert(&cursor, cmark_node_get_literal(node), state.mask);
+                break;
+            case CMARK_NODE_EMPH: // Italic
+                if (entering) format_state_push(&state, FORMAT_ITALIC);
+                else format_state_pop(&state, FORMAT_ITALIC);
+                break;
+            case CMARK_NODE_STRONG: // Bold
+                if (entering) format_state_push(&state, FORMAT_BOLD);
+                else format_state_pop(&state, FORMAT_BOLD);
+                break;
+            case CMARK_NODE_HEADING:
+            {
+                FormatBit heading = format_bit_for_heading(cmark_node_get_heading_level(node));
+                if (entering) format_state_push(&state, heading);
+                else format_state_pop(&state, heading);
+                break;
             }
-            break;
-        }
-        case CMARK_NODE_ITEM:
-        {
-            // Insert list item marker (bullet or number)
-            const char *marker_text;
-            char num_marker[12]; // Buffer for "123. "
-            cmark_node *parent_list = cmark_node_get_parent(node);
-
-            if (parent_list && cmark_node_get_list_type(parent_list) == CMARK_ORDERED_LIST) {
-                if (ordered_list_item_counter_ptr) {
-                    g_snprintf(num_marker, sizeof(num_marker), "%d. ", *ordered_list_item_counter_ptr);
-                    (*ordered_list_item_counter_ptr)++; // Increment for next item
-                    marker_text = num_marker;
+            case CMARK_NODE_BLOCK_QUOTE:
+                if (entering) format_state_push(&state, FORMAT_BLOCKQUOTE);
+                else format_state_pop(&state, FORMAT_BLOCKQUOTE);
+                break;
+            case CMARK_NODE_CODE: // Inline code
+                cm_render_insert(&cursor, cmark_node_get_literal(node), state.mask | FORMAT_MASK(FORMAT_CODE));
+                break;
+            case CMARK_NODE_CODE_BLOCK:
+                // const char *info = cmark_node_get_fence_info(node); // TODO: Use for syntax highlighting tag
+                cm_render_insert(&cursor, cmark_node_get_literal(node), FORMAT_MASK(FORMAT_CODEBLOCK));
+                break;
+            case CMARK_NODE_THEMATIC_BREAK:
+                cm_render_insert(&cursor, "---", FORMAT_MASK(FORMAT_HR));
+                break;
+            case CMARK_NODE_LINEBREAK: // Hard break
+                cm_render_insert(&cursor, "\n", 0);
+                break;
+            case CMARK_NODE_SOFTBREAK:
+                cm_render_insert(&cursor, " ", 0);
+                break;
+            case CMARK_NODE_IMAGE:
+            {
+                // TODO: Actual image display needs GtkImage + GtkTextChildAnchor.
+                // For now, render the alt text if present, or a placeholder, and skip the children.
+                cmark_node *text_child = cmark_node_first_child(node);
+                if (text_child && cmark_node_get_type(text_child) == CMARK_NODE_TEXT) {
+                    cm_render_insert(&cursor, "[Image: ", state.mask);
+                    cm_render_insert(&cursor, cmark_node_get_literal(text_child), state.mask);
+                    cm_render_insert(&cursor, "]", state.mask);
                 } else {
-                    marker_text = "?. "; // Should not happen if called correctly
-                }
-            } else { // Bullet list or unknown
-                marker_text = "- "; // CommonMark: -, +, *
-            }
-            cm_render_insert_with_active_tags(buffer, iter, marker_text, active_tags); // No special tag for marker itself
-
-            // Render item content
-            // Children of an item can be multiple blocks. They need their own inter-block newlines.
-            cmark_node *item_content_child;
-            gboolean first_block_in_item = TRUE;
-            for (item_content_child = cmark_node_first_child(node); item_content_child != NULL; item_content_child = cmark_node_next(item_content_child)) {
-                if (!first_block_in_item) {
-                    // If an item contains multiple blocks, they need blank line separation.
-                    // The child block will end with \n. We add one more.
-                    gtk_text_buffer_insert(buffer, iter, "\\n", -1);
+                    cm_render_insert(&cursor, "[Image]", state.mask);
                 }
-                cm_render_node_content_recursive(item_content_child, buffer, iter, active_tags, NULL); // No ordered list context for children of item
-                first_block_in_item = FALSE;
-            }
-            break;
-        }
-        case CMARK_NODE_HTML_BLOCK:
-        case CMARK_NODE_HTML_INLINE:
-        {
-            const char *literal = cmark_node_get_literal(node);
-            if (literal) {
-                cm_render_insert_with_active_tags(buffer, iter, literal, active_tags);
+                cmark_iter_reset(walker, node, CMARK_EVENT_EXIT);
+                break;
             }
-            break;
-        }
-        default: // Should not be reached if all types are handled
-            // Recursively call for children of unknown or container types
-            {
-                cmark_node *child;
-                for (child = cmark_node_first_child(node); child != NULL; child = cmark_node_next(child)) {
-                    cm_render_node_content_recursive(child, buffer, iter, active_tags, ordered_list_item_counter_ptr);
+            case CMARK_NODE_LIST:
+                if (entering) {
+                    if (list_depth < CM_RENDER_MAX_LIST_DEPTH) {
+                        list_counters[list_depth] = cmark_node_get_list_start(node);
+                    }
+                    list_depth++;
+                } else {
+                    list_depth--;
                 }
-            }
-            break;
-    }
-
-    if (is_block_node) {
-        // Ensure the rendered content of this block node ends with a single newline.
-        // Check if iter is already at a newline. If not, add one.
-        // This is important for the main loop's logic of adding a second newline for separation.
-        GtkTextIter current_pos_check_iter = *iter;
-        gboolean already_ends_with_newline = FALSE;
-        if (gtk_text_iter_get_offset(&current_pos_check_iter) > 0) {
-            if (gtk_text_iter_backward_char(&current_pos_check_iter)) {
-                if (gtk_text_iter_get_char(&current_pos_check_iter) == '\\n') {
-                    already_ends_with_newline = TRUE;
+                break;
+            case CMARK_NODE_ITEM:
+                if (entering) {
+                    // Insert list item marker (bullet or number)
+                    char num_marker[16]; // Buffer for "123. "
+                    const char *marker_text = "- "; // CommonMark: -, +, *
+                    cmark_node *parent_list = cmark_node_parent(node);
+
+                    if (parent_list && cmark_node_get_list_type(parent_list) == CMARK_ORDERED_LIST) {
+                        int number = cmark_node_get_list_start(parent_list);
+                        if (list_depth > 0 && list_depth <= CM_RENDER_MAX_LIST_DEPTH) {
+                            number = list_counters[list_depth - 1]++;
+                        }
+                        g_snprintf(num_marker, sizeof(num_marker), "%d. ", number);
+                        marker_text = num_marker;
+                    }
+                    cm_render_insert(&cursor, marker_text, state.mask);
                 }
-            }
-        } else if (gtk_text_buffer_get_char_count(buffer) == 0) {
-             // Empty buffer can be considered as "ending with a newline" for this purpose.
-            already_ends_with_newline = TRUE;
+                break;
+            default:
+                // Document, paragraph, link and custom nodes only contribute their children
+                // TODO: Create a "link" tag, store URL in GObject data.
+                break;
         }
 
-
-        if (!already_ends_with_newline) {
-            gtk_text_buffer_insert(buffer, iter, "\\n", -1);
+        // Ensure the rendered content of a block node ends with a single newline.
+        // Leaf blocks have no EXIT event, so they are closed right after ENTER.
+        gboolean is_leaf_block = (type == CMARK_NODE_CODE_BLOCK || type == CMARK_NODE_THEMATIC_BREAK ||
+                                  type == CMARK_NODE_HTML_BLOCK);
+        if (is_block_node && (!entering || is_leaf_block) && !cursor.at_line_start) {
+            cm_render_insert(&cursor, "\n", 0);
         }
     }
-}
-
 
-// Helper to ensure the 'blockquote' tag exists with basic styling
-static void ensure_base_blockquote_tag_exists(GtkTextBuffer *buffer) {
-    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
-    if (!gtk_text_tag_table_lookup(tag_table, "blockquote")) {
-        gtk_text_buffer_create_tag(buffer, "blockquote",
-                                 "left-margin", 20, // Example indent
-                                 "pixels-above-lines", 2,
-                                 "pixels-below-lines", 2,
-                                 // "border", ??? GtkTextTag does not have simple border
-                                 // Could use paragraph-background for a subtle effect
-                                 NULL);
-    }
+    cmark_iter_free(walker);
 }
 
 
-gboolean cm_render_markdown_to_buffer(GtkTextBuffer *buffer, const char *markdown_text) {
+gboolean cm_render_markdown_to_buffer(GtkTextBuffer *buffer, const char *markdown_text, gboolean validated) {
     if (!buffer || !markdown_text) {
         g_warning("cm_render_markdown_to_buffer: Invalid arguments.");
         return FALSE;
     }
 
+    PerfSpan span = perf_span_begin(PERF_OP_RENDER);
+
     // 1. Clear the buffer
     GtkTextIter start_clear, end_clear;
     gtk_text_buffer_get_bounds(buffer, &start_clear, &end_clear);
     gtk_text_buffer_delete(buffer, &start_clear, &end_clear);
 
-    // 2. Ensure basic non-theme dependent tags are available.
-    //    These will be created by cm_render_get_or_create_base_tag as needed when encountered,
-    //    but pre-creating common ones here can be a slight conceptual clarity.
+    // 2. Ensure basic non-theme dependent tags are available and resolve them once;
+    //    the traversal applies them by pointer.
     //    Theme properties are applied *after* all rendering.
-    cm_render_get_or_create_base_tag(buffer, "bold");
-    cm_render_get_or_create_base_tag(buffer, "italic");
-    for (int i = 1; i <= 6; i++) {
-        char h_tag[3];
-        g_snprintf(h_tag, sizeof(h_tag), "h%d", i);
-        cm_render_get_or_create_base_tag(buffer, h_tag);
+    FormatTags tags;
+    for (guint bit = 0; bit < FORMAT_COUNT; bit++) {
+        tags[bit] = cm_render_get_or_create_base_tag(buffer, format_bit_get_tag_name((FormatBit)bit));
     }
-    cm_render_get_or_create_base_tag(buffer, "code");
-    cm_render_get_or_create_base_tag(buffer, "codeblock");
-    cm_render_get_or_create_base_tag(buffer, "hr");
-    cm_render_get_or_create_base_tag(buffer, "blockquote"); // Add this in the pre-creation part
 
 
     // 3. Parse Markdown
     // CMARK_OPT_SMART enables smart quotes, dashes, etc.
-    // CMARK_OPT_VALIDATE_UTF8 is good practice.
+    // CMARK_OPT_VALIDATE_UTF8 makes cmark check byte by byte; text that has
+    // already been through text_scan() doesn't need it.
     // CMARK_OPT_LIBERAL_HTML_TAG allows more flexible HTML.
     // CMARK_OPT_FOOTNOTES if you want to support footnotes (not in initial scope)
-    int options = CMARK_OPT_DEFAULT | CMARK_OPT_SMART | CMARK_OPT_VALIDATE_UTF8;
-    cmark_parser *parser = cmark_parser_new(options);
+    gsize markdown_length = strlen(markdown_text);
+    int options = CMARK_OPT_DEFAULT | CMARK_OPT_SMART;
+    if (!validated) {
+        options |= CMARK_OPT_VALIDATE_UTF8;
+    }
+    // Parse into this thread's arena when it is free; freeing the tree is then a single reset.
+    cmark_mem *arena = cmark_arena_acquire();
+    cmark_parser *parser = arena ? cmark_parser_new_with_mem(options, arena) : cmark_parser_new(options);
     if (!parser) {
         g_warning("cm_render_markdown_to_buffer: Failed to create cmark_parser.");
+        if (arena) cmark_arena_release(arena);
+        perf_span_end(&span);
         return FALSE;
     }
-    cmark_parser_feed(parser, markdown_text, strlen(markdown_text));
+    cmark_parser_feed(parser, markdown_text, markdown_length);
     cmark_node *document = cmark_parser_finish(parser);
     cmark_parser_free(parser);
     
     if (!document) {
         g_warning("cm_render_markdown_to_buffer: Failed to parse Markdown document.");
+        if (arena) cmark_arena_release(arena);
+        perf_span_end(&span);
         return FALSE;
     }
 
@@ -508,31 +363,20 @@ gboolean cm_render_markdown_to_buffer(GtkTextBuffer *buffer, const char *markdow
     GtkTextIter iter;
     gtk_text_buffer_get_start_iter(buffer, &iter); // Start iter for the whole document
 
-    cmark_node *doc_child_node;
-    gboolean is_first_block_in_document = TRUE;
-
-    for (doc_child_node = cmark_node_first_child(document); doc_child_node != NULL; doc_child_node = cmark_node_next(doc_child_node)) {
-        if (!is_first_block_in_document) {
-            // Add the separating newline for the "blank line" between blocks.
-            // The previous block's rendering (via cm_render_node_content_recursive)
-            // should have ended with one \n. This makes it \n\n.
-            gtk_text_buffer_insert(buffer, &iter, "\\n", -1);
-        }
-        // Render the block node itself and its children.
-        // This call will ensure that the content of 'doc_child_node' ends with a single '\n'.
-        cm_render_node_content_recursive(doc_child_node, buffer, &iter, NULL, NULL); // Top-level blocks, no inherited ordered list counter
-
-        is_first_block_in_document = FALSE;
-        // iter is updated by cm_render_node_content_recursive and gtk_text_buffer_insert
-    }
+    cm_render_document(document, buffer, &iter, tags);
 
     // 5. Free cmark document
-    cmark_node_free(document);
+    if (arena) {
+        cmark_arena_release(arena);
+    } else {
+        cmark_node_free(document);
+    }
 
     // 6. Apply theme-dependent styles
     // This is crucial for elements like code blocks that need theme-specific colors.
     cm_render_update_theme_dependent_tags(buffer);
 
+    perf_span_end(&span);
     return TRUE;
 }
 
@@ -0,0 +1,390 @@
+#include "document_io.h"
+#include "gtktext_cmark.h"
+#include "md_export.h"
+#include "parallel_parse.h"
+#include "perf_trace.h"
+#include "source_map.h"
+#include "text_scan.h"
+
+// Bytes requested per read while loading
+#define DOCUMENT_IO_READ_SIZE (1024 * 1024)
+// Markdown staged before each write while saving
+#define DOCUMENT_IO_WRITE_SIZE (1024 * 1024)
+// Main loop time one export slice may take before yielding
+#define DOCUMENT_IO_SLICE_US 8000
+// Lines exported between clock checks
+#define DOCUMENT_IO_LINES_PER_CHECK 64
+
+typedef struct {
+    GInputStream *stream;
+    GByteArray *contents;
+    goffset size;      // From the file info; 0 if unknown
+    gchar *digest;     // Set by the parse thread
+    RenderPlan *plan;  // The parsed document, inserted into buffer a slice at a time
+    GtkTextBuffer *buffer;
+    RenderPlanPosition position;
+    DocumentIoProgressFunc progress;
+    gpointer user_data;
+} LoadJob;
+
+static void load_job_free(gpointer data) {
+    LoadJob *job = data;
+    g_clear_object(&job->stream);
+    if (job->contents) g_byte_array_unref(job->contents);
+    g_free(job->digest);
+    render_plan_free(job->plan);
+    if (job->buffer) {
+        gtk_text_buffer_end_irreversible_action(job->buffer);
+        g_object_unref(job->buffer);
+    }
+    g_free(job);
+}
+
+// Runs on a worker thread with the whole file in memory; only parses, GTK stays on the main thread
+static void load_parse_thread(GTask *task, G_GNUC_UNUSED gpointer source_object,
+                              gpointer task_data, G_GNUC_UNUSED GCancellable *cancellable) {
+    LoadJob *job = task_data;
+    gchar *contents = (gchar *)job->contents->data;
+    gsize length = job->contents->len - 1; // Without the terminating NUL
+    GError *error = NULL;
+
+    // Of the bytes on disk, before text_scan() normalizes line endings
+    job->digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)contents, length);
+    TextLineIndex *lines = NULL;
+    if (!text_scan(contents, &length, &lines, &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    // Only the parse; inserting into the buffer is spread over many frames
+    PerfSpan span = perf_span_begin(PERF_OP_IMPORT);
+    RenderPlan *plan = parallel_parse_markdown(contents, lines, 0);
+    perf_span_end(&span);
+    text_line_index_free(lines);
+    if (!plan) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to import markdown");
+        return;
+    }
+    g_task_return_pointer(task, plan, (GDestroyNotify)render_plan_free);
+}
+
+// Inserts the parsed plan until the slice's time is up
+static gboolean load_insert_slice(gpointer user_data) {
+    GTask *task = user_data;
+    LoadJob *job = g_task_get_task_data(task);
+
+    if (g_task_return_error_if_cancelled(task)) {
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(job->buffer, &end);
+    gint64 deadline = g_get_monotonic_time() + DOCUMENT_IO_SLICE_US;
+    if (!render_plan_insert(job->plan, job->buffer, &end, &job->position, deadline)) {
+        if (job->progress) {
+            // Inserting is the second half of the work
+            guint n_lines = render_plan_get_n_lines(job->plan);
+            job->progress(0.5 + 0.5 * (double)job->position.line / (double)n_lines, job->user_data);
+        }
+        return G_SOURCE_CONTINUE;
+    }
+
+    const SourceMap *map = render_plan_get_source_map(job->plan);
+    source_map_attach(job->buffer, map ? source_map_copy(map) : NULL);
+    gtk_text_buffer_end_irreversible_action(job->buffer);
+    g_task_return_pointer(task, g_steal_pointer(&job->buffer), g_object_unref);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_load_parsed(G_GNUC_UNUSED GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    LoadJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    job->plan = g_task_propagate_pointer(G_TASK(result), &error);
+    if (!job->plan) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    job->buffer = create_headless_buffer_cmark();
+    // Opening a file is not an edit that can be undone
+    gtk_text_buffer_begin_irreversible_action(job->buffer);
+    g_idle_add(load_insert_slice, task);
+}
+
+static void load_read_next(GTask *task);
+
+static void on_load_bytes_read(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    LoadJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    GBytes *bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source_object), result, &error);
+    if (!bytes) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    gsize n = g_bytes_get_size(bytes);
+    if (n > 0) {
+        g_byte_array_append(job->contents, g_bytes_get_data(bytes, NULL), (guint)n);
+        g_bytes_unref(bytes);
+        if (job->progress && job->size > 0) {
+            // Reading is the first half of the work
+            job->progress(0.5 * MIN(1.0, (double)job->contents->len / (double)job->size), job->user_data);
+        }
+        load_read_next(task);
+        return;
+    }
+    g_bytes_unref(bytes);
+
+    g_input_stream_close_async(job->stream, G_PRIORITY_DEFAULT, NULL, NULL, NULL);
+    g_clear_object(&job->stream);
+    g_byte_array_append(job->contents, (const guint8 *)"", 1);
+    if (job->progress) {
+        job->progress(-1.0, job->user_data); // The parse gives no progress
+    }
+    GTask *parse = g_task_new(NULL, g_task_get_cancellable(task), on_load_parsed, task);
+    g_task_set_task_data(parse, job, NULL);
+    g_task_run_in_thread(parse, load_parse_thread);
+    g_object_unref(parse);
+}
+
+static void load_read_next(GTask *task) {
+    LoadJob *job = g_task_get_task_data(task);
+    g_input_stream_read_bytes_async(job->stream, DOCUMENT_IO_READ_SIZE, G_PRIORITY_DEFAULT,
+                                    g_task_get_cancellable(task), on_load_bytes_read, task);
+}
+
+static void on_load_info(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    LoadJob *job = g_task_get_task_data(task);
+
+    // Without a size the load just shows no progress
+    GFileInfo *info = g_file_input_stream_query_info_finish(G_FILE_INPUT_STREAM(source_object), result, NULL);
+    if (info) {
+        job->size = g_file_info_get_size(info);
+        g_object_unref(info);
+    }
+    job->contents = g_byte_array_sized_new((guint)CLAMP(job->size + 1, 1, G_MAXUINT));
+    load_read_next(task);
+}
+
+static void on_load_opened(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    LoadJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    GFileInputStream *stream = g_file_read_finish(G_FILE(source_object), result, &error);
+    if (!stream) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    job->stream = G_INPUT_STREAM(stream);
+    g_file_input_stream_query_info_async(stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_PRIORITY_DEFAULT,
+                                         g_task_get_cancellable(task), on_load_info, task);
+}
+
+void document_io_load_async(GFile *file, GCancellable *cancellable, DocumentIoProgressFunc progress,
+                            GAsyncReadyCallback callback, gpointer user_data) {
+    g_return_if_fail(G_IS_FILE(file));
+
+    LoadJob *job = g_new0(LoadJob, 1);
+    job->progress = progress;
+    job->user_data = user_data;
+
+    GTask *task = g_task_new(file, cancellable, callback, user_data);
+    g_task_set_source_tag(task, document_io_load_async);
+    g_task_set_task_data(task, job, load_job_free);
+    g_file_read_async(file, G_PRIORITY_DEFAULT, cancellable, on_load_opened, task);
+}
+
+GtkTextBuffer *document_io_load_finish(GAsyncResult *result, gchar **digest, GError **error) {
+    g_return_val_if_fail(g_async_result_is_tagged(result, document_io_load_async), NULL);
+    GTask *task = G_TASK(result);
+
+    GtkTextBuffer *buffer = g_task_propagate_pointer(task, error);
+    if (buffer && digest) {
+        LoadJob *job = g_task_get_task_data(task);
+        *digest = g_strdup(job->digest);
+    }
+    return buffer;
+}
+
+typedef struct {
+    GtkTextBuffer *buffer;
+    GOutputStream *stream;   // The g_file_replace_async() stream
+    GOutputStream *staging;  // Markdown exported but not yet written
+    MdWriter md;
+    MdExportState state;
+    gint offset;             // Where the next slice starts
+    gint char_count;
+    gboolean exported;       // The whole buffer is in staging or written
+    GChecksum *checksum;
+    DocumentIoProgressFunc progress;
+    gpointer user_data;
+} SaveJob;
+
+static void save_job_free(gpointer data) {
+    SaveJob *job = data;
+    if (job->stream && !g_output_stream_is_closed(job->stream)) {
+        // Closing with a cancelled cancellable drops the temporary file and keeps the old one
+        GCancellable *abort_save = g_cancellable_new();
+        g_cancellable_cancel(abort_save);
+        g_output_stream_close(job->stream, abort_save, NULL);
+        g_object_unref(abort_save);
+    }
+    g_clear_object(&job->stream);
+    g_clear_object(&job->staging);
+    g_free(job->md.chunk);
+    g_clear_error(&job->md.error);
+    g_checksum_free(job->checksum);
+    g_object_unref(job->buffer);
+    g_free(job);
+}
+
+static void save_write_slice(GTask *task);
+
+static gboolean save_write_slice_idle(gpointer user_data) {
+    save_write_slice(G_TASK(user_data));
+    return G_SOURCE_REMOVE;
+}
+
+static void on_save_closed(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    GError *error = NULL;
+
+    if (!g_output_stream_close_finish(G_OUTPUT_STREAM(source_object), result, &error)) {
+        g_task_return_error(task, error);
+    } else {
+        g_task_return_boolean(task, TRUE);
+    }
+    g_object_unref(task);
+}
+
+static void on_save_written(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    SaveJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source_object), result, NULL, &error)) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    g_seekable_seek(G_SEEKABLE(job->staging), 0, G_SEEK_SET, NULL, NULL);
+    g_seekable_truncate(G_SEEKABLE(job->staging), 0, NULL, NULL);
+    save_write_slice(task);
+}
+
+// Exports lines until enough Markdown is staged or the slice's time is up, then writes it
+static void save_write_slice(GTask *task) {
+    SaveJob *job = g_task_get_task_data(task);
+    GMemoryOutputStream *staging = G_MEMORY_OUTPUT_STREAM(job->staging);
+
+    if (g_task_return_error_if_cancelled(task)) {
+        g_object_unref(task);
+        return;
+    }
+
+    if (!job->exported) {
+        gint64 deadline = g_get_monotonic_time() + DOCUMENT_IO_SLICE_US;
+        GtkTextIter iter;
+        gtk_text_buffer_get_iter_at_offset(job->buffer, &iter, job->offset);
+
+        guint lines = 0;
+        while (!gtk_text_iter_is_end(&iter) &&
+               g_memory_output_stream_get_data_size(staging) < DOCUMENT_IO_WRITE_SIZE) {
+            md_export_line(job->buffer, &iter, &job->state, &job->md);
+            if (++lines % DOCUMENT_IO_LINES_PER_CHECK == 0 && g_get_monotonic_time() >= deadline) {
+                break;
+            }
+        }
+        job->offset = gtk_text_iter_get_offset(&iter);
+
+        if (gtk_text_iter_is_end(&iter)) {
+            GError *error = NULL;
+            md_export_finish(job->state, &job->md);
+            if (!md_writer_finish(&job->md, &error)) {
+                g_task_return_error(task, error);
+                g_object_unref(task);
+                return;
+            }
+            job->exported = TRUE;
+        }
+        if (job->progress && job->char_count > 0) {
+            job->progress((double)job->offset / (double)job->char_count, job->user_data);
+        }
+    }
+
+    gsize size = g_memory_output_stream_get_data_size(staging);
+    if (size > 0) {
+        const guint8 *data = g_memory_output_stream_get_data(staging);
+        g_checksum_update(job->checksum, data, (gssize)size);
+        g_output_stream_write_all_async(job->stream, data, size, G_PRIORITY_DEFAULT,
+                                        g_task_get_cancellable(task), on_save_written, task);
+    } else if (!job->exported) {
+        // Nothing staged yet (only the writer's tail); let the main loop run before the next slice
+        g_idle_add(save_write_slice_idle, task);
+    } else {
+        g_output_stream_close_async(job->stream, G_PRIORITY_DEFAULT, g_task_get_cancellable(task),
+                                    on_save_closed, task);
+    }
+}
+
+static void on_save_replace_ready(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    SaveJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    GFileOutputStream *stream = g_file_replace_finish(G_FILE(source_object), result, &error);
+    if (!stream) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    job->stream = G_OUTPUT_STREAM(stream);
+    save_write_slice(task);
+}
+
+void document_io_save_async(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable,
+                            DocumentIoProgressFunc progress, GAsyncReadyCallback callback,
+                            gpointer user_data) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(G_IS_FILE(file));
+
+    SaveJob *job = g_new0(SaveJob, 1);
+    job->buffer = g_object_ref(buffer);
+    job->staging = g_memory_output_stream_new_resizable();
+    md_writer_init(&job->md, job->staging, NULL);
+    job->char_count = gtk_text_buffer_get_char_count(buffer);
+    job->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    job->progress = progress;
+    job->user_data = user_data;
+
+    GTask *task = g_task_new(file, cancellable, callback, user_data);
+    g_task_set_source_tag(task, document_io_save_async);
+    g_task_set_task_data(task, job, save_job_free);
+    g_file_replace_async(file, NULL, FALSE, G_FILE_CREATE_NONE, G_PRIORITY_DEFAULT, cancellable,
+                         on_save_replace_ready, task);
+}
+
+gboolean document_io_save_finish(GAsyncResult *result, gchar **digest, GError **error) {
+    g_return_val_if_fail(g_async_result_is_tagged(result, document_io_save_async), FALSE);
+    GTask *task = G_TASK(result);
+
+    if (!g_task_propagate_boolean(task, error)) {
+        return FALSE;
+    }
+    if (digest) {
+        SaveJob *job = g_task_get_task_data(task);
+        *digest = g_strdup(g_checksum_get_string(job->checksum));
+    }
+    return TRUE;
+}
@@ -0,0 +1,525 @@
+#include "document_print.h"
+#include "format_mask.h"
+#include "render_plan.h"
+#include "scheduler.h"
+#include <cairo-pdf.h>
+#include <pango/pangocairo.h>
+#include <string.h>
+
+#define PRINT_CACHE_KEY "gtktext-print-cache"
+#define PRINT_FONT "Sans 11"
+#define PRINT_CODE_FAMILY "Monospace"
+// Code blocks and block quotes are indented by this many points
+#define PRINT_BLOCK_INDENT 12
+// Time GtkPrintOperation::paginate may take per call
+#define PRINT_PAGINATE_SLICE_US 8000
+
+// Match the h1-h6 tags of cmark.c
+static const double heading_scales[6] = {
+    PANGO_SCALE_XX_LARGE, PANGO_SCALE_X_LARGE, PANGO_SCALE_LARGE,
+    PANGO_SCALE_MEDIUM, PANGO_SCALE_SMALL, PANGO_SCALE_X_SMALL,
+};
+
+// A line of a block, in Pango units from the top of the block
+typedef struct {
+    gint top;
+    gint height;
+    gint baseline;
+    gint x;
+} PrintLine;
+
+// A laid-out block, shared by the cache and the pages using it
+typedef struct {
+    PangoLayout *layout;
+    GArray *lines;  // PrintLine
+    gint indent;    // Pango units from the left of the printable area
+} PrintBlock;
+
+// Held by the buffer and by its pages
+typedef struct {
+    PangoContext *context;  // 72 dpi without hinting, so layouts are in points and fit any target
+    GHashTable *blocks;     // Key from block_key() → PrintBlock, for the blocks of the last pagination
+} PrintCache;
+
+// The first line of a page
+typedef struct {
+    guint block;
+    guint line;
+} PrintPageStart;
+
+struct _PrintPages {
+    PrintCache *cache;
+    RenderPlanSnapshot *snapshot;  // Until the buffer is read
+    RenderPlan *plan;              // After
+    gint width;              // Pango units
+    gint height;
+    GPtrArray *blocks;       // PrintBlock, one per line of plan placed so far
+    GHashTable *used;        // The blocks of this pagination; replaces the cache's when done
+    GArray *page_starts;     // PrintPageStart
+    gint y;                  // Pango units taken on the last page
+    guint n_laid_out;
+};
+
+static GtkPrintSettings *print_settings = NULL;
+
+static void print_block_clear(gpointer data) {
+    PrintBlock *block = data;
+    g_object_unref(block->layout);
+    g_array_unref(block->lines);
+}
+
+static void print_block_unref(gpointer data) {
+    g_rc_box_release_full(data, print_block_clear);
+}
+
+static GHashTable *print_block_table_new(void) {
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, print_block_unref);
+}
+
+static void print_cache_clear(gpointer data) {
+    PrintCache *cache = data;
+    g_object_unref(cache->context);
+    g_hash_table_unref(cache->blocks);
+}
+
+static void print_cache_unref(gpointer data) {
+    g_rc_box_release_full(data, print_cache_clear);
+}
+
+static PrintCache *print_cache_get(GtkTextBuffer *buffer) {
+    PrintCache *cache = g_object_get_data(G_OBJECT(buffer), PRINT_CACHE_KEY);
+    if (!cache) {
+        cache = g_rc_box_new0(PrintCache);
+        cache->context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+        pango_cairo_context_set_resolution(cache->context, 72);
+        pango_context_set_round_glyph_positions(cache->context, FALSE);
+        cairo_font_options_t *options = cairo_font_options_create();
+        cairo_font_options_set_hint_style(options, CAIRO_HINT_STYLE_NONE);
+        cairo_font_options_set_hint_metrics(options, CAIRO_HINT_METRICS_OFF);
+        pango_cairo_context_set_font_options(cache->context, options);
+        cairo_font_options_destroy(options);
+        cache->blocks = print_block_table_new();
+        g_object_set_data_full(G_OBJECT(buffer), PRINT_CACHE_KEY, cache, print_cache_unref);
+    }
+    return cache;
+}
+
+// Everything the layout of a block depends on
+static gchar *block_key(gint width, const gchar *text, gsize length, const RenderPlanRun *runs, guint n_runs) {
+    GString *key = g_string_sized_new(length + 16 * n_runs + 16);
+    g_string_append_printf(key, "%d", width);
+    for (guint r = 0; r < n_runs; r++) {
+        g_string_append_printf(key, ";%x:%d-%d", runs[r].mask, runs[r].start, runs[r].end);
+    }
+    g_string_append_c(key, '\n');
+    g_string_append_len(key, text, (gssize)length);
+    return g_string_free(key, FALSE);
+}
+
+static void add_attribute(PangoAttrList *attrs, PangoAttribute *attr, guint start, guint end) {
+    attr->start_index = start;
+    attr->end_index = end;
+    pango_attr_list_insert(attrs, attr);
+}
+
+// Print styles follow the screen's, but with colors meant for paper whatever the theme
+static void add_run_attributes(PangoAttrList *attrs, guint32 mask, guint start, guint end) {
+    if (mask & (FORMAT_MASK(FORMAT_BOLD) | FORMAT_MASK_HEADINGS)) {
+        add_attribute(attrs, pango_attr_weight_new(PANGO_WEIGHT_BOLD), start, end);
+    }
+    if (mask & (FORMAT_MASK(FORMAT_ITALIC) | FORMAT_MASK(FORMAT_BLOCKQUOTE))) {
+        add_attribute(attrs, pango_attr_style_new(PANGO_STYLE_ITALIC), start, end);
+    }
+    if (mask & (FORMAT_MASK(FORMAT_CODE) | FORMAT_MASK(FORMAT_CODEBLOCK))) {
+        add_attribute(attrs, pango_attr_family_new(PRINT_CODE_FAMILY), start, end);
+        add_attribute(attrs, pango_attr_background_new(0xf1f1, 0xf1f1, 0xf1f1), start, end);
+    }
+    if (mask & FORMAT_MASK(FORMAT_HR)) {
+        add_attribute(attrs, pango_attr_foreground_new(0x8080, 0x8080, 0x8080), start, end);
+    }
+    for (guint level = 0; level < G_N_ELEMENTS(heading_scales); level++) {
+        if (mask & FORMAT_MASK(FORMAT_H1 + level)) {
+            add_attribute(attrs, pango_attr_scale_new(heading_scales[level]), start, end);
+            break;
+        }
+    }
+}
+
+static PrintBlock *print_block_new(PrintCache *cache, gint width, const gchar *text, gsize length,
+                                   const RenderPlanRun *runs, guint n_runs) {
+    PrintBlock *block = g_rc_box_new0(PrintBlock);
+    guint32 block_mask = 0;
+    for (guint r = 0; r < n_runs; r++) {
+        block_mask |= runs[r].mask;
+    }
+    if (block_mask & (FORMAT_MASK(FORMAT_CODEBLOCK) | FORMAT_MASK(FORMAT_BLOCKQUOTE))) {
+        block->indent = PRINT_BLOCK_INDENT * PANGO_SCALE;
+    }
+
+    block->layout = pango_layout_new(cache->context);
+    pango_layout_set_width(block->layout, MAX(width - block->indent, PANGO_SCALE));
+    pango_layout_set_wrap(block->layout, PANGO_WRAP_WORD_CHAR);
+    PangoFontDescription *font = pango_font_description_from_string(PRINT_FONT);
+    pango_layout_set_font_description(block->layout, font);
+    pango_font_description_free(font);
+    pango_layout_set_text(block->layout, text, (int)length);
+
+    // Run offsets are in characters; the last run may cover the line terminator, which isn't laid out
+    PangoAttrList *attrs = pango_attr_list_new();
+    const gchar *run_start = text;
+    for (guint r = 0; r < n_runs; r++) {
+        const gchar *run_end = g_utf8_offset_to_pointer(run_start, runs[r].end - runs[r].start);
+        guint start = (guint)MIN((gsize)(run_start - text), length);
+        guint end = (guint)MIN((gsize)(run_end - text), length);
+        if (runs[r].mask != 0 && start < end) {
+            add_run_attributes(attrs, runs[r].mask, start, end);
+        }
+        run_start = run_end;
+    }
+    pango_layout_set_attributes(block->layout, attrs);
+    pango_attr_list_unref(attrs);
+
+    block->lines = g_array_new(FALSE, FALSE, sizeof(PrintLine));
+    PangoLayoutIter *iter = pango_layout_get_iter(block->layout);
+    do {
+        PangoRectangle logical;
+        pango_layout_iter_get_line_extents(iter, NULL, &logical);
+        PrintLine line = { logical.y, logical.height, pango_layout_iter_get_baseline(iter), logical.x };
+        g_array_append_val(block->lines, line);
+    } while (pango_layout_iter_next_line(iter));
+    pango_layout_iter_free(iter);
+    return block;
+}
+
+PrintPages *print_pages_new(GtkTextBuffer *buffer, double width, double height) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+    g_return_val_if_fail(width > 0 && height > 0, NULL);
+
+    PrintPages *pages = g_new0(PrintPages, 1);
+    pages->cache = g_rc_box_acquire(print_cache_get(buffer));
+    pages->snapshot = render_plan_snapshot_new(buffer);
+    pages->width = pango_units_from_double(width);
+    pages->height = pango_units_from_double(height);
+    pages->blocks = g_ptr_array_new_with_free_func(print_block_unref);
+    pages->used = print_block_table_new();
+    pages->page_starts = g_array_new(FALSE, TRUE, sizeof(PrintPageStart));
+    g_array_set_size(pages->page_starts, 1);
+    return pages;
+}
+
+void print_pages_free(PrintPages *pages) {
+    if (!pages) return;
+    print_cache_unref(pages->cache);
+    render_plan_snapshot_free(pages->snapshot);
+    render_plan_free(pages->plan);
+    g_ptr_array_unref(pages->blocks);
+    g_clear_pointer(&pages->used, g_hash_table_unref);
+    g_array_unref(pages->page_starts);
+    g_free(pages);
+}
+
+// The block of a plan line, from this pagination, the cache, or laid out now
+static PrintBlock *get_block(PrintPages *pages, guint line) {
+    const RenderPlanRun *runs;
+    guint n_runs;
+    const gchar *text = render_plan_get_line(pages->plan, line, &runs, &n_runs);
+    gsize length = strlen(text);
+    if (length > 0 && text[length - 1] == '\n') {
+        length--;
+    }
+
+    gchar *key = block_key(pages->width, text, length, runs, n_runs);
+    PrintBlock *block = g_hash_table_lookup(pages->used, key);
+    if (block) {
+        g_free(key);
+        return block;
+    }
+    block = g_hash_table_lookup(pages->cache->blocks, key);
+    if (block) {
+        g_rc_box_acquire(block);
+    } else {
+        block = print_block_new(pages->cache, pages->width, text, length, runs, n_runs);
+        pages->n_laid_out++;
+    }
+    g_hash_table_insert(pages->used, key, block);
+    return block;
+}
+
+// Lines go on the current page while they fit; a line taller than a page gets one of its own
+static void place_block(PrintPages *pages, const PrintBlock *block) {
+    for (guint i = 0; i < block->lines->len; i++) {
+        const PrintLine *line = &g_array_index(block->lines, PrintLine, i);
+        if (pages->y > 0 && pages->y + line->height > pages->height) {
+            PrintPageStart start = { pages->blocks->len - 1, i };
+            g_array_append_val(pages->page_starts, start);
+            pages->y = 0;
+        }
+        pages->y += line->height;
+    }
+}
+
+gboolean print_pages_paginate(PrintPages *pages, gint64 deadline_us) {
+    g_return_val_if_fail(pages != NULL, TRUE);
+
+    // The buffer is read a slice at a time too, picking up edits to what was read
+    if (pages->snapshot) {
+        if (!render_plan_snapshot_read(pages->snapshot, deadline_us)) return FALSE;
+        pages->plan = render_plan_snapshot_finish(g_steal_pointer(&pages->snapshot));
+        if (deadline_us > 0 && g_get_monotonic_time() >= deadline_us) return FALSE;
+    }
+
+    guint n_blocks = render_plan_get_n_lines(pages->plan);
+    while (pages->blocks->len < n_blocks) {
+        PrintBlock *block = get_block(pages, pages->blocks->len);
+        g_ptr_array_add(pages->blocks, g_rc_box_acquire(block));
+        place_block(pages, block);
+        if (deadline_us > 0 && g_get_monotonic_time() >= deadline_us) break;
+    }
+    if (pages->blocks->len < n_blocks) return FALSE;
+
+    // Blocks no longer in the document leave the cache
+    if (pages->used) {
+        g_hash_table_unref(pages->cache->blocks);
+        pages->cache->blocks = g_steal_pointer(&pages->used);
+    }
+    return TRUE;
+}
+
+double print_pages_get_progress(const PrintPages *pages) {
+    if (pages->snapshot) {
+        return 0.5 * render_plan_snapshot_get_progress(pages->snapshot);
+    }
+    return 0.5 + 0.5 * (double)pages->blocks->len / (double)render_plan_get_n_lines(pages->plan);
+}
+
+guint print_pages_get_n_pages(const PrintPages *pages) {
+    return pages->page_starts->len;
+}
+
+guint print_pages_get_n_laid_out(const PrintPages *pages) {
+    return pages->n_laid_out;
+}
+
+void print_pages_draw(const PrintPages *pages, guint page, cairo_t *cr) {
+    g_return_if_fail(pages != NULL && cr != NULL);
+    g_return_if_fail(page < pages->page_starts->len);
+
+    PrintPageStart start = g_array_index(pages->page_starts, PrintPageStart, page);
+    PrintPageStart end = { pages->blocks->len, 0 };
+    if (page + 1 < pages->page_starts->len) {
+        end = g_array_index(pages->page_starts, PrintPageStart, page + 1);
+    }
+
+    gint y = 0;
+    for (guint b = start.block; b <= end.block && b < pages->blocks->len; b++) {
+        const PrintBlock *block = g_ptr_array_index(pages->blocks, b);
+        guint first = b == start.block ? start.line : 0;
+        guint last = b == end.block ? end.line : block->lines->len;
+        for (guint i = first; i < last; i++) {
+            const PrintLine *line = &g_array_index(block->lines, PrintLine, i);
+            cairo_move_to(cr, pango_units_to_double(block->indent + line->x),
+                          pango_units_to_double(y + line->baseline - line->top));
+            pango_cairo_show_layout_line(cr, pango_layout_get_line_readonly(block->layout, (int)i));
+            y += line->height;
+        }
+    }
+}
+
+// Paper and orientation come from the last print
+static GtkPageSetup *get_page_setup(void) {
+    GtkPageSetup *setup = gtk_page_setup_new();
+    if (print_settings) {
+        GtkPaperSize *paper = gtk_print_settings_get_paper_size(print_settings);
+        if (paper) {
+            gtk_page_setup_set_paper_size_and_default_margins(setup, paper);
+            gtk_paper_size_free(paper);
+        }
+        gtk_page_setup_set_orientation(setup, gtk_print_settings_get_orientation(print_settings));
+    }
+    return setup;
+}
+
+static void on_begin_print(GtkPrintOperation *operation, GtkPrintContext *context,
+                           G_GNUC_UNUSED gpointer user_data) {
+    GtkTextBuffer *buffer = g_object_get_data(G_OBJECT(operation), "gtktext-print-buffer");
+    PrintPages *pages = print_pages_new(buffer, gtk_print_context_get_width(context),
+                                        gtk_print_context_get_height(context));
+    g_object_set_data_full(G_OBJECT(operation), "gtktext-print-pages", pages, (GDestroyNotify)print_pages_free);
+}
+
+// GTK calls this until it returns TRUE, showing progress in between
+static gboolean on_paginate(GtkPrintOperation *operation, G_GNUC_UNUSED GtkPrintContext *context,
+                            G_GNUC_UNUSED gpointer user_data) {
+    PrintPages *pages = g_object_get_data(G_OBJECT(operation), "gtktext-print-pages");
+    if (!print_pages_paginate(pages, g_get_monotonic_time() + PRINT_PAGINATE_SLICE_US)) {
+        return FALSE;
+    }
+    gtk_print_operation_set_n_pages(operation, (gint)print_pages_get_n_pages(pages));
+    return TRUE;
+}
+
+static void on_draw_page(GtkPrintOperation *operation, GtkPrintContext *context, gint page_nr,
+                         G_GNUC_UNUSED gpointer user_data) {
+    PrintPages *pages = g_object_get_data(G_OBJECT(operation), "gtktext-print-pages");
+    print_pages_draw(pages, (guint)page_nr, gtk_print_context_get_cairo_context(context));
+}
+
+static void on_print_done(GtkPrintOperation *operation, GtkPrintOperationResult result,
+                          G_GNUC_UNUSED gpointer user_data) {
+    if (result == GTK_PRINT_OPERATION_RESULT_ERROR) {
+        GError *error = NULL;
+        gtk_print_operation_get_error(operation, &error);
+        g_warning("Error printing: %s", error ? error->message : "unknown error");
+        g_clear_error(&error);
+    } else if (result == GTK_PRINT_OPERATION_RESULT_APPLY) {
+        g_set_object(&print_settings, gtk_print_operation_get_print_settings(operation));
+    }
+    // The layouts stay cached with the buffer for the next print
+    g_object_set_data(G_OBJECT(operation), "gtktext-print-pages", NULL);
+}
+
+void document_print(GtkWindow *parent, GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    GtkPrintOperation *operation = gtk_print_operation_new();
+    gtk_print_operation_set_unit(operation, GTK_UNIT_POINTS);
+    gtk_print_operation_set_allow_async(operation, TRUE);
+    gtk_print_operation_set_show_progress(operation, TRUE);
+    gtk_print_operation_set_embed_page_setup(operation, TRUE);
+    if (print_settings) {
+        gtk_print_operation_set_print_settings(operation, print_settings);
+    }
+    GtkPageSetup *setup = get_page_setup();
+    gtk_print_operation_set_default_page_setup(operation, setup);
+    g_object_unref(setup);
+
+    g_object_set_data_full(G_OBJECT(operation), "gtktext-print-buffer", g_object_ref(buffer), g_object_unref);
+    g_signal_connect(operation, "begin-print", G_CALLBACK(on_begin_print), NULL);
+    g_signal_connect(operation, "paginate", G_CALLBACK(on_paginate), NULL);
+    g_signal_connect(operation, "draw-page", G_CALLBACK(on_draw_page), NULL);
+    g_signal_connect(operation, "done", G_CALLBACK(on_print_done), NULL);
+
+    GError *error = NULL;
+    if (gtk_print_operation_run(operation, GTK_PRINT_OPERATION_ACTION_PRINT_DIALOG, parent, &error) ==
+        GTK_PRINT_OPERATION_RESULT_ERROR) {
+        g_warning("Error printing: %s", error->message);
+        g_clear_error(&error);
+    }
+    // An asynchronous run holds its own reference until "done"
+    g_object_unref(operation);
+}
+
+typedef struct {
+    PrintPages *pages;
+    GByteArray *pdf;           // Written by the surface; the whole file is replaced at the end
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    double left_margin;        // Points from the paper edge to the printable area
+    double top_margin;
+    guint next_page;
+    DocumentIoProgressFunc progress;
+    gpointer user_data;
+} PdfExport;
+
+static void pdf_export_free(gpointer data) {
+    PdfExport *export = data;
+    // The surface may still write to pdf as it is finished
+    g_clear_pointer(&export->cr, cairo_destroy);
+    g_clear_pointer(&export->surface, cairo_surface_destroy);
+    g_clear_pointer(&export->pdf, g_byte_array_unref);
+    print_pages_free(export->pages);
+    g_free(export);
+}
+
+static cairo_status_t pdf_write(void *closure, const unsigned char *data, unsigned int length) {
+    g_byte_array_append(closure, data, length);
+    return CAIRO_STATUS_SUCCESS;
+}
+
+static void on_pdf_written(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GTask *task = user_data;
+    GError *error = NULL;
+    if (g_file_replace_contents_finish(G_FILE(source_object), result, NULL, &error)) {
+        g_task_return_boolean(task, TRUE);
+    } else {
+        g_task_return_error(task, error);
+    }
+    g_object_unref(task);
+}
+
+// Paginates, then draws pages until the deadline, then writes the file
+static gboolean pdf_export_slice(G_GNUC_UNUSED SchedulerJob *job, gint64 deadline_us, gpointer user_data) {
+    GTask *task = user_data;
+    PdfExport *export = g_task_get_task_data(task);
+    if (g_task_return_error_if_cancelled(task)) return FALSE;
+
+    if (!print_pages_paginate(export->pages, deadline_us)) {
+        if (export->progress) {
+            export->progress(0.5 * print_pages_get_progress(export->pages), export->user_data);
+        }
+        return TRUE;
+    }
+
+    // Pagination may have used up the slice; the pages then wait for the next one
+    guint n_pages = print_pages_get_n_pages(export->pages);
+    while (export->next_page < n_pages && g_get_monotonic_time() < deadline_us) {
+        cairo_save(export->cr);
+        cairo_translate(export->cr, export->left_margin, export->top_margin);
+        print_pages_draw(export->pages, export->next_page, export->cr);
+        cairo_restore(export->cr);
+        cairo_show_page(export->cr);
+        export->next_page++;
+    }
+    if (export->progress) {
+        export->progress(0.5 + 0.5 * export->next_page / n_pages, export->user_data);
+    }
+    if (export->next_page < n_pages) return TRUE;
+
+    g_clear_pointer(&export->cr, cairo_destroy);
+    cairo_surface_finish(export->surface);
+    cairo_status_t status = cairo_surface_status(export->surface);
+    if (status != CAIRO_STATUS_SUCCESS) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to write PDF: %s",
+                                cairo_status_to_string(status));
+        return FALSE;
+    }
+    GBytes *bytes = g_byte_array_free_to_bytes(g_steal_pointer(&export->pdf));
+    g_file_replace_contents_bytes_async(G_FILE(g_task_get_source_object(task)), bytes, NULL, FALSE,
+                                        G_FILE_CREATE_REPLACE_DESTINATION, g_task_get_cancellable(task),
+                                        on_pdf_written, g_object_ref(task));
+    g_bytes_unref(bytes);
+    return FALSE;
+}
+
+void document_print_export_pdf_async(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable,
+                                     DocumentIoProgressFunc progress, GAsyncReadyCallback callback,
+                                     gpointer user_data) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(G_IS_FILE(file));
+
+    GtkPageSetup *setup = get_page_setup();
+    PdfExport *export = g_new0(PdfExport, 1);
+    export->pages = print_pages_new(buffer, gtk_page_setup_get_page_width(setup, GTK_UNIT_POINTS),
+                                    gtk_page_setup_get_page_height(setup, GTK_UNIT_POINTS));
+    export->pdf = g_byte_array_new();
+    export->surface = cairo_pdf_surface_create_for_stream(pdf_write, export->pdf,
+                                                          gtk_page_setup_get_paper_width(setup, GTK_UNIT_POINTS),
+                                                          gtk_page_setup_get_paper_height(setup, GTK_UNIT_POINTS));
+    export->cr = cairo_create(export->surface);
+    export->left_margin = gtk_page_setup_get_left_margin(setup, GTK_UNIT_POINTS);
+    export->top_margin = gtk_page_setup_get_top_margin(setup, GTK_UNIT_POINTS);
+    export->progress = progress;
+    export->user_data = user_data;
+    g_object_unref(setup);
+
+    GTask *task = g_task_new(file, cancellable, callback, user_data);
+    g_task_set_source_tag(task, document_print_export_pdf_async);
+    g_task_set_task_data(task, export, pdf_export_free);
+    // Edits during the export only restart the reading of the lines they touch, not the job
+    scheduler_add_slice(NULL, SCHEDULER_LANE_BACKGROUND, pdf_export_slice, task, g_object_unref);
+}
+
+gboolean document_print_export_pdf_finish(GAsyncResult *result, GError **error) {
+    g_return_val_if_fail(g_task_is_valid(result, NULL), FALSE);
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
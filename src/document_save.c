@@ -0,0 +1,139 @@
+#include "document_save.h"
+#include "export_cache.h"
+#include "file_monitor.h"
+#include "format_mask.h"
+#include "markdown_paste.h"
+#include "perf_policy.h"
+#include "perf_trace.h"
+#include "scheduler.h"
+
+#define DOCUMENT_SAVE_KEY "gtktext-document-save"
+
+typedef struct {
+    GFile *file;
+    guint autosave_id;   // Waiting for the autosave delay
+    guint autosave_job;  // Waiting on the scheduler's background lane
+} DocumentSave;
+
+static void document_save_free(gpointer data) {
+    DocumentSave *save = data;
+    g_clear_handle_id(&save->autosave_id, g_source_remove);
+    g_clear_handle_id(&save->autosave_job, scheduler_cancel);
+    g_object_unref(save->file);
+    g_free(save);
+}
+
+static void abort_save(GFileOutputStream *stream) {
+    // Closing with a cancelled cancellable drops the temporary file and keeps the old document
+    GCancellable *abort = g_cancellable_new();
+    g_cancellable_cancel(abort);
+    g_output_stream_close(G_OUTPUT_STREAM(stream), abort, NULL);
+    g_object_unref(abort);
+}
+
+void document_save_now(GtkTextBuffer *buffer) {
+    DocumentSave *save = g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY);
+    g_return_if_fail(save != NULL);
+
+    // Not timed: a save that writes nothing would pull the adaptive autosave delay down
+    const gchar *saved_digest = export_cache_get_saved_digest(buffer);
+    if (saved_digest && g_strcmp0(saved_digest, export_cache_get_written_digest(buffer)) == 0) {
+        return;
+    }
+    PerfSpan span = perf_span_begin(PERF_OP_SAVE);
+
+    g_autofree gchar *filename = g_file_get_parse_name(save->file);
+    g_autofree gchar *digest = NULL;
+    GError *error = NULL;
+
+    GFileOutputStream *stream = g_file_replace(save->file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+    if (stream && export_cache_write(buffer, G_OUTPUT_STREAM(stream), &digest, NULL, &error)) {
+        if (digest && g_strcmp0(digest, export_cache_get_saved_digest(buffer)) == 0) {
+            abort_save(stream); // Same Markdown as on disk
+            export_cache_set_saved_digest(buffer, digest);
+        } else if (g_output_stream_close(G_OUTPUT_STREAM(stream), NULL, &error)) {
+            g_print("Buffer content saved as markdown to %s using cmark\n", filename);
+            export_cache_set_saved_digest(buffer, digest);
+        }
+    }
+    if (error) {
+        g_warning("Error saving file: %s", error->message);
+        g_clear_error(&error);
+        if (stream && !g_output_stream_is_closed(G_OUTPUT_STREAM(stream))) {
+            abort_save(stream);
+        }
+    }
+    g_clear_object(&stream);
+    perf_span_end(&span);
+}
+
+static gboolean autosave_slice(G_GNUC_UNUSED SchedulerJob *job, G_GNUC_UNUSED gint64 deadline_us,
+                               gpointer user_data) {
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(user_data);
+    DocumentSave *save = g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY);
+    save->autosave_job = 0;
+    // A paste being inserted schedules the autosave again with its last piece
+    if (markdown_paste_is_pending(buffer)) return FALSE;
+    document_save_now(buffer);
+    return FALSE;
+}
+
+// The save itself waits behind visible work; an edit before it runs drops it and restarts the delay
+static gboolean autosave_timeout(gpointer user_data) {
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(user_data);
+    DocumentSave *save = g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY);
+    save->autosave_id = 0;
+    scheduler_cancel(save->autosave_job);
+    save->autosave_job = scheduler_add_slice(buffer, SCHEDULER_LANE_BACKGROUND, autosave_slice,
+                                             g_object_ref(buffer), g_object_unref);
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_autosave(GtkTextBuffer *buffer, DocumentSave *save) {
+    g_clear_handle_id(&save->autosave_id, g_source_remove);
+    save->autosave_id = g_timeout_add_full(G_PRIORITY_DEFAULT_IDLE, perf_policy_get_autosave_delay(),
+                                           autosave_timeout, g_object_ref(buffer), g_object_unref);
+}
+
+static void on_text_changed(GtkTextBuffer *buffer, gpointer user_data) {
+    // Changes applied from the file on disk don't need saving
+    if (file_monitor_is_reloading(buffer)) return;
+    schedule_autosave(buffer, user_data);
+}
+
+// Formatting from the toolbar only changes tags, which doesn't emit "changed"
+static void on_format_tag_changed(GtkTextBuffer *buffer, GtkTextTag *tag,
+                                  G_GNUC_UNUSED GtkTextIter *start, G_GNUC_UNUSED GtkTextIter *end,
+                                  gpointer user_data) {
+    if (file_monitor_is_reloading(buffer) || format_bit_from_tag(tag) < 0) return;
+    schedule_autosave(buffer, user_data);
+}
+
+void document_save_attach(GtkTextBuffer *buffer, GFile *file) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(G_IS_FILE(file));
+    g_return_if_fail(g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY) == NULL);
+
+    DocumentSave *save = g_new0(DocumentSave, 1);
+    save->file = g_object_ref(file);
+    g_object_set_data_full(G_OBJECT(buffer), DOCUMENT_SAVE_KEY, save, document_save_free);
+    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), save);
+    g_signal_connect_after(buffer, "apply-tag", G_CALLBACK(on_format_tag_changed), save);
+    g_signal_connect_after(buffer, "remove-tag", G_CALLBACK(on_format_tag_changed), save);
+}
+
+void document_save_set_file(GtkTextBuffer *buffer, GFile *file) {
+    DocumentSave *save = g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY);
+    g_return_if_fail(save != NULL);
+    g_return_if_fail(G_IS_FILE(file));
+    g_set_object(&save->file, file);
+}
+
+void document_save_flush(GtkTextBuffer *buffer) {
+    DocumentSave *save = g_object_get_data(G_OBJECT(buffer), DOCUMENT_SAVE_KEY);
+    g_return_if_fail(save != NULL);
+    g_clear_handle_id(&save->autosave_id, g_source_remove);
+    g_clear_handle_id(&save->autosave_job, scheduler_cancel);
+    markdown_paste_flush(buffer);
+    document_save_now(buffer);
+}
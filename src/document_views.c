@@ -0,0 +1,153 @@
+#include "document_views.h"
+
+#define DOCUMENT_VIEW_KEY "gtktext-document-view"
+
+typedef struct {
+    GtkTextView *view;       // Not owned; the state is view data
+    GtkTextBuffer *buffer;
+    GtkTextMark *insert;     // The view's cursor and selection while another view has focus
+    GtkTextMark *selection;
+    GtkTextMark *top;        // First visible line while the buffer is being replaced, or NULL
+} DocumentView;
+
+static GList *document_views = NULL;
+
+static void document_view_detach_buffer(DocumentView *dv) {
+    if (!dv->buffer) return;
+    gtk_text_buffer_delete_mark(dv->buffer, dv->insert);
+    gtk_text_buffer_delete_mark(dv->buffer, dv->selection);
+    if (dv->top) gtk_text_buffer_delete_mark(dv->buffer, dv->top);
+    dv->insert = NULL;
+    dv->selection = NULL;
+    dv->top = NULL;
+    g_clear_object(&dv->buffer);
+}
+
+static void document_view_set_buffer(DocumentView *dv, GtkTextBuffer *buffer) {
+    document_view_detach_buffer(dv);
+    if (!buffer) return;
+
+    dv->buffer = g_object_ref(buffer);
+    GtkTextIter insert, selection;
+    gtk_text_buffer_get_iter_at_mark(buffer, &insert, gtk_text_buffer_get_insert(buffer));
+    gtk_text_buffer_get_iter_at_mark(buffer, &selection, gtk_text_buffer_get_selection_bound(buffer));
+    dv->insert = gtk_text_buffer_create_mark(buffer, NULL, &insert, FALSE);
+    dv->selection = gtk_text_buffer_create_mark(buffer, NULL, &selection, FALSE);
+}
+
+static void on_view_buffer_changed(GtkTextView *view, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+    document_view_set_buffer(user_data, gtk_text_view_get_buffer(view));
+}
+
+static void on_focus_enter(G_GNUC_UNUSED GtkEventControllerFocus *controller, gpointer user_data) {
+    DocumentView *dv = user_data;
+    if (!dv->buffer) return;
+    GtkTextIter insert, selection;
+    gtk_text_buffer_get_iter_at_mark(dv->buffer, &insert, dv->insert);
+    gtk_text_buffer_get_iter_at_mark(dv->buffer, &selection, dv->selection);
+    gtk_text_buffer_select_range(dv->buffer, &insert, &selection);
+}
+
+// The buffer keeps the selection, so commands that act on it still see this view's
+static void on_focus_leave(G_GNUC_UNUSED GtkEventControllerFocus *controller, gpointer user_data) {
+    DocumentView *dv = user_data;
+    if (!dv->buffer) return;
+    GtkTextIter insert, selection;
+    gtk_text_buffer_get_iter_at_mark(dv->buffer, &insert, gtk_text_buffer_get_insert(dv->buffer));
+    gtk_text_buffer_get_iter_at_mark(dv->buffer, &selection, gtk_text_buffer_get_selection_bound(dv->buffer));
+    gtk_text_buffer_move_mark(dv->buffer, dv->insert, &insert);
+    gtk_text_buffer_move_mark(dv->buffer, dv->selection, &selection);
+}
+
+static void document_view_free(gpointer data) {
+    DocumentView *dv = data;
+    document_view_detach_buffer(dv);
+    document_views = g_list_remove(document_views, dv);
+    g_free(dv);
+}
+
+void document_views_add(GtkTextView *view) {
+    g_return_if_fail(GTK_IS_TEXT_VIEW(view));
+    if (g_object_get_data(G_OBJECT(view), DOCUMENT_VIEW_KEY)) return;
+
+    DocumentView *dv = g_new0(DocumentView, 1);
+    dv->view = view;
+    document_views = g_list_prepend(document_views, dv);
+    g_object_set_data_full(G_OBJECT(view), DOCUMENT_VIEW_KEY, dv, document_view_free);
+    g_signal_connect(view, "notify::buffer", G_CALLBACK(on_view_buffer_changed), dv);
+
+    GtkEventController *focus = gtk_event_controller_focus_new();
+    g_signal_connect(focus, "enter", G_CALLBACK(on_focus_enter), dv);
+    g_signal_connect(focus, "leave", G_CALLBACK(on_focus_leave), dv);
+    gtk_widget_add_controller(GTK_WIDGET(view), focus);
+
+    document_view_set_buffer(dv, gtk_text_view_get_buffer(view));
+}
+
+void document_views_set_buffer(GtkTextBuffer *old_buffer, GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    // Setting a buffer changes the list entry, not the list
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        if (dv->buffer == old_buffer) {
+            gtk_text_view_set_buffer(dv->view, buffer);
+        }
+    }
+}
+
+void document_views_set_editable(GtkTextBuffer *buffer, gboolean editable) {
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        if (dv->buffer == buffer) {
+            gtk_text_view_set_editable(dv->view, editable);
+        }
+    }
+}
+
+void document_views_set_monospace(GtkTextBuffer *buffer, gboolean monospace) {
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        if (dv->buffer == buffer) {
+            gtk_text_view_set_monospace(dv->view, monospace);
+        }
+    }
+}
+
+void document_views_keep_scroll(GtkTextBuffer *buffer) {
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        if (dv->buffer != buffer) continue;
+        GdkRectangle visible;
+        GtkTextIter top;
+        gtk_text_view_get_visible_rect(dv->view, &visible);
+        gtk_text_view_get_line_at_y(dv->view, &top, visible.y, NULL);
+        if (dv->top) {
+            gtk_text_buffer_move_mark(buffer, dv->top, &top);
+        } else {
+            // Left gravity: a replaced first line leaves the mark where its replacement starts
+            dv->top = gtk_text_buffer_create_mark(buffer, NULL, &top, TRUE);
+        }
+    }
+}
+
+void document_views_restore_scroll(GtkTextBuffer *buffer) {
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        if (dv->buffer != buffer || !dv->top) continue;
+        gtk_text_view_scroll_to_mark(dv->view, dv->top, 0.0, TRUE, 0.0, 0.0);
+        gtk_text_buffer_delete_mark(buffer, dv->top);
+        dv->top = NULL;
+    }
+}
+
+gboolean document_views_shown_elsewhere(GtkTextBuffer *buffer, GtkWindow *window) {
+    for (GList *l = document_views; l; l = l->next) {
+        DocumentView *dv = l->data;
+        GtkRoot *root = gtk_widget_get_root(GTK_WIDGET(dv->view));
+        // A view that is being destroyed has no root
+        if (dv->buffer == buffer && root && root != GTK_ROOT(window)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
@@ -0,0 +1,423 @@
+#include "export_cache.h"
+#include "gtktext_cmark.h"
+#include "format_mask.h"
+#include "md_export.h"
+#include "md_hash_stream.h"
+#include "perf_trace.h"
+#include <string.h>
+
+#define EXPORT_CACHE_KEY "gtktext-export-cache"
+
+// Exported Markdown of one buffer line and the exporter context it was made in
+typedef struct {
+    gboolean dirty;
+    MdExportState entry_state;
+    MdExportState exit_state;
+    gboolean entry_empty;                 // Nothing had been written before the line
+    char entry_tail[MD_WRITER_TAIL];      // Last bytes written before the line, 1 = last
+    guint dropped;                        // Bytes of earlier output the line removed
+    gsize len;
+    glong n_chars;                        // Characters in markdown
+    char *markdown;
+} ExportCacheLine;
+
+typedef struct {
+    GSequence *lines;  // One ExportCacheLine per buffer line
+    gchar *saved_digest;
+    ExportCacheChangeFunc change_func;
+    gpointer change_data;
+    gboolean written;                     // A write has finished since the lines were last reset
+    MdExportState final_state;            // State the last write finished in
+    gboolean changed;                     // Edited since the last write
+    gboolean modified;                    // Edited since the saved digest was set
+    gchar *written_digest;                // Of the last write's Markdown
+} ExportCache;
+
+// Builds the change reported to the change function during a write
+typedef struct {
+    GString *text;          // From the start of the change; NULL until a line is exported again
+    GArray *line_starts;    // gint, character offset in text where each line's Markdown starts
+    gint first_line;
+    gint start;             // Characters before text
+    gint chars;             // Characters written so far, while text is NULL
+    gint text_chars;        // Characters in text
+    GSequenceIter *pending; // First reused line after the last one exported again, or NULL
+    gint pending_chars;     // Characters the pending lines add, net of what they drop
+    guint pending_overflow; // Bytes the pending lines drop from text
+} ExportCacheTracker;
+
+static ExportCacheLine *export_cache_line_new(void) {
+    ExportCacheLine *line = g_new0(ExportCacheLine, 1);
+    line->dirty = TRUE;
+    return line;
+}
+
+static void export_cache_line_free(gpointer data) {
+    ExportCacheLine *line = data;
+    g_free(line->markdown);
+    g_free(line);
+}
+
+static void export_cache_free(gpointer data) {
+    ExportCache *cache = data;
+    g_sequence_free(cache->lines);
+    g_free(cache->saved_digest);
+    g_free(cache->written_digest);
+    g_free(cache);
+}
+
+static void export_cache_reset(ExportCache *cache, gint line_count) {
+    g_sequence_remove_range(g_sequence_get_begin_iter(cache->lines), g_sequence_get_end_iter(cache->lines));
+    for (gint i = 0; i < line_count; i++) {
+        g_sequence_append(cache->lines, export_cache_line_new());
+    }
+    cache->written = FALSE;
+    cache->changed = TRUE;
+}
+
+static void export_cache_mark_dirty(ExportCache *cache, gint first_line, gint last_line) {
+    cache->changed = TRUE;
+    cache->modified = TRUE;
+    GSequenceIter *it = g_sequence_get_iter_at_pos(cache->lines, first_line);
+    for (gint line = first_line; line <= last_line && !g_sequence_iter_is_end(it); line++) {
+        ExportCacheLine *entry = g_sequence_get(it);
+        entry->dirty = TRUE;
+        it = g_sequence_iter_next(it);
+    }
+}
+
+// Counts line breaks the way GtkTextBuffer does: \n, \r, \r\n and U+2029
+static gint count_line_breaks(const gchar *text, gint len) {
+    gint breaks = 0;
+    for (gint i = 0; i < len; i++) {
+        if (text[i] == '\r') {
+            breaks++;
+            if (i + 1 < len && text[i + 1] == '\n') i++;
+        } else if (text[i] == '\n') {
+            breaks++;
+        } else if ((guchar)text[i] == 0xE2 && i + 2 < len &&
+                   (guchar)text[i + 1] == 0x80 && (guchar)text[i + 2] == 0xA9) {
+            breaks++;
+            i += 2;
+        }
+    }
+    return breaks;
+}
+
+// The line lists are updated before GTK applies an edit, because "changed" (and so a
+// save) is emitted from within the default handler. A break that merges with a \r
+// already in the buffer miscounts; export_cache_write() then sees a line count
+// mismatch and starts over.
+static void on_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer user_data) {
+    ExportCache *cache = user_data;
+    gint line = gtk_text_iter_get_line(location);
+    export_cache_mark_dirty(cache, line, line);
+
+    gint added = count_line_breaks(text, len);
+    if (added > 0) {
+        GSequenceIter *next = g_sequence_iter_next(g_sequence_get_iter_at_pos(cache->lines, line));
+        for (gint i = 0; i < added; i++) {
+            g_sequence_insert_before(next, export_cache_line_new());
+        }
+    }
+}
+
+static void on_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                            GtkTextIter *end, gpointer user_data) {
+    ExportCache *cache = user_data;
+    gint first_line = gtk_text_iter_get_line(start);
+    gint last_line = gtk_text_iter_get_line(end);
+    if (first_line > last_line) {
+        gint swap = first_line;
+        first_line = last_line;
+        last_line = swap;
+    }
+
+    export_cache_mark_dirty(cache, first_line, first_line);
+    if (last_line > first_line) {
+        g_sequence_remove_range(g_sequence_get_iter_at_pos(cache->lines, first_line + 1),
+                                g_sequence_get_iter_at_pos(cache->lines, last_line + 1));
+    }
+}
+
+static void on_tag_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextTag *tag,
+                           GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    // Spell checking and other view-only tags don't change the Markdown
+    if (format_bit_from_tag(tag) < 0) return;
+
+    ExportCache *cache = user_data;
+    gint first_line = gtk_text_iter_get_line(start);
+    gint last_line = gtk_text_iter_get_line(end);
+    export_cache_mark_dirty(cache, MIN(first_line, last_line), MAX(first_line, last_line));
+}
+
+void export_cache_attach(GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    if (g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY)) return;
+
+    ExportCache *cache = g_new0(ExportCache, 1);
+    cache->lines = g_sequence_new(export_cache_line_free);
+    export_cache_reset(cache, gtk_text_buffer_get_line_count(buffer));
+    g_object_set_data_full(G_OBJECT(buffer), EXPORT_CACHE_KEY, cache, export_cache_free);
+
+    // Handlers run before the default ones, while the iterators still describe the old text
+    g_signal_connect(buffer, "insert-text", G_CALLBACK(on_insert_text), cache);
+    g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range), cache);
+    g_signal_connect(buffer, "apply-tag", G_CALLBACK(on_tag_changed), cache);
+    g_signal_connect(buffer, "remove-tag", G_CALLBACK(on_tag_changed), cache);
+}
+
+static gboolean export_cache_line_matches(const ExportCacheLine *entry, MdExportState state, const MdWriter *md) {
+    if (entry->dirty || entry->entry_state != state || entry->entry_empty != (md->total_len == 0)) {
+        return FALSE;
+    }
+    for (gsize back = 1; back <= MD_WRITER_TAIL; back++) {
+        if (entry->entry_tail[back - 1] != md_writer_last_char(md, back)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void export_cache_line_store(ExportCacheLine *entry, MdExportState state, const MdWriter *md) {
+    entry->entry_state = state;
+    entry->entry_empty = (md->total_len == 0);
+    for (gsize back = 1; back <= MD_WRITER_TAIL; back++) {
+        entry->entry_tail[back - 1] = md_writer_last_char(md, back);
+    }
+}
+
+// A line whose Markdown is reused, as it was in the last write
+static void tracker_reuse(ExportCacheTracker *tracker, GSequenceIter *it, const ExportCacheLine *entry) {
+    if (!tracker->text) {
+        tracker->chars += (gint)entry->n_chars - (gint)entry->dropped;
+        return;
+    }
+    if (!tracker->pending) {
+        tracker->pending = it;
+        tracker->pending_chars = 0;
+        tracker->pending_overflow = 0;
+    }
+    // Dropped bytes are newlines, one character each
+    gint take = MIN((gint)entry->dropped, tracker->pending_chars);
+    tracker->pending_chars += (gint)entry->n_chars - take;
+    tracker->pending_overflow += entry->dropped - (guint)take;
+}
+
+// Appends a line's Markdown to the change, after removing what it drops
+static void tracker_append(ExportCacheTracker *tracker, const ExportCacheLine *entry) {
+    guint drop = MIN(entry->dropped, (guint)tracker->text->len);
+    g_string_truncate(tracker->text, tracker->text->len - drop);
+    tracker->text_chars -= (gint)drop;
+    g_array_append_val(tracker->line_starts, tracker->text_chars);
+    g_string_append_len(tracker->text, entry->markdown, (gssize)entry->len);
+    tracker->text_chars += (gint)entry->n_chars;
+}
+
+// Moves the pending lines before end into the change
+static void tracker_flush(ExportCacheTracker *tracker, GSequenceIter *end) {
+    for (GSequenceIter *it = tracker->pending; it && it != end; it = g_sequence_iter_next(it)) {
+        tracker_append(tracker, g_sequence_get(it));
+    }
+    tracker->pending = NULL;
+}
+
+// Called before a line is exported again
+static void tracker_begin_line(ExportCacheTracker *tracker, GSequenceIter *it, gint line, const MdWriter *md) {
+    if (tracker->text) {
+        tracker_flush(tracker, it);
+        return;
+    }
+    // The line may drop newlines written before it, so the change starts before them
+    gint back = 0;
+    while (back < MD_WRITER_TAIL && back < tracker->chars && md_writer_last_char(md, (gsize)back + 1) == '\n') {
+        back++;
+    }
+    tracker->text = g_string_new(NULL);
+    tracker->line_starts = g_array_new(FALSE, FALSE, sizeof(gint));
+    tracker->first_line = line;
+    tracker->start = tracker->chars - back;
+    for (gint i = 0; i < back; i++) {
+        g_string_append_c(tracker->text, '\n');
+    }
+    tracker->text_chars = back;
+}
+
+// Reports the change a finished write made; finish is what md_export_finish() wrote
+static void tracker_report(ExportCache *cache, GtkTextBuffer *buffer, ExportCacheTracker *tracker,
+                           MdExportState state, const GByteArray *finish, gint line_count) {
+    gboolean same_end = cache->written && state == cache->final_state;
+    ExportCacheChange change = { 0 };
+    if (tracker->text) {
+        if (same_end && tracker->pending) {
+            // The lines after the last one exported again, and what closes the document, are unchanged
+            g_string_truncate(tracker->text, tracker->text->len - MIN(tracker->pending_overflow, tracker->text->len));
+            change.suffix = tracker->pending_chars + (gint)g_utf8_strlen((const gchar *)finish->data, finish->len);
+        } else {
+            tracker_flush(tracker, NULL);
+            g_string_append_len(tracker->text, (const gchar *)finish->data, finish->len);
+        }
+        change.start = tracker->start;
+        change.text = tracker->text->str;
+        change.length = tracker->text->len;
+        change.first_line = tracker->first_line;
+        change.n_lines = tracker->line_starts->len;
+        change.line_starts = (const gint *)(void *)tracker->line_starts->data;
+    } else if (!same_end) {
+        // Only what closes the document changed
+        change.start = tracker->chars;
+        change.text = (const gchar *)finish->data;
+        change.length = finish->len;
+        change.first_line = line_count;
+    }
+    cache->change_func(buffer, (tracker->text || !same_end) ? &change : NULL, cache->change_data);
+}
+
+gboolean export_cache_write(GtkTextBuffer *buffer, GOutputStream *stream, gchar **digest,
+                            GCancellable *cancellable, GError **error) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), FALSE);
+
+    if (digest) *digest = NULL;
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    if (!cache) {
+        return export_buffer_to_stream_cmark(buffer, stream, cancellable, error);
+    }
+
+    gint line_count = gtk_text_buffer_get_line_count(buffer);
+    if (g_sequence_get_length(cache->lines) != line_count) {
+        g_debug("export_cache: %d cached lines for %d buffer lines, starting over",
+                g_sequence_get_length(cache->lines), line_count);
+        export_cache_reset(cache, line_count);
+    }
+
+    PerfSpan span = perf_span_begin(PERF_OP_EXPORT);
+    MdWriter md;
+    md_writer_init(&md, stream, cancellable);
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    md.checksum = checksum;
+    GByteArray *capture = g_byte_array_new();
+    MdExportState state = 0;
+    GtkTextIter iter;
+    gint iter_line = -1;  // Line iter is at, if it is still valid
+    gint line = 0;
+    ExportCacheTracker tracker = { 0 };
+    gboolean track = (cache->change_func != NULL);
+
+    for (GSequenceIter *it = g_sequence_get_begin_iter(cache->lines);
+         !g_sequence_iter_is_end(it) && !md.error;
+         it = g_sequence_iter_next(it), line++) {
+        ExportCacheLine *entry = g_sequence_get(it);
+
+        if (export_cache_line_matches(entry, state, &md)) {
+            for (guint i = 0; i < entry->dropped; i++) {
+                md_writer_truncate_last(&md);
+            }
+            md_writer_append_len(&md, entry->markdown, entry->len);
+            state = entry->exit_state;
+            if (track) tracker_reuse(&tracker, it, entry);
+            continue;
+        }
+        if (track) tracker_begin_line(&tracker, it, line, &md);
+
+        if (iter_line != line) {
+            gtk_text_buffer_get_iter_at_line(buffer, &iter, line);
+        }
+        export_cache_line_store(entry, state, &md);
+        md_writer_begin_capture(&md, capture);
+        // A \r\n split by the exporter's line-end check takes two calls
+        do {
+            md_export_line(buffer, &iter, &state, &md);
+        } while (!gtk_text_iter_is_end(&iter) && !gtk_text_iter_starts_line(&iter));
+        entry->dropped = md_writer_end_capture(&md);
+        entry->exit_state = state;
+        g_free(entry->markdown);
+        entry->len = capture->len;
+        entry->markdown = g_memdup2(capture->data, capture->len);
+        entry->n_chars = g_utf8_strlen(entry->markdown, (gssize)entry->len);
+        entry->dirty = FALSE;
+        g_byte_array_set_size(capture, 0);
+        iter_line = line + 1;
+        if (track) tracker_append(&tracker, entry);
+    }
+    if (track) md_writer_begin_capture(&md, capture);
+    md_export_finish(state, &md);
+    if (track) md_writer_end_capture(&md);
+
+    gboolean ok = md_writer_finish(&md, error);
+    if (track) {
+        if (ok) {
+            tracker_report(cache, buffer, &tracker, state, capture, line_count);
+        } else {
+            // Lines may be cached that were never reported; the next write reports everything
+            export_cache_reset(cache, line_count);
+        }
+        if (tracker.text) {
+            g_string_free(tracker.text, TRUE);
+            g_array_unref(tracker.line_starts);
+        }
+    }
+    if (ok) {
+        cache->written = TRUE;
+        cache->final_state = state;
+        cache->changed = FALSE;
+        g_free(cache->written_digest);
+        cache->written_digest = g_strdup(g_checksum_get_string(checksum));
+        if (digest) *digest = g_strdup(cache->written_digest);
+    }
+    g_checksum_free(checksum);
+    g_byte_array_unref(capture);
+    perf_span_end(&span);
+    return ok;
+}
+
+const gchar *export_cache_get_written_digest(GtkTextBuffer *buffer) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    return cache && !cache->changed ? cache->written_digest : NULL;
+}
+
+gchar *export_cache_compute_digest(GtkTextBuffer *buffer) {
+    const gchar *written = export_cache_get_written_digest(buffer);
+    if (written) return g_strdup(written);
+
+    GOutputStream *hash_stream = md_hash_output_stream_new(G_CHECKSUM_SHA256);
+    gchar *digest = NULL;
+    // The hash stream never fails a write
+    if (export_cache_write(buffer, hash_stream, NULL, NULL, NULL)) {
+        digest = g_strdup(md_hash_output_stream_get_digest(MD_HASH_OUTPUT_STREAM(hash_stream)));
+    }
+    g_object_unref(hash_stream);
+    return digest;
+}
+
+void export_cache_set_saved_digest(GtkTextBuffer *buffer, const gchar *digest) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    g_return_if_fail(cache != NULL);
+    g_free(cache->saved_digest);
+    cache->saved_digest = g_strdup(digest);
+    cache->modified = FALSE;
+}
+
+const gchar *export_cache_get_saved_digest(GtkTextBuffer *buffer) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    return cache ? cache->saved_digest : NULL;
+}
+
+gboolean export_cache_is_modified(GtkTextBuffer *buffer) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    return cache && cache->modified;
+}
+
+void export_cache_set_change_func(GtkTextBuffer *buffer, ExportCacheChangeFunc func, gpointer user_data) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    g_return_if_fail(cache != NULL);
+    cache->change_func = func;
+    cache->change_data = user_data;
+}
+
+void export_cache_invalidate(GtkTextBuffer *buffer) {
+    ExportCache *cache = g_object_get_data(G_OBJECT(buffer), EXPORT_CACHE_KEY);
+    g_return_if_fail(cache != NULL);
+    export_cache_reset(cache, gtk_text_buffer_get_line_count(buffer));
+}
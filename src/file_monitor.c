@@ -0,0 +1,246 @@
+#include "file_monitor.h"
+#include "document_views.h"
+#include "export_cache.h"
+#include "gtktext_cmark.h"
+#include "parallel_parse.h"
+#include "text_scan.h"
+#include "perf_trace.h"
+#include "render_plan.h"
+
+#define FILE_MONITOR_KEY "gtktext-file-monitor"
+// One write shows up as several events; they are merged into one reload
+#define FILE_MONITOR_DEBOUNCE_MS 100
+
+typedef struct {
+    GtkTextBuffer *buffer;      // Not owned; the monitor is buffer data
+    GFile *file;
+    GFileMonitor *monitor;
+    GCancellable *cancellable;  // Reload in progress, if any
+    guint debounce_id;
+    gchar *disk_digest;         // Digest of the file as last loaded or reloaded
+    gboolean reloading;
+} FileMonitor;
+
+// Owned by the reload task; the digests are copied so the worker never touches the buffer
+typedef struct {
+    GFile *file;
+    gchar *saved_digest;  // Export cache digest when the reload started
+    gchar *disk_digest;
+    gchar *digest;        // Digest of what the worker read
+    gchar *export_digest; // Digest of the Markdown the parsed plan exports to
+} ReloadJob;
+
+static void reload_job_free(gpointer data) {
+    ReloadJob *job = data;
+    g_object_unref(job->file);
+    g_free(job->saved_digest);
+    g_free(job->disk_digest);
+    g_free(job->digest);
+    g_free(job->export_digest);
+    g_free(job);
+}
+
+static void file_monitor_free(gpointer data) {
+    FileMonitor *monitor = data;
+    if (monitor->cancellable) {
+        g_cancellable_cancel(monitor->cancellable);
+        g_object_unref(monitor->cancellable);
+    }
+    if (monitor->debounce_id) {
+        g_source_remove(monitor->debounce_id);
+    }
+    g_signal_handlers_disconnect_by_data(monitor->monitor, monitor);
+    g_file_monitor_cancel(monitor->monitor);
+    g_object_unref(monitor->monitor);
+    g_object_unref(monitor->file);
+    g_free(monitor->disk_digest);
+    g_free(monitor);
+}
+
+// Runs on a worker thread: read, then parse into a snapshot
+static void reload_thread(GTask *task, G_GNUC_UNUSED gpointer source_object,
+                          gpointer task_data, GCancellable *cancellable) {
+    ReloadJob *job = task_data;
+    GError *error = NULL;
+    gchar *contents = NULL;
+    gsize length = 0;
+
+    if (!g_file_load_contents(job->file, cancellable, &contents, &length, NULL, &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    // Our own save, or a write that didn't change anything
+    job->digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)contents, length);
+    if (g_strcmp0(job->digest, job->saved_digest) == 0 || g_strcmp0(job->digest, job->disk_digest) == 0) {
+        g_free(contents);
+        g_task_return_pointer(task, NULL, NULL);
+        return;
+    }
+    TextLineIndex *lines = NULL;
+    if (!text_scan(contents, &length, &lines, &error)) {
+        g_free(contents);
+        g_task_return_error(task, error);
+        return;
+    }
+
+    PerfSpan span = perf_span_begin(PERF_OP_IMPORT);
+    RenderPlan *plan = parallel_parse_markdown(contents, lines, 0);
+    perf_span_end(&span);
+    text_line_index_free(lines);
+    g_free(contents);
+    if (!plan) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to import markdown");
+        return;
+    }
+    // What saving the reloaded buffer would write, hashed here rather than
+    // exporting the buffer again on the main thread
+    gchar *markdown = export_plan_to_markdown_cmark(plan);
+    job->export_digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, markdown, -1);
+    g_free(markdown);
+    if (g_task_return_error_if_cancelled(task)) {
+        render_plan_free(plan);
+        return;
+    }
+    g_task_return_pointer(task, plan, (GDestroyNotify)render_plan_free);
+}
+
+static void reload_done(GObject *source_object, GAsyncResult *result, G_GNUC_UNUSED gpointer user_data) {
+    GtkTextBuffer *buffer = GTK_TEXT_BUFFER(source_object);
+    FileMonitor *monitor = g_object_get_data(source_object, FILE_MONITOR_KEY);
+    GTask *task = G_TASK(result);
+    ReloadJob *job = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    RenderPlan *plan = g_task_propagate_pointer(task, &error);
+    if (monitor && monitor->cancellable == g_task_get_cancellable(task)) {
+        g_clear_object(&monitor->cancellable);
+    }
+    if (error) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+            !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+            g_warning("Error reloading file: %s", error->message);
+        }
+        g_clear_error(&error);
+        return;
+    }
+    // Nothing new on disk, or the buffer has since been attached to another file
+    if (!plan || !monitor || !g_file_equal(monitor->file, job->file)) {
+        render_plan_free(plan);
+        return;
+    }
+    // A save since the reload started has already replaced what the worker read
+    if (g_strcmp0(export_cache_get_saved_digest(buffer), job->saved_digest) != 0) {
+        render_plan_free(plan);
+        return;
+    }
+    // Edits still waiting for autosave would be lost; the disk digest is kept,
+    // so the next save writes them over the external change
+    if (export_cache_is_modified(buffer)) {
+        g_autofree gchar *name = g_file_get_parse_name(monitor->file);
+        g_message("%s changed on disk, but has unsaved edits; the next save overwrites the change", name);
+        render_plan_free(plan);
+        return;
+    }
+
+    PerfSpan span = perf_span_begin(PERF_OP_RELOAD);
+    monitor->reloading = TRUE;
+    // Views stay on the text they showed, however many lines above it changed
+    document_views_keep_scroll(buffer);
+    guint replaced = render_plan_apply(plan, buffer);
+    document_views_restore_scroll(buffer);
+    monitor->reloading = FALSE;
+
+    // The buffer shows the file now; only the next edit needs saving
+    g_free(monitor->disk_digest);
+    monitor->disk_digest = g_strdup(job->digest);
+    export_cache_set_saved_digest(buffer, job->export_digest);
+    perf_span_end(&span);
+
+    g_autofree gchar *name = g_file_get_parse_name(monitor->file);
+    g_print("Reloaded %s after an external change: %u of %u lines replaced\n",
+            name, replaced, render_plan_get_n_lines(plan));
+    render_plan_free(plan);
+}
+
+static gboolean start_reload(gpointer user_data) {
+    FileMonitor *monitor = user_data;
+    monitor->debounce_id = 0;
+
+    // A newer change supersedes a reload that hasn't finished
+    if (monitor->cancellable) {
+        g_cancellable_cancel(monitor->cancellable);
+        g_object_unref(monitor->cancellable);
+    }
+    monitor->cancellable = g_cancellable_new();
+
+    ReloadJob *job = g_new0(ReloadJob, 1);
+    job->file = g_object_ref(monitor->file);
+    job->saved_digest = g_strdup(export_cache_get_saved_digest(monitor->buffer));
+    job->disk_digest = g_strdup(monitor->disk_digest);
+
+    // The task keeps the buffer, and with it this monitor, alive until reload_done
+    GTask *task = g_task_new(monitor->buffer, monitor->cancellable, reload_done, NULL);
+    g_task_set_task_data(task, job, reload_job_free);
+    g_task_run_in_thread(task, reload_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_file_changed(G_GNUC_UNUSED GFileMonitor *file_monitor, G_GNUC_UNUSED GFile *file,
+                            GFile *other_file, GFileMonitorEvent event_type, gpointer user_data) {
+    FileMonitor *monitor = user_data;
+
+    switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        // Atomic saves rename a temporary file onto the document
+        if (!other_file || !g_file_equal(other_file, monitor->file)) return;
+        break;
+    default:
+        // Keep the buffer if the file is deleted; the next save writes it again
+        return;
+    }
+
+    if (monitor->debounce_id) {
+        g_source_remove(monitor->debounce_id);
+    }
+    monitor->debounce_id = g_timeout_add(FILE_MONITOR_DEBOUNCE_MS, start_reload, monitor);
+}
+
+void file_monitor_attach(GtkTextBuffer *buffer, GFile *file) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(G_IS_FILE(file));
+
+    GError *error = NULL;
+    GFileMonitor *file_monitor = g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (!file_monitor) {
+        g_warning("Cannot watch for external changes: %s", error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    FileMonitor *monitor = g_new0(FileMonitor, 1);
+    monitor->buffer = buffer;
+    monitor->file = g_object_ref(file);
+    monitor->monitor = file_monitor;
+    monitor->disk_digest = g_strdup(export_cache_get_saved_digest(buffer));
+    g_signal_connect(file_monitor, "changed", G_CALLBACK(on_file_changed), monitor);
+    g_object_set_data_full(G_OBJECT(buffer), FILE_MONITOR_KEY, monitor, file_monitor_free);
+}
+
+void file_monitor_verify(GtkTextBuffer *buffer) {
+    FileMonitor *monitor = g_object_get_data(G_OBJECT(buffer), FILE_MONITOR_KEY);
+    if (!monitor) return;
+    g_clear_handle_id(&monitor->debounce_id, g_source_remove);
+    start_reload(monitor);
+}
+
+gboolean file_monitor_is_reloading(GtkTextBuffer *buffer) {
+    FileMonitor *monitor = g_object_get_data(G_OBJECT(buffer), FILE_MONITOR_KEY);
+    return monitor && monitor->reloading;
+}
@@ -0,0 +1,73 @@
+#include "format_mask.h"
+#include <string.h>
+
+// Tag names as created by cmark.c and cmrender.c; indexed by FormatBit.
+static const char *const format_tag_names[FORMAT_COUNT] = {
+    [FORMAT_BOLD] = "bold",
+    [FORMAT_ITALIC] = "italic",
+    [FORMAT_CODE] = "code",
+    [FORMAT_CODEBLOCK] = "codeblock",
+    [FORMAT_H1] = "h1",
+    [FORMAT_H2] = "h2",
+    [FORMAT_H3] = "h3",
+    [FORMAT_H4] = "h4",
+    [FORMAT_H5] = "h5",
+    [FORMAT_H6] = "h6",
+    [FORMAT_HR] = "hr",
+    [FORMAT_BLOCKQUOTE] = "blockquote",
+};
+
+const char *format_bit_get_tag_name(FormatBit bit) {
+    if ((guint)bit >= FORMAT_COUNT) {
+        return NULL;
+    }
+    return format_tag_names[bit];
+}
+
+int format_bit_from_tag(GtkTextTag *tag) {
+    g_autofree gchar *name = NULL;
+    g_object_get(tag, "name", &name, NULL);
+    if (!name) {
+        return -1;
+    }
+    for (int bit = 0; bit < FORMAT_COUNT; bit++) {
+        if (strcmp(name, format_tag_names[bit]) == 0) {
+            return bit;
+        }
+    }
+    return -1;
+}
+
+void format_tags_lookup(GtkTextBuffer *buffer, FormatTags tags) {
+    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
+    for (guint bit = 0; bit < FORMAT_COUNT; bit++) {
+        tags[bit] = gtk_text_tag_table_lookup(tag_table, format_tag_names[bit]);
+    }
+}
+
+guint32 format_mask_at_iter(const GtkTextIter *iter, FormatTags tags) {
+    guint32 mask = 0;
+    for (guint bit = 0; bit < FORMAT_COUNT; bit++) {
+        if (tags[bit] && gtk_text_iter_has_tag(iter, tags[bit])) {
+            mask |= FORMAT_MASK(bit);
+        }
+    }
+    return mask;
+}
+
+void format_insert_text(GtkTextBuffer *buffer, GtkTextIter *iter, const char *text,
+                        guint32 mask, FormatTags tags) {
+    if (!text || text[0] == '\0') return;
+
+    gint start_offset = gtk_text_iter_get_offset(iter);
+    gtk_text_buffer_insert(buffer, iter, text, -1);
+    if (mask == 0) return;
+
+    GtkTextIter start;
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, start_offset);
+    for (guint bit = 0; mask != 0; bit++, mask >>= 1) {
+        if ((mask & 1u) && tags[bit]) {
+            gtk_text_buffer_apply_tag(buffer, tags[bit], &start, iter);
+        }
+    }
+}
@@ -0,0 +1,378 @@
+#include "live_format.h"
+#include "file_monitor.h"
+#include "format_mask.h"
+#include "gtktext_cmark.h"
+#include "md_escape.h"
+#include "render_plan.h"
+#include "scheduler.h"
+#include <string.h>
+
+#define LIVE_FORMAT_KEY "gtktext-live-format"
+#define LIVE_FORMAT_MAX_CHARS 4096  // Longer paragraphs are left alone, keeping the work per keystroke bounded
+#define LIVE_FORMAT_DELIMITERS "*_`#"
+
+// Formats that make a paragraph something other than inline text
+#define LIVE_FORMAT_BLOCK_MASK \
+    (FORMAT_MASK(FORMAT_CODEBLOCK) | FORMAT_MASK(FORMAT_HR) | FORMAT_MASK(FORMAT_BLOCKQUOTE))
+#define LIVE_FORMAT_INLINE_MASK \
+    (FORMAT_MASK(FORMAT_BOLD) | FORMAT_MASK(FORMAT_ITALIC) | FORMAT_MASK(FORMAT_CODE))
+
+typedef struct {
+    GtkTextBuffer *buffer;  // Not owned; the state is its data
+    GtkTextMark *pending;   // In the paragraph a delimiter was typed into, or NULL
+    GtkTextMark *typed_start; // Text typed since pending was set; only its delimiters are
+    GtkTextMark *typed_end;   // read as syntax, the text around it is escaped
+    gboolean line_ended;    // A line break was typed since
+    gboolean applying;      // The paragraph is being replaced
+    guint job_id;
+} LiveFormat;
+
+// Finds the paragraph at iter without the blanks around it. The importer
+// renders soft breaks as spaces, so a paragraph is one line of the buffer.
+static gboolean find_paragraph(const GtkTextIter *iter, GtkTextIter *start, GtkTextIter *end) {
+    *start = *iter;
+    gtk_text_iter_set_line_offset(start, 0);
+    *end = *start;
+    if (!gtk_text_iter_ends_line(end)) {
+        gtk_text_iter_forward_to_line_end(end);
+    }
+    if (gtk_text_iter_get_offset(end) - gtk_text_iter_get_offset(start) > LIVE_FORMAT_MAX_CHARS) return FALSE;
+
+    // The Markdown parser would drop them, including a space just typed
+    while (gtk_text_iter_compare(start, end) < 0 && g_unichar_isspace(gtk_text_iter_get_char(start))) {
+        gtk_text_iter_forward_char(start);
+    }
+    while (gtk_text_iter_compare(start, end) < 0) {
+        GtkTextIter last = *end;
+        gtk_text_iter_backward_char(&last);
+        if (!g_unichar_isspace(gtk_text_iter_get_char(&last))) break;
+        *end = last;
+    }
+    return gtk_text_iter_compare(start, end) < 0;
+}
+
+// Whether new_text is old_text with only delimiters, escapes and spaces taken out, so
+// nothing was renumbered or restructured
+static gboolean only_syntax_removed(const gchar *old_text, const gchar *new_text) {
+    const gchar *o = old_text, *n = new_text;
+    while (*o) {
+        if (*n && g_utf8_get_char(o) == g_utf8_get_char(n)) {
+            n = g_utf8_next_char(n);
+        } else if (!strchr(LIVE_FORMAT_DELIMITERS "\\ \t", *o)) {
+            return FALSE;
+        }
+        o = g_utf8_next_char(o);
+    }
+    return *n == '\0';
+}
+
+// Closes the inline formats of a run that the next one doesn't share, innermost first
+static void write_transition(MdWriter *md, guint32 from, guint32 to) {
+    gboolean reopen_italic = FALSE;
+    if ((from & FORMAT_MASK(FORMAT_ITALIC)) &&
+        (!(to & FORMAT_MASK(FORMAT_ITALIC)) || !(to & FORMAT_MASK(FORMAT_BOLD)) != !(from & FORMAT_MASK(FORMAT_BOLD)))) {
+        md_writer_append_c(md, '*');
+        from &= ~FORMAT_MASK(FORMAT_ITALIC);
+        reopen_italic = (to & FORMAT_MASK(FORMAT_ITALIC)) != 0;
+    }
+    if ((from & FORMAT_MASK(FORMAT_BOLD)) && !(to & FORMAT_MASK(FORMAT_BOLD))) {
+        md_writer_append(md, "**");
+        from &= ~FORMAT_MASK(FORMAT_BOLD);
+    }
+    if (!(from & FORMAT_MASK(FORMAT_BOLD)) && (to & FORMAT_MASK(FORMAT_BOLD))) {
+        md_writer_append(md, "**");
+    }
+    if ((reopen_italic || !(from & FORMAT_MASK(FORMAT_ITALIC))) && (to & FORMAT_MASK(FORMAT_ITALIC))) {
+        md_writer_append_c(md, '*');
+    }
+}
+
+// Appends the part of a run from byte from to byte to; outside the typed text it is escaped.
+// edges holds the marker flags of the whole run, which apply to the parts at its ends.
+static void write_run_text(MdWriter *md, const gchar *text, gsize from, gsize to, gboolean typed,
+                           MdEscapeContext edges, char after) {
+    if (from >= to) return;
+    if (typed) {
+        md_writer_append_len(md, text + from, to - from);
+        return;
+    }
+    MdEscapeContext context = md->total_len == 0 ? MD_ESCAPE_LINE_START : 0;
+    if (from == 0) context |= edges & MD_ESCAPE_AFTER_MARKER;
+    if (!text[to]) context |= edges & MD_ESCAPE_BEFORE_MARKER;
+    md_escape_append(md, text + from, to - from, context, text[to] ? text[to] : after);
+}
+
+// The paragraph as Markdown: its formatting as markup, the text typed from
+// typed_start to typed_end as it is, so delimiters in it are read as syntax,
+// and the rest escaped. Returns NULL if it isn't an inline paragraph.
+static gchar *paragraph_to_markdown(const GtkTextIter *start, const GtkTextIter *end, FormatTags tags,
+                                    gint typed_start, gint typed_end, guint32 *first_mask) {
+    *first_mask = format_mask_at_iter(start, tags);
+    if (*first_mask & LIVE_FORMAT_BLOCK_MASK) return NULL;
+
+    GOutputStream *memory = g_memory_output_stream_new_resizable();
+    MdWriter md;
+    md_writer_init(&md, memory, NULL);
+    if (*first_mask & FORMAT_MASK_HEADINGS) {
+        for (gint bit = FORMAT_H1; bit <= FORMAT_H6; bit++) {
+            if (*first_mask & FORMAT_MASK(bit)) {
+                md_writer_append_len(&md, "######", (gsize)(bit - FORMAT_H1 + 1));
+                md_writer_append_c(&md, ' ');
+                break;
+            }
+        }
+    }
+
+    guint32 mask = 0;
+    gboolean block = FALSE;
+    GtkTextIter pos = *start;
+    while (gtk_text_iter_compare(&pos, end) < 0) {
+        guint32 run_mask = format_mask_at_iter(&pos, tags);
+        if (run_mask & LIVE_FORMAT_BLOCK_MASK) {
+            block = TRUE;
+            break;
+        }
+        GtkTextIter run_end = pos;
+        gtk_text_iter_forward_to_tag_toggle(&run_end, NULL);
+        if (gtk_text_iter_compare(&run_end, end) > 0) {
+            run_end = *end;
+        }
+        g_autofree gchar *text = gtk_text_iter_get_slice(&pos, &run_end);
+
+        if (run_mask & FORMAT_MASK(FORMAT_CODE)) {
+            write_transition(&md, mask, 0);
+            gboolean pad = FALSE;
+            gsize length = strlen(text);
+            gsize ticks = md_escape_code_delimiter(text, length, &pad);
+            for (gsize i = 0; i < ticks; i++) md_writer_append_c(&md, '`');
+            if (pad) md_writer_append_c(&md, ' ');
+            md_escape_append(&md, text, length, MD_ESCAPE_VERBATIM, 0);
+            if (pad) md_writer_append_c(&md, ' ');
+            for (gsize i = 0; i < ticks; i++) md_writer_append_c(&md, '`');
+            mask = 0;
+        } else {
+            guint32 inline_mask = run_mask & LIVE_FORMAT_INLINE_MASK;
+            gsize written = md.total_len;
+            write_transition(&md, mask, inline_mask);
+            // The run split where the typed text begins and ends
+            gint run_start = gtk_text_iter_get_offset(&pos);
+            gint run_chars = gtk_text_iter_get_offset(&run_end) - run_start;
+            gint from = CLAMP(typed_start - run_start, 0, run_chars);
+            gint to = CLAMP(typed_end - run_start, from, run_chars);
+            gsize from_byte = (gsize)(g_utf8_offset_to_pointer(text, from) - text);
+            gsize to_byte = (gsize)(g_utf8_offset_to_pointer(text, to) - text);
+            char after = gtk_text_iter_equal(&run_end, end) ? '\n' : 0;
+            // Another run, and so maybe a marker, follows unless this one ends the paragraph
+            MdEscapeContext edges = (md.total_len != written ? MD_ESCAPE_AFTER_MARKER : 0) |
+                                    (after ? 0 : MD_ESCAPE_BEFORE_MARKER);
+            write_run_text(&md, text, 0, from_byte, FALSE, edges, after);
+            write_run_text(&md, text, from_byte, to_byte, TRUE, edges, after);
+            write_run_text(&md, text, to_byte, strlen(text), FALSE, edges, after);
+            mask = inline_mask;
+        }
+        pos = run_end;
+    }
+    write_transition(&md, mask, 0);
+    md_writer_append_c(&md, '\n');
+
+    // Writes to a memory stream only fail on allocation failure, which aborts anyway
+    gchar *markdown = NULL;
+    if (md_writer_finish(&md, NULL) && !block && g_output_stream_write_all(memory, "", 1, NULL, NULL, NULL) &&
+        g_output_stream_close(memory, NULL, NULL)) {
+        markdown = g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(memory));
+    }
+    g_object_unref(memory);
+    return markdown;
+}
+
+// Takes out the characters of the paragraph that new_text doesn't have, matched as in
+// only_syntax_removed(), and sets its format tags to the runs of the plan line. The
+// text that stays keeps its other tags, such as spelling marks and folds.
+static void apply_rendered(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, const gchar *old_text,
+                           const gchar *new_text, const RenderPlanRun *runs, guint n_runs) {
+    gint start_offset = gtk_text_iter_get_offset(start);
+    gint old_chars = (gint)g_utf8_strlen(old_text, -1);
+
+    // Removed from the end, so the offsets of the characters before stay valid
+    const gchar *o = g_utf8_offset_to_pointer(old_text, old_chars);
+    const gchar *n = new_text + strlen(new_text);
+    gint i = old_chars;
+    while (i > 0) {
+        o = g_utf8_prev_char(o);
+        i--;
+        if (n > new_text && g_utf8_get_char(o) == g_utf8_get_char(g_utf8_prev_char(n))) {
+            n = g_utf8_prev_char(n);
+            continue;
+        }
+        gint removed_end = i + 1;
+        while (i > 0 && (n == new_text || g_utf8_get_char(g_utf8_prev_char(o)) != g_utf8_get_char(g_utf8_prev_char(n)))) {
+            o = g_utf8_prev_char(o);
+            i--;
+        }
+        GtkTextIter from, to;
+        gtk_text_buffer_get_iter_at_offset(buffer, &from, start_offset + i);
+        gtk_text_buffer_get_iter_at_offset(buffer, &to, start_offset + removed_end);
+        gtk_text_buffer_delete(buffer, &from, &to);
+    }
+
+    FormatTags tags;
+    format_tags_lookup(buffer, tags);
+    resolve_format_tags_cmark(buffer, tags);
+    gtk_text_buffer_get_iter_at_offset(buffer, start, start_offset);
+    gint new_chars = (gint)g_utf8_strlen(new_text, -1);
+    gtk_text_buffer_get_iter_at_offset(buffer, end, start_offset + new_chars);
+    for (gint bit = 0; bit < FORMAT_COUNT; bit++) {
+        if (!tags[bit]) continue;
+        gtk_text_buffer_remove_tag(buffer, tags[bit], start, end);
+        for (guint r = 0; r < n_runs; r++) {
+            // The line's terminator isn't part of the paragraph
+            if (!(runs[r].mask & FORMAT_MASK(bit)) || runs[r].start >= new_chars) continue;
+            GtkTextIter run_start, run_end;
+            gtk_text_buffer_get_iter_at_offset(buffer, &run_start, start_offset + runs[r].start);
+            gtk_text_buffer_get_iter_at_offset(buffer, &run_end, start_offset + MIN(runs[r].end, new_chars));
+            gtk_text_buffer_apply_tag(buffer, tags[bit], &run_start, &run_end);
+        }
+    }
+}
+
+// Converts the paragraph at the pending mark; FALSE if its syntax is not complete yet
+static gboolean live_format_paragraph(LiveFormat *lf) {
+    GtkTextBuffer *buffer = lf->buffer;
+    GtkTextIter iter, start, end, typed_start, typed_end;
+    gtk_text_buffer_get_iter_at_mark(buffer, &iter, lf->pending);
+    if (!find_paragraph(&iter, &start, &end)) return TRUE;
+
+    FormatTags tags;
+    format_tags_lookup(buffer, tags);
+    gtk_text_buffer_get_iter_at_mark(buffer, &typed_start, lf->typed_start);
+    gtk_text_buffer_get_iter_at_mark(buffer, &typed_end, lf->typed_end);
+    guint32 first_mask = 0;
+    g_autofree gchar *md = paragraph_to_markdown(&start, &end, tags, gtk_text_iter_get_offset(&typed_start),
+                                                 gtk_text_iter_get_offset(&typed_end), &first_mask);
+    if (!md) return TRUE;
+
+    gboolean complete = TRUE;
+    g_autofree gchar *old_text = gtk_text_iter_get_slice(&start, &end);
+    RenderPlan *plan = strpbrk(old_text, LIVE_FORMAT_DELIMITERS) ? parse_markdown_to_plan_cmark(md, NULL) : NULL;
+    if (plan) {
+        // An inline paragraph is one line, followed by the newlines the importer ends blocks with
+        const RenderPlanRun *runs = NULL;
+        guint n_runs = 0;
+        g_autofree gchar *new_text = g_strdup(render_plan_get_line(plan, 0, &runs, &n_runs));
+        gsize new_length = strlen(new_text);
+        while (new_length > 0 && new_text[new_length - 1] == '\n') new_text[--new_length] = '\0';
+        gboolean one_line = TRUE;
+        for (guint line = 1; line < render_plan_get_n_lines(plan); line++) {
+            if (render_plan_get_line(plan, line, NULL, NULL)[0] != '\n' &&
+                render_plan_get_line(plan, line, NULL, NULL)[0] != '\0') {
+                one_line = FALSE;
+            }
+        }
+        guint32 rendered_mask = n_runs > 0 ? runs[0].mask : 0;
+
+        gboolean new_heading = (rendered_mask & FORMAT_MASK_HEADINGS) && !(first_mask & FORMAT_MASK_HEADINGS);
+        if (new_text[0] == '\0' || (rendered_mask & LIVE_FORMAT_BLOCK_MASK) ||
+            (new_heading && !lf->line_ended)) {
+            // "#", "```", "***" or a heading still being typed
+            complete = FALSE;
+        } else if (one_line && strcmp(new_text, old_text) != 0 && only_syntax_removed(old_text, new_text)) {
+            // Only the syntax characters go, so the cursor stays beside the text it was at
+            lf->applying = TRUE;
+            gtk_text_buffer_begin_user_action(buffer);
+            apply_rendered(buffer, &start, &end, old_text, new_text, runs, n_runs);
+            gtk_text_buffer_end_user_action(buffer);
+            lf->applying = FALSE;
+        }
+        render_plan_free(plan);
+    }
+    return complete;
+}
+
+static gboolean live_format_slice(G_GNUC_UNUSED SchedulerJob *job, G_GNUC_UNUSED gint64 deadline_us,
+                                  gpointer user_data) {
+    LiveFormat *lf = user_data;
+    lf->job_id = 0;
+    // An incomplete paragraph stays pending, so the keystroke that completes it converts it
+    if (lf->pending && live_format_paragraph(lf)) {
+        gtk_text_buffer_delete_mark(lf->buffer, lf->pending);
+        gtk_text_buffer_delete_mark(lf->buffer, lf->typed_start);
+        gtk_text_buffer_delete_mark(lf->buffer, lf->typed_end);
+        lf->pending = NULL;
+        lf->typed_start = NULL;
+        lf->typed_end = NULL;
+        lf->line_ended = FALSE;
+    }
+    return FALSE;
+}
+
+// Grows the typed text to take in a keystroke from start to end
+static void track_typed(LiveFormat *lf, const GtkTextIter *start, const GtkTextIter *end) {
+    if (!lf->typed_start) {
+        lf->typed_start = gtk_text_buffer_create_mark(lf->buffer, NULL, start, TRUE);
+        lf->typed_end = gtk_text_buffer_create_mark(lf->buffer, NULL, end, FALSE);
+        return;
+    }
+    GtkTextIter typed_start, typed_end;
+    gtk_text_buffer_get_iter_at_mark(lf->buffer, &typed_start, lf->typed_start);
+    gtk_text_buffer_get_iter_at_mark(lf->buffer, &typed_end, lf->typed_end);
+    if (gtk_text_iter_compare(start, &typed_start) < 0) {
+        gtk_text_buffer_move_mark(lf->buffer, lf->typed_start, start);
+    }
+    if (gtk_text_iter_compare(end, &typed_end) > 0) {
+        gtk_text_buffer_move_mark(lf->buffer, lf->typed_end, end);
+    }
+}
+
+// Runs after the default handler: location is at the end of the inserted text
+static void on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location, gchar *text, gint len, gpointer user_data) {
+    LiveFormat *lf = user_data;
+    if (lf->applying || file_monitor_is_reloading(buffer)) return;
+
+    // A keystroke goes in at the cursor, one or two characters at a time
+    glong n_chars = g_utf8_strlen(text, len);
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    if (n_chars > 2 || !gtk_text_iter_equal(&cursor, location)) return;
+
+    gboolean delimiter = FALSE, line_end = FALSE;
+    for (gint i = 0; i < len; i++) {
+        if (strchr(LIVE_FORMAT_DELIMITERS, text[i])) delimiter = TRUE;
+        if (text[i] == '\n') line_end = TRUE;
+    }
+    GtkTextIter typed = *location;
+    gtk_text_iter_backward_chars(&typed, (gint)n_chars);
+    if (delimiter) {
+        // The span may still be growing; wait for the next keystroke that isn't a delimiter
+        lf->line_ended = FALSE;
+        if (lf->pending) {
+            gtk_text_buffer_move_mark(buffer, lf->pending, &typed);
+        } else {
+            lf->pending = gtk_text_buffer_create_mark(buffer, NULL, &typed, TRUE);
+        }
+        track_typed(lf, &typed, location);
+        g_clear_handle_id(&lf->job_id, scheduler_cancel);
+        return;
+    }
+    if (!lf->pending) return;
+    track_typed(lf, &typed, location);
+    lf->line_ended = lf->line_ended || line_end;
+    // The job of the previous keystroke went stale with this one; only the latest runs
+    scheduler_cancel(lf->job_id);
+    lf->job_id = scheduler_add_slice(buffer, SCHEDULER_LANE_INPUT, live_format_slice, lf, NULL);
+}
+
+static void live_format_free(gpointer data) {
+    LiveFormat *lf = data;
+    g_clear_handle_id(&lf->job_id, scheduler_cancel);
+    g_free(lf);
+}
+
+void live_format_attach(GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    if (g_object_get_data(G_OBJECT(buffer), LIVE_FORMAT_KEY)) return;
+
+    LiveFormat *lf = g_new0(LiveFormat, 1);
+    lf->buffer = buffer;
+    g_object_set_data_full(G_OBJECT(buffer), LIVE_FORMAT_KEY, lf, live_format_free);
+    g_signal_connect_after(buffer, "insert-text", G_CALLBACK(on_insert_text), lf);
+}
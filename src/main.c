@@ -6,6 +6,25 @@
 // #include "markdown.h"  // Tilføjet for at få adgang til markdown-funktionerne
 #include "gtktext_cmark.h" // Switched to gtktext_cmark
 #include "settings.h"
+#include "perf_trace.h"
+#include "perf_hud.h"
+#include "batch.h"
+#include "export_cache.h"
+#include "file_monitor.h"
+#include "document_io.h"
+#include "document_save.h"
+#include "render_cache.h"
+#include "spell_check.h"
+#include "parallel_parse.h"
+#include "text_scan.h"
+#include "document_views.h"
+#include "source_mode.h"
+#include "live_format.h"
+#include "perf_policy.h"
+#include "scheduler.h"
+#include "markdown_paste.h"
+#include "document_print.h"
+#include "outline.h"
 
 // Funktionsdeklarationer
 // static void setup_markdown_tags(GtkTextBuffer *buffer); // Removed duplicate
@@ -22,13 +41,40 @@ static gchar* get_save_file_path(void) {
     return g_build_filename(doc_dir, "mini_text_editor.md", NULL);
 }
 
-// Loads text content from the predefined save file.
-static void load_markdown_to_buffer(GtkTextBuffer *buffer) {
-    g_autofree gchar *filename = get_save_file_path();
+// The document being edited and autosaved; starts as the predefined save
+// file and changes when a file is opened or saved under a new name.
+static GFile *current_document = NULL;
+
+static GFile *get_current_document(void) {
+    if (!current_document) {
+        g_autofree gchar *path = get_save_file_path();
+        current_document = g_file_new_for_path(path);
+    }
+    return current_document;
+}
+
+static void set_current_document(GFile *file) {
+    g_set_object(&current_document, file);
+}
+
+// Loads text content from the current document.
+// Returns the SHA-256 of the file as read, or NULL if there is none.
+// An unchanged document comes from the render cache; *from_cache is then
+// set and the caller must have the file checked in the background.
+static gchar *load_markdown_to_buffer(GtkTextBuffer *buffer, gboolean *from_cache) {
+    g_autofree gchar *filename = g_file_get_path(get_current_document());
+    gchar *cached_digest = render_cache_load(buffer, get_current_document());
+    *from_cache = (cached_digest != NULL);
+    if (cached_digest) {
+        g_print("Loaded %s from the render cache\n", filename);
+        return cached_digest;
+    }
+
     gchar *content = NULL;
+    gsize length = 0;
     GError *error = NULL;
     g_print("Loading markdown from file: %s\n", filename);
-    if (!g_file_get_contents(filename, &content, NULL, &error)) {
+    if (!g_file_get_contents(filename, &content, &length, &error)) {
         // If the file doesn't exist, it's not an error, just start with an empty buffer.
         if (error->code != G_FILE_ERROR_NOENT) {
             g_warning("Error loading file: %s", error->message);
@@ -36,51 +82,365 @@ static void load_markdown_to_buffer(GtkTextBuffer *buffer) {
         g_clear_error(&error);
         // Ensure buffer is empty if file not found or on error
         gtk_text_buffer_set_text(buffer, "", -1);
-        return;
+        return NULL;
+    }
+    // The digest is of the bytes on disk, before line endings are normalized
+    gchar *digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)content, length);
+    TextLineIndex *lines = NULL;
+    if (!text_scan(content, &length, &lines, &error)) {
+        g_warning("Error loading file: %s", error->message);
+        g_clear_error(&error);
+        g_free(content);
+        g_free(digest);
+        gtk_text_buffer_set_text(buffer, "", -1);
+        return NULL;
     }
-    g_print("File contents: %s\n", content);
     // if (!import_markdown_to_buffer(buffer, content)) {
-    if (!import_markdown_to_buffer_cmark(buffer, content)) { // Changed to cmark version
+    if (!import_markdown_to_buffer_parallel(buffer, content, lines)) { // Large files are parsed on all cores
         g_warning("Failed to import markdown to buffer");
     } else {
         g_print("Markdown imported to buffer successfully using cmark.\n");
     }
+    text_line_index_free(lines);
     g_free(content);
+    return digest;
+}
+
+// Sets up autosave, the export cache and external change monitoring for a
+// buffer showing the current document.
+static void attach_document_buffer(GtkTextBuffer *buffer, const gchar *saved_digest) {
+    export_cache_attach(buffer);
+    export_cache_set_saved_digest(buffer, saved_digest);
+    file_monitor_attach(buffer, get_current_document());
+    // Markdown skrevet i teksten formateres af live_format, kun i det redigerede afsnit
+    live_format_attach(buffer);
+    outline_attach(buffer);
+    document_save_attach(buffer, get_current_document());
+}
+
+// Open/Save header bar buttons and the progress shown while they run.
+// Only one file operation runs at a time; each holds a reference.
+typedef struct {
+    GtkWindow *window;
+    GtkTextView *text_view;
+    GtkWidget *open_button;
+    GtkWidget *save_button;
+    GtkWidget *toolbar_container;
+    GtkWidget *progress_box;
+    GtkProgressBar *progress_bar;
+    GCancellable *cancellable;  // Operation in progress, if any
+    gboolean locks_editing;     // It needs the buffer to stay as it is
+    guint pulse_id;
+    gboolean closed;            // The window is gone; skip widget updates
+} DocumentUi;
+
+static void document_ui_clear(gpointer data) {
+    DocumentUi *ui = data;
+    g_clear_object(&ui->cancellable);
+    g_clear_handle_id(&ui->pulse_id, g_source_remove);
+}
+
+static void document_ui_unref(gpointer data) {
+    g_rc_box_release_full(data, document_ui_clear);
+}
+
+static gboolean pulse_progress(gpointer user_data) {
+    DocumentUi *ui = user_data;
+    gtk_progress_bar_pulse(ui->progress_bar);
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_io_progress(double fraction, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    if (ui->closed) return;
+    if (fraction < 0) {
+        if (!ui->pulse_id) {
+            ui->pulse_id = g_timeout_add(100, pulse_progress, ui);
+        }
+    } else {
+        g_clear_handle_id(&ui->pulse_id, g_source_remove);
+        gtk_progress_bar_set_fraction(ui->progress_bar, fraction);
+    }
+}
+
+// The toolbar formats the rendered document, so it is off while the source is shown
+static void document_ui_update_toolbar(DocumentUi *ui) {
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(ui->text_view);
+    gtk_widget_set_sensitive(ui->toolbar_container, !ui->locks_editing && !source_mode_is_source(buffer));
+}
+
+static void update_toolbars(GtkApplication *app) {
+    for (GList *l = gtk_application_get_windows(app); l; l = l->next) {
+        DocumentUi *ui = g_object_get_data(G_OBJECT(l->data), "document-ui");
+        if (ui && !ui->closed) {
+            document_ui_update_toolbar(ui);
+        }
+    }
+}
+
+// The buffer must not change while it is saved, so editing is paused too unless
+// the operation reads the buffer in a way that follows edits, as the PDF export does
+static void document_ui_set_busy(DocumentUi *ui, const char *label, gboolean lock_editing) {
+    gboolean busy = (label != NULL);
+    ui->locks_editing = busy && lock_editing;
+    if (busy) {
+        ui->cancellable = g_cancellable_new();
+        g_rc_box_acquire(ui);
+        gtk_progress_bar_set_text(ui->progress_bar, label);
+        gtk_progress_bar_set_fraction(ui->progress_bar, 0.0);
+    } else {
+        g_clear_object(&ui->cancellable);
+        g_clear_handle_id(&ui->pulse_id, g_source_remove);
+    }
+    if (ui->closed) return;
+    gtk_widget_set_visible(ui->progress_box, busy);
+    gtk_widget_set_sensitive(ui->open_button, !busy);
+    gtk_widget_set_sensitive(ui->save_button, !busy);
+    document_ui_update_toolbar(ui);
+    document_views_set_editable(gtk_text_view_get_buffer(ui->text_view), !ui->locks_editing);
+}
+
+static void on_document_loaded(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GError *error = NULL;
+    g_autofree gchar *digest = NULL;
+
+    GtkTextBuffer *buffer = document_io_load_finish(result, &digest, &error);
+    document_ui_set_busy(ui, NULL, FALSE);
+    if (!buffer) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Error opening file: %s", error->message);
+        }
+        g_clear_error(&error);
+    } else if (!ui->closed) {
+        // Swapping in the imported buffer is cheap; the old one goes with its cache and monitor
+        set_current_document(G_FILE(source_object));
+        update_code_tags_for_theme(buffer);
+        document_views_set_buffer(gtk_text_view_get_buffer(ui->text_view), buffer);
+        attach_document_buffer(buffer, digest);
+        update_toolbars(gtk_window_get_application(ui->window));
+        g_autofree gchar *name = g_file_get_parse_name(G_FILE(source_object));
+        g_print("Opened %s\n", name);
+    }
+    g_clear_object(&buffer);
+    document_ui_unref(ui);
+}
+
+static void on_open_dialog_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GError *error = NULL;
+
+    GFile *file = gtk_file_dialog_open_finish(GTK_FILE_DIALOG(source_object), result, &error);
+    if (!file) {
+        if (!g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_DISMISSED)) {
+            g_warning("Error choosing file: %s", error->message);
+        }
+        g_clear_error(&error);
+        document_ui_unref(ui);
+        return;
+    }
+    if (!ui->closed && !ui->cancellable) {
+        // The document being left is always saved; flush a pending autosave
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(ui->text_view);
+        source_mode_flush(buffer);
+        document_save_flush(source_mode_get_document(buffer));
+        document_ui_set_busy(ui, "Opening…", TRUE);
+        document_io_load_async(file, ui->cancellable, on_io_progress, on_document_loaded, ui);
+    }
+    g_object_unref(file);
+    document_ui_unref(ui);
+}
+
+static GtkFileDialog *create_markdown_file_dialog(const char *title) {
+    GtkFileDialog *dialog = gtk_file_dialog_new();
+    gtk_file_dialog_set_title(dialog, title);
+
+    GtkFileFilter *markdown = gtk_file_filter_new();
+    gtk_file_filter_set_name(markdown, "Markdown");
+    gtk_file_filter_add_mime_type(markdown, "text/markdown");
+    gtk_file_filter_add_suffix(markdown, "md");
+    gtk_file_filter_add_suffix(markdown, "markdown");
+    GtkFileFilter *text = gtk_file_filter_new();
+    gtk_file_filter_set_name(text, "Plain Text");
+    gtk_file_filter_add_mime_type(text, "text/plain");
+
+    GListStore *filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
+    g_list_store_append(filters, markdown);
+    g_list_store_append(filters, text);
+    gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+    gtk_file_dialog_set_default_filter(dialog, markdown);
+    g_object_unref(filters);
+    g_object_unref(text);
+    g_object_unref(markdown);
+    return dialog;
+}
+
+static void on_open_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GtkFileDialog *dialog = create_markdown_file_dialog("Open Markdown File");
+    gtk_file_dialog_open(dialog, ui->window, NULL, on_open_dialog_done, g_rc_box_acquire(ui));
+    g_object_unref(dialog);
+}
+
+static void on_document_saved(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GError *error = NULL;
+    g_autofree gchar *digest = NULL;
+
+    gboolean saved = document_io_save_finish(result, &digest, &error);
+    document_ui_set_busy(ui, NULL, FALSE);
+    if (!saved) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Error saving file: %s", error->message);
+        }
+        g_clear_error(&error);
+    } else if (!ui->closed) {
+        // Autosave continues in the new file
+        GtkTextBuffer *buffer = source_mode_get_document(gtk_text_view_get_buffer(ui->text_view));
+        set_current_document(G_FILE(source_object));
+        export_cache_set_saved_digest(buffer, digest);
+        document_save_set_file(buffer, get_current_document());
+        file_monitor_attach(buffer, get_current_document());
+        g_autofree gchar *name = g_file_get_parse_name(G_FILE(source_object));
+        g_print("Saved %s\n", name);
+    }
+    document_ui_unref(ui);
 }
 
-// Saves the content of the GtkTextBuffer to the predefined save file as markdown.
-static void save_buffer_as_markdown(GtkTextBuffer *buffer) {
-    g_autofree gchar *filename = get_save_file_path();
-    // char *md = export_buffer_to_markdown(buffer);
-    char *md = export_buffer_to_markdown_cmark(buffer); // Changed to cmark version
+static void on_save_dialog_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
     GError *error = NULL;
-    if (!g_file_set_contents(filename, md, -1, &error)) {
-        g_warning("Error saving file: %s", error->message);
+
+    GFile *file = gtk_file_dialog_save_finish(GTK_FILE_DIALOG(source_object), result, &error);
+    if (!file) {
+        if (!g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_DISMISSED)) {
+            g_warning("Error choosing file: %s", error->message);
+        }
+        g_clear_error(&error);
+        document_ui_unref(ui);
+        return;
+    }
+    if (!ui->closed && !ui->cancellable) {
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(ui->text_view);
+        source_mode_flush(buffer);
+        document_save_flush(source_mode_get_document(buffer));
+        document_ui_set_busy(ui, "Saving…", TRUE);
+        document_io_save_async(source_mode_get_document(buffer), file, ui->cancellable,
+                               on_io_progress, on_document_saved, ui);
+    }
+    g_object_unref(file);
+    document_ui_unref(ui);
+}
+
+static void on_save_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GtkFileDialog *dialog = create_markdown_file_dialog("Save Markdown File");
+    gtk_file_dialog_set_initial_file(dialog, get_current_document());
+    gtk_file_dialog_save(dialog, ui->window, NULL, on_save_dialog_done, g_rc_box_acquire(ui));
+    g_object_unref(dialog);
+}
+
+static void on_pdf_exported(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GError *error = NULL;
+
+    gboolean exported = document_print_export_pdf_finish(result, &error);
+    document_ui_set_busy(ui, NULL, FALSE);
+    if (!exported) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Error exporting PDF: %s", error->message);
+        }
         g_clear_error(&error);
     } else {
-        g_print("Buffer content saved as markdown to %s using cmark\n", filename);
+        g_autofree gchar *name = g_file_get_parse_name(G_FILE(source_object));
+        g_print("Exported %s\n", name);
     }
-    g_free(md);
+    document_ui_unref(ui);
 }
 
-// Callback triggered when the text in the GtkTextBuffer changes.
-static void on_text_changed(GtkTextBuffer *buffer, G_GNUC_UNUSED gpointer user_data) {
-    // Først gemmer vi ændringerne som normalt
-    save_buffer_as_markdown(buffer);
-    // Udskyd markdown-parsing til næste hovedloop-cyklus - Commented out dynamic processing
-    /*
-    if (!markdown_update_pending) {
-        markdown_update_pending = TRUE;
-        g_idle_add(idle_process_markdown_wrapper, buffer);
+static void on_export_pdf_dialog_done(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    GError *error = NULL;
+
+    GFile *file = gtk_file_dialog_save_finish(GTK_FILE_DIALOG(source_object), result, &error);
+    if (!file) {
+        if (!g_error_matches(error, GTK_DIALOG_ERROR, GTK_DIALOG_ERROR_DISMISSED)) {
+            g_warning("Error choosing file: %s", error->message);
+        }
+        g_clear_error(&error);
+        document_ui_unref(ui);
+        return;
+    }
+    if (!ui->closed && !ui->cancellable) {
+        // The rendered document is exported, also while the source is shown
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(ui->text_view);
+        source_mode_flush(buffer);
+        markdown_paste_flush(source_mode_get_document(buffer));
+        document_ui_set_busy(ui, "Exporting PDF…", FALSE);
+        document_print_export_pdf_async(source_mode_get_document(buffer), file, ui->cancellable,
+                                        on_io_progress, on_pdf_exported, ui);
+    }
+    g_object_unref(file);
+    document_ui_unref(ui);
+}
+
+static void on_io_cancel_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    if (ui->cancellable) {
+        g_cancellable_cancel(ui->cancellable);
+    }
+}
+
+static void on_document_ui_window_destroy(G_GNUC_UNUSED GtkWidget *window, gpointer user_data) {
+    DocumentUi *ui = user_data;
+    ui->closed = TRUE;
+    g_clear_handle_id(&ui->pulse_id, g_source_remove);
+    if (ui->cancellable) {
+        g_cancellable_cancel(ui->cancellable);
+    }
+}
+
+static void setup_document_ui(GtkBuilder *builder, GtkWidget *window, GtkWidget *text_view,
+                              GtkWidget *toolbar_container) {
+    DocumentUi *ui = g_rc_box_new0(DocumentUi);
+    ui->window = GTK_WINDOW(window);
+    ui->text_view = GTK_TEXT_VIEW(text_view);
+    ui->open_button = GTK_WIDGET(gtk_builder_get_object(builder, "open_button"));
+    ui->save_button = GTK_WIDGET(gtk_builder_get_object(builder, "save_button"));
+    ui->toolbar_container = toolbar_container;
+    ui->progress_box = GTK_WIDGET(gtk_builder_get_object(builder, "io_progress_box"));
+    ui->progress_bar = GTK_PROGRESS_BAR(gtk_builder_get_object(builder, "io_progress_bar"));
+    GtkWidget *cancel_button = GTK_WIDGET(gtk_builder_get_object(builder, "io_cancel_button"));
+    if (!ui->open_button || !ui->save_button || !ui->progress_box || !ui->progress_bar || !cancel_button) {
+        g_critical("Failed to get the open/save widgets from UI");
+        document_ui_unref(ui);
+        return;
     }
-    */
+
+    g_signal_connect(ui->open_button, "clicked", G_CALLBACK(on_open_clicked), ui);
+    g_signal_connect(ui->save_button, "clicked", G_CALLBACK(on_save_clicked), ui);
+    g_signal_connect(cancel_button, "clicked", G_CALLBACK(on_io_cancel_clicked), ui);
+    g_signal_connect(window, "destroy", G_CALLBACK(on_document_ui_window_destroy), ui);
+    g_object_set_data_full(G_OBJECT(window), "document-ui", ui, document_ui_unref);
 }
 
 // Callback triggered when the main window requests to be closed.
-static gboolean on_window_close_request(G_GNUC_UNUSED GtkWindow *window, gpointer user_data) {
+static gboolean on_window_close_request(GtkWindow *window, gpointer user_data) {
     GtkTextView *text_view = GTK_TEXT_VIEW(user_data);
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
-    save_buffer_as_markdown(buffer);
+    GtkTextBuffer *shown = gtk_text_view_get_buffer(text_view);
+    GtkTextBuffer *buffer = source_mode_get_document(shown);
+    source_mode_flush(shown);
+    document_save_flush(buffer);
+    // The last window showing the document stores it in the render cache
+    if (document_views_shown_elsewhere(shown, window)) {
+        return GDK_EVENT_PROPAGATE;
+    }
+
+    // Cache only what is on disk; a failed save leaves the buffer ahead of the file
+    g_autofree gchar *digest = export_cache_compute_digest(buffer);
+    if (digest && g_strcmp0(digest, export_cache_get_saved_digest(buffer)) == 0) {
+        render_cache_store(buffer, get_current_document(), digest);
+    }
     return GDK_EVENT_PROPAGATE;
 }
 
@@ -95,6 +455,7 @@ static void copy_selected_text_as_markdown(GtkTextView *text_view) {
         g_print("DEBUG: No text selected for copy\n");
         return;
     }
+    PerfSpan span = perf_span_begin(PERF_OP_CLIPBOARD_COPY);
     g_print("DEBUG: Text selection found\n");
 
     GString *md = g_string_new("");
@@ -283,40 +644,234 @@ static void copy_selected_text_as_markdown(GtkTextView *text_view) {
     gdk_clipboard_set_text(clipboard, md->str);
     g_print("Copied to clipboard as markdown: %s\n", md->str);
     g_string_free(md, TRUE);
+    perf_span_end(&span);
 }
 
-// Callback for tastaturgenvej (Ctrl+C)
-static gboolean on_key_pressed(G_GNUC_UNUSED GtkEventControllerKey *controller,
+// Callback for tastaturgenvej (Ctrl+C, Ctrl+V)
+static gboolean on_key_pressed(GtkEventControllerKey *controller,
                                guint keyval,
                                G_GNUC_UNUSED guint keycode,
                                GdkModifierType state,
                                gpointer user_data) {
     GtkTextView *text_view = GTK_TEXT_VIEW(user_data);
 
-    // Detect Ctrl+C
-    if (keyval == GDK_KEY_c && (state & GDK_CONTROL_MASK)) {
+    // Detect Ctrl+C; the source is already Markdown and is copied as it is
+    if (keyval == GDK_KEY_c && (state & GDK_CONTROL_MASK) &&
+        !source_mode_is_source(gtk_text_view_get_buffer(text_view))) {
         g_print("DEBUG: Ctrl+C detected\n");
         copy_selected_text_as_markdown(text_view);
         return TRUE; // Event handled
     }
 
+    // Ctrl+V pastes Markdown as formatting into the focused pane; Ctrl+Shift+V pastes plain text
+    if (gdk_keyval_to_lower(keyval) == GDK_KEY_v && (state & GDK_CONTROL_MASK) &&
+        !source_mode_is_source(gtk_text_view_get_buffer(text_view))) {
+        GtkWidget *focus_view = gtk_event_controller_get_widget(GTK_EVENT_CONTROLLER(controller));
+        if (state & GDK_SHIFT_MASK) {
+            g_signal_emit_by_name(focus_view, "paste-clipboard");
+        } else {
+            markdown_paste(GTK_TEXT_VIEW(focus_view));
+        }
+        return TRUE;
+    }
+
+    // F12 toggles the performance HUD
+    if (keyval == GDK_KEY_F12) {
+        perf_hud_toggle(GTK_WIDGET(text_view));
+        return TRUE;
+    }
+
     return FALSE; // Pass event to other handlers
 }
 
 
-static void app_activate(GApplication *application) {
-    GtkApplication *app = GTK_APPLICATION(application);
+static GtkWidget *create_document_window(GtkApplication *app, GtkTextBuffer *shared_buffer);
+
+// Another pane of the same buffer, below the window's text view
+static GtkWidget *create_split_view(GtkTextView *text_view) {
+    GtkWidget *split_view = gtk_text_view_new_with_buffer(gtk_text_view_get_buffer(text_view));
+    gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(split_view), gtk_text_view_get_wrap_mode(text_view));
+    gtk_text_view_set_left_margin(GTK_TEXT_VIEW(split_view), gtk_text_view_get_left_margin(text_view));
+    gtk_text_view_set_right_margin(GTK_TEXT_VIEW(split_view), gtk_text_view_get_right_margin(text_view));
+    gtk_text_view_set_top_margin(GTK_TEXT_VIEW(split_view), gtk_text_view_get_top_margin(text_view));
+    gtk_text_view_set_bottom_margin(GTK_TEXT_VIEW(split_view), gtk_text_view_get_bottom_margin(text_view));
+    gtk_text_view_set_editable(GTK_TEXT_VIEW(split_view), gtk_text_view_get_editable(text_view));
+    gtk_text_view_set_monospace(GTK_TEXT_VIEW(split_view), gtk_text_view_get_monospace(text_view));
+    document_views_add(GTK_TEXT_VIEW(split_view));
+    spell_check_attach(GTK_TEXT_VIEW(split_view));
+
+    // Ctrl+C copies the buffer's selection, which is this pane's while it has focus
+    GtkEventController *key_controller = gtk_event_controller_key_new();
+    g_signal_connect(key_controller, "key-pressed", G_CALLBACK(on_key_pressed), text_view);
+    gtk_widget_add_controller(split_view, key_controller);
+
+    GtkWidget *scrolled_window = gtk_scrolled_window_new();
+    gtk_widget_set_hexpand(scrolled_window, TRUE);
+    gtk_widget_set_vexpand(scrolled_window, TRUE);
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrolled_window), split_view);
+    return scrolled_window;
+}
+
+static void on_split_view_changed(GSimpleAction *action, GVariant *state, gpointer user_data) {
+    GtkBuilder *builder = g_object_get_data(G_OBJECT(user_data), "builder");
+    GtkPaned *paned = GTK_PANED(gtk_builder_get_object(builder, "editor_paned"));
+    GtkTextView *text_view = GTK_TEXT_VIEW(gtk_builder_get_object(builder, "text_view"));
+    if (g_variant_get_boolean(state)) {
+        gtk_paned_set_end_child(paned, create_split_view(text_view));
+        gtk_paned_set_position(paned, gtk_widget_get_height(GTK_WIDGET(paned)) / 2);
+    } else {
+        // Destroys the pane's view; the buffer stays with the window's own
+        gtk_paned_set_end_child(paned, NULL);
+        gtk_widget_grab_focus(GTK_WIDGET(text_view));
+    }
+    g_simple_action_set_state(action, state);
+}
+
+static void on_new_view(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                        gpointer user_data) {
+    GtkWindow *window = GTK_WINDOW(user_data);
+    GtkBuilder *builder = g_object_get_data(G_OBJECT(window), "builder");
+    GtkTextView *text_view = GTK_TEXT_VIEW(gtk_builder_get_object(builder, "text_view"));
+    create_document_window(gtk_window_get_application(window), gtk_text_view_get_buffer(text_view));
+}
+
+// Every view of the document switches, in every window
+static void on_toggle_source(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                             gpointer user_data) {
+    GtkWindow *window = GTK_WINDOW(user_data);
+    GtkBuilder *builder = g_object_get_data(G_OBJECT(window), "builder");
+    source_mode_toggle(GTK_TEXT_VIEW(gtk_builder_get_object(builder, "text_view")));
+    update_toolbars(gtk_window_get_application(window));
+}
+
+static void on_print(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                     gpointer user_data) {
+    GtkWindow *window = GTK_WINDOW(user_data);
+    GtkBuilder *builder = g_object_get_data(G_OBJECT(window), "builder");
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(gtk_builder_get_object(builder, "text_view")));
+    source_mode_flush(buffer);
+    markdown_paste_flush(source_mode_get_document(buffer));
+    document_print(window, source_mode_get_document(buffer));
+}
+
+static void on_export_pdf(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                          gpointer user_data) {
+    DocumentUi *ui = g_object_get_data(G_OBJECT(user_data), "document-ui");
+    if (!ui || ui->cancellable) return;
+
+    GtkFileDialog *dialog = gtk_file_dialog_new();
+    gtk_file_dialog_set_title(dialog, "Export PDF");
+    GtkFileFilter *pdf = gtk_file_filter_new();
+    gtk_file_filter_set_name(pdf, "PDF");
+    gtk_file_filter_add_mime_type(pdf, "application/pdf");
+    gtk_file_filter_add_suffix(pdf, "pdf");
+    gtk_file_dialog_set_default_filter(dialog, pdf);
+    g_object_unref(pdf);
+
+    // Named after the document, next to it
+    g_autofree gchar *basename = g_file_get_basename(get_current_document());
+    gchar *dot = g_strrstr(basename, ".");
+    if (dot) *dot = '\0';
+    g_autofree gchar *name = g_strconcat(basename, ".pdf", NULL);
+    GFile *parent = g_file_get_parent(get_current_document());
+    GFile *initial = parent ? g_file_get_child(parent, name) : g_file_new_for_path(name);
+    gtk_file_dialog_set_initial_file(dialog, initial);
+    g_object_unref(initial);
+    g_clear_object(&parent);
+
+    gtk_file_dialog_save(dialog, ui->window, NULL, on_export_pdf_dialog_done, g_rc_box_acquire(ui));
+    g_object_unref(dialog);
+}
+
+// Folding works on the rendered document; the source view shows every line
+static GtkTextBuffer *get_foldable_buffer(GtkWindow *window, GtkTextView **text_view) {
+    GtkBuilder *builder = g_object_get_data(G_OBJECT(window), "builder");
+    *text_view = GTK_TEXT_VIEW(gtk_builder_get_object(builder, "text_view"));
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(*text_view);
+    return source_mode_is_source(buffer) ? NULL : buffer;
+}
+
+static void on_toggle_fold(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                           gpointer user_data) {
+    GtkTextView *text_view;
+    GtkTextBuffer *buffer = get_foldable_buffer(GTK_WINDOW(user_data), &text_view);
+    if (!buffer) return;
+
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    gint section = outline_find_section(buffer, &cursor);
+    if (section < 0) return;
+    outline_set_folded(buffer, (guint)section, !outline_is_folded(buffer, (guint)section));
+    gtk_text_view_scroll_mark_onscreen(text_view, gtk_text_buffer_get_insert(buffer));
+}
+
+static void on_fold_others(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                           gpointer user_data) {
+    GtkTextView *text_view;
+    GtkTextBuffer *buffer = get_foldable_buffer(GTK_WINDOW(user_data), &text_view);
+    if (!buffer) return;
+
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    outline_fold_others(buffer, &cursor);
+    gtk_text_view_scroll_mark_onscreen(text_view, gtk_text_buffer_get_insert(buffer));
+}
+
+static void on_unfold_all(G_GNUC_UNUSED GSimpleAction *action, G_GNUC_UNUSED GVariant *parameter,
+                          gpointer user_data) {
+    GtkTextView *text_view;
+    GtkTextBuffer *buffer = get_foldable_buffer(GTK_WINDOW(user_data), &text_view);
+    if (!buffer) return;
+
+    outline_unfold_all(buffer);
+    gtk_text_view_scroll_mark_onscreen(text_view, gtk_text_buffer_get_insert(buffer));
+}
+
+static const GActionEntry window_actions[] = {
+    { "new-view", on_new_view, NULL, NULL, NULL, { 0 } },
+    { "split-view", NULL, NULL, "false", on_split_view_changed, { 0 } },
+    { "toggle-source", on_toggle_source, NULL, NULL, NULL, { 0 } },
+    { "print", on_print, NULL, NULL, NULL, { 0 } },
+    { "export-pdf", on_export_pdf, NULL, NULL, NULL, { 0 } },
+    { "toggle-fold", on_toggle_fold, NULL, NULL, NULL, { 0 } },
+    { "fold-others", on_fold_others, NULL, NULL, NULL, { 0 } },
+    { "unfold-all", on_unfold_all, NULL, NULL, NULL, { 0 } },
+};
+
+static void load_css_once(void) {
+    static gboolean loaded = FALSE;
+    if (loaded) return;
+    loaded = TRUE;
+
+    // Tilføj lidt CSS styling til toolbaren
+    GtkCssProvider *provider = gtk_css_provider_new();
+    gtk_css_provider_load_from_string(provider, 
+        ".toolbar { background-color: @theme_bg_color; border-bottom: 1px solid @borders; padding: 8px; margin: 4px; }"
+        ".toolbar button { padding: 4px 8px; min-height: 24px; }"
+        ".perf-hud { font-family: monospace; font-size: smaller; padding: 6px 10px; border-radius: 6px; }"
+        ".perf-hud.slow { color: #ff7b63; }"
+        ".io-progress { padding: 8px 12px; border-radius: 8px; }");
+    gtk_style_context_add_provider_for_display(
+        gdk_display_get_default(),
+        GTK_STYLE_PROVIDER(provider),
+        GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    g_object_unref(provider);
+}
+
+// Builds a window for the current document. With shared_buffer the window is
+// another view of an open document; otherwise the document is loaded.
+static GtkWidget *create_document_window(GtkApplication *app, GtkTextBuffer *shared_buffer) {
     GtkBuilder *builder = gtk_builder_new_from_file("../ui/main_window.ui");
     if (!builder) {
         g_critical("Failed to load UI file main_window.ui");
-        return;
+        return NULL;
     }
 
     GtkWidget *window = GTK_WIDGET(gtk_builder_get_object(builder, "main_window"));
     if (!window) {
         g_critical("Failed to get main_window from UI");
         g_object_unref(builder);
-        return;
+        return NULL;
     }
     gtk_window_set_application(GTK_WINDOW(window), GTK_APPLICATION(app));
 
@@ -324,7 +879,7 @@ static void app_activate(GApplication *application) {
     if (!text_view) {
         g_critical("Failed to get text_view from UI");
         g_object_unref(builder);
-        return;
+        return NULL;
     }
     
     // Opret toolbar og tilføj til container
@@ -332,24 +887,24 @@ static void app_activate(GApplication *application) {
     if (!toolbar_container) {
         g_critical("Failed to get toolbar_container from UI");
         g_object_unref(builder);
-        return;
+        return NULL;
     }
     
-    // Tilføj lidt CSS styling til toolbaren
-    GtkCssProvider *provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_string(provider, 
-        ".toolbar { background-color: @theme_bg_color; border-bottom: 1px solid @borders; padding: 8px; margin: 4px; }"
-        ".toolbar button { padding: 4px 8px; min-height: 24px; }");
-    gtk_style_context_add_provider_for_display(
-        gdk_display_get_default(),
-        GTK_STYLE_PROVIDER(provider),
-        GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-    g_object_unref(provider);
+    load_css_once();
     
     // Sørg for at builder associeres med window, så vi kan få det fra ethvert widget
     // der er forbundet med vinduet
     g_object_set_data(G_OBJECT(window), "builder", builder);
     g_object_ref(builder); // Hold en reference til builder
+
+    // A second view only shares the buffer; nothing is parsed again
+    if (shared_buffer) {
+        gtk_text_view_set_buffer(GTK_TEXT_VIEW(text_view), shared_buffer);
+        gtk_text_view_set_monospace(GTK_TEXT_VIEW(text_view), source_mode_is_source(shared_buffer));
+    }
+    document_views_add(GTK_TEXT_VIEW(text_view));
+    scheduler_follow_frame_clock(text_view);
+    g_action_map_add_action_entries(G_ACTION_MAP(window), window_actions, G_N_ELEMENTS(window_actions), window);
     
     // Opret toolbar og tilføj til UI
     GtkWidget *toolbar = create_toolbar(text_view);
@@ -360,14 +915,36 @@ static void app_activate(GApplication *application) {
         g_print("Toolbar er nu synlig og aktiv\n");
     }
 
-    // Opsæt key controller til at detektere Ctrl+C
+    // Performance HUD ligger oven på editoren og vises med F12
+    GtkWidget *editor_overlay = GTK_WIDGET(gtk_builder_get_object(builder, "editor_overlay"));
+    if (editor_overlay) {
+        perf_hud_attach(text_view, editor_overlay);
+    }
+
+    // Opsæt key controller til at detektere Ctrl+C og F12
     GtkEventController *key_controller = gtk_event_controller_key_new();
     g_signal_connect(key_controller, "key-pressed", G_CALLBACK(on_key_pressed), text_view);
     gtk_widget_add_controller(text_view, key_controller);
 
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
-    load_markdown_to_buffer(buffer);
-    g_signal_connect(buffer, "changed", G_CALLBACK(on_text_changed), NULL);
+    if (!shared_buffer) {
+        GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+        gboolean from_cache = FALSE;
+        g_autofree gchar *saved_digest = load_markdown_to_buffer(buffer, &from_cache);
+        attach_document_buffer(buffer, saved_digest);
+        if (from_cache) {
+            file_monitor_verify(buffer);
+        }
+    }
+
+    // Open/Save-knapperne i header bar
+    setup_document_ui(builder, window, text_view, toolbar_container);
+    DocumentUi *ui = g_object_get_data(G_OBJECT(window), "document-ui");
+    if (ui) {
+        document_ui_update_toolbar(ui);
+    }
+
+    // Stavekontrol i baggrunden
+    spell_check_attach(GTK_TEXT_VIEW(text_view));
 
     // Tilføj signal for window close
     g_signal_connect(window, "close-request", G_CALLBACK(on_window_close_request), text_view);
@@ -376,17 +953,77 @@ static void app_activate(GApplication *application) {
     g_signal_connect_swapped(window, "destroy", G_CALLBACK(g_object_unref), builder);
 
     gtk_window_present(GTK_WINDOW(window));
-    // Vi frigiver ikke builder her, da vi gemmer en reference i window-objektet
-    // Den frigives, når window ødelægges
+    // Window-objektet beholder sin egen reference til builder, som frigives når window ødelægges
+    g_object_unref(builder);
+    return window;
+}
+
+static void app_activate(GApplication *application) {
+    GtkApplication *app = GTK_APPLICATION(application);
+    static const char *const new_view_accels[] = { "<Control><Shift>n", NULL };
+    static const char *const split_view_accels[] = { "<Control>backslash", NULL };
+    static const char *const toggle_source_accels[] = { "<Control>slash", NULL };
+    static const char *const print_accels[] = { "<Control>p", NULL };
+    static const char *const toggle_fold_accels[] = { "<Control>bracketleft", NULL };
+    static const char *const fold_others_accels[] = { "<Control>bracketright", NULL };
+    gtk_application_set_accels_for_action(app, "win.new-view", new_view_accels);
+    gtk_application_set_accels_for_action(app, "win.split-view", split_view_accels);
+    gtk_application_set_accels_for_action(app, "win.toggle-source", toggle_source_accels);
+    gtk_application_set_accels_for_action(app, "win.print", print_accels);
+    gtk_application_set_accels_for_action(app, "win.toggle-fold", toggle_fold_accels);
+    gtk_application_set_accels_for_action(app, "win.fold-others", fold_others_accels);
+
+    // Launching again while running opens another view of the document, not another copy
+    GtkWindow *active = gtk_application_get_active_window(app);
+    if (active) {
+        gtk_widget_activate_action(GTK_WIDGET(active), "win.new-view", NULL);
+        return;
+    }
+    create_document_window(app, NULL);
+}
+
+// Handles command line options before the application is registered.
+static gint on_handle_local_options(G_GNUC_UNUSED GApplication *application,
+                                    GVariantDict *options,
+                                    G_GNUC_UNUSED gpointer user_data) {
+  const gchar *normalize_dir = NULL;
+  gint jobs = 0;
+
+  if (g_variant_dict_contains (options, "stats")) {
+    perf_trace_set_consumer (PERF_CONSUMER_STATS, TRUE);
+  }
+
+  // Batch mode runs here, before the application registers or opens a display
+  if (g_variant_dict_lookup (options, "normalize", "^&ay", &normalize_dir)) {
+    g_variant_dict_lookup (options, "jobs", "i", &jobs);
+    return batch_normalize_directory (normalize_dir, jobs, g_variant_dict_contains (options, "check"));
+  }
+  return -1; // Continue normal startup
 }
 
 int main (int argc, char *argv[]) {
   g_autoptr (AdwApplication) app = NULL;
   int status;
 
+  perf_trace_init ();
+  perf_policy_init ();
+
   app = adw_application_new ("com.example.MiniTextEditor", G_APPLICATION_DEFAULT_FLAGS);
+  g_application_add_main_option (G_APPLICATION (app), "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                                 "Write per-operation counts and latency histograms as JSON to stderr on exit", NULL);
+  g_application_add_main_option (G_APPLICATION (app), "normalize", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+                                 "Import and re-export every .md file below DIR without opening a window", "DIR");
+  g_application_add_main_option (G_APPLICATION (app), "jobs", 'j', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+                                 "Number of worker threads for --normalize (default: one per CPU)", "N");
+  g_application_add_main_option (G_APPLICATION (app), "check", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+                                 "With --normalize, only report files that would change", NULL);
+  g_signal_connect (app, "handle-local-options", G_CALLBACK (on_handle_local_options), NULL);
   g_signal_connect (app, "activate", G_CALLBACK (app_activate), NULL);
   status = g_application_run (G_APPLICATION (app), argc, argv);
 
+  if (g_atomic_int_get (&perf_trace_consumers) & PERF_CONSUMER_STATS) {
+    perf_trace_write_stats_json (stderr);
+  }
+
   return status;
 }
\ No newline at end of file
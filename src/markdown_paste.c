@@ -0,0 +1,179 @@
+#include "markdown_paste.h"
+#include "document_views.h"
+#include "parallel_parse.h"
+#include "perf_trace.h"
+#include "render_plan.h"
+#include "scheduler.h"
+#include "text_scan.h"
+#include <string.h>
+
+#define MARKDOWN_PASTE_KEY "gtktext-markdown-paste"
+
+// One paste, from reading the clipboard until the last piece is inserted
+typedef struct {
+    GtkTextBuffer *buffer;      // Owned, so the paste can finish after its window is closed
+    GtkTextView *view;          // Scrolled to the end of the paste; weak, and NULL for markdown_paste_text()
+    gchar *text;
+    gsize length;
+    gboolean valid;             // text is UTF-8
+    RenderPlan *plan;           // NULL if cmark failed
+    RenderPlanPosition position;
+    GtkTextMark *mark;          // Where the next piece goes; moves past each one
+    guint insert_job;           // Inserting the plan, once it is parsed
+    PerfSpan span;
+} Paste;
+
+static void paste_clear(gpointer data) {
+    Paste *paste = data;
+    g_clear_weak_pointer(&paste->view);
+    g_free(paste->text);
+    render_plan_free(paste->plan);
+    g_object_unref(paste->buffer);
+}
+
+static void paste_unref(gpointer data) {
+    g_rc_box_release_full(data, paste_clear);
+}
+
+static Paste *paste_new(GtkTextBuffer *buffer, GtkTextView *view) {
+    Paste *paste = g_rc_box_new0(Paste);
+    paste->buffer = g_object_ref(buffer);
+    g_set_weak_pointer(&paste->view, view);
+    paste->span = perf_span_begin(PERF_OP_CLIPBOARD_PASTE);
+    // The buffer keeps a borrowed pointer while the paste is pending
+    g_object_set_data(G_OBJECT(buffer), MARKDOWN_PASTE_KEY, paste);
+    return paste;
+}
+
+static void paste_finish(Paste *paste) {
+    g_object_set_data(G_OBJECT(paste->buffer), MARKDOWN_PASTE_KEY, NULL);
+    perf_span_end(&paste->span);
+}
+
+gboolean markdown_paste_is_pending(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    return g_object_get_data(G_OBJECT(buffer), MARKDOWN_PASTE_KEY) != NULL;
+}
+
+// Ends the paste once the whole plan is in, at iter
+static void paste_inserted(Paste *paste, GtkTextIter *iter) {
+    paste->insert_job = 0;
+    gtk_text_buffer_place_cursor(paste->buffer, iter);
+    gtk_text_buffer_delete_mark(paste->buffer, paste->mark);
+    paste->mark = NULL;
+    gtk_text_buffer_end_user_action(paste->buffer);
+    document_views_set_editable(paste->buffer, TRUE);
+    if (paste->view) {
+        gtk_text_view_scroll_mark_onscreen(paste->view, gtk_text_buffer_get_insert(paste->buffer));
+    }
+    paste_finish(paste);
+}
+
+static gboolean paste_insert_slice(SchedulerJob *job, gint64 deadline_us, gpointer user_data) {
+    Paste *paste = user_data;
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_mark(paste->buffer, &iter, paste->mark);
+    if (!render_plan_insert(paste->plan, paste->buffer, &iter, &paste->position, deadline_us)) {
+        // Only the first slice may hold up a frame
+        scheduler_job_set_lane(job, SCHEDULER_LANE_VISIBLE);
+        return TRUE;
+    }
+    paste_inserted(paste, &iter);
+    return FALSE;
+}
+
+static void paste_parse(G_GNUC_UNUSED SchedulerJob *job, gpointer user_data) {
+    Paste *paste = user_data;
+    TextLineIndex *lines = NULL;
+    paste->valid = text_scan(paste->text, &paste->length, &lines, NULL);
+    if (paste->valid) {
+        paste->plan = parallel_parse_markdown(paste->text, lines, 0);
+    }
+    if (paste->plan) {
+        render_plan_trim_end(paste->plan);
+    }
+    text_line_index_free(lines);
+}
+
+// Replaces the selection and starts inserting the plan where it was
+static void paste_parsed(gpointer user_data) {
+    Paste *paste = user_data;
+    if (!paste->valid) {
+        g_message("The pasted text is not valid UTF-8");
+        paste_finish(paste);
+        return;
+    }
+
+    gtk_text_buffer_begin_user_action(paste->buffer);
+    gtk_text_buffer_delete_selection(paste->buffer, TRUE, TRUE);
+    if (!paste->plan) {
+        g_message("Could not parse the pasted Markdown; pasting it as plain text");
+        gtk_text_buffer_insert_at_cursor(paste->buffer, paste->text, (gint)paste->length);
+        gtk_text_buffer_end_user_action(paste->buffer);
+        paste_finish(paste);
+        return;
+    }
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_mark(paste->buffer, &iter, gtk_text_buffer_get_insert(paste->buffer));
+    paste->mark = gtk_text_buffer_create_mark(paste->buffer, NULL, &iter, FALSE);
+    // Typing between slices would land inside the paste and its undo step
+    document_views_set_editable(paste->buffer, FALSE);
+    // Not tied to the buffer, whose generation the paste's own pieces advance
+    paste->insert_job = scheduler_add_slice(NULL, SCHEDULER_LANE_INPUT, paste_insert_slice,
+                                            g_rc_box_acquire(paste), paste_unref);
+}
+
+static void paste_start(Paste *paste, gchar *text) {
+    paste->text = text;
+    paste->length = strlen(text);
+    scheduler_add_work(NULL, SCHEDULER_LANE_INPUT, paste_parse, paste_parsed, paste, paste_unref);
+}
+
+void markdown_paste_flush(GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    Paste *paste = g_object_get_data(G_OBJECT(buffer), MARKDOWN_PASTE_KEY);
+    // While the paste is read or parsed it hasn't touched the buffer yet
+    if (!paste || !paste->mark) return;
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_mark(paste->buffer, &iter, paste->mark);
+    render_plan_insert(paste->plan, paste->buffer, &iter, &paste->position, 0);
+    guint job = paste->insert_job;
+    paste_inserted(paste, &iter);
+    // Releases the slice job's reference, so only after the paste is done with
+    scheduler_cancel(job);
+}
+
+gboolean markdown_paste_text(GtkTextBuffer *buffer, const char *markdown) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(markdown != NULL, FALSE);
+
+    if (markdown_paste_is_pending(buffer)) return FALSE;
+    paste_start(paste_new(buffer, NULL), g_strdup(markdown));
+    return TRUE;
+}
+
+static void on_clipboard_read(GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    Paste *paste = user_data;
+    GError *error = NULL;
+    gchar *text = gdk_clipboard_read_text_finish(GDK_CLIPBOARD(source_object), result, &error);
+    if (!text) {
+        // Also when the clipboard holds no text, such as an image
+        g_message("Could not read the clipboard: %s", error ? error->message : "no text");
+        g_clear_error(&error);
+        paste_finish(paste);
+        paste_unref(paste);
+        return;
+    }
+    paste_start(paste, text);
+}
+
+void markdown_paste(GtkTextView *view) {
+    g_return_if_fail(GTK_IS_TEXT_VIEW(view));
+
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+    if (!gtk_text_view_get_editable(view) || markdown_paste_is_pending(buffer)) return;
+    GdkClipboard *clipboard = gtk_widget_get_clipboard(GTK_WIDGET(view));
+    gdk_clipboard_read_text_async(clipboard, NULL, on_clipboard_read, paste_new(buffer, view));
+}
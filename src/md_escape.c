@@ -0,0 +1,188 @@
+#include "md_escape.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Character classes; bit flags
+enum {
+    MD_CHAR_INLINE = 1 << 0,      // May need escaping anywhere
+    MD_CHAR_LINE_START = 1 << 1,  // May start a block at the start of a line
+};
+
+static const guint8 md_char_class[256] = {
+    ['\\'] = MD_CHAR_INLINE,
+    ['*'] = MD_CHAR_INLINE,
+    ['_'] = MD_CHAR_INLINE,
+    ['`'] = MD_CHAR_INLINE,
+    ['['] = MD_CHAR_INLINE,
+    [']'] = MD_CHAR_INLINE,
+    ['<'] = MD_CHAR_INLINE,  // Not escaped; starts an HTML tag to skip
+    ['#'] = MD_CHAR_LINE_START,
+    ['>'] = MD_CHAR_LINE_START,
+    ['+'] = MD_CHAR_LINE_START,
+    ['-'] = MD_CHAR_LINE_START,
+    ['='] = MD_CHAR_LINE_START,
+    ['~'] = MD_CHAR_LINE_START,
+};
+
+// Returns the offset of the first byte at or after i with MD_CHAR_INLINE set, or length
+static gsize skip_plain(const char *text, gsize i, gsize length) {
+#ifdef __SSE2__
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i underscore = _mm_set1_epi8('_');
+    const __m128i backtick = _mm_set1_epi8('`');
+    const __m128i open = _mm_set1_epi8('[');
+    const __m128i close = _mm_set1_epi8(']');
+    const __m128i less = _mm_set1_epi8('<');
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, star)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, underscore), _mm_cmpeq_epi8(v, backtick)));
+        hit = _mm_or_si128(hit, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close)),
+                                             _mm_cmpeq_epi8(v, less)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return i + (gsize)__builtin_ctz((unsigned int)mask);
+    }
+#endif
+    while (i < length && !(md_char_class[(guchar)text[i]] & MD_CHAR_INLINE)) i++;
+    return i;
+}
+
+static inline char byte_at(const char *text, gsize length, gsize i, char next) {
+    return i < length ? text[i] : next;
+}
+
+static inline gboolean is_space_or_eol(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Only spaces and tabs from i to the end of the line
+static gboolean rest_is_blank(const char *text, gsize length, gsize i, char next) {
+    for (; i < length && text[i] != '\n'; i++) {
+        if (text[i] != ' ' && text[i] != '\t') return FALSE;
+    }
+    return i < length || next == '\n';
+}
+
+// Whether the first byte of a line would start a block unless escaped
+static gboolean starts_block(const char *text, gsize length, char next) {
+    gsize run = 1;
+    while (run < length && text[run] == text[0]) run++;
+
+    switch (text[0]) {
+        case '#':
+            return run <= 6 && is_space_or_eol(byte_at(text, length, run, next));
+        case '>':
+            return TRUE;
+        case '+':
+            return is_space_or_eol(byte_at(text, length, 1, next));
+        case '~':
+            return run >= 3;
+        case '-':
+            // A list item, setext underline or thematic break
+            return is_space_or_eol(byte_at(text, length, 1, next)) || rest_is_blank(text, length, run, next);
+        case '=':
+            return rest_is_blank(text, length, run, next);
+        default:
+            return FALSE;
+    }
+}
+
+// Returns the number of digits of an ordered list marker starting text, "1." or "1)", or 0
+static gsize ordered_marker_digits(const char *text, gsize length, char next) {
+    gsize digits = 0;
+    while (digits < length && digits < 10 && g_ascii_isdigit(text[digits])) digits++;
+    if (digits == 0 || digits > 9 || digits >= length) return 0;
+    if (text[digits] != '.' && text[digits] != ')') return 0;
+    return is_space_or_eol(byte_at(text, length, digits + 1, next)) ? digits : 0;
+}
+
+// Returns the length of the HTML tag at text[i], or 0 if there is none
+static gsize html_tag_length(const char *text, gsize i, gsize length) {
+    char c = byte_at(text, length, i + 1, 0);
+    if (!g_ascii_isalpha(c) && c != '/' && c != '!' && c != '?') return 0;
+    const char *end = memchr(text + i, '>', length - i);
+    return end ? (gsize)(end - (text + i)) + 1 : 0;
+}
+
+void md_escape_append(MdWriter *md, const char *text, gsize length, MdEscapeContext context, char next) {
+    if (length == 0) return;
+    if (context & MD_ESCAPE_VERBATIM) {
+        md_writer_append_len(md, text, length);
+        return;
+    }
+    gsize plain = 0; // Start of the bytes not yet appended
+    if (context & MD_ESCAPE_LINE_START && !rest_is_blank(text, length, 0, next)) {
+        // Up to three spaces may come before a block's marker; more, or a tab, start indented code
+        gsize indent = 0;
+        while (indent < length && indent < 3 && text[indent] == ' ') indent++;
+        const char *line = text + indent;
+        gsize line_length = length - indent;
+        gsize digits = line_length > 0 ? ordered_marker_digits(line, line_length, next) : 0;
+        gboolean code = line_length > 0 && (line[0] == ' ' || line[0] == '\t');
+        gboolean block = code || digits > 0 ||
+                         (line_length > 0 && (md_char_class[(guchar)line[0]] & MD_CHAR_LINE_START) &&
+                          starts_block(line, line_length, next));
+
+        if (block && (indent > 0 || code)) {
+            // An entity is not whitespace to the block parser, so the line stays a paragraph
+            // and keeps its indentation
+            md_writer_append(md, text[0] == '\t' ? "&#9;" : "&#32;");
+            plain = 1;
+        } else if (digits > 0) {
+            md_writer_append_len(md, text, digits);
+            md_writer_append_c(md, '\\');
+            plain = digits;
+        } else if (block) {
+            md_writer_append_c(md, '\\');
+        } else if (line_length > 0 && line[0] == '*' && byte_at(line, line_length, 1, next) == ' ') {
+            // A list item the importer wrote as "* "
+            md_writer_append_len(md, text, indent + 1);
+            plain = indent + 1;
+        }
+    }
+    // A marker ends the word next to it, whatever the character on its other side
+    if (context & MD_ESCAPE_BEFORE_MARKER) next = 0;
+
+    for (gsize i = skip_plain(text, plain, length); i < length; i = skip_plain(text, i, length)) {
+        char c = text[i];
+        gboolean escape = TRUE;
+        if (c == '<') {
+            // Copied as is, so the characters of an attribute aren't escaped
+            gsize tag = html_tag_length(text, i, length);
+            i += tag > 0 ? tag : 1;
+            continue;
+        } else if (c == '_') {
+            // Inside a word it can neither open nor close emphasis
+            char before = i > 0 ? text[i - 1] : (context & MD_ESCAPE_AFTER_MARKER) ? 0 : md_writer_last_char(md, 1);
+            escape = !(g_ascii_isalnum(before) && g_ascii_isalnum(byte_at(text, length, i + 1, next)));
+        } else if (c == '\\') {
+            // Only escapes punctuation, or makes a hard break before a newline
+            char after = byte_at(text, length, i + 1, next);
+            escape = after == '\n' || after == 0 || g_ascii_ispunct(after);
+        }
+        if (escape) {
+            md_writer_append_len(md, text + plain, i - plain);
+            md_writer_append_c(md, '\\');
+            plain = i;
+        }
+        i++;
+    }
+    md_writer_append_len(md, text + plain, length - plain);
+}
+
+gsize md_escape_code_delimiter(const char *text, gsize length, gboolean *pad) {
+    gsize longest = 0, run = 0;
+    gboolean all_spaces = TRUE;
+    for (gsize i = 0; i < length; i++) {
+        run = text[i] == '`' ? run + 1 : 0;
+        longest = MAX(longest, run);
+        if (text[i] != ' ') all_spaces = FALSE;
+    }
+    *pad = length > 0 &&
+           (text[0] == '`' || text[length - 1] == '`' ||
+            (text[0] == ' ' && text[length - 1] == ' ' && !all_spaces));
+    return longest + 1;
+}
@@ -0,0 +1,60 @@
+#include "md_hash_stream.h"
+
+struct _MdHashOutputStream {
+    GOutputStream parent_instance;
+
+    GChecksum *checksum;
+    guint64 size;
+    gboolean finalized;  // get_digest() was called; GChecksum accepts no more data
+};
+
+G_DEFINE_FINAL_TYPE(MdHashOutputStream, md_hash_output_stream, G_TYPE_OUTPUT_STREAM)
+
+static gssize md_hash_output_stream_write(GOutputStream *stream, const void *buffer, gsize count,
+                                          G_GNUC_UNUSED GCancellable *cancellable, GError **error) {
+    MdHashOutputStream *self = MD_HASH_OUTPUT_STREAM(stream);
+
+    if (self->finalized) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_CLOSED, "Checksum already finalized");
+        return -1;
+    }
+    // GChecksum takes a gssize length
+    count = MIN(count, (gsize)G_MAXSSIZE);
+    g_checksum_update(self->checksum, buffer, (gssize)count);
+    self->size += count;
+    return (gssize)count;
+}
+
+static void md_hash_output_stream_finalize(GObject *object) {
+    MdHashOutputStream *self = MD_HASH_OUTPUT_STREAM(object);
+    g_checksum_free(self->checksum);
+    G_OBJECT_CLASS(md_hash_output_stream_parent_class)->finalize(object);
+}
+
+static void md_hash_output_stream_class_init(MdHashOutputStreamClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS(klass);
+
+    object_class->finalize = md_hash_output_stream_finalize;
+    stream_class->write_fn = md_hash_output_stream_write;
+}
+
+static void md_hash_output_stream_init(G_GNUC_UNUSED MdHashOutputStream *self) {
+}
+
+GOutputStream *md_hash_output_stream_new(GChecksumType checksum_type) {
+    MdHashOutputStream *self = g_object_new(MD_TYPE_HASH_OUTPUT_STREAM, NULL);
+    self->checksum = g_checksum_new(checksum_type);
+    return G_OUTPUT_STREAM(self);
+}
+
+const char *md_hash_output_stream_get_digest(MdHashOutputStream *stream) {
+    g_return_val_if_fail(MD_IS_HASH_OUTPUT_STREAM(stream), NULL);
+    stream->finalized = TRUE;
+    return g_checksum_get_string(stream->checksum);
+}
+
+guint64 md_hash_output_stream_get_size(MdHashOutputStream *stream) {
+    g_return_val_if_fail(MD_IS_HASH_OUTPUT_STREAM(stream), 0);
+    return stream->size;
+}
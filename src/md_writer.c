@@ -0,0 +1,94 @@
+#include "md_writer.h"
+#include <string.h>
+
+void md_writer_init(MdWriter *md, GOutputStream *stream, GCancellable *cancellable) {
+    memset(md, 0, sizeof(*md));
+    md->stream = stream;
+    md->cancellable = cancellable;
+    md->chunk = g_malloc(MD_WRITER_CHUNK_SIZE);
+}
+
+static void md_writer_flush(MdWriter *md, gsize keep) {
+    if (md->error || md->len <= keep) return;
+    gsize flush_len = md->len - keep;
+    if (!g_output_stream_write_all(md->stream, md->chunk, flush_len, NULL, md->cancellable, &md->error)) {
+        return;
+    }
+    if (md->checksum) {
+        g_checksum_update(md->checksum, (const guchar *)md->chunk, (gssize)flush_len);
+    }
+    memmove(md->chunk, md->chunk + flush_len, keep);
+    md->len = keep;
+}
+
+gboolean md_writer_finish(MdWriter *md, GError **error) {
+    md_writer_flush(md, 0);
+    g_clear_pointer(&md->chunk, g_free);
+    if (md->error) {
+        g_propagate_error(error, md->error);
+        md->error = NULL;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void md_writer_append_len(MdWriter *md, const char *text, gsize text_len) {
+    if (md->capture) {
+        g_byte_array_append(md->capture, (const guint8 *)text, (guint)text_len);
+    }
+    md->total_len += text_len;
+    while (text_len > 0) {
+        if (md->len == MD_WRITER_CHUNK_SIZE) {
+            md_writer_flush(md, MD_WRITER_TAIL);
+            if (md->error) return;
+        }
+        gsize n = MIN(text_len, MD_WRITER_CHUNK_SIZE - md->len);
+        memcpy(md->chunk + md->len, text, n);
+        md->len += n;
+        text += n;
+        text_len -= n;
+    }
+}
+
+void md_writer_append(MdWriter *md, const char *text) {
+    md_writer_append_len(md, text, strlen(text));
+}
+
+void md_writer_append_c(MdWriter *md, char c) {
+    md_writer_append_len(md, &c, 1);
+}
+
+void md_writer_append_unichar(MdWriter *md, gunichar c) {
+    char utf8[6];
+    md_writer_append_len(md, utf8, (gsize)g_unichar_to_utf8(c, utf8));
+}
+
+char md_writer_last_char(const MdWriter *md, gsize back) {
+    g_assert(back <= MD_WRITER_TAIL);
+    return md->len >= back ? md->chunk[md->len - back] : 0;
+}
+
+void md_writer_truncate_last(MdWriter *md) {
+    if (md->len == 0) return;
+    md->len--;
+    md->total_len--;
+    if (md->capture) {
+        if (md->capture->len > 0) {
+            g_byte_array_set_size(md->capture, md->capture->len - 1);
+        } else {
+            md->capture_dropped++;
+        }
+    }
+}
+
+void md_writer_begin_capture(MdWriter *md, GByteArray *capture) {
+    md->capture = capture;
+    md->capture_dropped = 0;
+}
+
+guint md_writer_end_capture(MdWriter *md) {
+    guint dropped = md->capture_dropped;
+    md->capture = NULL;
+    md->capture_dropped = 0;
+    return dropped;
+}
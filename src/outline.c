@@ -0,0 +1,453 @@
+#include "outline.h"
+#include "format_mask.h"
+#include "scheduler.h"
+
+#define OUTLINE_KEY "gtktext-outline"
+// Marks a folded heading, which would otherwise look like one with an empty section
+#define OUTLINE_FOLDED_HEADING_TAG "folded-heading"
+
+typedef struct {
+    GtkTextMark *mark;  // On the heading's line; right gravity, so text typed before it or a new line above keeps it there
+    guint level;        // 1 to 6
+    gboolean folded;
+    GtkTextMark *fold_start;  // Where the folded tag is applied, while it is; NULL otherwise
+    GtkTextMark *fold_end;
+} OutlineHeading;
+
+// A heading line found in the buffer
+typedef struct {
+    gint line;
+    guint level;
+} HeadingLine;
+
+typedef struct {
+    GtkTextBuffer *buffer;      // Not owned; the outline is its data
+    GArray *headings;           // OutlineHeading, in buffer order
+    GArray *cleared;            // Offset pairs of folds taken off since the folds were last applied
+    GtkTextTag *folded_tag;
+    GtkTextTag *folded_heading_tag;
+    gboolean dirty;             // The headings may be out of date
+    gboolean has_folds;         // The tags may be applied somewhere
+    guint refresh_job;
+} Outline;
+
+static void outline_free(gpointer data) {
+    Outline *outline = data;
+    g_clear_handle_id(&outline->refresh_job, scheduler_cancel);
+    // The marks go with the buffer
+    g_array_unref(outline->headings);
+    g_array_unref(outline->cleared);
+    g_free(outline);
+}
+
+static gint compare_heading_lines(gconstpointer a, gconstpointer b) {
+    const HeadingLine *line_a = a;
+    const HeadingLine *line_b = b;
+    if (line_a->line != line_b->line) {
+        return line_a->line < line_b->line ? -1 : 1;
+    }
+    return (line_a->level > line_b->level) - (line_a->level < line_b->level);
+}
+
+// Every non-empty line with a heading tag; jumps from toggle to toggle
+static GArray *find_heading_lines(GtkTextBuffer *buffer) {
+    GArray *lines = g_array_new(FALSE, FALSE, sizeof(HeadingLine));
+    GtkTextTagTable *table = gtk_text_buffer_get_tag_table(buffer);
+    for (guint level = 1; level <= 6; level++) {
+        GtkTextTag *tag = gtk_text_tag_table_lookup(table, format_bit_get_tag_name(format_bit_for_heading((int)level)));
+        if (!tag) continue;
+
+        GtkTextIter start;
+        gtk_text_buffer_get_start_iter(buffer, &start);
+        if (!gtk_text_iter_has_tag(&start, tag) && !gtk_text_iter_forward_to_tag_toggle(&start, tag)) continue;
+        while (!gtk_text_iter_is_end(&start)) {
+            GtkTextIter end = start;
+            gtk_text_iter_forward_to_tag_toggle(&end, tag);
+            GtkTextIter line = start;
+            if (gtk_text_iter_ends_line(&line) && !gtk_text_iter_starts_line(&line)) {
+                gtk_text_iter_forward_line(&line);  // Only the line break before the heading
+            } else {
+                gtk_text_iter_set_line_offset(&line, 0);  // Text typed in front of a heading doesn't get its tag
+            }
+            while (gtk_text_iter_compare(&line, &end) < 0) {
+                if (!gtk_text_iter_ends_line(&line)) {
+                    HeadingLine heading = { gtk_text_iter_get_line(&line), level };
+                    g_array_append_val(lines, heading);
+                }
+                if (!gtk_text_iter_forward_line(&line)) break;
+            }
+            start = end;
+            if (!gtk_text_iter_forward_to_tag_toggle(&start, tag)) break;
+        }
+    }
+    g_array_sort(lines, compare_heading_lines);
+    return lines;
+}
+
+// Takes a heading's folded tags off, noting where so folds around it are applied again
+static void unfold(Outline *outline, OutlineHeading *heading) {
+    if (!heading->fold_start) return;
+    GtkTextBuffer *buffer = outline->buffer;
+    GtkTextIter line_start, start, end;
+    gtk_text_buffer_get_iter_at_mark(buffer, &line_start, heading->mark);
+    gtk_text_buffer_get_iter_at_mark(buffer, &start, heading->fold_start);
+    gtk_text_buffer_get_iter_at_mark(buffer, &end, heading->fold_end);
+    gtk_text_buffer_remove_tag(buffer, outline->folded_tag, &start, &end);
+    if (gtk_text_iter_compare(&line_start, &start) < 0) {
+        gtk_text_buffer_remove_tag(buffer, outline->folded_heading_tag, &line_start, &start);
+    }
+    gint cleared[2] = { gtk_text_iter_get_offset(&start), gtk_text_iter_get_offset(&end) };
+    g_array_append_vals(outline->cleared, cleared, 2);
+    gtk_text_buffer_delete_mark(buffer, heading->fold_start);
+    gtk_text_buffer_delete_mark(buffer, heading->fold_end);
+    heading->fold_start = NULL;
+    heading->fold_end = NULL;
+}
+
+// From the end of the heading's line to the line break before the next heading of its level or higher
+static gboolean fold_range(Outline *outline, guint index, GtkTextIter *line_start, GtkTextIter *start,
+                           GtkTextIter *end) {
+    GtkTextBuffer *buffer = outline->buffer;
+    const OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, index);
+    gtk_text_buffer_get_iter_at_mark(buffer, line_start, heading->mark);
+    *start = *line_start;
+    if (!gtk_text_iter_ends_line(start)) {
+        gtk_text_iter_forward_to_line_end(start);
+    }
+    gtk_text_buffer_get_end_iter(buffer, end);
+    for (guint j = index + 1; j < outline->headings->len; j++) {
+        const OutlineHeading *next = &g_array_index(outline->headings, OutlineHeading, j);
+        if (next->level <= heading->level) {
+            gtk_text_buffer_get_iter_at_mark(buffer, end, next->mark);
+            gtk_text_iter_backward_char(end);
+            break;
+        }
+    }
+    return gtk_text_iter_compare(start, end) < 0;
+}
+
+/*
+ * Brings the folded tags in line with the fold states. Only folds whose
+ * range moved are taken off and put back, along with the folds around
+ * what was taken off, so an edit costs the sections it changed rather
+ * than the document.
+ */
+static void apply_folds(Outline *outline) {
+    GtkTextBuffer *buffer = outline->buffer;
+    guint n = outline->headings->len;
+    for (guint i = 0; i < n; i++) {
+        OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, i);
+        if (!heading->fold_start) continue;
+        GtkTextIter line_start, start, end, applied_start, applied_end;
+        if (heading->folded && fold_range(outline, i, &line_start, &start, &end)) {
+            gtk_text_buffer_get_iter_at_mark(buffer, &applied_start, heading->fold_start);
+            gtk_text_buffer_get_iter_at_mark(buffer, &applied_end, heading->fold_end);
+            if (gtk_text_iter_equal(&start, &applied_start) && gtk_text_iter_equal(&end, &applied_end)) continue;
+        }
+        unfold(outline, heading);
+    }
+
+    outline->has_folds = FALSE;
+    for (guint i = 0; i < n; i++) {
+        OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, i);
+        GtkTextIter line_start, start, end;
+        if (!heading->folded || !fold_range(outline, i, &line_start, &start, &end)) continue;
+        outline->has_folds = TRUE;
+
+        gboolean apply = heading->fold_start == NULL;
+        gint from = gtk_text_iter_get_offset(&start), to = gtk_text_iter_get_offset(&end);
+        for (guint c = 0; c + 1 < outline->cleared->len && !apply; c += 2) {
+            // A fold nested in this one was taken off inside it
+            apply = g_array_index(outline->cleared, gint, c) < to && g_array_index(outline->cleared, gint, c + 1) > from;
+        }
+        if (!apply) continue;
+        gtk_text_buffer_apply_tag(buffer, outline->folded_tag, &start, &end);
+        gtk_text_buffer_apply_tag(buffer, outline->folded_heading_tag, &line_start, &start);
+        if (!heading->fold_start) {
+            // Text typed at the end of the heading's line stays in front of the fold
+            heading->fold_start = gtk_text_buffer_create_mark(buffer, NULL, &start, FALSE);
+            heading->fold_end = gtk_text_buffer_create_mark(buffer, NULL, &end, TRUE);
+        }
+    }
+    g_array_set_size(outline->cleared, 0);
+}
+
+// Headings still on a heading line keep their mark and fold state
+static void rebuild(Outline *outline) {
+    GtkTextBuffer *buffer = outline->buffer;
+    GArray *lines = find_heading_lines(buffer);
+    GHashTable *by_line = g_hash_table_new(NULL, NULL);
+    for (guint i = 0; i < outline->headings->len; i++) {
+        OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, i);
+        GtkTextIter iter;
+        gtk_text_buffer_get_iter_at_mark(buffer, &iter, heading->mark);
+        gpointer key = GINT_TO_POINTER(gtk_text_iter_get_line(&iter) + 1);
+        if (g_hash_table_contains(by_line, key)) {
+            unfold(outline, heading);
+            gtk_text_buffer_delete_mark(buffer, heading->mark);  // Two headings were merged
+        } else {
+            g_hash_table_insert(by_line, key, heading);
+        }
+    }
+
+    GArray *headings = g_array_sized_new(FALSE, FALSE, sizeof(OutlineHeading), lines->len);
+    for (guint i = 0; i < lines->len; i++) {
+        const HeadingLine *line = &g_array_index(lines, HeadingLine, i);
+        if (i > 0 && g_array_index(lines, HeadingLine, i - 1).line == line->line) continue;
+
+        GtkTextIter iter;
+        gtk_text_buffer_get_iter_at_line(buffer, &iter, line->line);
+        gpointer key = GINT_TO_POINTER(line->line + 1);
+        OutlineHeading *old = g_hash_table_lookup(by_line, key);
+        OutlineHeading heading = { NULL, line->level, FALSE, NULL, NULL };
+        if (old) {
+            heading.mark = old->mark;
+            heading.folded = old->folded;
+            heading.fold_start = old->fold_start;
+            heading.fold_end = old->fold_end;
+            gtk_text_buffer_move_mark(buffer, heading.mark, &iter);
+            g_hash_table_remove(by_line, key);
+        } else {
+            heading.mark = gtk_text_buffer_create_mark(buffer, NULL, &iter, FALSE);
+        }
+        g_array_append_val(headings, heading);
+    }
+
+    // Headings that are gone
+    GHashTableIter gone;
+    gpointer value;
+    g_hash_table_iter_init(&gone, by_line);
+    while (g_hash_table_iter_next(&gone, NULL, &value)) {
+        unfold(outline, value);
+        gtk_text_buffer_delete_mark(buffer, ((OutlineHeading *)value)->mark);
+    }
+    g_hash_table_unref(by_line);
+    g_array_unref(lines);
+
+    g_array_unref(outline->headings);
+    outline->headings = headings;
+    outline->dirty = FALSE;
+}
+
+static void outline_update(Outline *outline) {
+    if (!outline->dirty) return;
+    g_clear_handle_id(&outline->refresh_job, scheduler_cancel);
+    rebuild(outline);
+    apply_folds(outline);
+}
+
+static gboolean refresh_slice(G_GNUC_UNUSED SchedulerJob *job, G_GNUC_UNUSED gint64 deadline_us, gpointer user_data) {
+    Outline *outline = user_data;
+    outline->refresh_job = 0;
+    outline_update(outline);
+    return FALSE;
+}
+
+// Folds are only reapplied ahead of a read while there are any
+static void mark_dirty(Outline *outline) {
+    outline->dirty = TRUE;
+    scheduler_cancel(outline->refresh_job);
+    outline->refresh_job = outline->has_folds
+        ? scheduler_add_slice(outline->buffer, SCHEDULER_LANE_BACKGROUND, refresh_slice, outline, NULL)
+        : 0;
+}
+
+// The last heading on or before a line, or -1; the marks keep their order through edits
+static gint heading_at_line(Outline *outline, gint line) {
+    gint low = 0;
+    gint high = (gint)outline->headings->len;
+    while (low < high) {
+        gint middle = low + (high - low) / 2;
+        GtkTextIter heading;
+        gtk_text_buffer_get_iter_at_mark(outline->buffer, &heading,
+                                         g_array_index(outline->headings, OutlineHeading, middle).mark);
+        if (gtk_text_iter_get_line(&heading) <= line) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+// An edit of lines first to last only changes the outline if one of them holds a heading
+static void edited(Outline *outline, const GtkTextIter *start, const GtkTextIter *end) {
+    if (outline->dirty) return;  // The rebuild to come covers it
+    gint index = heading_at_line(outline, gtk_text_iter_get_line(end));
+    if (index >= 0) {
+        GtkTextIter heading;
+        gtk_text_buffer_get_iter_at_mark(outline->buffer, &heading,
+                                         g_array_index(outline->headings, OutlineHeading, index).mark);
+        if (gtk_text_iter_get_line(&heading) >= gtk_text_iter_get_line(start)) {
+            mark_dirty(outline);
+            return;
+        }
+    }
+
+    // Text inserted into a folded section, as by a reload, is hidden with it
+    if (!outline->has_folds || gtk_text_iter_equal(start, end)) return;
+    guint level = G_MAXUINT;
+    for (gint i = index; i >= 0 && level > 1; i--) {
+        const OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, i);
+        if (heading->level >= level) continue;
+        level = heading->level;
+        if (!heading->fold_start) continue;
+        GtkTextIter fold_start, fold_end;
+        gtk_text_buffer_get_iter_at_mark(outline->buffer, &fold_start, heading->fold_start);
+        gtk_text_buffer_get_iter_at_mark(outline->buffer, &fold_end, heading->fold_end);
+        if (gtk_text_iter_compare(start, &fold_start) >= 0 && gtk_text_iter_compare(end, &fold_end) <= 0) {
+            gtk_text_buffer_apply_tag(outline->buffer, outline->folded_tag, start, end);
+            return;
+        }
+    }
+}
+
+static void on_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer user_data) {
+    GtkTextIter start = *location;
+    gtk_text_iter_backward_chars(&start, (gint)g_utf8_strlen(text, len));
+    edited(user_data, &start, location);
+}
+
+static void on_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                            G_GNUC_UNUSED GtkTextIter *end, gpointer user_data) {
+    // Both are where the text was; a heading whose line was joined to this one has its mark here
+    edited(user_data, start, start);
+}
+
+static void on_tag_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextTag *tag, G_GNUC_UNUSED GtkTextIter *start,
+                           G_GNUC_UNUSED GtkTextIter *end, gpointer user_data) {
+    int bit = format_bit_from_tag(tag);
+    if (bit >= 0 && (FORMAT_MASK(bit) & FORMAT_MASK_HEADINGS)) {
+        mark_dirty(user_data);
+    }
+}
+
+static Outline *outline_get(GtkTextBuffer *buffer) {
+    Outline *outline = g_object_get_data(G_OBJECT(buffer), OUTLINE_KEY);
+    if (!outline) {
+        outline = g_new0(Outline, 1);
+        outline->buffer = buffer;
+        outline->headings = g_array_new(FALSE, FALSE, sizeof(OutlineHeading));
+        outline->cleared = g_array_new(FALSE, FALSE, sizeof(gint));
+        outline->dirty = TRUE;
+        GtkTextTagTable *table = gtk_text_buffer_get_tag_table(buffer);
+        outline->folded_tag = gtk_text_tag_table_lookup(table, OUTLINE_FOLDED_TAG);
+        if (!outline->folded_tag) {
+            outline->folded_tag = gtk_text_buffer_create_tag(buffer, OUTLINE_FOLDED_TAG, "invisible", TRUE, NULL);
+        }
+        outline->folded_heading_tag = gtk_text_tag_table_lookup(table, OUTLINE_FOLDED_HEADING_TAG);
+        if (!outline->folded_heading_tag) {
+            outline->folded_heading_tag = gtk_text_buffer_create_tag(buffer, OUTLINE_FOLDED_HEADING_TAG, "underline",
+                                                                     PANGO_UNDERLINE_SINGLE, NULL);
+        }
+        g_object_set_data_full(G_OBJECT(buffer), OUTLINE_KEY, outline, outline_free);
+        // After the default handlers, so jobs belong to the new generation
+        g_signal_connect_after(buffer, "insert-text", G_CALLBACK(on_insert_text), outline);
+        g_signal_connect_after(buffer, "delete-range", G_CALLBACK(on_delete_range), outline);
+        g_signal_connect_after(buffer, "apply-tag", G_CALLBACK(on_tag_changed), outline);
+        g_signal_connect_after(buffer, "remove-tag", G_CALLBACK(on_tag_changed), outline);
+    }
+    outline_update(outline);
+    return outline;
+}
+
+void outline_attach(GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    outline_get(buffer);
+}
+
+guint outline_get_n_headings(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), 0);
+    return outline_get(buffer)->headings->len;
+}
+
+guint outline_get_heading(GtkTextBuffer *buffer, guint index, GtkTextIter *iter) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), 0);
+    Outline *outline = outline_get(buffer);
+    g_return_val_if_fail(index < outline->headings->len, 0);
+
+    const OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, index);
+    if (iter) {
+        gtk_text_buffer_get_iter_at_mark(buffer, iter, heading->mark);
+    }
+    return heading->level;
+}
+
+gint outline_find_section(GtkTextBuffer *buffer, const GtkTextIter *iter) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer) && iter != NULL, -1);
+    return heading_at_line(outline_get(buffer), gtk_text_iter_get_line(iter));
+}
+
+gboolean outline_is_folded(GtkTextBuffer *buffer, guint index) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    Outline *outline = outline_get(buffer);
+    g_return_val_if_fail(index < outline->headings->len, FALSE);
+    return g_array_index(outline->headings, OutlineHeading, index).folded;
+}
+
+// A cursor in hidden text goes to the end of its section's visible heading
+static void reveal_cursor(Outline *outline) {
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(outline->buffer, &cursor, gtk_text_buffer_get_insert(outline->buffer));
+    if (!gtk_text_iter_has_tag(&cursor, outline->folded_tag)) return;
+
+    gtk_text_iter_backward_to_tag_toggle(&cursor, outline->folded_tag);
+    gtk_text_buffer_place_cursor(outline->buffer, &cursor);
+}
+
+static void set_folds(Outline *outline, const gboolean *folded) {
+    for (guint i = 0; i < outline->headings->len; i++) {
+        g_array_index(outline->headings, OutlineHeading, i).folded = folded[i];
+    }
+    apply_folds(outline);
+    reveal_cursor(outline);
+}
+
+void outline_set_folded(GtkTextBuffer *buffer, guint index, gboolean folded) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    Outline *outline = outline_get(buffer);
+    g_return_if_fail(index < outline->headings->len);
+
+    OutlineHeading *heading = &g_array_index(outline->headings, OutlineHeading, index);
+    if (heading->folded == !!folded) return;
+    heading->folded = !!folded;
+    apply_folds(outline);
+    reveal_cursor(outline);
+}
+
+void outline_fold_others(GtkTextBuffer *buffer, const GtkTextIter *iter) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer) && iter != NULL);
+    Outline *outline = outline_get(buffer);
+    gint current = outline_find_section(buffer, iter);
+
+    g_autofree gboolean *folded = g_new(gboolean, MAX(outline->headings->len, 1));
+    for (guint i = 0; i < outline->headings->len; i++) {
+        folded[i] = TRUE;
+    }
+    if (current >= 0) {
+        // The section, the sections containing it, and the ones inside it stay open
+        guint level = g_array_index(outline->headings, OutlineHeading, current).level;
+        folded[current] = FALSE;
+        guint above = level;
+        for (gint i = current - 1; i >= 0 && above > 1; i--) {
+            guint i_level = g_array_index(outline->headings, OutlineHeading, i).level;
+            if (i_level < above) {
+                folded[i] = FALSE;
+                above = i_level;
+            }
+        }
+        for (guint i = (guint)current + 1; i < outline->headings->len; i++) {
+            if (g_array_index(outline->headings, OutlineHeading, i).level <= level) break;
+            folded[i] = FALSE;
+        }
+    }
+    set_folds(outline, folded);
+}
+
+void outline_unfold_all(GtkTextBuffer *buffer) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    Outline *outline = outline_get(buffer);
+    g_autofree gboolean *folded = g_new0(gboolean, MAX(outline->headings->len, 1));
+    set_folds(outline, folded);
+}
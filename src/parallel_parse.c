@@ -0,0 +1,354 @@
+#include "parallel_parse.h"
+#include "gtktext_cmark.h"
+#include "source_map.h"
+#include "perf_policy.h"
+#include "perf_trace.h"
+#include <string.h>
+
+// Below this a chunk isn't worth its own buffer and thread
+#define PARALLEL_PARSE_MIN_CHUNK (512 * 1024)
+
+typedef enum {
+    DEFINITION_NONE,
+    DEFINITION_FOUND,
+    DEFINITION_UNKNOWN  // Continues on the next line, so only a parser can tell
+} DefinitionScan;
+
+static gsize count_indent(const char *line, const char *eol, const char **content) {
+    gsize column = 0;
+    const char *p = line;
+    for (; p < eol; p++) {
+        if (*p == ' ') column++;
+        else if (*p == '\t') column += 4 - column % 4;
+        else break;
+    }
+    *content = p;
+    return column;
+}
+
+static gboolean is_blank(const char *p, const char *eol) {
+    for (; p < eol; p++) {
+        if (*p != ' ' && *p != '\t' && *p != '\r') return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean has_prefix_ci(const char *p, const char *eol, const char *prefix) {
+    gsize len = strlen(prefix);
+    return (gsize)(eol - p) >= len && g_ascii_strncasecmp(p, prefix, len) == 0;
+}
+
+static gboolean contains_ci(const char *p, const char *eol, const char *needle) {
+    for (; p < eol; p++) {
+        if (has_prefix_ci(p, eol, needle)) return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean is_list_marker(const char *p, const char *eol) {
+    const char *q = p;
+    if (q < eol && (*q == '-' || *q == '+' || *q == '*')) {
+        q++;
+    } else {
+        while (q < eol && q - p < 9 && g_ascii_isdigit(*q)) q++;
+        if (q == p || q >= eol || (*q != '.' && *q != ')')) return FALSE;
+        q++;
+    }
+    return q == eol || *q == ' ' || *q == '\t' || *q == '\r';
+}
+
+// Returns the fence length if the line opens a code fence, 0 otherwise
+static gsize scan_fence(const char *p, const char *eol, char *fence_char) {
+    if (p >= eol || (*p != '`' && *p != '~')) return 0;
+    const char *q = p;
+    while (q < eol && *q == *p) q++;
+    if (q - p < 3) return 0;
+    // A backtick fence's info string can't contain backticks
+    if (*p == '`' && memchr(q, '`', (gsize)(eol - q))) return 0;
+    *fence_char = *p;
+    return (gsize)(q - p);
+}
+
+static gboolean closes_fence(const char *p, const char *eol, char fence_char, gsize fence_len) {
+    const char *q = p;
+    while (q < eol && *q == fence_char) q++;
+    return (gsize)(q - p) >= fence_len && is_blank(q, eol);
+}
+
+// HTML blocks of CommonMark types 1-5 end at a marker rather than a blank line.
+// Returns that marker, or NULL if no such block starts here.
+static const char *scan_html_block(const char *p, const char *eol) {
+    static const char *const raw_tags[] = { "<script", "<pre", "<style", "<textarea" };
+    for (guint i = 0; i < G_N_ELEMENTS(raw_tags); i++) {
+        if (has_prefix_ci(p, eol, raw_tags[i])) {
+            const char *after = p + strlen(raw_tags[i]);
+            if (after == eol || *after == ' ' || *after == '\t' || *after == '>' || *after == '\r') {
+                return "</"; // Checked against all four closing tags
+            }
+        }
+    }
+    if (has_prefix_ci(p, eol, "<!--")) return "-->";
+    if (has_prefix_ci(p, eol, "<?")) return "?>";
+    if (has_prefix_ci(p, eol, "<![CDATA[")) return "]]>";
+    if (eol - p > 2 && p[0] == '<' && p[1] == '!' && g_ascii_isalpha(p[2])) return ">";
+    return NULL;
+}
+
+static gboolean ends_html_block(const char *p, const char *eol, const char *marker) {
+    if (strcmp(marker, "</") == 0) {
+        return contains_ci(p, eol, "</script>") || contains_ci(p, eol, "</pre>") ||
+               contains_ci(p, eol, "</style>") || contains_ci(p, eol, "</textarea>");
+    }
+    return contains_ci(p, eol, marker);
+}
+
+// Checks a line starting with '[' for "[label]: destination 'title'"
+static DefinitionScan scan_definition(const char *p, const char *eol, const char **label_end) {
+    const char *q = p + 1;
+    gboolean has_text = FALSE;
+    while (q < eol && *q != ']') {
+        if (*q == '[') return DEFINITION_NONE;
+        if (*q == '\\' && q + 1 < eol) q++;
+        if (*q != ' ' && *q != '\t') has_text = TRUE;
+        q++;
+    }
+    if (q >= eol) return DEFINITION_UNKNOWN; // The label may go on
+    if (!has_text || q + 1 >= eol || q[1] != ':') return DEFINITION_NONE;
+    *label_end = q + 1;
+
+    q += 2;
+    while (q < eol && (*q == ' ' || *q == '\t')) q++;
+    if (is_blank(q, eol)) return DEFINITION_UNKNOWN; // Destination on the next line
+    if (*q == '<') {
+        while (q < eol && *q != '>') q++;
+        if (q >= eol) return DEFINITION_NONE;
+        q++;
+    } else {
+        while (q < eol && *q != ' ' && *q != '\t' && *q != '\r') q++;
+    }
+    const char *title = q;
+    while (q < eol && (*q == ' ' || *q == '\t')) q++;
+    if (is_blank(q, eol)) return DEFINITION_FOUND;
+    if (q == title || (*q != '"' && *q != '\'' && *q != '(')) return DEFINITION_NONE;
+
+    char close = *q == '(' ? ')' : *q;
+    for (q++; q < eol && *q != close; q++) {
+        if (*q == '\\' && q + 1 < eol) q++;
+    }
+    if (q >= eol) return DEFINITION_UNKNOWN; // The title may go on
+    // Anything after the title turns the line into a paragraph
+    return is_blank(q + 1, eol) ? DEFINITION_FOUND : DEFINITION_NONE;
+}
+
+// Skips block quote markers and list item markers in front of a line's text
+static const char *skip_container_markers(const char *p, const char *eol) {
+    for (;;) {
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+        if (p < eol && *p == '>') {
+            p++;
+        } else if (is_list_marker(p, eol)) {
+            while (p < eol && *p != ' ' && *p != '\t') p++;
+        } else {
+            return p;
+        }
+    }
+}
+
+GArray *parallel_parse_split(const char *markdown, gsize length, const TextLineIndex *lines,
+                             guint n_chunks, GString *definitions) {
+    g_return_val_if_fail(markdown != NULL && definitions != NULL, NULL);
+
+    GArray *starts = g_array_new(FALSE, FALSE, sizeof(gsize));
+    gsize first = 0;
+    g_array_append_val(starts, first);
+
+    // Each cut goes at the first safe line at or after step * next_chunk
+    gsize step = n_chunks > 1 ? length / n_chunks : G_MAXSIZE;
+    guint next_chunk = 1;
+    gboolean prev_blank = TRUE;       // The document start counts as one
+    gboolean prev_definition = FALSE;
+    char fence_char = 0;
+    gsize fence_len = 0;              // Non-zero inside fenced code
+    const char *html_end = NULL;      // Non-NULL inside an HTML block of type 1-5
+
+    const char *end = markdown + length;
+    guint line_number = 0;
+    for (const char *line = markdown; line < end; line_number++) {
+        const char *eol;
+        if (lines) {
+            eol = markdown + text_line_index_get_line_end(lines, line_number);
+        } else {
+            eol = memchr(line, '\n', (gsize)(end - line));
+            if (!eol) eol = end;
+        }
+        const char *next = eol < end ? eol + 1 : end;
+        const char *content;
+        gsize indent = count_indent(line, eol, &content);
+
+        if (fence_len > 0) {
+            if (indent <= 3 && closes_fence(content, eol, fence_char, fence_len)) fence_len = 0;
+            prev_blank = prev_definition = FALSE;
+            line = next;
+            continue;
+        }
+        if (html_end) {
+            if (ends_html_block(line, eol, html_end)) html_end = NULL;
+            prev_blank = prev_definition = FALSE;
+            line = next;
+            continue;
+        }
+        if (is_blank(content, eol)) {
+            prev_blank = TRUE;
+            prev_definition = FALSE;
+            line = next;
+            continue;
+        }
+
+        gsize offset = (gsize)(line - markdown);
+        if (next_chunk < n_chunks && offset >= step * next_chunk && offset > 0 &&
+            prev_blank && indent == 0 && !is_list_marker(content, eol)) {
+            g_array_append_val(starts, offset);
+            do {
+                next_chunk++;
+            } while (next_chunk < n_chunks && offset >= step * next_chunk);
+        }
+
+        gboolean definition = FALSE;
+        const char *text = skip_container_markers(content, eol);
+        if (indent <= 3 && (fence_len = scan_fence(content, eol, &fence_char)) > 0) {
+            // Opened; the info string can't close it
+        } else if (indent <= 3 && (html_end = scan_html_block(content, eol)) != NULL) {
+            if (ends_html_block(content + 1, eol, html_end)) html_end = NULL;
+        } else if (text < eol && *text == '[') {
+            const char *label_end = NULL;
+            DefinitionScan scan = scan_definition(text, eol, &label_end);
+            // Unindented, so it can't be inside a list item's fenced code
+            if (scan == DEFINITION_FOUND && indent == 0 && text == content && (prev_blank || prev_definition)) {
+                g_string_append_len(definitions, text, label_end - text);
+                g_string_append(definitions, " #\n");
+                definition = TRUE;
+            } else if (scan != DEFINITION_NONE) {
+                // Inside a container, after a paragraph line or not finished on this line
+                g_array_unref(starts);
+                return NULL;
+            }
+        }
+        prev_blank = FALSE;
+        prev_definition = definition;
+        line = next;
+    }
+    return starts;
+}
+
+typedef struct {
+    gchar *markdown;
+    gssize source_shift; // From chunk offsets to document offsets
+    RenderPlan *plan;
+} ParseChunk;
+
+// Touches no GTK objects, so it runs on the pool's threads
+static RenderPlan *parse_to_plan(const char *markdown, const TextLineIndex *lines, gssize source_shift) {
+    RenderPlan *plan = parse_markdown_to_plan_cmark(markdown, lines);
+    const SourceMap *map = plan ? render_plan_get_source_map(plan) : NULL;
+    if (map && source_shift != 0) {
+        // Anchors in the prepended definitions fall before the document and are dropped
+        SourceMap *shifted = source_map_new();
+        source_map_append(shifted, map, 0, source_shift);
+        render_plan_set_source_map(plan, shifted);
+    }
+    return plan;
+}
+
+static void parse_chunk(gpointer data, G_GNUC_UNUSED gpointer user_data) {
+    ParseChunk *chunk = data;
+    chunk->plan = parse_to_plan(chunk->markdown, NULL, chunk->source_shift);
+}
+
+static guint choose_n_chunks(gsize length) {
+    return (guint)MIN((gsize)perf_policy_get_worker_threads(), length / PARALLEL_PARSE_MIN_CHUNK);
+}
+
+static gsize markdown_length(const char *markdown, const TextLineIndex *lines) {
+    if (lines) {
+        return text_line_index_get_line_end(lines, text_line_index_get_n_lines(lines) - 1);
+    }
+    return strlen(markdown);
+}
+
+RenderPlan *parallel_parse_markdown(const char *markdown, const TextLineIndex *lines, guint n_chunks) {
+    g_return_val_if_fail(markdown != NULL, NULL);
+
+    gsize length = markdown_length(markdown, lines);
+    if (n_chunks == 0) {
+        n_chunks = choose_n_chunks(length);
+    }
+    GString *definitions = g_string_new(NULL);
+    GArray *starts = n_chunks > 1 ? parallel_parse_split(markdown, length, lines, n_chunks, definitions) : NULL;
+    if (!starts || starts->len < 2) {
+        if (starts) g_array_unref(starts);
+        g_string_free(definitions, TRUE);
+        return parse_to_plan(markdown, lines, 0);
+    }
+    if (definitions->len > 0) {
+        g_string_append_c(definitions, '\n');
+    }
+
+    guint n = starts->len;
+    ParseChunk *chunks = g_new0(ParseChunk, n);
+    GThreadPool *pool = g_thread_pool_new(parse_chunk, NULL, (gint)n, FALSE, NULL);
+    for (guint i = 0; i < n; i++) {
+        gsize start = g_array_index(starts, gsize, i);
+        gsize end = i + 1 < n ? g_array_index(starts, gsize, i + 1) : length;
+        GString *chunk = g_string_sized_new(definitions->len + (end - start));
+        g_string_append_len(chunk, definitions->str, (gssize)definitions->len);
+        g_string_append_len(chunk, markdown + start, (gssize)(end - start));
+        chunks[i].markdown = g_string_free(chunk, FALSE);
+        chunks[i].source_shift = (gssize)start - (gssize)definitions->len;
+        g_thread_pool_push(pool, &chunks[i], NULL);
+    }
+    // Waits for every chunk
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    RenderPlan *plan = NULL;
+    gboolean failed = FALSE;
+    for (guint i = 0; i < n; i++) {
+        if (!chunks[i].plan) {
+            failed = TRUE;
+        } else if (failed) {
+            render_plan_free(chunks[i].plan);
+        } else if (!plan) {
+            plan = chunks[i].plan;
+        } else {
+            render_plan_append(plan, chunks[i].plan);
+        }
+        g_free(chunks[i].markdown);
+    }
+    if (failed) {
+        render_plan_free(plan);
+        plan = NULL;
+    }
+    g_free(chunks);
+    g_array_unref(starts);
+    g_string_free(definitions, TRUE);
+    return plan;
+}
+
+gboolean import_markdown_to_buffer_parallel(GtkTextBuffer *buffer, const char *markdown,
+                                            const TextLineIndex *lines) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(markdown != NULL, FALSE);
+
+    if (choose_n_chunks(markdown_length(markdown, lines)) < 2) {
+        return import_markdown_to_buffer_cmark(buffer, markdown);
+    }
+    PerfSpan span = perf_span_begin(PERF_OP_IMPORT);
+    RenderPlan *plan = parallel_parse_markdown(markdown, lines, 0);
+    if (!plan) {
+        perf_span_end(&span);
+        return FALSE;
+    }
+    render_plan_apply(plan, buffer);
+    render_plan_free(plan);
+    perf_span_end(&span);
+    return TRUE;
+}
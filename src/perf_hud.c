@@ -0,0 +1,238 @@
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "perf_hud.h"
+#include "perf_trace.h"
+
+// The label is refreshed a few times per second; refreshing it from the
+// frame clock would itself schedule a new frame on every paint.
+#define PERF_HUD_REFRESH_MS 250
+// Keystroke-to-paint latency above one 60 Hz frame is flagged as slow
+#define PERF_HUD_SLOW_LATENCY_US 16667
+// Used when the backend does not report a refresh interval
+#define PERF_HUD_DEFAULT_REFRESH_US 16667
+// A longer gap between frames means nothing asked for one, not a stall
+#define PERF_HUD_IDLE_GAP_US 250000
+
+typedef struct {
+    GtkWidget *text_view;        // Not owned; the HUD lives as long as the view
+    GtkWidget *label;            // Cleared on destroy; the overlay may dispose it before the view's data is freed
+    gulong label_destroy_id;
+    GdkFrameClock *frame_clock;  // Referenced while the HUD is visible
+    gulong after_paint_id;
+    gint64 last_frame_time;      // Frame time of the previous paint, or 0
+    guint refresh_id;
+    gint64 pending_key_us;       // First keystroke not yet painted, or 0
+    gint64 last_latency_us;
+    gint64 worst_latency_us;
+    guint64 frames;
+    guint64 missed_frames;
+} PerfHud;
+
+// Number of visible HUDs; span durations are only recorded while one is shown
+static guint visible_hud_count = 0;
+
+static gint64 read_rss_bytes(void) {
+    g_autofree gchar *statm = NULL;
+    unsigned long size_pages = 0, resident_pages = 0;
+
+    if (!g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+        return -1;
+    }
+    if (sscanf(statm, "%lu %lu", &size_pages, &resident_pages) != 2) {
+        return -1;
+    }
+    return (gint64)resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+static void append_duration(GString *text, const char *label, gint64 duration_us) {
+    if (duration_us < 0) {
+        g_string_append_printf(text, "%-8s      –", label);
+    } else {
+        g_string_append_printf(text, "%-8s%7.1f ms", label, duration_us / 1000.0);
+    }
+}
+
+static gboolean perf_hud_refresh(gpointer user_data) {
+    PerfHud *hud = user_data;
+    if (!hud->label) {
+        return G_SOURCE_CONTINUE;
+    }
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(hud->text_view));
+    GString *text = g_string_new(NULL);
+
+    g_string_append_printf(text, "Key→paint %6.1f ms (worst %.1f)\n",
+                           hud->last_latency_us / 1000.0, hud->worst_latency_us / 1000.0);
+    g_string_append_printf(text, "Missed    %" G_GUINT64_FORMAT " / %" G_GUINT64_FORMAT " frames\n",
+                           hud->missed_frames, hud->frames);
+
+    append_duration(text, "Parse", perf_trace_get_last_duration(PERF_OP_IMPORT));
+    g_string_append(text, "   ");
+    append_duration(text, "Render", perf_trace_get_last_duration(PERF_OP_RENDER));
+    g_string_append_c(text, '\n');
+    append_duration(text, "Export", perf_trace_get_last_duration(PERF_OP_EXPORT));
+    g_string_append(text, "   ");
+    append_duration(text, "Save", perf_trace_get_last_duration(PERF_OP_SAVE));
+    g_string_append_c(text, '\n');
+
+    g_string_append_printf(text, "Buffer    %d chars, %d lines\n",
+                           gtk_text_buffer_get_char_count(buffer),
+                           gtk_text_buffer_get_line_count(buffer));
+    g_string_append_printf(text, "Tags      %d\n",
+                           gtk_text_tag_table_get_size(gtk_text_buffer_get_tag_table(buffer)));
+
+    gint64 rss = read_rss_bytes();
+    if (rss >= 0) {
+        g_autofree gchar *rss_text = g_format_size((guint64)rss);
+        g_string_append_printf(text, "RSS       %s", rss_text);
+    } else {
+        g_string_append(text, "RSS       n/a");
+    }
+
+    gtk_label_set_text(GTK_LABEL(hud->label), text->str);
+    g_string_free(text, TRUE);
+
+    if (hud->last_latency_us > PERF_HUD_SLOW_LATENCY_US) {
+        gtk_widget_add_css_class(hud->label, "slow");
+    } else {
+        gtk_widget_remove_css_class(hud->label, "slow");
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Runs after every paint of the window that contains the text view.
+static void on_after_paint(GdkFrameClock *frame_clock, gpointer user_data) {
+    PerfHud *hud = user_data;
+    gint64 now = g_get_monotonic_time();
+    gint64 refresh_interval = 0;
+
+    GdkFrameTimings *timings = gdk_frame_clock_get_current_timings(frame_clock);
+    if (timings) {
+        refresh_interval = gdk_frame_timings_get_refresh_interval(timings);
+    }
+    if (refresh_interval <= 0) {
+        refresh_interval = PERF_HUD_DEFAULT_REFRESH_US;
+    }
+
+    // Consecutive frames should be one refresh interval apart; every whole
+    // interval beyond that is a frame that was due but never presented
+    gint64 frame_time = gdk_frame_clock_get_frame_time(frame_clock);
+    hud->frames++;
+    if (hud->last_frame_time != 0) {
+        gint64 delta = frame_time - hud->last_frame_time;
+        if (delta < PERF_HUD_IDLE_GAP_US) {
+            gint64 intervals = (delta + refresh_interval / 2) / refresh_interval;
+            hud->missed_frames += (guint64)MAX(intervals - 1, 0);
+        }
+    }
+    hud->last_frame_time = frame_time;
+
+    if (hud->pending_key_us != 0) {
+        hud->last_latency_us = now - hud->pending_key_us;
+        hud->worst_latency_us = MAX(hud->worst_latency_us, hud->last_latency_us);
+        hud->pending_key_us = 0;
+    }
+}
+
+static gboolean on_key_pressed_capture(G_GNUC_UNUSED GtkEventControllerKey *controller,
+                                       G_GNUC_UNUSED guint keyval,
+                                       G_GNUC_UNUSED guint keycode,
+                                       G_GNUC_UNUSED GdkModifierType state,
+                                       gpointer user_data) {
+    PerfHud *hud = user_data;
+    if (hud->refresh_id != 0 && hud->pending_key_us == 0) {
+        hud->pending_key_us = g_get_monotonic_time();
+    }
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void perf_hud_set_visible(PerfHud *hud, gboolean visible) {
+    if (visible == (hud->refresh_id != 0)) {
+        return;
+    }
+
+    if (visible) {
+        hud->frame_clock = gtk_widget_get_frame_clock(hud->text_view);
+        if (hud->frame_clock) {
+            g_object_ref(hud->frame_clock);
+            hud->after_paint_id = g_signal_connect(hud->frame_clock, "after-paint",
+                                                   G_CALLBACK(on_after_paint), hud);
+        }
+        hud->last_latency_us = hud->worst_latency_us = 0;
+        hud->frames = hud->missed_frames = 0;
+        hud->last_frame_time = 0;
+        hud->refresh_id = g_timeout_add(PERF_HUD_REFRESH_MS, perf_hud_refresh, hud);
+        if (visible_hud_count++ == 0) {
+            perf_trace_set_consumer(PERF_CONSUMER_HUD, TRUE);
+        }
+        perf_hud_refresh(hud);
+    } else {
+        if (hud->frame_clock) {
+            g_signal_handler_disconnect(hud->frame_clock, hud->after_paint_id);
+            g_clear_object(&hud->frame_clock);
+            hud->after_paint_id = 0;
+        }
+        g_clear_handle_id(&hud->refresh_id, g_source_remove);
+        hud->pending_key_us = 0;
+        if (--visible_hud_count == 0) {
+            perf_trace_set_consumer(PERF_CONSUMER_HUD, FALSE);
+        }
+    }
+    if (hud->label) {
+        gtk_widget_set_visible(hud->label, visible);
+    }
+}
+
+static void on_label_destroy(G_GNUC_UNUSED GtkWidget *label, gpointer user_data) {
+    PerfHud *hud = user_data;
+    hud->label = NULL;
+    hud->label_destroy_id = 0;
+}
+
+static void perf_hud_free(gpointer data) {
+    PerfHud *hud = data;
+    perf_hud_set_visible(hud, FALSE);
+    if (hud->label) {
+        g_signal_handler_disconnect(hud->label, hud->label_destroy_id);
+    }
+    g_free(hud);
+}
+
+void perf_hud_attach(GtkWidget *text_view, GtkWidget *overlay) {
+    g_return_if_fail(GTK_IS_TEXT_VIEW(text_view));
+    g_return_if_fail(overlay != NULL);
+
+    PerfHud *hud = g_new0(PerfHud, 1);
+    hud->text_view = text_view;
+
+    hud->label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(hud->label), 0.0f);
+    gtk_widget_set_halign(hud->label, GTK_ALIGN_END);
+    gtk_widget_set_valign(hud->label, GTK_ALIGN_START);
+    gtk_widget_set_margin_top(hud->label, 12);
+    gtk_widget_set_margin_end(hud->label, 12);
+    gtk_widget_set_can_target(hud->label, FALSE); // Never steal clicks from the editor
+    gtk_widget_add_css_class(hud->label, "osd");
+    gtk_widget_add_css_class(hud->label, "perf-hud");
+    gtk_widget_set_visible(hud->label, FALSE);
+    gtk_overlay_add_overlay(GTK_OVERLAY(overlay), hud->label);
+    hud->label_destroy_id = g_signal_connect(hud->label, "destroy", G_CALLBACK(on_label_destroy), hud);
+
+    // Capture phase, so the timestamp is taken before any handler does work
+    GtkEventController *key_controller = gtk_event_controller_key_new();
+    gtk_event_controller_set_propagation_phase(key_controller, GTK_PHASE_CAPTURE);
+    g_signal_connect(key_controller, "key-pressed", G_CALLBACK(on_key_pressed_capture), hud);
+    gtk_widget_add_controller(text_view, key_controller);
+
+    g_object_set_data_full(G_OBJECT(text_view), "perf-hud", hud, perf_hud_free);
+}
+
+void perf_hud_toggle(GtkWidget *text_view) {
+    PerfHud *hud = g_object_get_data(G_OBJECT(text_view), "perf-hud");
+    if (!hud) {
+        g_warning("perf_hud_toggle: No HUD attached to this text view");
+        return;
+    }
+    perf_hud_set_visible(hud, hud->refresh_id == 0);
+}
@@ -0,0 +1,115 @@
+#include "perf_policy.h"
+#include "perf_trace.h"
+#include "scheduler.h"
+
+// Used until the settings are loaded, or without the schema; match data/org.gtk.gtktext.gschema.xml
+#define DEFAULT_AUTOSAVE_DELAY_MS 500
+#define DEFAULT_LARGE_DOCUMENT_KIB 4096
+#define DEFAULT_RENDER_CACHE_MIB 256
+#define DEFAULT_PARSER_RETAIN_MIB 64
+// An adapted autosave delay keeps saving to about a tenth of the time
+#define AUTOSAVE_SAVE_SHARE 10
+#define AUTOSAVE_MAX_DELAY_MS 10000
+// Saves or loads slower than this switch to large-document mode
+#define LARGE_DOCUMENT_LATENCY_US (100 * 1000)
+
+static GSettings *settings = NULL;
+
+// Copies of the settings; the integers are also read by worker threads
+static gint autosave_delay_ms = DEFAULT_AUTOSAVE_DELAY_MS;
+static gboolean adaptive = TRUE;
+static gint large_document_kib = DEFAULT_LARGE_DOCUMENT_KIB;
+static gint worker_threads = 0;
+static gint render_cache_mib = DEFAULT_RENDER_CACHE_MIB;
+static gint parser_retain_mib = DEFAULT_PARSER_RETAIN_MIB;
+static PerfHighlightScope highlight_scope = PERF_HIGHLIGHT_DOCUMENT;
+
+static void read_settings(GSettings *source, G_GNUC_UNUSED const gchar *key, G_GNUC_UNUSED gpointer user_data) {
+    g_atomic_int_set(&autosave_delay_ms, (gint)g_settings_get_uint(source, "autosave-delay"));
+    adaptive = g_settings_get_boolean(source, "adaptive");
+    // Spans only pay for the smoothed durations while something adapts to them
+    perf_trace_set_consumer(PERF_CONSUMER_POLICY, adaptive);
+    g_atomic_int_set(&large_document_kib, (gint)g_settings_get_uint(source, "large-document-threshold"));
+    g_atomic_int_set(&worker_threads, (gint)g_settings_get_uint(source, "worker-threads"));
+    g_atomic_int_set(&render_cache_mib, (gint)g_settings_get_uint(source, "render-cache-size"));
+    g_atomic_int_set(&parser_retain_mib, (gint)g_settings_get_uint(source, "parser-retain-size"));
+    highlight_scope = (PerfHighlightScope)g_settings_get_enum(source, "highlight-scope");
+    scheduler_update_worker_threads();
+}
+
+// The installed schemas come first; a build that was never installed uses the one in its tree
+static GSettingsSchema *lookup_schema(void) {
+    GSettingsSchemaSource *installed = g_settings_schema_source_get_default();
+    GSettingsSchema *schema = installed ? g_settings_schema_source_lookup(installed, PERF_POLICY_SCHEMA_ID, TRUE) : NULL;
+#ifdef GTKTEXT_SCHEMA_DIR
+    if (!schema) {
+        GSettingsSchemaSource *local = g_settings_schema_source_new_from_directory(GTKTEXT_SCHEMA_DIR, installed,
+                                                                                    FALSE, NULL);
+        if (local) {
+            schema = g_settings_schema_source_lookup(local, PERF_POLICY_SCHEMA_ID, FALSE);
+            g_settings_schema_source_unref(local);
+        }
+    }
+#endif
+    return schema;
+}
+
+void perf_policy_init(void) {
+    if (settings) return;
+
+    GSettingsSchema *schema = lookup_schema();
+    if (!schema) {
+        perf_trace_set_consumer(PERF_CONSUMER_POLICY, adaptive);
+        g_message("Schema %s is not installed; performance settings use their defaults", PERF_POLICY_SCHEMA_ID);
+        return;
+    }
+    settings = g_settings_new_full(schema, NULL, NULL);
+    g_settings_schema_unref(schema);
+    read_settings(settings, NULL, NULL);
+    g_signal_connect(settings, "changed", G_CALLBACK(read_settings), NULL);
+}
+
+GSettings *perf_policy_get_settings(void) {
+    return settings;
+}
+
+guint perf_policy_get_autosave_delay(void) {
+    guint delay = (guint)g_atomic_int_get(&autosave_delay_ms);
+    gint64 save_us = adaptive ? perf_trace_get_smoothed_duration(PERF_OP_SAVE) : -1;
+    if (save_us > 0) {
+        delay = MAX(delay, (guint)MIN(save_us * AUTOSAVE_SAVE_SHARE / 1000, AUTOSAVE_MAX_DELAY_MS));
+    }
+    return delay;
+}
+
+gboolean perf_policy_is_large_document(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+
+    // Characters stand in for bytes; counting bytes would take an export
+    guint64 threshold = (guint64)g_atomic_int_get(&large_document_kib) * 1024;
+    if (threshold > 0 && (guint64)gtk_text_buffer_get_char_count(buffer) > threshold) {
+        return TRUE;
+    }
+    return adaptive && (perf_trace_get_smoothed_duration(PERF_OP_SAVE) > LARGE_DOCUMENT_LATENCY_US ||
+                        perf_trace_get_smoothed_duration(PERF_OP_IMPORT) > LARGE_DOCUMENT_LATENCY_US);
+}
+
+PerfHighlightScope perf_policy_get_highlight_scope(GtkTextBuffer *buffer) {
+    if (highlight_scope == PERF_HIGHLIGHT_DOCUMENT && perf_policy_is_large_document(buffer)) {
+        return PERF_HIGHLIGHT_VISIBLE;
+    }
+    return highlight_scope;
+}
+
+guint perf_policy_get_worker_threads(void) {
+    gint threads = g_atomic_int_get(&worker_threads);
+    return threads > 0 ? (guint)threads : g_get_num_processors();
+}
+
+guint64 perf_policy_get_render_cache_size(void) {
+    return (guint64)g_atomic_int_get(&render_cache_mib) * 1024 * 1024;
+}
+
+gsize perf_policy_get_parser_retain_size(void) {
+    return (gsize)g_atomic_int_get(&parser_retain_mib) * 1024 * 1024;
+}
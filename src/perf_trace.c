@@ -0,0 +1,191 @@
+#include "perf_trace.h"
+
+#ifdef HAVE_SYSPROF
+#include <sysprof-capture.h>
+#endif
+
+// Number of log2 latency buckets; bucket i counts durations in [2^i, 2^(i+1)) µs.
+#define PERF_HISTOGRAM_BUCKETS 32
+// Each span moves the smoothed duration 1/PERF_SMOOTHING of the way towards it
+#define PERF_SMOOTHING 4
+
+typedef struct {
+    guint64 count;
+    gint64 total_us;
+    gint64 min_us;
+    gint64 max_us;
+    guint64 buckets[PERF_HISTOGRAM_BUCKETS];
+} PerfOpStats;
+
+gint perf_trace_consumers = 0;
+
+static PerfOpStats op_stats[PERF_OP_COUNT];
+static gint64 last_duration_us[PERF_OP_COUNT];
+static gint64 smoothed_duration_us[PERF_OP_COUNT];
+static GMutex op_stats_lock;
+
+// Stable names used for Sysprof marks and JSON keys; indexed by PerfOp.
+static const char *const op_names[PERF_OP_COUNT] = {
+    [PERF_OP_IMPORT] = "import",
+    [PERF_OP_RENDER] = "render",
+    [PERF_OP_EXPORT] = "export",
+    [PERF_OP_SAVE] = "save",
+    [PERF_OP_CLIPBOARD_COPY] = "clipboard-copy",
+    [PERF_OP_TOOLBAR_ITALIC] = "toolbar-italic",
+    [PERF_OP_TOOLBAR_BOLD] = "toolbar-bold",
+    [PERF_OP_TOOLBAR_HEADING] = "toolbar-heading",
+    [PERF_OP_TOOLBAR_HR] = "toolbar-hr",
+    [PERF_OP_RELOAD] = "reload",
+    [PERF_OP_CACHE_LOAD] = "cache-load",
+    [PERF_OP_CLIPBOARD_PASTE] = "clipboard-paste",
+};
+
+const char *perf_op_get_name(PerfOp op) {
+    if ((guint)op >= PERF_OP_COUNT) {
+        return "unknown";
+    }
+    return op_names[op];
+}
+
+void perf_trace_init(void) {
+#ifdef HAVE_SYSPROF
+    // The collector is only active when sysprof-cli/Sysprof launched us
+    if (sysprof_collector_is_active()) {
+        perf_trace_set_consumer(PERF_CONSUMER_SYSPROF, TRUE);
+    }
+#endif
+}
+
+void perf_trace_set_consumer(PerfConsumer consumer, gboolean enabled) {
+    gint old_value, new_value;
+    do {
+        old_value = g_atomic_int_get(&perf_trace_consumers);
+        new_value = enabled ? (old_value | (gint)consumer) : (old_value & ~(gint)consumer);
+    } while (!g_atomic_int_compare_and_exchange(&perf_trace_consumers, old_value, new_value));
+}
+
+static guint histogram_bucket_for(gint64 duration_us) {
+    guint bucket = 0;
+    while (duration_us > 1 && bucket < PERF_HISTOGRAM_BUCKETS - 1) {
+        duration_us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void record_stats(PerfOp op, gint64 duration_us) {
+    g_mutex_lock(&op_stats_lock);
+    PerfOpStats *stats = &op_stats[op];
+    if (stats->count == 0 || duration_us < stats->min_us) stats->min_us = duration_us;
+    if (duration_us > stats->max_us) stats->max_us = duration_us;
+    stats->count++;
+    stats->total_us += duration_us;
+    stats->buckets[histogram_bucket_for(duration_us)]++;
+    g_mutex_unlock(&op_stats_lock);
+}
+
+void perf_span_end(PerfSpan *span) {
+    if (!span || span->start_us == 0 || span->op >= PERF_OP_COUNT) {
+        return;
+    }
+
+    gint64 duration_us = g_get_monotonic_time() - span->start_us;
+    gint consumers = g_atomic_int_get(&perf_trace_consumers);
+
+#ifdef HAVE_SYSPROF
+    if (consumers & PERF_CONSUMER_SYSPROF) {
+        // g_get_monotonic_time() and the Sysprof clock are both CLOCK_MONOTONIC
+        sysprof_collector_mark(span->start_us * 1000, duration_us * 1000,
+                               "gtktext", op_names[span->op], NULL);
+    }
+#endif
+    if (consumers & PERF_CONSUMER_STATS) {
+        record_stats(span->op, duration_us);
+    }
+    if (consumers & PERF_CONSUMER_HUD) {
+        g_mutex_lock(&op_stats_lock);
+        last_duration_us[span->op] = duration_us + 1; // 0 means "never recorded"
+        g_mutex_unlock(&op_stats_lock);
+    }
+    if (consumers & PERF_CONSUMER_POLICY) {
+        g_mutex_lock(&op_stats_lock);
+        gint64 *smoothed = &smoothed_duration_us[span->op];
+        // Also stored plus one; the first span starts the average
+        *smoothed = *smoothed == 0 ? duration_us + 1
+                                   : *smoothed + (duration_us + 1 - *smoothed) / PERF_SMOOTHING;
+        g_mutex_unlock(&op_stats_lock);
+    }
+
+    span->start_us = 0;
+}
+
+gint64 perf_trace_get_last_duration(PerfOp op) {
+    if ((guint)op >= PERF_OP_COUNT) {
+        return -1;
+    }
+    g_mutex_lock(&op_stats_lock);
+    gint64 stored = last_duration_us[op];
+    g_mutex_unlock(&op_stats_lock);
+    return stored - 1;
+}
+
+gint64 perf_trace_get_smoothed_duration(PerfOp op) {
+    if ((guint)op >= PERF_OP_COUNT) {
+        return -1;
+    }
+    g_mutex_lock(&op_stats_lock);
+    gint64 stored = smoothed_duration_us[op];
+    g_mutex_unlock(&op_stats_lock);
+    return stored - 1;
+}
+
+// Estimate a percentile from the histogram; returns the upper bound of the bucket it falls in.
+static gint64 histogram_percentile(const PerfOpStats *stats, double fraction) {
+    guint64 target = (guint64)(stats->count * fraction);
+    guint64 seen = 0;
+    for (guint i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen > target) {
+            return MIN((gint64)1 << (i + 1), stats->max_us);
+        }
+    }
+    return stats->max_us;
+}
+
+void perf_trace_write_stats_json(FILE *out) {
+    GString *json = g_string_new("{\n  \"unit\": \"us\",\n  \"operations\": {");
+    gboolean first_op = TRUE;
+
+    g_mutex_lock(&op_stats_lock);
+    for (guint op = 0; op < PERF_OP_COUNT; op++) {
+        const PerfOpStats *stats = &op_stats[op];
+        if (stats->count == 0) continue;
+
+        g_string_append_printf(json,
+            "%s\n    \"%s\": {\"count\": %" G_GUINT64_FORMAT ", \"total\": %" G_GINT64_FORMAT
+            ", \"min\": %" G_GINT64_FORMAT ", \"max\": %" G_GINT64_FORMAT
+            ", \"mean\": %" G_GINT64_FORMAT ", \"p50\": %" G_GINT64_FORMAT
+            ", \"p95\": %" G_GINT64_FORMAT ", \"p99\": %" G_GINT64_FORMAT ", \"histogram\": [",
+            first_op ? "" : ",", op_names[op], stats->count, stats->total_us,
+            stats->min_us, stats->max_us, stats->total_us / (gint64)stats->count,
+            histogram_percentile(stats, 0.50), histogram_percentile(stats, 0.95),
+            histogram_percentile(stats, 0.99));
+
+        // Only non-empty buckets; "le" is the exclusive upper bound in µs
+        gboolean first_bucket = TRUE;
+        for (guint i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+            if (stats->buckets[i] == 0) continue;
+            g_string_append_printf(json, "%s{\"le\": %" G_GUINT64_FORMAT ", \"count\": %" G_GUINT64_FORMAT "}",
+                                   first_bucket ? "" : ", ", (guint64)1 << (i + 1), stats->buckets[i]);
+            first_bucket = FALSE;
+        }
+        g_string_append(json, "]}");
+        first_op = FALSE;
+    }
+    g_mutex_unlock(&op_stats_lock);
+
+    g_string_append(json, first_op ? "}\n}\n" : "\n  }\n}\n");
+    fputs(json->str, out);
+    fflush(out);
+    g_string_free(json, TRUE);
+}
@@ -0,0 +1,292 @@
+#include "render_cache.h"
+#include "format_mask.h"
+#include "gtktext_cmark.h"
+#include "perf_policy.h"
+#include "perf_trace.h"
+#include "text_scan.h"
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define RENDER_CACHE_MAGIC "GTKTRC\r\n"
+// Bump whenever the layout below or the meaning of the stored text changes
+#define RENDER_CACHE_VERSION 1
+
+/*
+ * File layout, in native byte order; the cache never leaves this machine:
+ *
+ *   RenderCacheHeader
+ *   RenderCacheSpan[n_spans]   sorted by start, non-overlapping
+ *   char text[text_len]        UTF-8 without a terminating NUL
+ */
+typedef struct {
+    char magic[8];
+    guint32 version;
+    guint32 format_count;  // FORMAT_COUNT when written; the bits mean nothing across layouts
+    guint64 file_size;
+    guint64 file_mtime;    // Microseconds
+    char digest[64];       // SHA-256 of the file, hex
+    guint64 text_len;
+    guint64 n_spans;
+} RenderCacheHeader;
+
+// Characters [start, end) carry the tags of every bit in mask
+typedef struct {
+    guint32 start;
+    guint32 end;
+    guint32 mask;
+} RenderCacheSpan;
+
+G_STATIC_ASSERT(sizeof(RenderCacheHeader) % sizeof(guint32) == 0);
+
+static gchar *get_cache_path(GFile *file) {
+    g_autofree gchar *uri = g_file_get_uri(file);
+    g_autofree gchar *key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, uri, -1);
+    g_autofree gchar *name = g_strconcat(key, ".rcache", NULL);
+    return g_build_filename(g_get_user_cache_dir(), "gtktext", name, NULL);
+}
+
+static gboolean query_file_stamp(GFile *file, guint64 *size, guint64 *mtime) {
+    GFileInfo *info = g_file_query_info(file,
+                                        G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                        G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                        G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                        G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (!info) {
+        return FALSE;
+    }
+    *size = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
+    *mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+             g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    g_object_unref(info);
+    return TRUE;
+}
+
+// Checks everything a corrupt or stale cache could get wrong before the buffer is touched
+static const RenderCacheHeader *validate_cache(const gchar *contents, gsize length,
+                                               guint64 file_size, guint64 file_mtime) {
+    if (length < sizeof(RenderCacheHeader)) {
+        return NULL;
+    }
+    const RenderCacheHeader *header = (const RenderCacheHeader *)contents;
+    if (memcmp(header->magic, RENDER_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != RENDER_CACHE_VERSION || header->format_count != FORMAT_COUNT) {
+        return NULL;
+    }
+    if (header->file_size != file_size || header->file_mtime != file_mtime) {
+        return NULL;
+    }
+    gsize payload = length - sizeof(RenderCacheHeader);
+    if (header->n_spans > payload / sizeof(RenderCacheSpan) ||
+        header->text_len != payload - header->n_spans * sizeof(RenderCacheSpan) ||
+        header->text_len > G_MAXINT) {
+        return NULL;
+    }
+    for (gsize i = 0; i < sizeof(header->digest); i++) {
+        if (!g_ascii_isxdigit(header->digest[i])) {
+            return NULL;
+        }
+    }
+    return header;
+}
+
+gchar *render_cache_load(GtkTextBuffer *buffer, GFile *file) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+    g_return_val_if_fail(G_IS_FILE(file), NULL);
+
+    guint64 file_size, file_mtime;
+    if (perf_policy_get_render_cache_size() == 0 || !query_file_stamp(file, &file_size, &file_mtime)) {
+        return NULL;
+    }
+    g_autofree gchar *cache_path = get_cache_path(file);
+    GMappedFile *mapped = g_mapped_file_new(cache_path, FALSE, NULL);
+    if (!mapped) {
+        return NULL;
+    }
+
+    PerfSpan span = perf_span_begin(PERF_OP_CACHE_LOAD);
+    const gchar *contents = g_mapped_file_get_contents(mapped);
+    const RenderCacheHeader *header = validate_cache(contents, g_mapped_file_get_length(mapped),
+                                                     file_size, file_mtime);
+    const RenderCacheSpan *spans = header ? (const RenderCacheSpan *)(header + 1) : NULL;
+    const gchar *text = header ? (const gchar *)(spans + header->n_spans) : NULL;
+    if (!header || !text_scan_validate(text, header->text_len)) {
+        g_mapped_file_unref(mapped);
+        perf_span_end(&span);
+        return NULL;
+    }
+
+    FormatTags tags = { NULL };
+    resolve_format_tags_cmark(buffer, tags);
+    gtk_text_buffer_set_text(buffer, text, (gint)header->text_len);
+
+    // Spans are sorted, so one iterator walks the buffer once
+    guint32 char_count = (guint32)gtk_text_buffer_get_char_count(buffer);
+    guint32 valid_bits = FORMAT_MASK(FORMAT_COUNT) - 1;
+    GtkTextIter start, end;
+    gtk_text_buffer_get_start_iter(buffer, &end);
+    guint32 position = 0;
+    for (guint64 i = 0; i < header->n_spans; i++) {
+        const RenderCacheSpan *s = &spans[i];
+        if (s->start < position || s->end <= s->start || s->end > char_count) {
+            break;
+        }
+        start = end;
+        gtk_text_iter_forward_chars(&start, (gint)(s->start - position));
+        end = start;
+        gtk_text_iter_forward_chars(&end, (gint)(s->end - s->start));
+        position = s->end;
+        guint32 mask = s->mask & valid_bits;
+        for (guint bit = 0; mask != 0; bit++, mask >>= 1) {
+            if ((mask & 1u) && tags[bit]) {
+                gtk_text_buffer_apply_tag(buffer, tags[bit], &start, &end);
+            }
+        }
+    }
+
+    gchar *digest = g_strndup(header->digest, sizeof(header->digest));
+    g_mapped_file_unref(mapped);
+    perf_span_end(&span);
+    return digest;
+}
+
+static GArray *collect_spans(GtkTextBuffer *buffer) {
+    FormatTags tags;
+    format_tags_lookup(buffer, tags);
+
+    GArray *spans = g_array_new(FALSE, FALSE, sizeof(RenderCacheSpan));
+    GtkTextIter pos;
+    gtk_text_buffer_get_start_iter(buffer, &pos);
+    while (!gtk_text_iter_is_end(&pos)) {
+        RenderCacheSpan span;
+        span.start = (guint32)gtk_text_iter_get_offset(&pos);
+        span.mask = format_mask_at_iter(&pos, tags);
+        gtk_text_iter_forward_to_tag_toggle(&pos, NULL);
+        span.end = (guint32)gtk_text_iter_get_offset(&pos);
+        if (span.mask == 0) continue;
+
+        // Toggles of tags we don't store split spans that look the same
+        RenderCacheSpan *last = spans->len > 0
+            ? &g_array_index(spans, RenderCacheSpan, spans->len - 1) : NULL;
+        if (last && last->end == span.start && last->mask == span.mask) {
+            last->end = span.end;
+        } else {
+            g_array_append_val(spans, span);
+        }
+    }
+    return spans;
+}
+
+typedef struct {
+    gchar *path;
+    guint64 size;
+    gint64 mtime;
+} CacheEntry;
+
+static gint compare_entries_by_mtime(gconstpointer a, gconstpointer b) {
+    const CacheEntry *entry_a = a;
+    const CacheEntry *entry_b = b;
+    return (entry_a->mtime > entry_b->mtime) - (entry_a->mtime < entry_b->mtime);
+}
+
+// Removes the least recently written caches, other than keep, until the directory fits in limit bytes
+static void prune_cache_dir(const gchar *cache_dir, const gchar *keep, guint64 limit) {
+    GDir *dir = g_dir_open(cache_dir, 0, NULL);
+    if (!dir) {
+        return;
+    }
+    GArray *entries = g_array_new(FALSE, FALSE, sizeof(CacheEntry));
+    guint64 total = 0;
+    const gchar *name;
+    while ((name = g_dir_read_name(dir))) {
+        if (!g_str_has_suffix(name, ".rcache")) continue;
+        CacheEntry entry = { g_build_filename(cache_dir, name, NULL), 0, 0 };
+        GStatBuf st;
+        if (g_stat(entry.path, &st) != 0) {
+            g_free(entry.path);
+            continue;
+        }
+        entry.size = (guint64)st.st_size;
+        entry.mtime = (gint64)st.st_mtime;
+        total += entry.size;
+        g_array_append_val(entries, entry);
+    }
+    g_dir_close(dir);
+
+    g_array_sort(entries, compare_entries_by_mtime);
+    for (guint i = 0; i < entries->len; i++) {
+        CacheEntry *entry = &g_array_index(entries, CacheEntry, i);
+        if (total > limit && strcmp(entry->path, keep) != 0 && g_remove(entry->path) == 0) {
+            total -= entry->size;
+        }
+        g_free(entry->path);
+    }
+    g_array_unref(entries);
+}
+
+gboolean render_cache_store(GtkTextBuffer *buffer, GFile *file, const gchar *digest) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), FALSE);
+    g_return_val_if_fail(G_IS_FILE(file), FALSE);
+
+    RenderCacheHeader header = { 0 };
+    if (!digest || strlen(digest) != sizeof(header.digest) ||
+        !query_file_stamp(file, &header.file_size, &header.file_mtime)) {
+        return FALSE;
+    }
+
+    g_autofree gchar *cache_path = get_cache_path(file);
+    g_autofree gchar *cache_dir = g_path_get_dirname(cache_path);
+    if (g_mkdir_with_parents(cache_dir, 0700) != 0) {
+        return FALSE;
+    }
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, TRUE);
+    GArray *spans = collect_spans(buffer);
+
+    memcpy(header.magic, RENDER_CACHE_MAGIC, sizeof(header.magic));
+    header.version = RENDER_CACHE_VERSION;
+    header.format_count = FORMAT_COUNT;
+    memcpy(header.digest, digest, sizeof(header.digest));
+    header.text_len = strlen(text);
+    header.n_spans = spans->len;
+
+    // A document too large for the cache on its own isn't stored
+    guint64 limit = perf_policy_get_render_cache_size();
+    if (sizeof(header) + spans->len * sizeof(RenderCacheSpan) + header.text_len > limit) {
+        g_array_unref(spans);
+        return FALSE;
+    }
+
+    // Written beside the old cache and renamed over it, so readers never see half a file
+    GError *error = NULL;
+    GFile *cache_file = g_file_new_for_path(cache_path);
+    GFileOutputStream *stream = g_file_replace(cache_file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &error);
+    gboolean written = stream &&
+        g_output_stream_write_all(G_OUTPUT_STREAM(stream), &header, sizeof(header), NULL, NULL, &error) &&
+        g_output_stream_write_all(G_OUTPUT_STREAM(stream), spans->data,
+                                  spans->len * sizeof(RenderCacheSpan), NULL, NULL, &error) &&
+        g_output_stream_write_all(G_OUTPUT_STREAM(stream), text, header.text_len, NULL, NULL, &error);
+    if (stream) {
+        if (!written) {
+            // Closing a replace stream after a cancel keeps the old cache
+            GCancellable *abort = g_cancellable_new();
+            g_cancellable_cancel(abort);
+            g_output_stream_close(G_OUTPUT_STREAM(stream), abort, NULL);
+            g_object_unref(abort);
+        } else {
+            written = g_output_stream_close(G_OUTPUT_STREAM(stream), NULL, &error);
+        }
+        g_object_unref(stream);
+    }
+    if (error) {
+        g_warning("Cannot write render cache: %s", error->message);
+        g_clear_error(&error);
+    }
+    g_object_unref(cache_file);
+    g_array_unref(spans);
+    if (written) {
+        prune_cache_dir(cache_dir, cache_path, limit);
+    }
+    return written;
+}
@@ -0,0 +1,614 @@
+#include "render_plan.h"
+#include "format_mask.h"
+#include "gtktext_cmark.h"
+#include "source_map.h"
+#include <string.h>
+
+// Characters inserted at once by render_plan_insert(), so a long run doesn't overrun a deadline
+#define RENDER_PLAN_INSERT_PIECE 4096
+
+typedef struct {
+    gchar *text;  // Including the line terminator
+    GArray *runs; // RenderPlanRun, in order and covering the whole line
+} RenderPlanLine;
+
+struct _RenderPlan {
+    GArray *lines;         // RenderPlanLine
+    gint n_chars;          // Characters in all lines
+    SourceMap *source_map; // Copy of the buffer's, or NULL
+};
+
+static void render_plan_line_clear(gpointer data) {
+    RenderPlanLine *line = data;
+    g_free(line->text);
+    g_array_unref(line->runs);
+}
+
+struct _RenderPlanBuilder {
+    RenderPlan *plan;
+    GString *line;     // Text of the last line, which is still open
+    GArray *runs;      // Its RenderPlanRuns
+    gint line_chars;   // Characters in line
+};
+
+// Adds a run to a line, merging it into the last one if the formatting is the same
+static void render_plan_runs_add(GArray *runs, gint start, gint end, guint32 mask) {
+    RenderPlanRun *last = runs->len > 0 ? &g_array_index(runs, RenderPlanRun, runs->len - 1) : NULL;
+    if (last && last->mask == mask && last->end == start) {
+        last->end = end;
+    } else {
+        RenderPlanRun run = { start, end, mask };
+        g_array_append_val(runs, run);
+    }
+}
+
+static RenderPlan *render_plan_alloc(guint n_lines) {
+    RenderPlan *plan = g_new0(RenderPlan, 1);
+    plan->lines = g_array_sized_new(FALSE, TRUE, sizeof(RenderPlanLine), n_lines);
+    g_array_set_clear_func(plan->lines, render_plan_line_clear);
+    return plan;
+}
+
+RenderPlanBuilder *render_plan_builder_new(void) {
+    RenderPlanBuilder *builder = g_new0(RenderPlanBuilder, 1);
+    builder->plan = render_plan_alloc(0);
+    builder->line = g_string_new(NULL);
+    builder->runs = g_array_new(FALSE, FALSE, sizeof(RenderPlanRun));
+    return builder;
+}
+
+// Moves the open line into the plan
+static void render_plan_builder_close_line(RenderPlanBuilder *builder) {
+    RenderPlanLine line = { g_string_free(builder->line, FALSE), builder->runs };
+    g_array_append_val(builder->plan->lines, line);
+    builder->line = g_string_new(NULL);
+    builder->runs = g_array_new(FALSE, FALSE, sizeof(RenderPlanRun));
+    builder->line_chars = 0;
+}
+
+void render_plan_builder_append(RenderPlanBuilder *builder, const char *text, guint32 mask) {
+    g_return_if_fail(builder != NULL);
+    if (!text) return;
+
+    while (*text) {
+        const char *eol = strchr(text, '\n');
+        const char *next = eol ? eol + 1 : text + strlen(text);
+        gint n_chars = (gint)g_utf8_strlen(text, next - text);
+        g_string_append_len(builder->line, text, next - text);
+        render_plan_runs_add(builder->runs, builder->line_chars, builder->line_chars + n_chars, mask);
+        builder->line_chars += n_chars;
+        builder->plan->n_chars += n_chars;
+        if (eol) {
+            render_plan_builder_close_line(builder);
+        }
+        text = next;
+    }
+}
+
+gint render_plan_builder_get_offset(const RenderPlanBuilder *builder) {
+    return builder->plan->n_chars;
+}
+
+RenderPlan *render_plan_builder_finish(RenderPlanBuilder *builder, SourceMap *source_map) {
+    g_return_val_if_fail(builder != NULL, NULL);
+
+    // The last line has no terminator and may be empty, as in a buffer
+    RenderPlanLine line = { g_string_free(builder->line, FALSE), builder->runs };
+    g_array_append_val(builder->plan->lines, line);
+    RenderPlan *plan = builder->plan;
+    plan->source_map = source_map;
+    g_free(builder);
+    return plan;
+}
+
+gchar *render_plan_read_line(GtkTextIter *iter, FormatTags tags, GArray *runs) {
+    g_return_val_if_fail(iter != NULL && runs != NULL, NULL);
+
+    GtkTextIter line_start = *iter;
+    gtk_text_iter_forward_line(iter);
+    g_array_set_size(runs, 0);
+
+    GtkTextIter pos = line_start;
+    gint start = 0;
+    while (gtk_text_iter_compare(&pos, iter) < 0) {
+        guint32 mask = format_mask_at_iter(&pos, tags);
+        gtk_text_iter_forward_to_tag_toggle(&pos, NULL);
+        if (gtk_text_iter_compare(&pos, iter) > 0) {
+            pos = *iter;
+        }
+        gint end = gtk_text_iter_get_offset(&pos) - gtk_text_iter_get_offset(&line_start);
+        // Toggles of other tags, such as spell checking, split runs that look the same
+        render_plan_runs_add(runs, start, end, mask);
+        start = end;
+    }
+    return gtk_text_iter_get_slice(&line_start, iter);
+}
+
+// Reads the line starting at iter and moves iter to the start of the next one
+static void render_plan_line_read(RenderPlanLine *line, GtkTextIter *iter, FormatTags tags) {
+    line->runs = g_array_new(FALSE, FALSE, sizeof(RenderPlanRun));
+    line->text = render_plan_read_line(iter, tags, line->runs);
+}
+
+static gboolean render_plan_line_equal(const RenderPlanLine *a, const RenderPlanLine *b) {
+    if (strcmp(a->text, b->text) != 0 || a->runs->len != b->runs->len) {
+        return FALSE;
+    }
+    return memcmp(a->runs->data, b->runs->data, a->runs->len * sizeof(RenderPlanRun)) == 0;
+}
+
+struct _RenderPlanSnapshot {
+    GtkTextBuffer *buffer;  // Referenced
+    RenderPlan *plan;       // The lines read so far
+    FormatTags tags;
+    gulong handler_ids[4];
+};
+
+// The lines from an edited one on are read again
+static void snapshot_forget_from(RenderPlanSnapshot *snapshot, const GtkTextIter *iter) {
+    guint line = (guint)gtk_text_iter_get_line(iter);
+    if (line < snapshot->plan->lines->len) {
+        g_array_set_size(snapshot->plan->lines, line);
+    }
+}
+
+static void on_snapshot_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                                    G_GNUC_UNUSED gchar *text, G_GNUC_UNUSED gint len, gpointer user_data) {
+    snapshot_forget_from(user_data, location);
+}
+
+static void on_snapshot_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                                     G_GNUC_UNUSED GtkTextIter *end, gpointer user_data) {
+    snapshot_forget_from(user_data, start);
+}
+
+// Only format tags change what a plan records; spell checking and folds don't
+static void on_snapshot_tag_changed(GtkTextBuffer *buffer, GtkTextTag *tag, GtkTextIter *start,
+                                    G_GNUC_UNUSED GtkTextIter *end, gpointer user_data) {
+    RenderPlanSnapshot *snapshot = user_data;
+    format_tags_lookup(buffer, snapshot->tags);  // The tag may be new
+    for (guint bit = 0; bit < FORMAT_COUNT; bit++) {
+        if (snapshot->tags[bit] == tag) {
+            snapshot_forget_from(snapshot, start);
+            return;
+        }
+    }
+}
+
+RenderPlanSnapshot *render_plan_snapshot_new(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+
+    RenderPlanSnapshot *snapshot = g_new0(RenderPlanSnapshot, 1);
+    snapshot->buffer = g_object_ref(buffer);
+    snapshot->plan = render_plan_alloc((guint)gtk_text_buffer_get_line_count(buffer));
+    format_tags_lookup(buffer, snapshot->tags);
+    // Before the default handlers, while the iters still point into the old text
+    snapshot->handler_ids[0] = g_signal_connect(buffer, "insert-text", G_CALLBACK(on_snapshot_insert_text), snapshot);
+    snapshot->handler_ids[1] = g_signal_connect(buffer, "delete-range", G_CALLBACK(on_snapshot_delete_range), snapshot);
+    snapshot->handler_ids[2] = g_signal_connect(buffer, "apply-tag", G_CALLBACK(on_snapshot_tag_changed), snapshot);
+    snapshot->handler_ids[3] = g_signal_connect(buffer, "remove-tag", G_CALLBACK(on_snapshot_tag_changed), snapshot);
+    return snapshot;
+}
+
+gboolean render_plan_snapshot_read(RenderPlanSnapshot *snapshot, gint64 deadline_us) {
+    g_return_val_if_fail(snapshot != NULL, TRUE);
+
+    GArray *lines = snapshot->plan->lines;
+    guint n_lines = (guint)gtk_text_buffer_get_line_count(snapshot->buffer);
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(snapshot->buffer, &iter, (gint)lines->len);
+    while (lines->len < n_lines) {
+        RenderPlanLine line;
+        render_plan_line_read(&line, &iter, snapshot->tags);
+        g_array_append_val(lines, line);
+        if (deadline_us > 0 && g_get_monotonic_time() >= deadline_us) break;
+    }
+    return lines->len == n_lines;
+}
+
+double render_plan_snapshot_get_progress(const RenderPlanSnapshot *snapshot) {
+    g_return_val_if_fail(snapshot != NULL, 1.0);
+    return (double)snapshot->plan->lines->len / gtk_text_buffer_get_line_count(snapshot->buffer);
+}
+
+static void snapshot_disconnect(RenderPlanSnapshot *snapshot) {
+    for (guint i = 0; i < G_N_ELEMENTS(snapshot->handler_ids); i++) {
+        g_signal_handler_disconnect(snapshot->buffer, snapshot->handler_ids[i]);
+    }
+    g_object_unref(snapshot->buffer);
+}
+
+RenderPlan *render_plan_snapshot_finish(RenderPlanSnapshot *snapshot) {
+    g_return_val_if_fail(snapshot != NULL, NULL);
+
+    RenderPlan *plan = snapshot->plan;
+    plan->n_chars = gtk_text_buffer_get_char_count(snapshot->buffer);
+    SourceMap *map = source_map_get(snapshot->buffer);
+    plan->source_map = map ? source_map_copy(map) : NULL;
+    snapshot_disconnect(snapshot);
+    g_free(snapshot);
+    return plan;
+}
+
+void render_plan_snapshot_free(RenderPlanSnapshot *snapshot) {
+    if (!snapshot) return;
+    snapshot_disconnect(snapshot);
+    render_plan_free(snapshot->plan);
+    g_free(snapshot);
+}
+
+RenderPlan *render_plan_new_from_buffer(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+
+    RenderPlanSnapshot *snapshot = render_plan_snapshot_new(buffer);
+    render_plan_snapshot_read(snapshot, 0);
+    return render_plan_snapshot_finish(snapshot);
+}
+
+void render_plan_free(RenderPlan *plan) {
+    if (!plan) return;
+    g_array_unref(plan->lines);
+    source_map_free(plan->source_map);
+    g_free(plan);
+}
+
+guint render_plan_get_n_lines(const RenderPlan *plan) {
+    return plan->lines->len;
+}
+
+const SourceMap *render_plan_get_source_map(const RenderPlan *plan) {
+    return plan->source_map;
+}
+
+void render_plan_set_source_map(RenderPlan *plan, SourceMap *source_map) {
+    g_return_if_fail(plan != NULL);
+    source_map_free(plan->source_map);
+    plan->source_map = source_map;
+}
+
+const gchar *render_plan_get_line(const RenderPlan *plan, guint line, const RenderPlanRun **runs, guint *n_runs) {
+    g_return_val_if_fail(plan != NULL && line < plan->lines->len, NULL);
+
+    const RenderPlanLine *plan_line = &g_array_index(plan->lines, RenderPlanLine, line);
+    if (runs) *runs = (const RenderPlanRun *)plan_line->runs->data;
+    if (n_runs) *n_runs = plan_line->runs->len;
+    return plan_line->text;
+}
+
+void render_plan_append(RenderPlan *plan, RenderPlan *tail) {
+    g_return_if_fail(plan != NULL && tail != NULL);
+
+    RenderPlanLine *last = &g_array_index(plan->lines, RenderPlanLine, plan->lines->len - 1);
+    RenderPlanLine *first = &g_array_index(tail->lines, RenderPlanLine, 0);
+    gint shift = (gint)g_utf8_strlen(last->text, -1);
+    gchar *text = g_strconcat(last->text, first->text, NULL);
+    g_free(last->text);
+    last->text = text;
+    for (guint r = 0; r < first->runs->len; r++) {
+        const RenderPlanRun *run = &g_array_index(first->runs, RenderPlanRun, r);
+        render_plan_runs_add(last->runs, run->start + shift, run->end + shift, run->mask);
+    }
+
+    // The other lines move over as they are
+    g_array_append_vals(plan->lines, &g_array_index(tail->lines, RenderPlanLine, 1), tail->lines->len - 1);
+
+    // A map covering only part of the text would be wrong for the rest
+    if (plan->source_map && tail->source_map) {
+        source_map_append(plan->source_map, tail->source_map, plan->n_chars, 0);
+    } else {
+        source_map_free(plan->source_map);
+        plan->source_map = NULL;
+    }
+    plan->n_chars += tail->n_chars;
+    g_array_set_clear_func(tail->lines, NULL);
+    render_plan_line_clear(first);
+    render_plan_free(tail);
+}
+
+void render_plan_trim_end(RenderPlan *plan) {
+    g_return_if_fail(plan != NULL);
+
+    for (;;) {
+        RenderPlanLine *last = &g_array_index(plan->lines, RenderPlanLine, plan->lines->len - 1);
+        gsize length = strlen(last->text);
+        if (length == 0 && plan->lines->len > 1) {
+            g_array_remove_index(plan->lines, plan->lines->len - 1);
+            continue;
+        }
+        if (length == 0 || last->text[length - 1] != '\n') break;
+
+        last->text[length - 1] = '\0';
+        plan->n_chars--;
+        gint n_chars = (gint)g_utf8_strlen(last->text, -1);
+        while (last->runs->len > 0) {
+            RenderPlanRun *run = &g_array_index(last->runs, RenderPlanRun, last->runs->len - 1);
+            if (run->start < n_chars) {
+                run->end = MIN(run->end, n_chars);
+                break;
+            }
+            g_array_remove_index(last->runs, last->runs->len - 1);
+        }
+    }
+    source_map_free(plan->source_map);
+    plan->source_map = NULL;
+}
+
+gboolean render_plan_insert(const RenderPlan *plan, GtkTextBuffer *buffer, GtkTextIter *iter,
+                            RenderPlanPosition *position, gint64 deadline_us) {
+    g_return_val_if_fail(plan != NULL && position != NULL, TRUE);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), TRUE);
+
+    FormatTags tags;
+    resolve_format_tags_cmark(buffer, tags);
+
+    while (position->line < plan->lines->len) {
+        const RenderPlanLine *line = &g_array_index(plan->lines, RenderPlanLine, position->line);
+        if (position->run >= line->runs->len) {
+            position->line++;
+            position->run = 0;
+            position->offset = 0;
+            position->byte = 0;
+            continue;
+        }
+
+        const RenderPlanRun *run = &g_array_index(line->runs, RenderPlanRun, position->run);
+        gint n_chars = MIN(run->end - position->offset, RENDER_PLAN_INSERT_PIECE);
+        const gchar *piece_start = line->text + position->byte;
+        const gchar *piece_end = g_utf8_offset_to_pointer(piece_start, n_chars);
+        g_autofree gchar *text = g_strndup(piece_start, (gsize)(piece_end - piece_start));
+        format_insert_text(buffer, iter, text, run->mask, tags);
+
+        position->offset += n_chars;
+        position->byte += (gsize)(piece_end - piece_start);
+        if (position->offset >= run->end) {
+            position->run++;
+        }
+        if (deadline_us > 0 && g_get_monotonic_time() >= deadline_us) {
+            break;
+        }
+    }
+    return position->line >= plan->lines->len;
+}
+
+// Compares buffer line buffer_line with plan line plan_line
+static gboolean buffer_line_matches(GtkTextBuffer *buffer, gint buffer_line, FormatTags tags,
+                                    const RenderPlan *plan, guint plan_line) {
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, buffer_line);
+    RenderPlanLine line;
+    render_plan_line_read(&line, &iter, tags);
+    gboolean equal = render_plan_line_equal(&line, &g_array_index(plan->lines, RenderPlanLine, plan_line));
+    render_plan_line_clear(&line);
+    return equal;
+}
+
+static guint render_plan_line_hash(gconstpointer key) {
+    const RenderPlanLine *line = key;
+    return g_str_hash(line->text);
+}
+
+static gboolean render_plan_line_key_equal(gconstpointer a, gconstpointer b) {
+    return render_plan_line_equal(a, b);
+}
+
+// Old lines old_start..old_end are replaced by plan lines new_start..new_end
+typedef struct {
+    guint old_start, old_end;
+    guint new_start, new_end;
+} RenderPlanHunk;
+
+// Occurrences of one line text in the old and new lines
+typedef struct {
+    guint old_count, new_count;
+    guint old_index;
+} RenderPlanLineCount;
+
+/*
+ * Pairs of old and new lines that are kept: the lines that occur exactly
+ * once on both sides and whose order is the same on both (the longest
+ * increasing run of old indices), as in patience diff. Every paragraph has
+ * its own text, so a changed block is usually fenced in by kept lines.
+ */
+static GArray *render_plan_find_anchors(const RenderPlanLine *old_lines, guint n_old,
+                                        const RenderPlanLine *new_lines, guint n_new) {
+    GHashTable *counts = g_hash_table_new_full(render_plan_line_hash, render_plan_line_key_equal, NULL, g_free);
+    for (guint i = 0; i < n_old; i++) {
+        RenderPlanLineCount *count = g_hash_table_lookup(counts, &old_lines[i]);
+        if (!count) {
+            count = g_new0(RenderPlanLineCount, 1);
+            g_hash_table_insert(counts, (gpointer)&old_lines[i], count);
+        }
+        count->old_count++;
+        count->old_index = i;
+    }
+    for (guint j = 0; j < n_new; j++) {
+        RenderPlanLineCount *count = g_hash_table_lookup(counts, &new_lines[j]);
+        if (count) count->new_count++;
+    }
+
+    // Candidates in new order; tails[k] ends the best increasing run of length k + 1
+    GArray *pairs = g_array_new(FALSE, FALSE, sizeof(guint) * 2);
+    for (guint j = 0; j < n_new; j++) {
+        RenderPlanLineCount *count = g_hash_table_lookup(counts, &new_lines[j]);
+        if (count && count->old_count == 1 && count->new_count == 1) {
+            guint pair[2] = { count->old_index, j };
+            g_array_append_val(pairs, pair);
+        }
+    }
+    g_hash_table_destroy(counts);
+
+    guint n = pairs->len;
+    guint *tails = g_new(guint, n + 1);
+    guint *previous = g_new(guint, n + 1);
+    guint length = 0;
+    for (guint k = 0; k < n; k++) {
+        guint old_index = ((guint *)pairs->data)[2 * k];
+        guint low = 0, high = length;
+        while (low < high) {
+            guint mid = (low + high) / 2;
+            if (((guint *)pairs->data)[2 * tails[mid]] < old_index) low = mid + 1;
+            else high = mid;
+        }
+        previous[k] = low > 0 ? tails[low - 1] : G_MAXUINT;
+        tails[low] = k;
+        if (low == length) length++;
+    }
+
+    GArray *anchors = g_array_sized_new(FALSE, FALSE, sizeof(guint) * 2, length);
+    g_array_set_size(anchors, length);
+    guint k = length > 0 ? tails[length - 1] : G_MAXUINT;
+    for (guint i = length; i > 0; i--) {
+        memcpy((guint *)anchors->data + 2 * (i - 1), (guint *)pairs->data + 2 * k, sizeof(guint) * 2);
+        k = previous[k];
+    }
+    g_free(previous);
+    g_free(tails);
+    g_array_unref(pairs);
+    return anchors;
+}
+
+// Hunks between the anchors, with the equal lines at either end of each gap kept as well
+static GArray *render_plan_find_hunks(const RenderPlanLine *old_lines, guint n_old,
+                                      const RenderPlanLine *new_lines, guint n_new) {
+    GArray *anchors = render_plan_find_anchors(old_lines, n_old, new_lines, n_new);
+    GArray *hunks = g_array_new(FALSE, FALSE, sizeof(RenderPlanHunk));
+    guint old_pos = 0, new_pos = 0;
+    for (guint a = 0; a <= anchors->len; a++) {
+        guint old_end = n_old, new_end = n_new;
+        if (a < anchors->len) {
+            old_end = ((guint *)anchors->data)[2 * a];
+            new_end = ((guint *)anchors->data)[2 * a + 1];
+        }
+        while (old_pos < old_end && new_pos < new_end &&
+               render_plan_line_equal(&old_lines[old_pos], &new_lines[new_pos])) {
+            old_pos++;
+            new_pos++;
+        }
+        while (old_end > old_pos && new_end > new_pos &&
+               render_plan_line_equal(&old_lines[old_end - 1], &new_lines[new_end - 1])) {
+            old_end--;
+            new_end--;
+        }
+        if (old_pos < old_end || new_pos < new_end) {
+            RenderPlanHunk hunk = { old_pos, old_end, new_pos, new_end };
+            g_array_append_val(hunks, hunk);
+        }
+        if (a < anchors->len) {
+            // Past the anchor itself
+            old_pos = ((guint *)anchors->data)[2 * a] + 1;
+            new_pos = ((guint *)anchors->data)[2 * a + 1] + 1;
+        }
+    }
+    g_array_unref(anchors);
+    return hunks;
+}
+
+// Inserts plan lines from..to at iter, which moves past them
+static void render_plan_insert_lines(const RenderPlan *plan, GtkTextBuffer *buffer, GtkTextIter *iter,
+                                     guint from, guint to, FormatTags tags) {
+    for (guint i = from; i < to; i++) {
+        const RenderPlanLine *line = &g_array_index(plan->lines, RenderPlanLine, i);
+        for (guint r = 0; r < line->runs->len; r++) {
+            const RenderPlanRun *run = &g_array_index(line->runs, RenderPlanRun, r);
+            const gchar *run_start = g_utf8_offset_to_pointer(line->text, run->start);
+            const gchar *run_end = g_utf8_offset_to_pointer(run_start, run->end - run->start);
+            g_autofree gchar *text = g_strndup(run_start, (gsize)(run_end - run_start));
+            format_insert_text(buffer, iter, text, run->mask, tags);
+        }
+    }
+}
+
+guint render_plan_apply(const RenderPlan *plan, GtkTextBuffer *buffer) {
+    g_return_val_if_fail(plan != NULL, 0);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), 0);
+
+    FormatTags tags;
+    format_tags_lookup(buffer, tags);
+
+    guint old_lines = (guint)gtk_text_buffer_get_line_count(buffer);
+    guint new_lines = plan->lines->len;
+    guint shared = MIN(old_lines, new_lines);
+
+    // Lines kept at the start, then at the end
+    guint prefix = 0;
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    while (prefix < shared) {
+        RenderPlanLine line;
+        render_plan_line_read(&line, &iter, tags);
+        gboolean equal = render_plan_line_equal(&line, &g_array_index(plan->lines, RenderPlanLine, prefix));
+        render_plan_line_clear(&line);
+        if (!equal) break;
+        prefix++;
+    }
+    guint suffix = 0;
+    while (suffix < shared - prefix &&
+           buffer_line_matches(buffer, (gint)(old_lines - 1 - suffix), tags, plan, new_lines - 1 - suffix)) {
+        suffix++;
+    }
+    if (prefix == old_lines && prefix == new_lines) {
+        source_map_attach(buffer, plan->source_map ? source_map_copy(plan->source_map) : NULL);
+        return 0;
+    }
+
+    // Between them, the blocks that are still the same are kept too
+    guint n_old = old_lines - suffix - prefix;
+    GArray *middle = g_array_sized_new(FALSE, FALSE, sizeof(RenderPlanLine), n_old);
+    g_array_set_clear_func(middle, render_plan_line_clear);
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, (gint)prefix);
+    for (guint i = 0; i < n_old; i++) {
+        RenderPlanLine line;
+        render_plan_line_read(&line, &iter, tags);
+        g_array_append_val(middle, line);
+    }
+    GArray *hunks = render_plan_find_hunks((const RenderPlanLine *)middle->data, n_old,
+                                           &g_array_index(plan->lines, RenderPlanLine, prefix),
+                                           new_lines - suffix - prefix);
+    g_array_unref(middle);
+
+    // The replaced lines may use tags the buffer doesn't have yet
+    resolve_format_tags_cmark(buffer, tags);
+
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    gint cursor_line = gtk_text_iter_get_line(&cursor);
+    gint cursor_offset = gtk_text_iter_get_line_offset(&cursor);
+
+    // The plan's map replaces the buffer's, which needn't be patched on the way
+    source_map_attach(buffer, NULL);
+    gtk_text_buffer_begin_user_action(buffer);
+    guint replaced = 0;
+    // From the end, so the line numbers of the hunks still to come stay valid
+    for (guint h = hunks->len; h > 0; h--) {
+        const RenderPlanHunk *hunk = &g_array_index(hunks, RenderPlanHunk, h - 1);
+        gint first = (gint)(prefix + hunk->old_start);
+        gint old_end = (gint)(prefix + hunk->old_end);
+        GtkTextIter start, end;
+        gtk_text_buffer_get_iter_at_line(buffer, &start, first);
+        if ((guint)old_end < old_lines) {
+            gtk_text_buffer_get_iter_at_line(buffer, &end, old_end);
+        } else {
+            gtk_text_buffer_get_end_iter(buffer, &end);
+        }
+        gtk_text_buffer_delete(buffer, &start, &end);
+        render_plan_insert_lines(plan, buffer, &start, prefix + hunk->new_start, prefix + hunk->new_end, tags);
+        replaced += hunk->new_end - hunk->new_start;
+
+        if (cursor_line >= first && cursor_line < old_end) {
+            // Keep it within the new lines, or at the start of the first kept line after them
+            gint last_line = MAX(first + (gint)(hunk->new_end - hunk->new_start) - 1, first);
+            gint line = CLAMP(cursor_line, first, last_line);
+            gtk_text_buffer_get_iter_at_line(buffer, &cursor, line);
+            if (cursor_offset < gtk_text_iter_get_chars_in_line(&cursor)) {
+                gtk_text_iter_set_line_offset(&cursor, cursor_offset);
+            } else if (!gtk_text_iter_ends_line(&cursor)) {
+                gtk_text_iter_forward_to_line_end(&cursor);
+            }
+            gtk_text_buffer_place_cursor(buffer, &cursor);
+        }
+    }
+    gtk_text_buffer_end_user_action(buffer);
+    source_map_attach(buffer, plan->source_map ? source_map_copy(plan->source_map) : NULL);
+    g_array_unref(hunks);
+    return replaced;
+}
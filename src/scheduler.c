@@ -0,0 +1,339 @@
+#include "scheduler.h"
+#include "perf_policy.h"
+
+#define SCHEDULER_GENERATION_KEY "gtktext-scheduler-generation"
+// Without a frame clock frames are taken to come at 60 Hz; the lanes below input may use this much of each
+#define SCHEDULER_FRAME_US 16667
+#define SCHEDULER_FRAME_BUDGET_US 6000
+// A frame clock that stops, as for a minimized window, is given up on after this long
+#define SCHEDULER_FRAME_STALL_US 100000
+// Longest slice, so input waits at most this long for a slice to return
+#define SCHEDULER_SLICE_US 3000
+
+// Held by a buffer and its jobs, so workers can still read it once the buffer is gone
+typedef struct {
+    gint value;
+} Generation;
+
+struct _SchedulerJob {
+    guint id;                  // Also the submission order
+    SchedulerLane lane;
+    Generation *generation;    // NULL for work that doesn't go stale
+    gint start_generation;
+    gint cancelled;
+    gboolean running;          // In its slice, or handed to the pool
+    SchedulerSliceFunc slice;
+    SchedulerWorkFunc work;
+    SchedulerDoneFunc done;
+    gpointer user_data;
+    GDestroyNotify destroy;
+};
+
+static const gint lane_priorities[SCHEDULER_LANE_COUNT] = {
+    [SCHEDULER_LANE_INPUT] = G_PRIORITY_HIGH_IDLE,  // Ahead of GTK's relayout and redraw
+    [SCHEDULER_LANE_VISIBLE] = G_PRIORITY_DEFAULT_IDLE,
+    [SCHEDULER_LANE_BACKGROUND] = G_PRIORITY_DEFAULT_IDLE + 50,
+    [SCHEDULER_LANE_IDLE] = G_PRIORITY_LOW,
+};
+
+// Main thread only; workers see nothing but their own job
+static GQueue lanes[SCHEDULER_LANE_COUNT];
+static guint lane_source_ids[SCHEDULER_LANE_COUNT];
+static GHashTable *jobs = NULL;  // Every job not yet freed, by id
+static guint next_job_id = 1;
+static gint64 frame_start_us = 0;
+static gint64 frame_used_us = 0;
+static GdkFrameClock *frame_clock = NULL;  // Not owned; cleared when finalized
+static gulong before_paint_id = 0;
+static gulong after_paint_id = 0;
+static gboolean lane_waiting_for_frame[SCHEDULER_LANE_COUNT];
+static GThreadPool *worker_pool = NULL;
+
+static void advance_generation(Generation *generation) {
+    g_atomic_int_inc(&generation->value);
+}
+
+// The buffer is gone, so everything queued for it is stale
+static void generation_dispose(gpointer data) {
+    advance_generation(data);
+    g_atomic_rc_box_release(data);
+}
+
+static Generation *get_generation(GtkTextBuffer *buffer) {
+    Generation *generation = g_object_get_data(G_OBJECT(buffer), SCHEDULER_GENERATION_KEY);
+    if (!generation) {
+        generation = g_atomic_rc_box_new0(Generation);
+        g_object_set_data_full(G_OBJECT(buffer), SCHEDULER_GENERATION_KEY, generation, generation_dispose);
+        // Before the default handler, so handlers run after it see the new generation
+        g_signal_connect_swapped(buffer, "insert-text", G_CALLBACK(advance_generation), generation);
+        g_signal_connect_swapped(buffer, "delete-range", G_CALLBACK(advance_generation), generation);
+    }
+    return generation;
+}
+
+guint scheduler_get_generation(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), 0);
+    return (guint)g_atomic_int_get(&get_generation(buffer)->value);
+}
+
+gboolean scheduler_job_is_cancelled(SchedulerJob *job) {
+    g_return_val_if_fail(job != NULL, TRUE);
+    return g_atomic_int_get(&job->cancelled) ||
+           (job->generation && g_atomic_int_get(&job->generation->value) != job->start_generation);
+}
+
+static SchedulerJob *job_new(GtkTextBuffer *buffer, SchedulerLane lane, gpointer user_data, GDestroyNotify destroy) {
+    SchedulerJob *job = g_new0(SchedulerJob, 1);
+    job->id = next_job_id++;
+    if (next_job_id == 0) next_job_id = 1;
+    job->lane = lane;
+    if (buffer) {
+        job->generation = g_atomic_rc_box_acquire(get_generation(buffer));
+        job->start_generation = g_atomic_int_get(&job->generation->value);
+    }
+    job->user_data = user_data;
+    job->destroy = destroy;
+    if (!jobs) {
+        jobs = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_insert(jobs, GUINT_TO_POINTER(job->id), job);
+    return job;
+}
+
+static void job_finish(SchedulerJob *job) {
+    g_hash_table_remove(jobs, GUINT_TO_POINTER(job->id));
+    if (job->destroy) {
+        job->destroy(job->user_data);
+    }
+    if (job->generation) {
+        g_atomic_rc_box_release(job->generation);
+    }
+    g_free(job);
+}
+
+static gboolean lane_dispatch(gpointer user_data);
+
+static void lane_wake(SchedulerLane lane) {
+    if (lane_source_ids[lane] == 0) {
+        lane_source_ids[lane] = g_idle_add_full(lane_priorities[lane], lane_dispatch, GINT_TO_POINTER(lane), NULL);
+    }
+}
+
+static gboolean lane_wake_timeout(gpointer user_data) {
+    SchedulerLane lane = GPOINTER_TO_INT(user_data);
+    lane_source_ids[lane] = 0;
+    lane_waiting_for_frame[lane] = FALSE;
+    lane_wake(lane);
+    return G_SOURCE_REMOVE;
+}
+
+static void wake_waiting_lanes(void) {
+    for (gint lane = 0; lane < SCHEDULER_LANE_COUNT; lane++) {
+        if (lane_waiting_for_frame[lane]) {
+            lane_waiting_for_frame[lane] = FALSE;
+            g_clear_handle_id(&lane_source_ids[lane], g_source_remove);
+            lane_wake((SchedulerLane)lane);
+        }
+    }
+}
+
+// A frame begins; its budget is counted from the clock's frame time
+static void on_before_paint(GdkFrameClock *clock, G_GNUC_UNUSED gpointer user_data) {
+    frame_start_us = gdk_frame_clock_get_frame_time(clock);
+    frame_used_us = 0;
+}
+
+static void on_after_paint(G_GNUC_UNUSED GdkFrameClock *clock, G_GNUC_UNUSED gpointer user_data) {
+    wake_waiting_lanes();
+}
+
+static void frame_clock_finalized(G_GNUC_UNUSED gpointer data, G_GNUC_UNUSED GObject *clock) {
+    frame_clock = NULL;
+    wake_waiting_lanes();  // They go back to the timer
+}
+
+static void set_frame_clock(GdkFrameClock *clock) {
+    if (clock == frame_clock) return;
+    if (frame_clock) {
+        g_signal_handler_disconnect(frame_clock, before_paint_id);
+        g_signal_handler_disconnect(frame_clock, after_paint_id);
+        g_object_weak_unref(G_OBJECT(frame_clock), frame_clock_finalized, NULL);
+    }
+    frame_clock = clock;
+    if (clock) {
+        g_object_weak_ref(G_OBJECT(clock), frame_clock_finalized, NULL);
+        before_paint_id = g_signal_connect(clock, "before-paint", G_CALLBACK(on_before_paint), NULL);
+        after_paint_id = g_signal_connect(clock, "after-paint", G_CALLBACK(on_after_paint), NULL);
+    }
+    // Lanes waiting on the old clock would never hear from it
+    wake_waiting_lanes();
+}
+
+static void follow_widget_clock(GtkWidget *widget, G_GNUC_UNUSED gpointer user_data) {
+    if (gtk_widget_get_realized(widget)) {
+        set_frame_clock(gtk_widget_get_frame_clock(widget));
+    }
+}
+
+static void on_followed_unrealize(GtkWidget *widget, G_GNUC_UNUSED gpointer user_data) {
+    if (frame_clock && frame_clock == gtk_widget_get_frame_clock(widget)) {
+        set_frame_clock(NULL);
+    }
+}
+
+static void on_followed_focus(GtkWidget *widget, G_GNUC_UNUSED GParamSpec *pspec, G_GNUC_UNUSED gpointer user_data) {
+    if (gtk_widget_has_focus(widget)) {
+        follow_widget_clock(widget, NULL);
+    }
+}
+
+void scheduler_follow_frame_clock(GtkWidget *widget) {
+    g_return_if_fail(GTK_IS_WIDGET(widget));
+    g_signal_connect(widget, "realize", G_CALLBACK(follow_widget_clock), NULL);
+    g_signal_connect(widget, "unrealize", G_CALLBACK(on_followed_unrealize), NULL);
+    g_signal_connect(widget, "notify::has-focus", G_CALLBACK(on_followed_focus), NULL);
+    follow_widget_clock(widget, NULL);
+}
+
+// Runs one slice of the lane's first job per main loop iteration, so other sources get their turn
+static gboolean lane_dispatch(gpointer user_data) {
+    SchedulerLane lane = GPOINTER_TO_INT(user_data);
+    gint64 now = g_get_monotonic_time();
+    if (now - frame_start_us >= (frame_clock ? SCHEDULER_FRAME_STALL_US : SCHEDULER_FRAME_US)) {
+        frame_start_us = now;
+        frame_used_us = 0;
+    }
+
+    SchedulerJob *job = g_queue_pop_head(&lanes[lane]);
+    while (job && scheduler_job_is_cancelled(job)) {
+        job_finish(job);
+        job = g_queue_pop_head(&lanes[lane]);
+    }
+    if (!job) {
+        lane_source_ids[lane] = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    // Input is never held back; the other lanes wait for the next frame once its budget is spent
+    gint64 slice_us = SCHEDULER_SLICE_US;
+    if (lane != SCHEDULER_LANE_INPUT) {
+        gint64 left = SCHEDULER_FRAME_BUDGET_US - frame_used_us;
+        if (left <= 0) {
+            g_queue_push_head(&lanes[lane], job);
+            gint64 frame_us = SCHEDULER_FRAME_US;
+            if (frame_clock) {
+                // Back once the next frame is painted, or when the clock has stalled
+                lane_waiting_for_frame[lane] = TRUE;
+                gdk_frame_clock_request_phase(frame_clock, GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+                frame_us = SCHEDULER_FRAME_STALL_US;
+            }
+            guint wait_ms = (guint)((frame_start_us + frame_us - now + 999) / 1000);
+            lane_source_ids[lane] = g_timeout_add_full(lane_priorities[lane], wait_ms, lane_wake_timeout,
+                                                       GINT_TO_POINTER(lane), NULL);
+            return G_SOURCE_REMOVE;
+        }
+        slice_us = MIN(slice_us, left);
+    }
+
+    job->running = TRUE;
+    gboolean more = job->slice(job, now + slice_us, job->user_data);
+    job->running = FALSE;
+    frame_used_us += g_get_monotonic_time() - now;
+
+    if (more && !scheduler_job_is_cancelled(job)) {
+        g_queue_push_tail(&lanes[job->lane], job);
+        lane_wake(job->lane);
+    } else {
+        job_finish(job);
+    }
+    if (g_queue_is_empty(&lanes[lane])) {
+        lane_source_ids[lane] = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+guint scheduler_add_slice(GtkTextBuffer *buffer, SchedulerLane lane, SchedulerSliceFunc slice,
+                          gpointer user_data, GDestroyNotify destroy) {
+    g_return_val_if_fail(buffer == NULL || GTK_IS_TEXT_BUFFER(buffer), 0);
+    g_return_val_if_fail((guint)lane < SCHEDULER_LANE_COUNT && slice != NULL, 0);
+
+    SchedulerJob *job = job_new(buffer, lane, user_data, destroy);
+    job->slice = slice;
+    g_queue_push_tail(&lanes[lane], job);
+    lane_wake(lane);
+    return job->id;
+}
+
+static gboolean work_done(gpointer data) {
+    SchedulerJob *job = data;
+    if (job->done && !scheduler_job_is_cancelled(job)) {
+        job->done(job->user_data);
+    }
+    job_finish(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void run_work(gpointer data, G_GNUC_UNUSED gpointer pool_data) {
+    SchedulerJob *job = data;
+    if (!scheduler_job_is_cancelled(job)) {
+        job->work(job, job->user_data);
+    }
+    // Not g_main_context_invoke(), which may call back on this thread when the main loop isn't running
+    g_idle_add_full(lane_priorities[job->lane], work_done, job, NULL);
+}
+
+// Waiting work is taken by lane, then in the order it was added
+static gint compare_work(gconstpointer a, gconstpointer b, G_GNUC_UNUSED gpointer user_data) {
+    const SchedulerJob *job_a = a;
+    const SchedulerJob *job_b = b;
+    if (job_a->lane != job_b->lane) {
+        return job_a->lane < job_b->lane ? -1 : 1;
+    }
+    return (job_a->id > job_b->id) - (job_a->id < job_b->id);
+}
+
+guint scheduler_add_work(GtkTextBuffer *buffer, SchedulerLane lane, SchedulerWorkFunc work,
+                         SchedulerDoneFunc done, gpointer user_data, GDestroyNotify destroy) {
+    g_return_val_if_fail(buffer == NULL || GTK_IS_TEXT_BUFFER(buffer), 0);
+    g_return_val_if_fail((guint)lane < SCHEDULER_LANE_COUNT && work != NULL, 0);
+
+    if (!worker_pool) {
+        worker_pool = g_thread_pool_new(run_work, NULL, (gint)perf_policy_get_worker_threads(), FALSE, NULL);
+        g_thread_pool_set_sort_function(worker_pool, compare_work, NULL);
+    }
+    SchedulerJob *job = job_new(buffer, lane, user_data, destroy);
+    job->work = work;
+    job->done = done;
+    job->running = TRUE;  // The pool owns it until work_done()
+    g_thread_pool_push(worker_pool, job, NULL);
+    return job->id;
+}
+
+void scheduler_update_worker_threads(void) {
+    if (worker_pool) {
+        g_thread_pool_set_max_threads(worker_pool, (gint)perf_policy_get_worker_threads(), NULL);
+    }
+}
+
+void scheduler_cancel(guint job_id) {
+    SchedulerJob *job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(job_id)) : NULL;
+    if (!job) return;
+
+    g_atomic_int_set(&job->cancelled, TRUE);
+    if (!job->running) {
+        g_queue_remove(&lanes[job->lane], job);
+        job_finish(job);
+    }
+}
+
+gboolean scheduler_is_pending(guint job_id) {
+    SchedulerJob *job = jobs ? g_hash_table_lookup(jobs, GUINT_TO_POINTER(job_id)) : NULL;
+    return job && !scheduler_job_is_cancelled(job);
+}
+
+void scheduler_job_set_lane(SchedulerJob *job, SchedulerLane lane) {
+    g_return_if_fail(job != NULL && job->slice != NULL && job->running);
+    g_return_if_fail((guint)lane < SCHEDULER_LANE_COUNT);
+    job->lane = lane;
+}
@@ -2,12 +2,110 @@
 #include <gtk/gtk.h>
 
 #include "settings.h"
+#include "perf_policy.h"
 
-// Simpelt settings-vindue med en lukke-knap
+// Rækkefølgen svarer til PerfHighlightScope og enum'en i skemaet
+static const char *const highlight_scope_nicks[] = { "document", "visible", "none" };
+static const char *const highlight_scope_labels[] = { "Hele dokumentet", "Kun synlig tekst", "Ingen", NULL };
+
+static gboolean highlight_scope_to_selected(GValue *value, GVariant *variant, G_GNUC_UNUSED gpointer user_data) {
+    const gchar *nick = g_variant_get_string(variant, NULL);
+    for (guint i = 0; i < G_N_ELEMENTS(highlight_scope_nicks); i++) {
+        if (g_strcmp0(nick, highlight_scope_nicks[i]) == 0) {
+            g_value_set_uint(value, i);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static GVariant *selected_to_highlight_scope(const GValue *value, G_GNUC_UNUSED const GVariantType *type,
+                                             G_GNUC_UNUSED gpointer user_data) {
+    guint selected = g_value_get_uint(value);
+    if (selected >= G_N_ELEMENTS(highlight_scope_nicks)) return NULL;
+    return g_variant_new_string(highlight_scope_nicks[selected]);
+}
+
+// En talrække bundet til en nøgle; uden skemaet vises den kun
+static void add_spin_row(AdwPreferencesGroup *group, GSettings *settings, const char *key,
+                         const char *title, const char *subtitle, double max, double step) {
+    GtkWidget *row = adw_spin_row_new_with_range(0, max, step);
+    adw_preferences_row_set_title(ADW_PREFERENCES_ROW(row), title);
+    adw_action_row_set_subtitle(ADW_ACTION_ROW(row), subtitle);
+    if (settings) {
+        g_settings_bind(settings, key, row, "value", G_SETTINGS_BIND_DEFAULT);
+    } else {
+        gtk_widget_set_sensitive(row, FALSE);
+    }
+    adw_preferences_group_add(group, row);
+}
+
+static AdwPreferencesGroup *add_group(AdwPreferencesPage *page, const char *title) {
+    AdwPreferencesGroup *group = ADW_PREFERENCES_GROUP(adw_preferences_group_new());
+    adw_preferences_group_set_title(group, title);
+    adw_preferences_page_add(page, group);
+    return group;
+}
+
+// Ydelsesindstillingerne, som perf_policy læser og tilpasser mens programmet kører
+static AdwPreferencesPage *create_performance_page(void) {
+    GSettings *settings = perf_policy_get_settings();
+    AdwPreferencesPage *page = ADW_PREFERENCES_PAGE(adw_preferences_page_new());
+    adw_preferences_page_set_title(page, "Ydelse");
+    adw_preferences_page_set_icon_name(page, "preferences-system-symbolic");
+
+    AdwPreferencesGroup *saving = add_group(page, "Gem");
+    if (!settings) {
+        adw_preferences_group_set_description(saving, "Skemaet " PERF_POLICY_SCHEMA_ID " er ikke installeret, "
+                                                      "så standardværdierne bruges");
+    }
+    add_spin_row(saving, settings, "autosave-delay", "Forsinkelse før autogem",
+                 "Millisekunder efter den sidste ændring", 10000, 100);
+    GtkWidget *adaptive_row = adw_switch_row_new();
+    adw_preferences_row_set_title(ADW_PREFERENCES_ROW(adaptive_row), "Tilpas efter målte svartider");
+    adw_action_row_set_subtitle(ADW_ACTION_ROW(adaptive_row),
+                                "Vent længere før autogem når det er langsomt at gemme, og brug tilstanden "
+                                "for store dokumenter når gem eller indlæsning er langsom");
+    if (settings) {
+        g_settings_bind(settings, "adaptive", adaptive_row, "active", G_SETTINGS_BIND_DEFAULT);
+    } else {
+        gtk_widget_set_sensitive(adaptive_row, FALSE);
+    }
+    adw_preferences_group_add(saving, adaptive_row);
+
+    AdwPreferencesGroup *large = add_group(page, "Store dokumenter");
+    add_spin_row(large, settings, "large-document-threshold", "Grænse for store dokumenter",
+                 "KiB tekst; 0 skifter kun efter målte svartider", 1048576, 1024);
+    GtkWidget *scope_row = adw_combo_row_new();
+    adw_preferences_row_set_title(ADW_PREFERENCES_ROW(scope_row), "Stavekontrol");
+    adw_action_row_set_subtitle(ADW_ACTION_ROW(scope_row),
+                                "Store dokumenter kontrolleres kun i den synlige tekst");
+    GtkStringList *scope_labels = gtk_string_list_new(highlight_scope_labels);
+    adw_combo_row_set_model(ADW_COMBO_ROW(scope_row), G_LIST_MODEL(scope_labels));
+    g_object_unref(scope_labels);
+    if (settings) {
+        g_settings_bind_with_mapping(settings, "highlight-scope", scope_row, "selected", G_SETTINGS_BIND_DEFAULT,
+                                     highlight_scope_to_selected, selected_to_highlight_scope, NULL, NULL);
+    } else {
+        gtk_widget_set_sensitive(scope_row, FALSE);
+    }
+    adw_preferences_group_add(large, scope_row);
+
+    AdwPreferencesGroup *resources = add_group(page, "Ressourcer");
+    add_spin_row(resources, settings, "worker-threads", "Tråde til parsning",
+                 "0 bruger én pr. processor", 256, 1);
+    add_spin_row(resources, settings, "render-cache-size", "Render-cache",
+                 "MiB renderede dokumenter på disken til hurtig genåbning; 0 slår den fra", 16384, 64);
+    add_spin_row(resources, settings, "parser-retain-size", "Parserhukommelse",
+                 "MiB hver tråd beholder mellem parsninger", 4096, 16);
+    return page;
+}
+
+// Settings-vindue med ydelsesindstillingerne
 AdwDialog* create_settings_window(GtkWindow *parent) {
     // Brug AdwPreferencesDialog for en mere standard GNOME-stil (nyere API)
     AdwDialog *dialog = adw_preferences_dialog_new();
-    
+
     // AdwPreferencesDialog er ikke længere en GtkWindow i nyere libadwaita,
     // så vi bruger de korrekte metoder i stedet
     adw_dialog_set_title(dialog, "Indstillinger");
@@ -15,23 +113,11 @@ AdwDialog* create_settings_window(GtkWindow *parent) {
     adw_dialog_set_content_height(dialog, 400);
     adw_dialog_set_presentation_mode(dialog, ADW_DIALOG_AUTO);
     adw_dialog_set_follows_content_size(dialog, TRUE);
-    
+
     // Sæt parent-vinduet
     adw_dialog_present(dialog, GTK_WIDGET(parent));
-    
-    // Tilføj en tom præferenceside som placeholder
-    GtkWidget *page_widget = adw_preferences_page_new();
-    AdwPreferencesPage *page = ADW_PREFERENCES_PAGE(page_widget);
-    adw_preferences_page_set_title(page, "Generelt");
-    adw_preferences_page_set_icon_name(page, "preferences-system-symbolic");
-    
-    GtkWidget *group_widget = adw_preferences_group_new();
-    AdwPreferencesGroup *group = ADW_PREFERENCES_GROUP(group_widget);
-    adw_preferences_group_set_title(group, "Indstillinger");
-    adw_preferences_group_set_description(group, "Her kommer indstillinger i en fremtidig version");
-    
-    adw_preferences_page_add(page, group);
-    adw_preferences_dialog_add(ADW_PREFERENCES_DIALOG(dialog), page);
-    
+
+    adw_preferences_dialog_add(ADW_PREFERENCES_DIALOG(dialog), create_performance_page());
+
     return dialog;
 }
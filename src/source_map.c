@@ -0,0 +1,226 @@
+#include "source_map.h"
+
+#define SOURCE_MAP_KEY "gtktext-source-map"
+
+typedef struct {
+    guint32 buffer;  // Character offset
+    guint32 source;  // Byte offset
+} SourceAnchor;
+
+struct _SourceMap {
+    GArray *anchors; // SourceAnchor, sorted on both columns
+};
+
+// Holds the buffer's map; the edit handlers stay connected while the map is swapped
+typedef struct {
+    SourceMap *map;
+} SourceMapBinding;
+
+#define ANCHOR(map, i) g_array_index((map)->anchors, SourceAnchor, (i))
+
+SourceMap *source_map_new(void) {
+    SourceMap *map = g_new(SourceMap, 1);
+    map->anchors = g_array_new(FALSE, FALSE, sizeof(SourceAnchor));
+    return map;
+}
+
+SourceMap *source_map_copy(const SourceMap *map) {
+    g_return_val_if_fail(map != NULL, NULL);
+    SourceMap *copy = g_new(SourceMap, 1);
+    copy->anchors = g_array_copy(map->anchors);
+    return copy;
+}
+
+void source_map_free(SourceMap *map) {
+    if (!map) return;
+    g_array_unref(map->anchors);
+    g_free(map);
+}
+
+void source_map_add(SourceMap *map, gint buffer_offset, gsize source_offset) {
+    g_return_if_fail(map != NULL && buffer_offset >= 0);
+    if (source_offset > G_MAXUINT32) return;
+
+    SourceAnchor anchor = { (guint32)buffer_offset, (guint32)source_offset };
+    guint n = map->anchors->len;
+    if (n > 0) {
+        SourceAnchor *last = &ANCHOR(map, n - 1);
+        // Nodes are rendered in source order; an out-of-order position is dropped
+        if (anchor.buffer < last->buffer || anchor.source < last->source) return;
+        if (anchor.buffer == last->buffer) {
+            *last = anchor;
+            return;
+        }
+    }
+    g_array_append_val(map->anchors, anchor);
+}
+
+void source_map_append(SourceMap *map, const SourceMap *tail, gint buffer_shift, gssize source_shift) {
+    g_return_if_fail(map != NULL && tail != NULL);
+    for (guint i = 0; i < tail->anchors->len; i++) {
+        const SourceAnchor *anchor = &ANCHOR(tail, i);
+        gint64 source = (gint64)anchor->source + source_shift;
+        if (source < 0) continue;
+        source_map_add(map, (gint)anchor->buffer + buffer_shift, (gsize)source);
+    }
+}
+
+guint source_map_get_n_anchors(const SourceMap *map) {
+    return map->anchors->len;
+}
+
+// Index of the first anchor whose buffer offset is above offset, or at or above it
+static guint find_buffer(const SourceMap *map, guint32 offset, gboolean inclusive) {
+    guint low = 0, high = map->anchors->len;
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+        guint32 value = ANCHOR(map, mid).buffer;
+        if (value < offset || (!inclusive && value == offset)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Index of the first anchor whose source offset is above offset
+static guint find_source(const SourceMap *map, gsize offset) {
+    guint low = 0, high = map->anchors->len;
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+        if (ANCHOR(map, mid).source <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+gsize source_map_to_source(const SourceMap *map, gint buffer_offset) {
+    g_return_val_if_fail(map != NULL, 0);
+    if (buffer_offset < 0) return 0;
+    guint next = find_buffer(map, (guint32)buffer_offset, FALSE);
+    if (next == 0) return 0;
+
+    const SourceAnchor *anchor = &ANCHOR(map, next - 1);
+    gsize source = anchor->source + (gsize)((guint32)buffer_offset - anchor->buffer);
+    if (next < map->anchors->len) {
+        source = MIN(source, ANCHOR(map, next).source);
+    }
+    return source;
+}
+
+gint source_map_to_buffer(const SourceMap *map, gsize source_offset) {
+    g_return_val_if_fail(map != NULL, 0);
+    guint next = find_source(map, source_offset);
+    if (next == 0) return 0;
+
+    const SourceAnchor *anchor = &ANCHOR(map, next - 1);
+    gsize buffer = anchor->buffer + MIN(source_offset - anchor->source, (gsize)G_MAXINT);
+    if (next < map->anchors->len) {
+        buffer = MIN(buffer, ANCHOR(map, next).buffer);
+    }
+    return (gint)MIN(buffer, (gsize)G_MAXINT);
+}
+
+void source_map_insert(SourceMap *map, gint offset, gint n_chars) {
+    g_return_if_fail(map != NULL && offset >= 0 && n_chars >= 0);
+    // Text inserted where a node starts goes in front of it
+    for (guint i = find_buffer(map, (guint32)offset, TRUE); i < map->anchors->len; i++) {
+        ANCHOR(map, i).buffer += (guint32)n_chars;
+    }
+}
+
+void source_map_delete(SourceMap *map, gint start, gint end) {
+    g_return_if_fail(map != NULL && start >= 0 && start <= end);
+    if (start == end) return;
+
+    // Anchors inside the deleted text go; the one at its start stays
+    guint first = find_buffer(map, (guint32)start, FALSE);
+    guint after = find_buffer(map, (guint32)end, TRUE);
+    if (after > first && (after == map->anchors->len || ANCHOR(map, after).buffer != (guint32)end)) {
+        // The text that followed keeps its position through the last anchor removed
+        SourceAnchor anchor = { (guint32)end, (guint32)source_map_to_source(map, end) };
+        g_array_insert_val(map->anchors, after, anchor);
+    }
+    g_array_remove_range(map->anchors, first, after - first);
+    for (guint i = first; i < map->anchors->len; i++) {
+        ANCHOR(map, i).buffer -= (guint32)(end - start);
+    }
+    // The text that followed now starts where the deleted text did
+    if (first > 0 && first < map->anchors->len && ANCHOR(map, first - 1).buffer == ANCHOR(map, first).buffer) {
+        g_array_remove_index(map->anchors, first - 1);
+    }
+}
+
+void source_map_replace(SourceMap *map, gint buffer_start, gint buffer_end, const SourceMap *anchors, gssize source_shift) {
+    g_return_if_fail(map != NULL && anchors != NULL && buffer_start >= 0 && buffer_start <= buffer_end);
+
+    guint first = find_buffer(map, (guint32)buffer_start, TRUE);
+    guint after = find_buffer(map, (guint32)MIN(buffer_end, G_MAXINT), TRUE);
+    g_array_remove_range(map->anchors, first, after - first);
+    for (guint i = first; i < map->anchors->len; i++) {
+        gint64 source = (gint64)ANCHOR(map, i).source + source_shift;
+        ANCHOR(map, i).source = (guint32)CLAMP(source, 0, G_MAXUINT32);
+    }
+    guint n = anchors->anchors->len;
+    if (n == 0) return;
+    g_array_insert_vals(map->anchors, first, anchors->anchors->data, n);
+
+    // Text the new anchors took over from their neighbours moves with them
+    guint32 low = ANCHOR(map, first).source, high = ANCHOR(map, first + n - 1).source;
+    for (guint i = first; i > 0 && ANCHOR(map, i - 1).source > low; i--) {
+        ANCHOR(map, i - 1).source = low;
+    }
+    for (guint i = first + n; i < map->anchors->len && ANCHOR(map, i).source < high; i++) {
+        ANCHOR(map, i).source = high;
+    }
+}
+
+static void source_map_binding_free(gpointer data) {
+    SourceMapBinding *binding = data;
+    source_map_free(binding->map);
+    g_free(binding);
+}
+
+// Run before the default handlers, while the iterators still describe the old text
+static void on_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer user_data) {
+    SourceMapBinding *binding = user_data;
+    if (!binding->map) return;
+    source_map_insert(binding->map, gtk_text_iter_get_offset(location), (gint)g_utf8_strlen(text, len));
+}
+
+static void on_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                            GtkTextIter *end, gpointer user_data) {
+    SourceMapBinding *binding = user_data;
+    if (!binding->map) return;
+    gint start_offset = gtk_text_iter_get_offset(start);
+    gint end_offset = gtk_text_iter_get_offset(end);
+    source_map_delete(binding->map, MIN(start_offset, end_offset), MAX(start_offset, end_offset));
+}
+
+void source_map_attach(GtkTextBuffer *buffer, SourceMap *map) {
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    SourceMapBinding *binding = g_object_get_data(G_OBJECT(buffer), SOURCE_MAP_KEY);
+    if (!binding) {
+        if (!map) return;
+        binding = g_new0(SourceMapBinding, 1);
+        g_object_set_data_full(G_OBJECT(buffer), SOURCE_MAP_KEY, binding, source_map_binding_free);
+        g_signal_connect(buffer, "insert-text", G_CALLBACK(on_insert_text), binding);
+        g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range), binding);
+    }
+    if (binding->map != map) {
+        source_map_free(binding->map);
+        binding->map = map;
+    }
+}
+
+SourceMap *source_map_get(GtkTextBuffer *buffer) {
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+    SourceMapBinding *binding = g_object_get_data(G_OBJECT(buffer), SOURCE_MAP_KEY);
+    return binding ? binding->map : NULL;
+}
@@ -0,0 +1,442 @@
+#include "source_mode.h"
+#include "document_views.h"
+#include "export_cache.h"
+#include "format_mask.h"
+#include "parallel_parse.h"
+#include "render_plan.h"
+#include "scheduler.h"
+#include "source_map.h"
+#include "text_scan.h"
+#include <string.h>
+
+#define SOURCE_MODE_KEY "gtktext-source-mode"
+#define SOURCE_DOCUMENT_KEY "gtktext-source-document"
+#define REPARSE_DELAY_MS 300
+
+typedef struct {
+    GtkTextBuffer *rendered;      // Not owned; the state is its data
+    GtkTextBuffer *source;        // Owned while the rendered buffer is shown; it owns the rendered one otherwise
+    gboolean owns_source;
+    SourceMap *lines;             // Where the Markdown of each rendered line starts in source, in characters
+    gboolean active;              // The views show source
+    gboolean synced;              // source is the Markdown of rendered, and lines is valid
+    gboolean stale;               // rendered changed since its Markdown was last written
+    gboolean source_edited;       // source changed since rendered was last parsed from it
+    gboolean updating;            // source is being changed to follow rendered
+    guint reparse_id;
+    guint parse_job;              // Tied to the source's generation, so an edit drops a parse of older text
+    GtkTextView *switch_view;     // Shows the rendered buffer once the parse of the source lands (weak)
+    guint rebuild_job;
+    TextLineIndex *parsed_lines;  // Of the source text rendered was last parsed from, or NULL
+} SourceMode;
+
+// A parse of the source text, made off the main thread
+typedef struct {
+    SourceMode *sm;
+    gchar *text;
+    gsize length;
+    TextLineIndex *lines;
+    RenderPlan *plan;
+} Reparse;
+
+static void reparse_free(gpointer data) {
+    Reparse *reparse = data;
+    g_free(reparse->text);
+    text_line_index_free(reparse->lines);
+    render_plan_free(reparse->plan);
+    g_free(reparse);
+}
+
+static Reparse *reparse_new(SourceMode *sm) {
+    Reparse *reparse = g_new0(Reparse, 1);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(sm->source, &start, &end);
+    reparse->text = gtk_text_buffer_get_text(sm->source, &start, &end, TRUE);
+    reparse->length = strlen(reparse->text);
+    reparse->sm = sm;
+    return reparse;
+}
+
+static void reparse_run(Reparse *reparse) {
+    if (text_scan(reparse->text, &reparse->length, &reparse->lines, NULL)) {
+        reparse->plan = parallel_parse_markdown(reparse->text, reparse->lines, 0);
+    }
+}
+
+// Only the blocks that differ are replaced, so views of the rendered buffer keep their place
+static void reparse_apply(SourceMode *sm, Reparse *reparse) {
+    if (!reparse->plan) return;
+    render_plan_apply(reparse->plan, sm->rendered);
+    text_line_index_free(sm->parsed_lines);
+    sm->parsed_lines = g_steal_pointer(&reparse->lines);
+    sm->source_edited = FALSE;
+}
+
+static void finish_switch(SourceMode *sm);
+
+static void reparse_work(G_GNUC_UNUSED SchedulerJob *job, gpointer user_data) {
+    reparse_run(user_data);
+}
+
+// Not called when the source was edited again while it was parsed; a newer parse follows
+static void reparse_done(gpointer user_data) {
+    Reparse *reparse = user_data;
+    reparse->sm->parse_job = 0;
+    reparse_apply(reparse->sm, reparse);
+    finish_switch(reparse->sm);
+}
+
+static void reparse_start(SourceMode *sm, SchedulerLane lane) {
+    g_clear_handle_id(&sm->reparse_id, g_source_remove);
+    scheduler_cancel(sm->parse_job);
+    sm->parse_job = scheduler_add_work(sm->source, lane, reparse_work, reparse_done, reparse_new(sm), reparse_free);
+}
+
+static gboolean reparse_timeout(gpointer user_data) {
+    SourceMode *sm = user_data;
+    sm->reparse_id = 0;
+    reparse_start(sm, SCHEDULER_LANE_BACKGROUND);
+    return G_SOURCE_REMOVE;
+}
+
+// Blocks for a parse of the whole source; only for a save, which can't wait for the background one
+static void reparse_now(SourceMode *sm) {
+    g_clear_handle_id(&sm->reparse_id, g_source_remove);
+    g_clear_handle_id(&sm->parse_job, scheduler_cancel);  // Drops a parse still running
+    if (!sm->source_edited) return;
+    Reparse *reparse = reparse_new(sm);
+    reparse_run(reparse);
+    reparse_apply(sm, reparse);
+    reparse_free(reparse);
+    finish_switch(sm);
+}
+
+// Replaces the part of the source a write changed, and the anchors of the lines it wrote
+static void on_markdown_changed(GtkTextBuffer *buffer, const ExportCacheChange *change, gpointer user_data) {
+    SourceMode *sm = user_data;
+    if (sm->active || !sm->synced) return;
+    sm->stale = FALSE;
+    if (!change) return;
+
+    GtkTextIter start, end;
+    gint removed_end = gtk_text_buffer_get_char_count(sm->source) - change->suffix;
+    gtk_text_buffer_get_iter_at_offset(sm->source, &start, change->start);
+    gtk_text_buffer_get_iter_at_offset(sm->source, &end, removed_end);
+    sm->updating = TRUE;
+    gtk_text_buffer_begin_irreversible_action(sm->source);
+    gtk_text_buffer_delete(sm->source, &start, &end);
+    gtk_text_buffer_insert(sm->source, &start, change->text, (gint)change->length);
+    gtk_text_buffer_end_irreversible_action(sm->source);
+    sm->updating = FALSE;
+
+    SourceMap *anchors = source_map_new();
+    gint range_start = G_MAXINT, range_end = G_MAXINT;
+    GtkTextIter line;
+    gtk_text_buffer_get_iter_at_line(buffer, &line, change->first_line);
+    if (change->first_line < gtk_text_buffer_get_line_count(buffer)) {
+        range_start = gtk_text_iter_get_offset(&line);
+        for (guint i = 0; i < change->n_lines; i++) {
+            source_map_add(anchors, gtk_text_iter_get_offset(&line), (gsize)(change->start + change->line_starts[i]));
+            if (!gtk_text_iter_forward_line(&line)) break;
+        }
+        if (!gtk_text_iter_is_end(&line)) {
+            range_end = gtk_text_iter_get_offset(&line);
+        }
+    }
+    gint inserted = (gint)g_utf8_strlen(change->text, (gssize)change->length);
+    source_map_replace(sm->lines, range_start, range_end, anchors, inserted - (removed_end - change->start));
+    source_map_free(anchors);
+}
+
+// Writes the whole Markdown into the source buffer
+static void rebuild(SourceMode *sm) {
+    g_clear_handle_id(&sm->rebuild_job, scheduler_cancel);
+    source_map_free(sm->lines);
+    sm->lines = source_map_new();
+    sm->synced = TRUE;
+    export_cache_invalidate(sm->rendered);
+    g_free(export_cache_compute_digest(sm->rendered));
+}
+
+static gboolean rebuild_slice(G_GNUC_UNUSED SchedulerJob *job, G_GNUC_UNUSED gint64 deadline_us,
+                              gpointer user_data) {
+    SourceMode *sm = user_data;
+    sm->rebuild_job = 0;
+    if (!sm->active && !sm->synced) {
+        rebuild(sm);
+    }
+    return FALSE;
+}
+
+// Run before the default handlers, while the iterators still describe the old text
+static void on_rendered_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                                    gchar *text, gint len, gpointer user_data) {
+    SourceMode *sm = user_data;
+    // Behind the shown source only its parses change the rendered buffer; it is written again later
+    if (sm->active) {
+        sm->synced = FALSE;
+        return;
+    }
+    sm->stale = TRUE;
+    if (sm->synced) {
+        source_map_insert(sm->lines, gtk_text_iter_get_offset(location), (gint)g_utf8_strlen(text, len));
+    }
+}
+
+static void on_rendered_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                                     GtkTextIter *end, gpointer user_data) {
+    SourceMode *sm = user_data;
+    if (sm->active) {
+        sm->synced = FALSE;
+        return;
+    }
+    sm->stale = TRUE;
+    if (sm->synced) {
+        gint start_offset = gtk_text_iter_get_offset(start);
+        gint end_offset = gtk_text_iter_get_offset(end);
+        source_map_delete(sm->lines, MIN(start_offset, end_offset), MAX(start_offset, end_offset));
+    }
+}
+
+// Spell checking and other tags that aren't exported leave the Markdown as it is
+static void on_rendered_tag_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextTag *tag,
+                                    G_GNUC_UNUSED GtkTextIter *start, G_GNUC_UNUSED GtkTextIter *end,
+                                    gpointer user_data) {
+    SourceMode *sm = user_data;
+    if (format_bit_from_tag(tag) >= 0) {
+        sm->stale = TRUE;
+    }
+}
+
+static void on_source_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, gpointer user_data) {
+    SourceMode *sm = user_data;
+    if (sm->updating) return;
+    sm->source_edited = TRUE;
+    sm->synced = FALSE;
+    if (sm->switch_view) {
+        // The edit dropped the parse a switch is waiting for
+        reparse_start(sm, SCHEDULER_LANE_VISIBLE);
+        return;
+    }
+    g_clear_handle_id(&sm->reparse_id, g_source_remove);
+    sm->reparse_id = g_timeout_add(REPARSE_DELAY_MS, reparse_timeout, sm);
+}
+
+static void source_mode_free(gpointer data) {
+    SourceMode *sm = data;
+    g_clear_handle_id(&sm->reparse_id, g_source_remove);
+    g_clear_handle_id(&sm->parse_job, scheduler_cancel);
+    g_clear_handle_id(&sm->rebuild_job, scheduler_cancel);
+    g_clear_weak_pointer(&sm->switch_view);
+    // A shown source buffer is what is being destroyed
+    if (sm->owns_source) {
+        g_signal_handlers_disconnect_by_data(sm->source, sm);
+        g_object_set_data(G_OBJECT(sm->source), SOURCE_DOCUMENT_KEY, NULL);
+        g_object_unref(sm->source);
+    }
+    source_map_free(sm->lines);
+    text_line_index_free(sm->parsed_lines);
+    g_free(sm);
+}
+
+static SourceMode *source_mode_get(GtkTextBuffer *rendered) {
+    SourceMode *sm = g_object_get_data(G_OBJECT(rendered), SOURCE_MODE_KEY);
+    if (sm) return sm;
+
+    sm = g_new0(SourceMode, 1);
+    sm->rendered = rendered;
+    sm->source = gtk_text_buffer_new(NULL);
+    sm->owns_source = TRUE;
+    sm->lines = source_map_new();
+    g_object_set_data(G_OBJECT(sm->source), SOURCE_DOCUMENT_KEY, rendered);
+    g_object_set_data_full(G_OBJECT(rendered), SOURCE_MODE_KEY, sm, source_mode_free);
+
+    export_cache_set_change_func(rendered, on_markdown_changed, sm);
+    g_signal_connect(rendered, "insert-text", G_CALLBACK(on_rendered_insert_text), sm);
+    g_signal_connect(rendered, "delete-range", G_CALLBACK(on_rendered_delete_range), sm);
+    g_signal_connect(rendered, "apply-tag", G_CALLBACK(on_rendered_tag_changed), sm);
+    g_signal_connect(rendered, "remove-tag", G_CALLBACK(on_rendered_tag_changed), sm);
+    g_signal_connect(sm->source, "changed", G_CALLBACK(on_source_changed), sm);
+    return sm;
+}
+
+// Position in markup of the character at column in plain, or the other way round.
+// Walking markup, a character of plain is passed whenever it is the same, so
+// what only markup has (markers, escapes) is stepped over.
+static gint align_column(const gchar *markup, const gchar *plain, gint column, gboolean to_plain) {
+    const gchar *m = markup, *p = plain;
+    gint mi = 0, pi = 0;
+    while (*m) {
+        if (to_plain ? mi == column
+                     : (pi == column && (!*p || g_utf8_get_char(m) == g_utf8_get_char(p)))) {
+            break;
+        }
+        if (*p && g_utf8_get_char(m) == g_utf8_get_char(p)) {
+            p = g_utf8_next_char(p);
+            pi++;
+        }
+        m = g_utf8_next_char(m);
+        mi++;
+    }
+    return to_plain ? pi : mi;
+}
+
+static gchar *line_text(GtkTextBuffer *buffer, const GtkTextIter *line_start) {
+    GtkTextIter end = *line_start;
+    if (!gtk_text_iter_ends_line(&end)) {
+        gtk_text_iter_forward_to_line_end(&end);
+    }
+    return gtk_text_buffer_get_text(buffer, line_start, &end, TRUE);
+}
+
+// Source offset of a rendered position, through the line anchors
+static gint rendered_to_source(SourceMode *sm, const GtkTextIter *iter) {
+    GtkTextIter line = *iter, next;
+    gtk_text_iter_set_line_offset(&line, 0);
+    next = line;
+    gint from = (gint)source_map_to_source(sm->lines, gtk_text_iter_get_offset(&line));
+    gint to = gtk_text_iter_forward_line(&next)
+        ? (gint)source_map_to_source(sm->lines, gtk_text_iter_get_offset(&next))
+        : gtk_text_buffer_get_char_count(sm->source);
+
+    GtkTextIter source_start, source_end;
+    gtk_text_buffer_get_iter_at_offset(sm->source, &source_start, from);
+    gtk_text_buffer_get_iter_at_offset(sm->source, &source_end, MAX(from, to));
+    g_autofree gchar *markup = gtk_text_buffer_get_text(sm->source, &source_start, &source_end, TRUE);
+    g_autofree gchar *plain = line_text(sm->rendered, &line);
+    return from + align_column(markup, plain, gtk_text_iter_get_line_offset(iter), FALSE);
+}
+
+// Rendered offset of a source position
+static gint source_to_rendered(SourceMode *sm, const GtkTextIter *iter) {
+    SourceMap *parsed = source_map_get(sm->rendered);
+    if (sm->parsed_lines && parsed) {
+        // Rendered was parsed from this text; its import map is in bytes
+        guint line = (guint)gtk_text_iter_get_line(iter);
+        if (line < text_line_index_get_n_lines(sm->parsed_lines)) {
+            gsize byte = text_line_index_get_line_start(sm->parsed_lines, line) + (gsize)gtk_text_iter_get_line_index(iter);
+            return source_map_to_buffer(parsed, byte);
+        }
+        return gtk_text_buffer_get_char_count(sm->rendered);
+    }
+
+    gint offset = gtk_text_iter_get_offset(iter);
+    GtkTextIter line;
+    gtk_text_buffer_get_iter_at_offset(sm->rendered, &line, source_map_to_buffer(sm->lines, (gsize)offset));
+    gtk_text_iter_set_line_offset(&line, 0);
+    gint from = (gint)source_map_to_source(sm->lines, gtk_text_iter_get_offset(&line));
+    if (from > offset && gtk_text_iter_backward_line(&line)) {
+        from = (gint)source_map_to_source(sm->lines, gtk_text_iter_get_offset(&line));
+    }
+
+    GtkTextIter source_start;
+    gtk_text_buffer_get_iter_at_offset(sm->source, &source_start, MIN(from, offset));
+    g_autofree gchar *markup = gtk_text_buffer_get_text(sm->source, &source_start, iter, TRUE);
+    g_autofree gchar *plain = line_text(sm->rendered, &line);
+    gint column = align_column(markup, plain, (gint)g_utf8_strlen(markup, -1), TRUE);
+    return gtk_text_iter_get_offset(&line) + column;
+}
+
+static void place_cursor(GtkTextBuffer *buffer, gint offset, GtkTextView *view) {
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+    gtk_text_buffer_place_cursor(buffer, &iter);
+    gtk_text_view_scroll_to_mark(view, gtk_text_buffer_get_insert(buffer), 0.1, FALSE, 0.0, 0.0);
+}
+
+static void show_source(SourceMode *sm, GtkTextView *view) {
+    if (!sm->synced) {
+        rebuild(sm);
+    } else if (sm->stale) {
+        // An export is pending, such as the idle save after formatting
+        g_free(export_cache_compute_digest(sm->rendered));
+    }
+
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(sm->rendered, &cursor, gtk_text_buffer_get_insert(sm->rendered));
+    gint offset = rendered_to_source(sm, &cursor);
+
+    // The shown source keeps the document alive
+    g_object_set_data_full(G_OBJECT(sm->source), SOURCE_DOCUMENT_KEY, g_object_ref(sm->rendered), g_object_unref);
+    text_line_index_free(sm->parsed_lines);
+    sm->parsed_lines = NULL;
+    sm->active = TRUE;
+    document_views_set_buffer(sm->rendered, sm->source);
+    document_views_set_monospace(sm->source, TRUE);
+    g_object_unref(sm->source);
+    sm->owns_source = FALSE;
+    place_cursor(sm->source, offset, view);
+}
+
+static void switch_to_rendered(SourceMode *sm, GtkTextView *view) {
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_mark(sm->source, &cursor, gtk_text_buffer_get_insert(sm->source));
+    gint offset = source_to_rendered(sm, &cursor);
+
+    g_object_ref(sm->source);
+    sm->owns_source = TRUE;
+    sm->active = FALSE;
+    document_views_set_monospace(sm->source, FALSE);
+    document_views_set_buffer(sm->source, sm->rendered);
+    g_object_set_data(G_OBJECT(sm->source), SOURCE_DOCUMENT_KEY, sm->rendered);
+    place_cursor(sm->rendered, offset, view);
+
+    // The source is written again from the edited document when the editor is idle
+    if (!sm->synced && !sm->rebuild_job) {
+        sm->rebuild_job = scheduler_add_slice(NULL, SCHEDULER_LANE_IDLE, rebuild_slice, sm, NULL);
+    }
+}
+
+// Completes a switch that waited for the parse of the source
+static void finish_switch(SourceMode *sm) {
+    if (!sm->switch_view) return;
+    GtkTextView *view = sm->switch_view;
+    g_clear_weak_pointer(&sm->switch_view);
+    // The view may have been given another document meanwhile
+    if (sm->active && gtk_text_view_get_buffer(view) == sm->source) {
+        switch_to_rendered(sm, view);
+    }
+}
+
+static void show_rendered(SourceMode *sm, GtkTextView *view) {
+    if (!sm->source_edited) {
+        g_clear_handle_id(&sm->reparse_id, g_source_remove);
+        switch_to_rendered(sm, view);
+        return;
+    }
+    // The source stays shown until the parse of its last edit lands; one waiting for a pause in typing starts now
+    g_set_weak_pointer(&sm->switch_view, view);
+    if (sm->reparse_id || !sm->parse_job) {
+        reparse_start(sm, SCHEDULER_LANE_VISIBLE);
+    }
+}
+
+void source_mode_toggle(GtkTextView *view) {
+    g_return_if_fail(GTK_IS_TEXT_VIEW(view));
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+    SourceMode *sm = source_mode_get(source_mode_get_document(buffer));
+    if (sm->switch_view) {
+        // Toggled again before the switch back happened: stay on the source
+        g_clear_weak_pointer(&sm->switch_view);
+    } else if (sm->active) {
+        show_rendered(sm, view);
+    } else {
+        show_source(sm, view);
+    }
+}
+
+gboolean source_mode_is_source(GtkTextBuffer *buffer) {
+    return g_object_get_data(G_OBJECT(buffer), SOURCE_DOCUMENT_KEY) != NULL;
+}
+
+GtkTextBuffer *source_mode_get_document(GtkTextBuffer *buffer) {
+    GtkTextBuffer *document = g_object_get_data(G_OBJECT(buffer), SOURCE_DOCUMENT_KEY);
+    return document ? document : buffer;
+}
+
+void source_mode_flush(GtkTextBuffer *buffer) {
+    SourceMode *sm = g_object_get_data(G_OBJECT(source_mode_get_document(buffer)), SOURCE_MODE_KEY);
+    if (sm) {
+        reparse_now(sm);
+    }
+}
@@ -0,0 +1,411 @@
+#include "spell_check.h"
+#include "spell_dict.h"
+#include "format_mask.h"
+#include "perf_policy.h"
+#include "scheduler.h"
+#include <string.h>
+
+#define SPELL_CHECK_KEY "gtktext-spell-check"
+// Marks paragraphs that changed since they were last checked
+#define SPELL_UNCHECKED_TAG "spell-unchecked"
+// Words are only checked once typing pauses, so a half-typed word isn't flagged
+#define SPELL_EDIT_DELAY_MS 300
+#define SPELL_WORDS_PER_CLOCK 32
+
+typedef enum {
+    DICT_UNLOADED,
+    DICT_LOADING,
+    DICT_READY,
+    DICT_MISSING
+} DictStatus;
+
+// Shared by all views; loaded once on a worker thread
+static SpellDict *spell_dict = NULL;
+static DictStatus dict_status = DICT_UNLOADED;
+static GList *spell_checkers = NULL;
+
+typedef struct {
+    GtkTextView *view;       // Not owned; the checker is view data
+    GtkTextBuffer *buffer;
+    GtkTextTag *unchecked_tag;
+    GtkTextTag *error_tag;
+    GtkAdjustment *vadjustment;  // Scrolling brings unchecked text into view
+    guint delay_id;
+    guint job_id;
+} SpellChecker;
+
+static gchar *find_dictionary(void) {
+    const gchar *path = g_getenv("GTKTEXT_SPELL_DICT");
+    if (path && path[0] != '\0') {
+        return g_strdup(path);
+    }
+    // Language names run from the most specific, e.g. "da_DK.UTF-8", "da_DK", "da", "C"
+    const gchar *const *languages = g_get_language_names();
+    for (guint i = 0; languages[i]; i++) {
+        if (strchr(languages[i], '.') || strchr(languages[i], '@') || strcmp(languages[i], "C") == 0) continue;
+        g_autofree gchar *name = g_strconcat(languages[i], ".dic", NULL);
+        g_autofree gchar *candidate = g_build_filename("/usr/share/hunspell", name, NULL);
+        if (g_file_test(candidate, G_FILE_TEST_IS_REGULAR)) {
+            return g_steal_pointer(&candidate);
+        }
+    }
+    if (g_file_test("/usr/share/dict/words", G_FILE_TEST_IS_REGULAR)) {
+        return g_strdup("/usr/share/dict/words");
+    }
+    return NULL;
+}
+
+static void load_dictionary_thread(GTask *task, G_GNUC_UNUSED gpointer source_object,
+                                   G_GNUC_UNUSED gpointer task_data, G_GNUC_UNUSED GCancellable *cancellable) {
+    g_autofree gchar *path = find_dictionary();
+    if (!path) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No word list found");
+        return;
+    }
+    GError *error = NULL;
+    SpellDict *dict = spell_dict_new_from_file(path, &error);
+    if (!dict) {
+        g_task_return_error(task, error);
+    } else if (spell_dict_get_n_words(dict) == 0) {
+        // Probably not UTF-8; flagging every word helps nobody
+        spell_dict_free(dict);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "No UTF-8 words in %s", path);
+    } else {
+        g_task_return_pointer(task, dict, (GDestroyNotify)spell_dict_free);
+    }
+}
+
+static void spell_checker_schedule(SpellChecker *checker, guint delay_ms);
+
+static void dictionary_loaded(G_GNUC_UNUSED GObject *source_object, GAsyncResult *result,
+                              G_GNUC_UNUSED gpointer user_data) {
+    GError *error = NULL;
+    spell_dict = g_task_propagate_pointer(G_TASK(result), &error);
+    if (!spell_dict) {
+        g_message("Spell checking disabled: %s", error->message);
+        g_clear_error(&error);
+        dict_status = DICT_MISSING;
+        return;
+    }
+    dict_status = DICT_READY;
+    for (GList *l = spell_checkers; l; l = l->next) {
+        spell_checker_schedule(l->data, 0);
+    }
+}
+
+static void on_highlight_scope_changed(G_GNUC_UNUSED GSettings *settings, G_GNUC_UNUSED const gchar *key,
+                                       G_GNUC_UNUSED gpointer user_data) {
+    for (GList *l = spell_checkers; l; l = l->next) {
+        spell_checker_schedule(l->data, 0);
+    }
+}
+
+static void load_dictionary(void) {
+    if (dict_status != DICT_UNLOADED) return;
+    dict_status = DICT_LOADING;
+    GSettings *settings = perf_policy_get_settings();
+    if (settings) {
+        g_signal_connect(settings, "changed::highlight-scope", G_CALLBACK(on_highlight_scope_changed), NULL);
+    }
+    GTask *task = g_task_new(NULL, NULL, dictionary_loaded, NULL);
+    g_task_run_in_thread(task, load_dictionary_thread);
+    g_object_unref(task);
+}
+
+static gboolean should_check_word(const gchar *word) {
+    gboolean has_lower = FALSE;
+    glong n_chars = 0;
+    for (const gchar *p = word; *p; p = g_utf8_next_char(p), n_chars++) {
+        gunichar c = g_utf8_get_char(p);
+        if (g_unichar_isdigit(c)) return FALSE;
+        if (g_unichar_islower(c)) has_lower = TRUE;
+    }
+    // Acronyms such as GTK or HTML
+    return has_lower || n_chars == 1;
+}
+
+static void check_word(SpellChecker *checker, const GtkTextIter *start, const GtkTextIter *end) {
+    g_autofree gchar *word = gtk_text_iter_get_slice(start, end);
+    if (!should_check_word(word)) return;
+
+    // Smart punctuation turns apostrophes into U+2019; word lists use the ASCII one
+    g_autoptr(GString) normalized = NULL;
+    if (strstr(word, "\xe2\x80\x99")) {
+        normalized = g_string_new(word);
+        g_string_replace(normalized, "\xe2\x80\x99", "'", 0);
+    }
+    const gchar *lookup = normalized ? normalized->str : word;
+    if (!spell_dict_contains(spell_dict, lookup, -1)) {
+        gtk_text_buffer_apply_tag(checker->buffer, checker->error_tag, start, end);
+    }
+}
+
+static gboolean in_code(const GtkTextIter *iter, GtkTextTag *code_tag, GtkTextTag *codeblock_tag) {
+    return (code_tag && gtk_text_iter_has_tag(iter, code_tag)) ||
+           (codeblock_tag && gtk_text_iter_has_tag(iter, codeblock_tag));
+}
+
+// Checks the words of an unchecked range until the deadline and marks what was checked
+static void check_range(SpellChecker *checker, const GtkTextIter *start, const GtkTextIter *end,
+                        GtkTextTag *code_tag, GtkTextTag *codeblock_tag, gint64 deadline) {
+    GtkTextIter done = *end;
+    gtk_text_buffer_remove_tag(checker->buffer, checker->error_tag, start, end);
+
+    GtkTextIter word_start = *start;
+    if (!gtk_text_iter_starts_word(&word_start)) {
+        gtk_text_iter_forward_word_end(&word_start);
+        gtk_text_iter_backward_word_start(&word_start);
+        if (gtk_text_iter_compare(&word_start, start) < 0) {
+            word_start = *end; // No words left in the range
+        }
+    }
+
+    guint n_words = 0;
+    while (gtk_text_iter_compare(&word_start, end) < 0) {
+        if (++n_words % SPELL_WORDS_PER_CLOCK == 0 && g_get_monotonic_time() >= deadline) {
+            done = word_start;
+            break;
+        }
+        GtkTextIter word_end = word_start;
+        gtk_text_iter_forward_word_end(&word_end);
+        if (!in_code(&word_start, code_tag, codeblock_tag)) {
+            check_word(checker, &word_start, &word_end);
+        }
+
+        GtkTextIter next = word_end;
+        gtk_text_iter_forward_word_end(&next);
+        if (gtk_text_iter_compare(&next, &word_end) <= 0) break;
+        gtk_text_iter_backward_word_start(&next);
+        word_start = next;
+    }
+    gtk_text_buffer_remove_tag(checker->buffer, checker->unchecked_tag, start, &done);
+}
+
+// Finds the first unchecked range starting at or after from, and before limit if given
+static gboolean next_unchecked(SpellChecker *checker, const GtkTextIter *from, const GtkTextIter *limit,
+                               GtkTextIter *start, GtkTextIter *end) {
+    GtkTextIter iter = *from;
+    if (!gtk_text_iter_has_tag(&iter, checker->unchecked_tag) &&
+        !gtk_text_iter_forward_to_tag_toggle(&iter, checker->unchecked_tag)) {
+        return FALSE;
+    }
+    if (gtk_text_iter_is_end(&iter) || (limit && gtk_text_iter_compare(&iter, limit) > 0)) {
+        return FALSE;
+    }
+    *start = iter;
+    *end = iter;
+    gtk_text_iter_forward_to_tag_toggle(end, checker->unchecked_tag);
+    return TRUE;
+}
+
+static gboolean find_unchecked_range(SpellChecker *checker, gboolean whole_document,
+                                     GtkTextIter *start, GtkTextIter *end, gboolean *in_view) {
+    // What the user is looking at comes first
+    GdkRectangle rect;
+    gtk_text_view_get_visible_rect(checker->view, &rect);
+    GtkTextIter visible_start, visible_end;
+    gtk_text_view_get_iter_at_location(checker->view, &visible_start, rect.x, rect.y);
+    gtk_text_view_get_iter_at_location(checker->view, &visible_end, rect.x + rect.width, rect.y + rect.height);
+    gtk_text_iter_set_line_offset(&visible_start, 0);
+    *in_view = TRUE;
+    if (next_unchecked(checker, &visible_start, &visible_end, start, end)) {
+        return TRUE;
+    }
+    if (!whole_document) {
+        return FALSE;
+    }
+    *in_view = FALSE;
+
+    GtkTextIter buffer_start;
+    gtk_text_buffer_get_start_iter(checker->buffer, &buffer_start);
+    return next_unchecked(checker, &buffer_start, NULL, start, end);
+}
+
+static gboolean spell_check_slice(SchedulerJob *job, gint64 deadline, gpointer user_data) {
+    SpellChecker *checker = user_data;
+    PerfHighlightScope scope = perf_policy_get_highlight_scope(checker->buffer);
+    if (scope == PERF_HIGHLIGHT_NONE) {
+        // Flagged words are cleared; the text stays unchecked for when highlighting returns
+        GtkTextIter start, end;
+        gtk_text_buffer_get_bounds(checker->buffer, &start, &end);
+        gtk_text_buffer_remove_tag(checker->buffer, checker->error_tag, &start, &end);
+        checker->job_id = 0;
+        return FALSE;
+    }
+
+    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(checker->buffer);
+    GtkTextTag *code_tag = gtk_text_tag_table_lookup(tag_table, format_bit_get_tag_name(FORMAT_CODE));
+    GtkTextTag *codeblock_tag = gtk_text_tag_table_lookup(tag_table, format_bit_get_tag_name(FORMAT_CODEBLOCK));
+
+    do {
+        GtkTextIter start, end;
+        gboolean in_view;
+        if (!find_unchecked_range(checker, scope == PERF_HIGHLIGHT_DOCUMENT, &start, &end, &in_view)) {
+            checker->job_id = 0;
+            return FALSE;
+        }
+        // Once what is on screen is done, the rest waits until nothing else is
+        if (!in_view) {
+            scheduler_job_set_lane(job, SCHEDULER_LANE_IDLE);
+        }
+        check_range(checker, &start, &end, code_tag, codeblock_tag, deadline);
+    } while (g_get_monotonic_time() < deadline);
+    return TRUE;
+}
+
+static gboolean start_checking(gpointer user_data) {
+    SpellChecker *checker = user_data;
+    checker->delay_id = 0;
+    spell_checker_schedule(checker, 0);
+    return G_SOURCE_REMOVE;
+}
+
+// An edit postpones checking until typing pauses; 0 starts right away
+static void spell_checker_schedule(SpellChecker *checker, guint delay_ms) {
+    if (dict_status != DICT_READY || !checker->buffer) return;
+    g_clear_handle_id(&checker->delay_id, g_source_remove);
+    if (delay_ms > 0) {
+        g_clear_handle_id(&checker->job_id, scheduler_cancel);
+        checker->delay_id = g_timeout_add(delay_ms, start_checking, checker);
+    } else if (!scheduler_is_pending(checker->job_id)) {
+        // Visible text first; an edit of the buffer drops the job, and the edit schedules another
+        checker->job_id = scheduler_add_slice(checker->buffer, SCHEDULER_LANE_VISIBLE, spell_check_slice,
+                                              checker, NULL);
+    }
+}
+
+// Whole paragraphs are rechecked, since an edit can join or split words
+static void mark_unchecked(SpellChecker *checker, const GtkTextIter *start, const GtkTextIter *end) {
+    GtkTextIter paragraph_start = *start;
+    GtkTextIter paragraph_end = *end;
+    gtk_text_iter_set_line_offset(&paragraph_start, 0);
+    if (!gtk_text_iter_ends_line(&paragraph_end)) {
+        gtk_text_iter_forward_to_line_end(&paragraph_end);
+    }
+    gtk_text_buffer_apply_tag(checker->buffer, checker->unchecked_tag, &paragraph_start, &paragraph_end);
+    spell_checker_schedule(checker, SPELL_EDIT_DELAY_MS);
+}
+
+static void on_insert_text(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *location,
+                           gchar *text, gint len, gpointer user_data) {
+    GtkTextIter start = *location;
+    gtk_text_iter_backward_chars(&start, (gint)g_utf8_strlen(text, len));
+    mark_unchecked(user_data, &start, location);
+}
+
+static void on_delete_range(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextIter *start,
+                            GtkTextIter *end, gpointer user_data) {
+    mark_unchecked(user_data, start, end);
+}
+
+// Text that becomes or stops being code changes what gets checked
+static void on_tag_changed(G_GNUC_UNUSED GtkTextBuffer *buffer, GtkTextTag *tag,
+                           GtkTextIter *start, GtkTextIter *end, gpointer user_data) {
+    int bit = format_bit_from_tag(tag);
+    if (bit == FORMAT_CODE || bit == FORMAT_CODEBLOCK) {
+        mark_unchecked(user_data, start, end);
+    }
+}
+
+static void spell_checker_connect(SpellChecker *checker, GtkTextBuffer *buffer);
+
+// Another view of the buffer takes over; what is left unchecked is marked in the buffer
+static void spell_checker_detach_buffer(SpellChecker *checker) {
+    g_clear_handle_id(&checker->delay_id, g_source_remove);
+    g_clear_handle_id(&checker->job_id, scheduler_cancel);
+    if (!checker->buffer) return;
+
+    GtkTextBuffer *buffer = checker->buffer;
+    g_signal_handlers_disconnect_by_data(buffer, checker);
+    checker->buffer = NULL;
+    for (GList *l = spell_checkers; l; l = l->next) {
+        SpellChecker *other = l->data;
+        if (other != checker && !other->buffer && gtk_text_view_get_buffer(other->view) == buffer) {
+            spell_checker_connect(other, buffer);
+            break;
+        }
+    }
+    g_object_unref(buffer);
+}
+
+static void spell_checker_set_buffer(SpellChecker *checker, GtkTextBuffer *buffer) {
+    spell_checker_detach_buffer(checker);
+    if (!buffer) return;
+
+    // Views sharing a buffer share its checker; the others stay idle
+    for (GList *l = spell_checkers; l; l = l->next) {
+        SpellChecker *other = l->data;
+        if (other != checker && other->buffer == buffer) return;
+    }
+    spell_checker_connect(checker, buffer);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    gtk_text_buffer_apply_tag(buffer, checker->unchecked_tag, &start, &end);
+}
+
+static void spell_checker_connect(SpellChecker *checker, GtkTextBuffer *buffer) {
+    checker->buffer = g_object_ref(buffer);
+    GtkTextTagTable *tag_table = gtk_text_buffer_get_tag_table(buffer);
+    checker->unchecked_tag = gtk_text_tag_table_lookup(tag_table, SPELL_UNCHECKED_TAG);
+    if (!checker->unchecked_tag) {
+        checker->unchecked_tag = gtk_text_buffer_create_tag(buffer, SPELL_UNCHECKED_TAG, NULL);
+    }
+    checker->error_tag = gtk_text_tag_table_lookup(tag_table, SPELL_CHECK_ERROR_TAG);
+    if (!checker->error_tag) {
+        checker->error_tag = gtk_text_buffer_create_tag(buffer, SPELL_CHECK_ERROR_TAG,
+                                                        "underline", PANGO_UNDERLINE_ERROR, NULL);
+    }
+
+    g_signal_connect_after(buffer, "insert-text", G_CALLBACK(on_insert_text), checker);
+    g_signal_connect_after(buffer, "delete-range", G_CALLBACK(on_delete_range), checker);
+    g_signal_connect_after(buffer, "apply-tag", G_CALLBACK(on_tag_changed), checker);
+    g_signal_connect_after(buffer, "remove-tag", G_CALLBACK(on_tag_changed), checker);
+    spell_checker_schedule(checker, 0);
+}
+
+static void on_view_buffer_changed(GtkTextView *view, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+    spell_checker_set_buffer(user_data, gtk_text_view_get_buffer(view));
+}
+
+static void on_view_scrolled(G_GNUC_UNUSED GtkAdjustment *adjustment, gpointer user_data) {
+    spell_checker_schedule(user_data, 0);
+}
+
+static void spell_checker_set_adjustment(SpellChecker *checker, GtkAdjustment *adjustment) {
+    if (checker->vadjustment) {
+        g_signal_handlers_disconnect_by_data(checker->vadjustment, checker);
+        g_clear_object(&checker->vadjustment);
+    }
+    if (adjustment) {
+        checker->vadjustment = g_object_ref(adjustment);
+        g_signal_connect(adjustment, "value-changed", G_CALLBACK(on_view_scrolled), checker);
+    }
+}
+
+static void on_view_adjustment_changed(GtkScrollable *view, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+    spell_checker_set_adjustment(user_data, gtk_scrollable_get_vadjustment(view));
+}
+
+static void spell_checker_free(gpointer data) {
+    SpellChecker *checker = data;
+    spell_checker_set_adjustment(checker, NULL);
+    spell_checker_detach_buffer(checker);
+    spell_checkers = g_list_remove(spell_checkers, checker);
+    g_free(checker);
+}
+
+void spell_check_attach(GtkTextView *view) {
+    g_return_if_fail(GTK_IS_TEXT_VIEW(view));
+
+    SpellChecker *checker = g_new0(SpellChecker, 1);
+    checker->view = view;
+    spell_checkers = g_list_prepend(spell_checkers, checker);
+    g_object_set_data_full(G_OBJECT(view), SPELL_CHECK_KEY, checker, spell_checker_free);
+    g_signal_connect(view, "notify::buffer", G_CALLBACK(on_view_buffer_changed), checker);
+    g_signal_connect(view, "notify::vadjustment", G_CALLBACK(on_view_adjustment_changed), checker);
+    spell_checker_set_adjustment(checker, gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(view)));
+
+    spell_checker_set_buffer(checker, gtk_text_view_get_buffer(view));
+    load_dictionary();
+}
@@ -0,0 +1,121 @@
+#include "spell_dict.h"
+#include <string.h>
+
+struct _SpellDict {
+    GMappedFile *mapped;
+    const char *words;  // Contents of the mapping
+    gsize length;
+    guint32 *slots;     // Offset of a word + 1, 0 = empty
+    guint32 mask;       // Number of slots - 1; a power of two
+    guint n_words;
+};
+
+static inline gboolean is_word_terminator(char c) {
+    return c == '\n' || c == '\r' || c == '/';
+}
+
+// FNV-1a
+static inline guint32 hash_word(const char *word, gsize len) {
+    guint32 hash = 2166136261u;
+    for (gsize i = 0; i < len; i++) {
+        hash = (hash ^ (guchar)word[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static gboolean slot_matches(const SpellDict *dict, guint32 slot, const char *word, gsize len) {
+    gsize offset = slot - 1;
+    if (dict->length - offset < len || memcmp(dict->words + offset, word, len) != 0) {
+        return FALSE;
+    }
+    return offset + len == dict->length || is_word_terminator(dict->words[offset + len]);
+}
+
+// Returns the slot holding the word, or the empty slot where it belongs
+static guint32 *find_slot(const SpellDict *dict, const char *word, gsize len) {
+    guint32 i = hash_word(word, len) & dict->mask;
+    while (dict->slots[i] != 0 && !slot_matches(dict, dict->slots[i], word, len)) {
+        i = (i + 1) & dict->mask;
+    }
+    return &dict->slots[i];
+}
+
+SpellDict *spell_dict_new_from_file(const char *path, GError **error) {
+    g_return_val_if_fail(path != NULL, NULL);
+
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, error);
+    if (!mapped) {
+        return NULL;
+    }
+    gsize length = g_mapped_file_get_length(mapped);
+    if (length >= G_MAXUINT32) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Word list %s is too large", path);
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+
+    SpellDict *dict = g_new0(SpellDict, 1);
+    dict->mapped = mapped;
+    dict->words = length > 0 ? g_mapped_file_get_contents(mapped) : "";
+    dict->length = length;
+
+    // Size the set for at most 50% load from the line count
+    gsize lines = 1;
+    for (const char *p = dict->words; (p = memchr(p, '\n', length - (gsize)(p - dict->words))) != NULL; p++) {
+        lines++;
+    }
+    gsize n_slots = 16;
+    while (n_slots < lines * 2) {
+        n_slots *= 2;
+    }
+    dict->slots = g_new0(guint32, n_slots);
+    dict->mask = (guint32)(n_slots - 1);
+
+    gsize pos = 0;
+    while (pos < length) {
+        gsize start = pos;
+        while (pos < length && !is_word_terminator(dict->words[pos])) {
+            pos++;
+        }
+        gsize len = pos - start;
+        // Skip the rest of the line, such as Hunspell flags
+        while (pos < length && dict->words[pos] != '\n') {
+            pos++;
+        }
+        pos++;
+
+        if (len == 0 || !g_utf8_validate(dict->words + start, (gssize)len, NULL)) continue;
+        guint32 *slot = find_slot(dict, dict->words + start, len);
+        if (*slot == 0) {
+            *slot = (guint32)start + 1;
+            dict->n_words++;
+        }
+    }
+    return dict;
+}
+
+void spell_dict_free(SpellDict *dict) {
+    if (!dict) return;
+    g_free(dict->slots);
+    g_mapped_file_unref(dict->mapped);
+    g_free(dict);
+}
+
+gboolean spell_dict_contains(const SpellDict *dict, const char *word, gssize len) {
+    g_return_val_if_fail(dict != NULL && word != NULL, FALSE);
+
+    gsize word_len = len < 0 ? strlen(word) : (gsize)len;
+    if (word_len == 0 || *find_slot(dict, word, word_len) != 0) {
+        return TRUE;
+    }
+    g_autofree gchar *lower = g_utf8_strdown(word, (gssize)word_len);
+    gsize lower_len = strlen(lower);
+    if (lower_len == word_len && memcmp(lower, word, word_len) == 0) {
+        return FALSE;
+    }
+    return *find_slot(dict, lower, lower_len) != 0;
+}
+
+guint spell_dict_get_n_words(const SpellDict *dict) {
+    return dict->n_words;
+}
@@ -0,0 +1,216 @@
+#include "text_scan.h"
+#include <gio/gio.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct _TextLineIndex {
+    guint32 *starts;
+    guint n_lines;
+    gsize length;
+};
+
+// Returns the length of the valid multi-byte UTF-8 sequence at p, or 0.
+// Rejects overlong forms, surrogates and code points above U+10FFFF.
+static inline gsize utf8_sequence_length(const guchar *p, gsize available) {
+    guchar c = p[0];
+    if (c >= 0xC2 && c <= 0xDF) {
+        return available >= 2 && (p[1] & 0xC0) == 0x80 ? 2 : 0;
+    }
+    if (c >= 0xE0 && c <= 0xEF) {
+        if (available < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80) return 0;
+        if (c == 0xE0 && p[1] < 0xA0) return 0;
+        if (c == 0xED && p[1] > 0x9F) return 0;
+        return 3;
+    }
+    if (c >= 0xF0 && c <= 0xF4) {
+        if (available < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80) return 0;
+        if (c == 0xF0 && p[1] < 0x90) return 0;
+        if (c == 0xF4 && p[1] > 0x8F) return 0;
+        return 4;
+    }
+    return 0;
+}
+
+/*
+ * Reads src and, when dst is set, writes the normalized text to it; dst may
+ * be src. Blocks of 16 plain ASCII bytes are copied and searched for '\n'
+ * with SSE2; a block holding a CR, a NUL or a non-ASCII byte is decoded
+ * byte by byte. Returns FALSE with the offset of the first invalid byte.
+ */
+static gboolean scan_kernel(const guchar *src, gsize length, guchar *dst, GArray *starts,
+                            gsize *out_length, gsize *error_offset) {
+    gsize r = 0, w = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+#endif
+
+    while (r < length) {
+#ifdef __SSE2__
+        while (r + 16 <= length) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + r));
+            // The sign bit marks non-ASCII bytes
+            int special = _mm_movemask_epi8(v) |
+                          _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, zero)));
+            if (special) break;
+            if (dst && dst + w != src + r) {
+                _mm_storeu_si128((__m128i *)(dst + w), v);
+            }
+            if (starts) {
+                unsigned int newlines = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+                while (newlines) {
+                    guint32 start = (guint32)(w + (gsize)__builtin_ctz(newlines) + 1);
+                    g_array_append_val(starts, start);
+                    newlines &= newlines - 1;
+                }
+            }
+            r += 16;
+            w += 16;
+        }
+        gsize block_end = MIN(r + 16, length);
+#else
+        gsize block_end = length;
+#endif
+
+        while (r < block_end) {
+            guchar c = src[r];
+            if (c == 0) {
+                *error_offset = r;
+                return FALSE;
+            }
+            if (c >= 0x80) {
+                gsize n = utf8_sequence_length(src + r, length - r);
+                if (n == 0) {
+                    *error_offset = r;
+                    return FALSE;
+                }
+                if (dst && w != r) {
+                    memmove(dst + w, src + r, n);
+                }
+                r += n;
+                w += n;
+                continue;
+            }
+            if (c == '\r' && dst) {
+                r++;
+                if (r < length && src[r] == '\n') continue; // CRLF: the LF follows
+                c = '\n';
+            } else {
+                r++;
+            }
+            if (dst) dst[w] = c;
+            w++;
+            if (c == '\n' && starts) {
+                guint32 start = (guint32)w;
+                g_array_append_val(starts, start);
+            }
+        }
+    }
+    *out_length = w;
+    return TRUE;
+}
+
+gboolean text_scan(gchar *text, gsize *length, TextLineIndex **lines, GError **error) {
+    g_return_val_if_fail(length != NULL, FALSE);
+    g_return_val_if_fail(text != NULL || *length == 0, FALSE);
+
+    if (lines) {
+        *lines = NULL;
+        if (*length > G_MAXUINT32) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Text over 4 GiB can't be indexed");
+            return FALSE;
+        }
+    }
+
+    GArray *starts = NULL;
+    if (lines) {
+        // Guess from a typical line length; the array grows if needed
+        starts = g_array_sized_new(FALSE, FALSE, sizeof(guint32), (guint)(*length / 64 + 1));
+        guint32 first = 0;
+        g_array_append_val(starts, first);
+    }
+
+    gsize new_length = 0, error_offset = 0;
+    if (!scan_kernel((const guchar *)text, *length, (guchar *)text, starts, &new_length, &error_offset)) {
+        g_set_error(error, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE,
+                    "Invalid UTF-8 at byte %" G_GSIZE_FORMAT, error_offset);
+        if (starts) g_array_unref(starts);
+        return FALSE;
+    }
+    if (new_length < *length) {
+        text[new_length] = '\0';
+    }
+    *length = new_length;
+
+    if (lines) {
+        TextLineIndex *index = g_new(TextLineIndex, 1);
+        index->n_lines = starts->len;
+        index->length = new_length;
+        index->starts = (guint32 *)(void *)g_array_free(starts, FALSE);
+        *lines = index;
+    }
+    return TRUE;
+}
+
+gboolean text_scan_validate(const gchar *text, gsize length) {
+    g_return_val_if_fail(text != NULL || length == 0, FALSE);
+    gsize scanned, error_offset;
+    return scan_kernel((const guchar *)text, length, NULL, NULL, &scanned, &error_offset);
+}
+
+TextLineIndex *text_line_index_new(const gchar *text, gsize length) {
+    g_return_val_if_fail(text != NULL || length == 0, NULL);
+    if (length > G_MAXUINT32) return NULL;
+
+    GArray *starts = g_array_sized_new(FALSE, FALSE, sizeof(guint32), (guint)(length / 64 + 1));
+    guint32 start = 0;
+    g_array_append_val(starts, start);
+    for (const gchar *p = text, *end = text + length; (p = memchr(p, '\n', (gsize)(end - p))) != NULL;) {
+        p++;
+        start = (guint32)(p - text);
+        g_array_append_val(starts, start);
+    }
+
+    TextLineIndex *index = g_new(TextLineIndex, 1);
+    index->n_lines = starts->len;
+    index->length = length;
+    index->starts = (guint32 *)(void *)g_array_free(starts, FALSE);
+    return index;
+}
+
+void text_line_index_free(TextLineIndex *lines) {
+    if (!lines) return;
+    g_free(lines->starts);
+    g_free(lines);
+}
+
+guint text_line_index_get_n_lines(const TextLineIndex *lines) {
+    return lines->n_lines;
+}
+
+gsize text_line_index_get_line_start(const TextLineIndex *lines, guint line) {
+    g_return_val_if_fail(line < lines->n_lines, lines->length);
+    return lines->starts[line];
+}
+
+gsize text_line_index_get_line_end(const TextLineIndex *lines, guint line) {
+    g_return_val_if_fail(line < lines->n_lines, lines->length);
+    return line + 1 < lines->n_lines ? lines->starts[line + 1] - 1 : lines->length;
+}
+
+guint text_line_index_get_line_at_offset(const TextLineIndex *lines, gsize offset) {
+    // Last line starting at or before offset
+    guint low = 0, high = lines->n_lines;
+    while (high - low > 1) {
+        guint mid = low + (high - low) / 2;
+        if (lines->starts[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
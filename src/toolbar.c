@@ -1,9 +1,11 @@
 #include <gtk/gtk.h>
 #include "toolbar.h"
 #include "gtktext_cmark.h"
+#include "perf_trace.h"
 
 /* Knap callbacks */
 static void on_italic_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    PerfSpan span = perf_span_begin(PERF_OP_TOOLBAR_ITALIC);
     GtkTextView *text_view = GTK_TEXT_VIEW(user_data);
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
     GtkTextIter start, end;
@@ -40,9 +42,11 @@ static void on_italic_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer u
     } else {
         g_print("Ingen tekst markeret for kursiv\n");
     }
+    perf_span_end(&span);
 }
 
 static void on_bold_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    PerfSpan span = perf_span_begin(PERF_OP_TOOLBAR_BOLD);
     GtkTextView *text_view = GTK_TEXT_VIEW(user_data);
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
     GtkTextIter start, end;
@@ -79,9 +83,11 @@ static void on_bold_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer use
     } else {
         g_print("Ingen tekst markeret for fed skrift\n");
     }
+    perf_span_end(&span);
 }
 
 static void on_hr_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_data) {
+    PerfSpan span = perf_span_begin(PERF_OP_TOOLBAR_HR);
     GtkTextView *text_view = GTK_TEXT_VIEW(user_data);
     GtkTextBuffer *buffer = gtk_text_view_get_buffer(text_view);
     GtkTextIter insert;
@@ -131,9 +137,11 @@ static void on_hr_button_clicked(G_GNUC_UNUSED GtkButton *button, gpointer user_
     
     // Fjern det midlertidige mark
     gtk_text_buffer_delete_mark(buffer, start_mark);
+    perf_span_end(&span);
 }
 
 static void on_heading_button_clicked(GtkButton *button, gpointer user_data) {
+    PerfSpan span = perf_span_begin(PERF_OP_TOOLBAR_HEADING);
     // Find heading level fra knappen
     int level = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(button), "heading-level"));
     
@@ -183,6 +191,7 @@ static void on_heading_button_clicked(GtkButton *button, gpointer user_data) {
     if (popover) {
         gtk_popover_popdown(GTK_POPOVER(popover));
     }
+    perf_span_end(&span);
 }
 
 static void setup_heading_menu(GtkWidget *heading_button, GtkWidget *text_view) {
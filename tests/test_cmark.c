@@ -6,12 +6,58 @@
 #include <assert.h>
 
 #include "gtktext_cmark.h" // Our project's cmark header
+#include "cmark_arena.h"
+#include "md_hash_stream.h"
+#include "export_cache.h"
+#include "render_plan.h"
+#include "render_cache.h"
+#include "spell_dict.h"
+#include "parallel_parse.h"
+#include "text_scan.h"
+#include "source_map.h"
+#include "document_views.h"
+#include "source_mode.h"
+#include "live_format.h"
+#include "perf_policy.h"
+#include "scheduler.h"
+#include "markdown_paste.h"
+#include "document_print.h"
+#include "outline.h"
+#include "document_io.h"
+#include "file_monitor.h"
+#include <cairo-pdf.h>
 
 // Test function prototypes
 static void test_import_markdown(void);
 static void test_export_markdown(void);
+static void test_export_bold_italic(void);
+static void test_export_escaping(void);
+static void test_import_deep_nesting(void);
+static void test_cmark_arena(void);
+static void test_export_to_hash_stream(void);
+static void test_export_cache_incremental(void);
+static void test_render_plan_apply(void);
+static void test_render_cache_roundtrip(void);
+static void test_document_io(void);
+static void test_file_monitor(void);
+static void test_spell_dict_lookup(void);
+static void test_parallel_parse(void);
+static void test_text_scan(void);
+static void test_source_map(void);
+static void test_document_views(void);
+static void test_source_mode(void);
+static void test_live_format(void);
+static void test_perf_policy(void);
+static void test_scheduler(void);
+static void test_markdown_paste(void);
+static void test_print_pages(void);
+static void test_outline(void);
 
 int main(int argc, char *argv[]) {
+    // Keep the render cache test out of the user's cache; must precede the first lookup
+    g_autofree gchar *cache_home = g_dir_make_tmp("gtktext-test-XXXXXX", NULL);
+    g_setenv("XDG_CACHE_HOME", cache_home, TRUE);
+
     // Initialize GTK before our tests
     gtk_init();
     
@@ -20,6 +66,28 @@ int main(int argc, char *argv[]) {
     // Run tests
     test_import_markdown();
     test_export_markdown();
+    test_export_bold_italic();
+    test_export_escaping();
+    test_import_deep_nesting();
+    test_cmark_arena();
+    test_export_to_hash_stream();
+    test_export_cache_incremental();
+    test_render_plan_apply();
+    test_render_cache_roundtrip();
+    test_document_io();
+    test_file_monitor();
+    test_spell_dict_lookup();
+    test_parallel_parse();
+    test_text_scan();
+    test_source_map();
+    test_document_views();
+    test_source_mode();
+    test_live_format();
+    test_perf_policy();
+    test_scheduler();
+    test_markdown_paste();
+    test_print_pages();
+    test_outline();
     
     printf("All tests passed!\n");
     return EXIT_SUCCESS;
@@ -52,35 +120,6 @@ static void test_export_markdown(void) {
     // Create a buffer for testing
     GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
     
-    // Create tags needed for formatting
-    gtk_text_buffer_create_tag(buffer, "bold", "weight", PANGO_WEIGHT_BOLD, NULL);
-    gtk_text_buffer_create_tag(buffer, "italic", "style", PANGO_STYLE_ITALIC, NULL);
-    gtk_text_buffer_create_tag(buffer, "code", "family", "monospace", NULL);
-    
-    // Test for bold and italic combined
-    gtk_text_buffer_set_text(buffer, "This is regular text and this is bold/italic.", -1);
-    
-    // Apply formatting: Get iterators for the text to format
-    GtkTextIter start, end;
-    gtk_text_buffer_get_iter_at_offset(buffer, &start, 27); // "this is bold/italic"
-    gtk_text_buffer_get_iter_at_offset(buffer, &end, 46);   // End of "bold/italic"
-    
-    // Apply both bold and italic tags
-    gtk_text_buffer_apply_tag_by_name(buffer, "bold", &start, &end);
-    gtk_text_buffer_apply_tag_by_name(buffer, "italic", &start, &end);
-    
-    // Export the buffer to markdown
-    char *exported = export_buffer_to_markdown_cmark(buffer);
-    
-    // Check specific format: We should have "***bold/italic***" with three stars on each side
-    const char *expected = "***bold/italic***";
-    assert(strstr(exported, expected) != NULL);
-    
-    printf("Combined bold/italic format test passed.\n");
-    
-    // Create a buffer for testing
-    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
-    
     // Set up a simple buffer with formatting
     // This would normally be done through cmark import, but we're setting up directly for the test
     GtkTextIter start, end;
@@ -114,3 +153,1187 @@ static void test_export_markdown(void) {
     
     printf("Export test passed.\n");
 }
+
+// Test combined bold and italic export
+static void test_export_bold_italic(void) {
+    printf("Testing combined bold/italic export...\n");
+    
+    // Create a buffer for testing
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    
+    // Create tags needed for formatting
+    gtk_text_buffer_create_tag(buffer, "bold", "weight", PANGO_WEIGHT_BOLD, NULL);
+    gtk_text_buffer_create_tag(buffer, "italic", "style", PANGO_STYLE_ITALIC, NULL);
+    gtk_text_buffer_create_tag(buffer, "code", "family", "monospace", NULL);
+    
+    // Test for bold and italic combined
+    gtk_text_buffer_set_text(buffer, "This is regular text and this is bold/italic.", -1);
+    
+    // Apply formatting: Get iterators for the text to format
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 33); // Start of "bold/italic"
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, 44);   // End of "bold/italic"
+    
+    // Apply both bold and italic tags
+    gtk_text_buffer_apply_tag_by_name(buffer, "bold", &start, &end);
+    gtk_text_buffer_apply_tag_by_name(buffer, "italic", &start, &end);
+    
+    // Export the buffer to markdown
+    char *exported = export_buffer_to_markdown_cmark(buffer);
+    
+    // Check specific format: We should have "***bold/italic***" with three stars on each side
+    const char *expected = "***bold/italic***";
+    assert(strstr(exported, expected) != NULL);
+    
+    printf("Combined bold/italic format test passed.\n");
+    g_free(exported);
+    g_object_unref(buffer);
+}
+
+// Literal markup characters must be escaped so a round-trip keeps them as text,
+// while the bullet marker and inline HTML the importer keeps as text are left alone
+static void test_export_escaping(void) {
+    printf("Testing Markdown escaping on export...\n");
+
+    static const char *const cases[][2] = {
+        { "Literal \\*stars\\*, snake_case and \\[brackets\\]\n", NULL },
+        { "A back\\slash, and one before \\\\\\* a star\n", NULL },
+        { "Code ``a`b`` and <span class=\"x_y\">html</span>\n", NULL },
+        { "\\# Not a heading\n", NULL },
+        { "\\+ Not a list\n", NULL },
+        { "\\- Not a list either\n", NULL },
+        { "\\> Not a quote\n", NULL },
+        { "- item\n", "* item\n" }, // Bullets come back with the importer's marker
+        { "1\\. Not a list\n", NULL },
+        { "2024\\) Neither, but 1.5 stays\n", NULL },
+        { "1. item\n", "1\\. item\n" }, // The number is text in the buffer
+        { "**snake**\\_case and snake\\_**case**\n", NULL }, // A marker ends the word
+        { "*a*\\_b\\_*c*\n", NULL },
+        // Leading spaces in the buffer come from an entity; they must not let a block start
+        { "&#32; # Not a heading\n", NULL },
+        { "&#32;  > Not a quote\n", NULL },
+        { "&#32;- Not a list\n", NULL },
+        { "&#32; 2. Not a list\n", NULL },
+        { "&#32;   Not code\n", NULL },
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(cases); i++) {
+        const char *expected = cases[i][1] ? cases[i][1] : cases[i][0];
+        GtkTextBuffer *buffer = create_headless_buffer_cmark();
+        assert(import_markdown_to_buffer_cmark(buffer, cases[i][0]));
+        char *exported = export_buffer_to_markdown_cmark(buffer);
+        assert(strcmp(exported, expected) == 0);
+
+        // Batch mode exports the plan instead of a buffer, with the same result
+        RenderPlan *plan = parse_markdown_to_plan_cmark(cases[i][0], NULL);
+        char *exported_plan = export_plan_to_markdown_cmark(plan);
+        assert(strcmp(exported_plan, expected) == 0);
+        g_free(exported_plan);
+        render_plan_free(plan);
+
+        // Importing the export again gives the same Markdown
+        assert(import_markdown_to_buffer_cmark(buffer, exported));
+        char *exported_again = export_buffer_to_markdown_cmark(buffer);
+        assert(strcmp(exported_again, expected) == 0);
+        g_free(exported_again);
+        g_free(exported);
+        g_object_unref(buffer);
+    }
+
+    printf("Escaping test passed.\n");
+}
+
+// Deeply nested input must not exhaust the stack, and nested strong
+// emphasis must keep bold active after the inner span closes
+static void test_import_deep_nesting(void) {
+    printf("Testing import of deeply nested markdown...\n");
+
+    // Headless, so the test does not need libadwaita for the code tags
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+
+    GString *markdown = g_string_new(NULL);
+    for (int i = 0; i < 20000; i++) {
+        g_string_append_c(markdown, '>');
+    }
+    g_string_append(markdown, " deep\n\n**outer **inner** tail**\n");
+
+    gboolean result = import_markdown_to_buffer_cmark(buffer, markdown->str);
+    assert(result == TRUE);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    char *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    const char *tail = strstr(text, "tail");
+    assert(strstr(text, "deep") != NULL);
+    assert(tail != NULL);
+
+    GtkTextIter tail_iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &tail_iter, (gint)g_utf8_pointer_to_offset(text, tail));
+    GtkTextTag *bold_tag = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "bold");
+    assert(bold_tag != NULL);
+    assert(gtk_text_iter_has_tag(&tail_iter, bold_tag));
+
+    printf("Deep nesting test passed.\n");
+    g_free(text);
+    g_string_free(markdown, TRUE);
+    g_object_unref(buffer);
+}
+
+// Parse trees allocated from the arena are released in one reset, and the
+// arena's blocks are reused by the next parse instead of growing
+static void test_cmark_arena(void) {
+    printf("Testing cmark arena allocator...\n");
+
+    const char *markdown = "# Title\n\nSome *emphasis* and `code`.\n";
+    gsize retained_after_first = 0;
+
+    for (int round = 0; round < 3; round++) {
+        cmark_mem *arena = cmark_arena_acquire();
+        assert(arena != NULL);
+        // A second acquire on the same thread must fall back to malloc
+        assert(cmark_arena_acquire() == NULL);
+
+        cmark_parser *parser = cmark_parser_new_with_mem(CMARK_OPT_DEFAULT, arena);
+        cmark_parser_feed(parser, markdown, strlen(markdown));
+        cmark_node *document = cmark_parser_finish(parser);
+        cmark_parser_free(parser);
+
+        cmark_node *heading = cmark_node_first_child(document);
+        assert(cmark_node_get_type(heading) == CMARK_NODE_HEADING);
+        assert(strcmp(cmark_node_get_literal(cmark_node_first_child(heading)), "Title") == 0);
+
+        cmark_arena_release(arena);
+        if (round == 0) {
+            retained_after_first = cmark_arena_get_retained_size();
+            assert(retained_after_first > 0);
+        } else {
+            assert(cmark_arena_get_retained_size() == retained_after_first);
+        }
+    }
+
+    printf("Arena test passed.\n");
+}
+
+// Streaming a document larger than one export chunk into the hashing sink
+// must see exactly the bytes the string exporter returns
+static void test_export_to_hash_stream(void) {
+    printf("Testing export to a hash stream...\n");
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    GString *markdown = g_string_new(NULL);
+    for (int i = 0; i < 4000; i++) {
+        g_string_append_printf(markdown, "## Section %d\n\nSome **bold** and *italic* text.\n\n---\n\n", i);
+    }
+    assert(import_markdown_to_buffer_cmark(buffer, markdown->str));
+
+    char *exported = export_buffer_to_markdown_cmark(buffer);
+    assert(strlen(exported) > 64 * 1024);
+
+    GOutputStream *hash_stream = md_hash_output_stream_new(G_CHECKSUM_SHA256);
+    GError *error = NULL;
+    gboolean result = export_buffer_to_stream_cmark(buffer, hash_stream, NULL, &error);
+    assert(result == TRUE);
+    assert(error == NULL);
+
+    char *expected = g_compute_checksum_for_string(G_CHECKSUM_SHA256, exported, -1);
+    MdHashOutputStream *hash = MD_HASH_OUTPUT_STREAM(hash_stream);
+    assert(md_hash_output_stream_get_size(hash) == strlen(exported));
+    assert(strcmp(md_hash_output_stream_get_digest(hash), expected) == 0);
+
+    printf("Hash stream test passed.\n");
+    g_free(expected);
+    g_object_unref(hash_stream);
+    g_free(exported);
+    g_string_free(markdown, TRUE);
+    g_object_unref(buffer);
+}
+
+static char *export_with_cache(GtkTextBuffer *buffer) {
+    GOutputStream *memory = g_memory_output_stream_new_resizable();
+    GError *error = NULL;
+    assert(export_cache_write(buffer, memory, NULL, NULL, &error));
+    assert(g_output_stream_write_all(memory, "", 1, NULL, NULL, &error));
+    assert(g_output_stream_close(memory, NULL, &error));
+    char *md = g_memory_output_stream_steal_data(G_MEMORY_OUTPUT_STREAM(memory));
+    g_object_unref(memory);
+    return md;
+}
+
+static void assert_cache_matches_full_export(GtkTextBuffer *buffer) {
+    char *cached = export_with_cache(buffer);
+    char *full = export_buffer_to_markdown_cmark(buffer);
+    assert(strcmp(cached, full) == 0);
+    g_free(cached);
+    g_free(full);
+}
+
+static void test_export_cache_incremental(void) {
+    printf("Testing incremental export with the export cache...\n");
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    const char *markdown = "# Title\n\nSome **bold** and *italic* text.\n\n---\n\n"
+                           "```\ncode line\n```\n\nLast `code` paragraph.\n";
+    assert(import_markdown_to_buffer_cmark(buffer, markdown));
+    export_cache_attach(buffer);
+    assert_cache_matches_full_export(buffer);
+    // Second export comes entirely from the cache
+    assert_cache_matches_full_export(buffer);
+
+    // Typing inside a paragraph, including a new line
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &iter, 2, 4);
+    gtk_text_buffer_insert(buffer, &iter, " more\nwords", -1);
+    assert_cache_matches_full_export(buffer);
+
+    // Formatting only changes tags; bold that runs over a line end changes the next line's context
+    GtkTextIter start, end;
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "bold");
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &start, 0, 2);
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &end, 2, 2);
+    gtk_text_buffer_apply_tag(buffer, bold, &start, &end);
+    assert_cache_matches_full_export(buffer);
+    gtk_text_buffer_remove_tag(buffer, bold, &start, &end);
+    assert_cache_matches_full_export(buffer);
+
+    // Deleting across lines, then everything
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 1);
+    gtk_text_buffer_get_iter_at_line(buffer, &end, 4);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    assert_cache_matches_full_export(buffer);
+
+    // The write hashes what it wrote, and the digest is known until the next edit
+    GOutputStream *hash_stream = md_hash_output_stream_new(G_CHECKSUM_SHA256);
+    char *digest = NULL;
+    assert(export_cache_write(buffer, hash_stream, &digest, NULL, NULL));
+    char *full = export_buffer_to_markdown_cmark(buffer);
+    char *expected = g_compute_checksum_for_string(G_CHECKSUM_SHA256, full, -1);
+    assert(strcmp(digest, expected) == 0);
+    assert(strcmp(md_hash_output_stream_get_digest(MD_HASH_OUTPUT_STREAM(hash_stream)), expected) == 0);
+    assert(g_strcmp0(export_cache_get_written_digest(buffer), expected) == 0);
+    g_object_unref(hash_stream);
+    g_free(digest);
+    digest = export_cache_compute_digest(buffer);
+    assert(strcmp(digest, expected) == 0);
+
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "x", -1);
+    assert(export_cache_get_written_digest(buffer) == NULL);
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, 1);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    char *unchanged = export_cache_compute_digest(buffer);
+    assert(strcmp(unchanged, expected) == 0);
+    g_free(unchanged);
+
+    gtk_text_buffer_set_text(buffer, "", -1);
+    assert_cache_matches_full_export(buffer);
+
+    printf("Export cache test passed.\n");
+    g_free(expected);
+    g_free(full);
+    g_free(digest);
+    g_object_unref(buffer);
+}
+
+static void test_render_plan_apply(void) {
+    printf("Testing applying a render plan...\n");
+
+    GString *before = g_string_new(NULL);
+    GString *after = g_string_new(NULL);
+    for (int i = 0; i < 500; i++) {
+        g_string_append_printf(before, "Paragraph %d with **bold** text.\n\n", i);
+        g_string_append_printf(after, i == 250 ? "Paragraph %d with *changed* text.\n\n"
+                                               : "Paragraph %d with **bold** text.\n\n", i);
+    }
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    GtkTextBuffer *scratch = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(buffer, before->str));
+    assert(import_markdown_to_buffer_cmark(scratch, after->str));
+
+    RenderPlan *plan = render_plan_new_from_buffer(scratch);
+    assert(render_plan_get_n_lines(plan) == (guint)gtk_text_buffer_get_line_count(scratch));
+    // Only the changed paragraph is replaced
+    assert(render_plan_apply(plan, buffer) == 1);
+    assert(render_plan_apply(plan, buffer) == 0);
+
+    char *expected = export_buffer_to_markdown_cmark(scratch);
+    char *actual = export_buffer_to_markdown_cmark(buffer);
+    assert(strcmp(expected, actual) == 0);
+    g_free(actual);
+    g_free(expected);
+
+    // Changes far apart replace only their own blocks, not everything between them
+    g_string_truncate(after, 0);
+    for (int i = 0; i < 500; i++) {
+        if (i == 10) g_string_append(after, "An inserted paragraph.\n\n");
+        if (i == 400) continue;
+        g_string_append_printf(after, i == 250 ? "Paragraph %d with *changed* text.\n\n"
+                                               : "Paragraph %d with **bold** text.\n\n", i);
+    }
+    assert(import_markdown_to_buffer_cmark(scratch, after->str));
+    render_plan_free(plan);
+    plan = render_plan_new_from_buffer(scratch);
+    GtkTextIter cursor;
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &cursor, 300, 4);
+    gtk_text_buffer_place_cursor(buffer, &cursor);
+    assert(render_plan_apply(plan, buffer) == 2);
+    expected = export_buffer_to_markdown_cmark(scratch);
+    actual = export_buffer_to_markdown_cmark(buffer);
+    assert(strcmp(expected, actual) == 0);
+    // The cursor moved down with its paragraph, one line per paragraph
+    gtk_text_buffer_get_iter_at_mark(buffer, &cursor, gtk_text_buffer_get_insert(buffer));
+    assert(gtk_text_iter_get_line(&cursor) == 301 && gtk_text_iter_get_line_offset(&cursor) == 4);
+
+    // Shrinking to an empty document
+    gtk_text_buffer_set_text(scratch, "", -1);
+    render_plan_free(plan);
+    plan = render_plan_new_from_buffer(scratch);
+    render_plan_apply(plan, buffer);
+    assert(gtk_text_buffer_get_char_count(buffer) == 0);
+
+    printf("Render plan test passed.\n");
+    g_free(actual);
+    g_free(expected);
+    render_plan_free(plan);
+    g_object_unref(scratch);
+    g_object_unref(buffer);
+    g_string_free(after, TRUE);
+    g_string_free(before, TRUE);
+}
+
+// Test that a cached document comes back with the same text and tags
+static void test_render_cache_roundtrip(void) {
+    printf("Testing the render cache...\n");
+
+    const char *markdown = "# Title\n\nSome **bold** and *italic* text with `code`.\n\n"
+                           "```\nint x;\n```\n\n## Next\n\nPlain ending\n";
+    g_autofree gchar *path = g_build_filename(g_getenv("XDG_CACHE_HOME"), "doc.md", NULL);
+    assert(g_file_set_contents(path, markdown, -1, NULL));
+    GFile *file = g_file_new_for_path(path);
+    g_autofree gchar *digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, markdown, -1);
+
+    GtkTextBuffer *source = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(source, markdown));
+    assert(render_cache_load(source, file) == NULL);
+    assert(render_cache_store(source, file, digest));
+
+    GtkTextBuffer *cached = create_headless_buffer_cmark();
+    g_autofree gchar *cached_digest = render_cache_load(cached, file);
+    assert(cached_digest && strcmp(cached_digest, digest) == 0);
+
+    // Applying a snapshot of the original changes nothing if the cache restored it exactly
+    RenderPlan *plan = render_plan_new_from_buffer(source);
+    assert(render_plan_apply(plan, cached) == 0);
+    render_plan_free(plan);
+
+    // A different size invalidates the entry
+    assert(g_file_set_contents(path, "changed\n", -1, NULL));
+    GtkTextBuffer *stale = create_headless_buffer_cmark();
+    assert(render_cache_load(stale, file) == NULL);
+
+    g_object_unref(stale);
+    g_object_unref(cached);
+    g_object_unref(source);
+    g_object_unref(file);
+    printf("Render cache test passed.\n");
+}
+
+static void on_document_io_ready(G_GNUC_UNUSED GObject *source_object, GAsyncResult *result, gpointer user_data) {
+    GAsyncResult **out = user_data;
+    *out = g_object_ref(result);
+}
+
+static GAsyncResult *wait_for_document_io(GAsyncResult **result) {
+    while (!*result) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    return *result;
+}
+
+// Test an async open and save round trip, and that a cancelled save keeps the old file
+static void test_document_io(void) {
+    printf("Testing async open and save...\n");
+
+    const char *markdown = "# Title\n\nSome **bold** and *italic* text with `code`.\n\n"
+                           "```\nint x;\n```\n\nPlain ending\n";
+    g_autofree gchar *path = g_build_filename(g_getenv("XDG_CACHE_HOME"), "io.md", NULL);
+    g_autofree gchar *copy_path = g_build_filename(g_getenv("XDG_CACHE_HOME"), "io-copy.md", NULL);
+    assert(g_file_set_contents(path, markdown, -1, NULL));
+    GFile *file = g_file_new_for_path(path);
+    GFile *copy = g_file_new_for_path(copy_path);
+
+    GAsyncResult *result = NULL;
+    document_io_load_async(file, NULL, NULL, on_document_io_ready, &result);
+    g_autofree gchar *digest = NULL;
+    GtkTextBuffer *buffer = document_io_load_finish(wait_for_document_io(&result), &digest, NULL);
+    g_clear_object(&result);
+    assert(buffer != NULL);
+    g_autofree gchar *expected_digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, markdown, -1);
+    assert(strcmp(digest, expected_digest) == 0);
+    assert(!gtk_text_buffer_get_can_undo(buffer));
+
+    // The loaded buffer matches a synchronous import of the same file
+    GtkTextBuffer *imported = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(imported, markdown));
+    RenderPlan *plan = render_plan_new_from_buffer(imported);
+    assert(render_plan_apply(plan, buffer) == 0);
+    render_plan_free(plan);
+
+    // Saving writes what the exporter produces, and the digest is of the written bytes
+    document_io_save_async(buffer, copy, NULL, NULL, on_document_io_ready, &result);
+    g_autofree gchar *saved_digest = NULL;
+    assert(document_io_save_finish(wait_for_document_io(&result), &saved_digest, NULL));
+    g_clear_object(&result);
+    g_autofree gchar *saved = NULL;
+    assert(g_file_get_contents(copy_path, &saved, NULL, NULL));
+    g_autofree gchar *exported = export_buffer_to_markdown_cmark(buffer);
+    assert(strcmp(saved, exported) == 0);
+    g_autofree gchar *written_digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, saved, -1);
+    assert(strcmp(saved_digest, written_digest) == 0);
+
+    // A cancelled save fails without touching the file
+    GCancellable *cancellable = g_cancellable_new();
+    gtk_text_buffer_set_text(buffer, "replaced", -1);
+    document_io_save_async(buffer, copy, cancellable, NULL, on_document_io_ready, &result);
+    g_cancellable_cancel(cancellable);
+    GError *error = NULL;
+    assert(!document_io_save_finish(wait_for_document_io(&result), NULL, &error));
+    assert(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+    g_clear_error(&error);
+    g_clear_object(&result);
+    g_autofree gchar *kept = NULL;
+    assert(g_file_get_contents(copy_path, &kept, NULL, NULL));
+    assert(strcmp(kept, saved) == 0);
+
+    g_object_unref(cancellable);
+    g_object_unref(imported);
+    g_object_unref(buffer);
+    g_object_unref(copy);
+    g_object_unref(file);
+    printf("Async open and save test passed.\n");
+}
+
+static gboolean buffer_contains(GtkTextBuffer *buffer, const char *needle) {
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree gchar *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    return strstr(text, needle) != NULL;
+}
+
+// A reload task holds a reference on the buffer until it has finished
+static void wait_for_reload(GtkTextBuffer *buffer) {
+    while (G_OBJECT(buffer)->ref_count > 1) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+// Test that an external change is reloaded, but never over unsaved edits
+static void test_file_monitor(void) {
+    printf("Testing reloading external changes...\n");
+
+    const char *markdown = "# Title\n\nFirst version\n";
+    g_autofree gchar *path = g_build_filename(g_getenv("XDG_CACHE_HOME"), "monitor.md", NULL);
+    assert(g_file_set_contents(path, markdown, -1, NULL));
+    GFile *file = g_file_new_for_path(path);
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(buffer, markdown));
+    export_cache_attach(buffer);
+    g_autofree gchar *digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, markdown, -1);
+    export_cache_set_saved_digest(buffer, digest);
+    file_monitor_attach(buffer, file);
+    assert(!export_cache_is_modified(buffer));
+
+    // Without edits the change is applied and the buffer is clean again
+    assert(g_file_set_contents(path, "# Title\n\nSecond version\n", -1, NULL));
+    file_monitor_verify(buffer);
+    wait_for_reload(buffer);
+    assert(buffer_contains(buffer, "Second version"));
+    assert(!export_cache_is_modified(buffer));
+
+    // An edit still waiting for autosave survives a change on disk
+    GtkTextIter iter;
+    gtk_text_buffer_get_end_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "\nUnsaved edit", -1);
+    assert(export_cache_is_modified(buffer));
+    g_autofree gchar *saved_digest = g_strdup(export_cache_get_saved_digest(buffer));
+    assert(g_file_set_contents(path, "# Title\n\nThird version\n", -1, NULL));
+    file_monitor_verify(buffer);
+    wait_for_reload(buffer);
+    assert(buffer_contains(buffer, "Unsaved edit"));
+    assert(buffer_contains(buffer, "Second version"));
+    assert(!buffer_contains(buffer, "Third version"));
+    assert(export_cache_is_modified(buffer));
+    assert(g_strcmp0(export_cache_get_saved_digest(buffer), saved_digest) == 0);
+
+    g_object_unref(buffer);
+    g_object_unref(file);
+    printf("Reload test passed.\n");
+}
+
+// Test word list parsing and lookups
+static void test_spell_dict_lookup(void) {
+    printf("Testing the spell checking dictionary...\n");
+
+    // Hunspell layout: a word count, then words with affix flags
+    const char *words = "5\nhello/S\nworld\r\ndon't\nhello\nsmørrebrød/M\n";
+    g_autofree gchar *path = g_build_filename(g_getenv("XDG_CACHE_HOME"), "words.dic", NULL);
+    assert(g_file_set_contents(path, words, -1, NULL));
+
+    SpellDict *dict = spell_dict_new_from_file(path, NULL);
+    assert(dict != NULL);
+    assert(spell_dict_get_n_words(dict) == 5); // "5" counts, the second "hello" doesn't
+    assert(spell_dict_contains(dict, "hello", -1));
+    assert(spell_dict_contains(dict, "Hello", -1));
+    assert(spell_dict_contains(dict, "world", -1));
+    assert(spell_dict_contains(dict, "don't", -1));
+    assert(spell_dict_contains(dict, "smørrebrød", -1));
+    assert(spell_dict_contains(dict, "worldwide", 5));
+    assert(!spell_dict_contains(dict, "hell", -1));
+    assert(!spell_dict_contains(dict, "helloS", -1));
+    assert(!spell_dict_contains(dict, "wrold", -1));
+    spell_dict_free(dict);
+
+    assert(spell_dict_new_from_file("/nonexistent/words", NULL) == NULL);
+    printf("Spell dictionary test passed.\n");
+}
+
+static gpointer parse_plan_thread(gpointer data) {
+    return parse_markdown_to_plan_cmark(data, NULL);
+}
+
+// Test that chunked parsing gives the same result as parsing the whole document
+static void test_parallel_parse(void) {
+    printf("Testing parallel chunked parsing...\n");
+
+    GString *markdown = g_string_new(NULL);
+    for (int i = 0; i < 200; i++) {
+        g_string_append_printf(markdown, "## Section %d\n\nSome **bold** and [a link][ref%d] here.\n\n", i, i % 7);
+        g_string_append(markdown, "```\ncode\n\nnot a split point\n```\n\n");
+        g_string_append(markdown, "- item\n\n- loose item\n\n");
+        g_string_append(markdown, "<!--\n\ncomment\n\n-->\n\n");
+    }
+    // Defined at the end, used from every chunk
+    for (int i = 0; i < 7; i++) {
+        g_string_append_printf(markdown, "[ref%d]: https://example.com/%d\n", i, i);
+    }
+
+    GString *definitions = g_string_new(NULL);
+    GArray *starts = parallel_parse_split(markdown->str, markdown->len, NULL, 4, definitions);
+    assert(starts != NULL && starts->len == 4);
+    for (guint i = 1; i < starts->len; i++) {
+        // Cuts follow a blank line and are never inside the fenced code or the comment
+        gsize offset = g_array_index(starts, gsize, i);
+        g_autofree gchar *before = g_strndup(markdown->str, offset);
+        assert(g_str_has_suffix(before, "\n\n"));
+        g_auto(GStrv) fences = g_strsplit(before, "```", -1);
+        assert(g_strv_length(fences) % 2 == 1);
+        g_auto(GStrv) comments = g_strsplit(before, "<!--", -1);
+        g_auto(GStrv) comment_ends = g_strsplit(before, "-->", -1);
+        assert(g_strv_length(comments) == g_strv_length(comment_ends));
+    }
+    assert(strstr(definitions->str, "[ref6] #\n") != NULL);
+
+    // Stepping through a line index finds the same cuts
+    gsize length = markdown->len;
+    TextLineIndex *lines = NULL;
+    assert(text_scan(markdown->str, &length, &lines, NULL) && length == markdown->len);
+    GString *indexed_definitions = g_string_new(NULL);
+    GArray *indexed_starts = parallel_parse_split(markdown->str, length, lines, 4, indexed_definitions);
+    assert(indexed_starts != NULL && indexed_starts->len == starts->len);
+    assert(memcmp(indexed_starts->data, starts->data, starts->len * sizeof(gsize)) == 0);
+    assert(strcmp(indexed_definitions->str, definitions->str) == 0);
+    g_array_unref(indexed_starts);
+    g_string_free(indexed_definitions, TRUE);
+    g_array_unref(starts);
+    g_string_free(definitions, TRUE);
+
+    // Parsed whole and in four chunks, the result must be identical
+    GtkTextBuffer *whole = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(whole, markdown->str));
+    RenderPlan *plan = parallel_parse_markdown(markdown->str, lines, 4);
+    assert(plan != NULL);
+    assert(render_plan_apply(plan, whole) == 0);
+    render_plan_free(plan);
+
+    // The plan is built without GTK objects, so any thread can parse
+    GThread *thread = g_thread_new("parse", parse_plan_thread, markdown->str);
+    plan = g_thread_join(thread);
+    assert(plan != NULL);
+    assert(render_plan_apply(plan, whole) == 0);
+    render_plan_free(plan);
+    text_line_index_free(lines);
+    g_object_unref(whole);
+
+    // A definition inside a block quote can't be judged without parsing
+    definitions = g_string_new(NULL);
+    assert(parallel_parse_split("Text\n\n> [a]: /url\n\nMore\n", 24, NULL, 2, definitions) == NULL);
+    g_string_free(definitions, TRUE);
+
+    g_string_free(markdown, TRUE);
+    printf("Parallel parse test passed.\n");
+}
+
+// Test line ending normalization, the line index and UTF-8 validation,
+// with text long enough to cross the 16-byte blocks of the SSE2 path
+static void test_text_scan(void) {
+    printf("Testing text scan...\n");
+
+    gchar text[] = "A line of plain ASCII text\r\nthen a lone CR\rthen \xc3\xa6\xc3\xb8\xc3\xa5 and\n\nend";
+    const gchar *expected = "A line of plain ASCII text\nthen a lone CR\nthen \xc3\xa6\xc3\xb8\xc3\xa5 and\n\nend";
+    gsize length = strlen(text);
+    TextLineIndex *lines = NULL;
+    assert(text_scan(text, &length, &lines, NULL));
+    assert(length == strlen(expected) && strcmp(text, expected) == 0);
+    assert(text_line_index_get_n_lines(lines) == 5);
+    assert(text_line_index_get_line_start(lines, 1) == 27);
+    assert(text_line_index_get_line_end(lines, 0) == 26);
+    assert(text_line_index_get_line_start(lines, 4) == length - 3);
+    assert(text_line_index_get_line_end(lines, 4) == length);
+    assert(text_line_index_get_line_at_offset(lines, 0) == 0);
+    assert(text_line_index_get_line_at_offset(lines, 27) == 1);
+    assert(text_line_index_get_line_at_offset(lines, length) == 4);
+    text_line_index_free(lines);
+
+    // Empty text has one empty line
+    gchar empty[] = "";
+    length = 0;
+    assert(text_scan(empty, &length, &lines, NULL));
+    assert(text_line_index_get_n_lines(lines) == 1 && text_line_index_get_line_end(lines, 0) == 0);
+    text_line_index_free(lines);
+
+    // Overlong '/', a surrogate, a code point above U+10FFFF, a NUL and a cut-off sequence,
+    // each after 20 ASCII bytes so the SSE2 path must hand over to the scalar one
+    static const gchar *const invalid[] = { "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\0", "\xe2\x82" };
+    static const gsize invalid_len[] = { 2, 3, 4, 1, 2 };
+    for (guint i = 0; i < G_N_ELEMENTS(invalid); i++) {
+        gchar bad[32] = "twenty bytes of text";
+        memcpy(bad + 20, invalid[i], invalid_len[i]);
+        length = 20 + invalid_len[i];
+        GError *error = NULL;
+        assert(!text_scan_validate(bad, length));
+        assert(!text_scan(bad, &length, NULL, &error));
+        assert(g_error_matches(error, G_CONVERT_ERROR, G_CONVERT_ERROR_ILLEGAL_SEQUENCE));
+        g_clear_error(&error);
+    }
+    assert(text_scan_validate("twenty bytes of text \xe2\x82\xac \xf0\x9f\x98\x80", 29));
+
+    printf("Text scan test passed.\n");
+}
+
+static void test_source_map(void) {
+    printf("Testing source map...\n");
+
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    assert(import_markdown_to_buffer_cmark(buffer, "# Title\n\nSome *emphasis* here\n\n```\ncode\n```\n"));
+    SourceMap *map = source_map_get(buffer);
+    assert(map != NULL);
+
+    // "Title\n\nSome emphasis here\ncode\n"
+    assert(source_map_to_source(map, 0) == 2);
+    assert(source_map_to_source(map, 7) == 9);
+    assert(source_map_to_source(map, 12) == 15);
+    assert(source_map_to_source(map, 14) == 17);
+    assert(source_map_to_source(map, 26) == 35);
+    assert(source_map_to_buffer(map, 15) == 12);
+    assert(source_map_to_buffer(map, 9) == 7);
+    assert(source_map_to_buffer(map, 35) == 26);
+
+    // Text typed in front of a node moves it along
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 7);
+    gtk_text_buffer_insert(buffer, &iter, "XX", -1);
+    assert(source_map_to_source(map, 9) == 9);
+    assert(source_map_to_buffer(map, 9) == 9);
+
+    GtkTextIter end;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 7);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, 9);
+    gtk_text_buffer_delete(buffer, &iter, &end);
+    assert(source_map_to_source(map, 7) == 9);
+    assert(source_map_to_buffer(map, 15) == 12);
+
+    g_object_unref(buffer);
+    printf("Source map test passed!\n");
+}
+
+static void test_document_views(void) {
+    printf("Testing document views...\n");
+
+    GtkWidget *first = g_object_ref_sink(gtk_text_view_new());
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(first));
+    GtkWidget *second = g_object_ref_sink(gtk_text_view_new_with_buffer(buffer));
+    GtkWidget *other = g_object_ref_sink(gtk_text_view_new());
+    document_views_add(GTK_TEXT_VIEW(first));
+    document_views_add(GTK_TEXT_VIEW(second));
+    document_views_add(GTK_TEXT_VIEW(other));
+
+    document_views_set_editable(buffer, FALSE);
+    assert(!gtk_text_view_get_editable(GTK_TEXT_VIEW(first)));
+    assert(!gtk_text_view_get_editable(GTK_TEXT_VIEW(second)));
+    assert(gtk_text_view_get_editable(GTK_TEXT_VIEW(other)));
+
+    // Opening a document swaps the buffer of every view of the old one
+    GtkTextBuffer *opened = gtk_text_buffer_new(NULL);
+    document_views_set_buffer(buffer, opened);
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(first)) == opened);
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(second)) == opened);
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(other)) != opened);
+
+    g_object_unref(first);
+    g_object_unref(second);
+    g_object_unref(other);
+    g_object_unref(opened);
+    printf("Document views test passed!\n");
+}
+
+// The source buffer follows the document through the changes each export reports
+static void assert_source_matches(GtkTextBuffer *buffer, GtkTextBuffer *source) {
+    g_free(export_cache_compute_digest(buffer));
+    char *full = export_buffer_to_markdown_cmark(buffer);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(source, &start, &end);
+    char *text = gtk_text_buffer_get_text(source, &start, &end, TRUE);
+    assert(strcmp(text, full) == 0);
+    g_free(text);
+    g_free(full);
+}
+
+static void test_source_mode(void) {
+    printf("Testing source mode...\n");
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(buffer, "# Title\n\nSome *emphasis* here\n\n---\n\nLast `code` line.\n"));
+    export_cache_attach(buffer);
+    GtkWidget *view = g_object_ref_sink(gtk_text_view_new_with_buffer(buffer));
+    document_views_add(GTK_TEXT_VIEW(view));
+
+    // The cursor on the 'e' of "emphasis" moves past the marker in the source, and back
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &iter, 2, 5);
+    gint offset = gtk_text_iter_get_offset(&iter);
+    gtk_text_buffer_place_cursor(buffer, &iter);
+    source_mode_toggle(GTK_TEXT_VIEW(view));
+    GtkTextBuffer *source = gtk_text_view_get_buffer(GTK_TEXT_VIEW(view));
+    assert(source != buffer && source_mode_is_source(source));
+    assert(source_mode_get_document(source) == buffer);
+    assert_source_matches(buffer, source);
+    gtk_text_buffer_get_iter_at_mark(source, &iter, gtk_text_buffer_get_insert(source));
+    assert(gtk_text_iter_get_char(&iter) == 'e');
+    gtk_text_iter_backward_char(&iter);
+    assert(gtk_text_iter_get_char(&iter) == '*');
+
+    source_mode_toggle(GTK_TEXT_VIEW(view));
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)) == buffer);
+    gtk_text_buffer_get_iter_at_mark(buffer, &iter, gtk_text_buffer_get_insert(buffer));
+    assert(gtk_text_iter_get_offset(&iter) == offset);
+
+    // Edits to the document replace only what they change in the source
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &iter, 2, 4);
+    gtk_text_buffer_insert(buffer, &iter, " more\nwords", -1);
+    assert_source_matches(buffer, source);
+    GtkTextIter start, end;
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "bold");
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &start, 0, 2);
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &end, 2, 2);
+    gtk_text_buffer_apply_tag(buffer, bold, &start, &end);
+    assert_source_matches(buffer, source);
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gtk_text_buffer_insert(buffer, &end, "tail", -1);
+    assert_source_matches(buffer, source);
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 1);
+    gtk_text_buffer_get_iter_at_line(buffer, &end, 4);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    assert_source_matches(buffer, source);
+
+    // Edits to the source are parsed into the document when it is shown again
+    source_mode_toggle(GTK_TEXT_VIEW(view));
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)) == source);
+    gtk_text_buffer_get_start_iter(source, &iter);
+    gtk_text_buffer_insert(source, &iter, "**New** start\n\n", -1);
+    source_mode_toggle(GTK_TEXT_VIEW(view));
+    // The source stays shown until its parse lands
+    assert(gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)) == source);
+    while (gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)) != buffer) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    assert(gtk_text_iter_has_tag(&iter, bold));
+    gtk_text_buffer_get_iter_at_line_offset(buffer, &end, 0, 9);
+    char *first_line = gtk_text_buffer_get_text(buffer, &iter, &end, FALSE);
+    assert(strcmp(first_line, "New start") == 0);
+
+    g_free(first_line);
+    g_object_unref(view);
+    g_object_unref(buffer);
+    printf("Source mode test passed!\n");
+}
+
+// Types text a keystroke at a time and runs the idle work it schedules
+static void type_text(GtkTextBuffer *buffer, const char *text) {
+    for (const char *p = text; *p; p++) {
+        gtk_text_buffer_insert_interactive_at_cursor(buffer, p, 1, TRUE);
+    }
+    while (g_main_context_iteration(NULL, FALSE));
+}
+
+static void test_live_format(void) {
+    printf("Testing live formatting...\n");
+
+    GtkTextBuffer *buffer = create_headless_buffer_cmark();
+    live_format_attach(buffer);
+    GtkTextTagTable *table = gtk_text_buffer_get_tag_table(buffer);
+
+    // A span is left as typed until the keystroke after its closing delimiter
+    type_text(buffer, "Some **bold*");
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    char *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "Some **bold*") == 0);
+    g_free(text);
+    type_text(buffer, "* ");
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "Some bold ") == 0);
+    g_free(text);
+    GtkTextTag *bold = gtk_text_tag_table_lookup(table, "bold");
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 5);
+    assert(bold && gtk_text_iter_has_tag(&start, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 9);
+    assert(!gtk_text_iter_has_tag(&start, bold));
+
+    // A heading waits for its line to end
+    type_text(buffer, "\n# Title");
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 1);
+    assert(gtk_text_iter_get_char(&start) == '#');
+    type_text(buffer, "\n");
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 1);
+    end = start;
+    gtk_text_iter_forward_to_line_end(&end);
+    text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "Title") == 0);
+    g_free(text);
+    GtkTextTag *h1 = gtk_text_tag_table_lookup(table, "h1");
+    assert(h1 && gtk_text_iter_has_tag(&start, h1));
+
+    // Undo takes the conversion back in one step
+    gtk_text_buffer_undo(buffer);
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 1);
+    assert(gtk_text_iter_get_char(&start) == '#');
+    g_object_unref(buffer);
+
+    // Delimiters that were already text stay text, and other tags stay on what is kept
+    buffer = create_headless_buffer_cmark();
+    assert(import_markdown_to_buffer_cmark(buffer, "file\\*name\\*x\n"));
+    live_format_attach(buffer);
+    table = gtk_text_buffer_get_tag_table(buffer);
+    GtkTextTag *misspelled = gtk_text_buffer_create_tag(buffer, "test-misspelled", "underline", PANGO_UNDERLINE_ERROR, NULL);
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 0);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, 4);
+    gtk_text_buffer_apply_tag(buffer, misspelled, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer, &end, 11);
+    gtk_text_buffer_place_cursor(buffer, &end);
+    type_text(buffer, " **b** ");
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 0);
+    end = start;
+    gtk_text_iter_forward_to_line_end(&end);
+    text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "file*name*x b ") == 0);
+    g_free(text);
+    GtkTextTag *italic = gtk_text_tag_table_lookup(table, "italic");
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 5);
+    assert(!italic || !gtk_text_iter_has_tag(&start, italic));
+    bold = gtk_text_tag_table_lookup(table, "bold");
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 12);
+    assert(bold && gtk_text_iter_has_tag(&start, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 2);
+    assert(gtk_text_iter_has_tag(&start, misspelled));
+    char *markdown = export_buffer_to_markdown_cmark(buffer);
+    assert(strstr(markdown, "file\\*name\\*x **b**") != NULL);
+    g_free(markdown);
+
+    g_object_unref(buffer);
+    printf("Live formatting test passed!\n");
+}
+
+// Without the schema loaded, the policy gives the schema's defaults
+static void test_perf_policy(void) {
+    printf("Testing performance policy...\n");
+
+    assert(perf_policy_get_settings() == NULL);
+    assert(perf_policy_get_autosave_delay() == 500);
+    assert(perf_policy_get_worker_threads() >= 1);
+    assert(perf_policy_get_render_cache_size() == 256 * 1024 * 1024);
+
+    // Documents over the threshold narrow highlighting to the visible text
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    gtk_text_buffer_set_text(buffer, "Short", -1);
+    assert(!perf_policy_is_large_document(buffer));
+    assert(perf_policy_get_highlight_scope(buffer) == PERF_HIGHLIGHT_DOCUMENT);
+    gchar *large = g_strnfill(4096 * 1024 + 1, 'x');
+    gtk_text_buffer_set_text(buffer, large, -1);
+    assert(perf_policy_is_large_document(buffer));
+    assert(perf_policy_get_highlight_scope(buffer) == PERF_HIGHLIGHT_VISIBLE);
+
+    g_free(large);
+    g_object_unref(buffer);
+    printf("Performance policy test passed!\n");
+}
+
+static gboolean count_slices(G_GNUC_UNUSED SchedulerJob *job, G_GNUC_UNUSED gint64 deadline_us, gpointer user_data) {
+    int *count = user_data;
+    return ++*count < 3;
+}
+
+typedef struct {
+    gint worked;
+    gboolean done;
+    gboolean freed;
+} SchedulerTestWork;
+
+static void scheduler_test_work(G_GNUC_UNUSED SchedulerJob *job, gpointer user_data) {
+    SchedulerTestWork *work = user_data;
+    g_atomic_int_set(&work->worked, TRUE);
+}
+
+static void scheduler_test_done(gpointer user_data) {
+    SchedulerTestWork *work = user_data;
+    work->done = TRUE;
+}
+
+static void scheduler_test_free(gpointer user_data) {
+    SchedulerTestWork *work = user_data;
+    work->freed = TRUE;
+}
+
+static void test_scheduler(void) {
+    printf("Testing scheduler...\n");
+
+    // A slice job runs until it reports that it is done
+    int slices = 0;
+    guint id = scheduler_add_slice(NULL, SCHEDULER_LANE_BACKGROUND, count_slices, &slices, NULL);
+    while (scheduler_is_pending(id)) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    assert(slices == 3);
+
+    // An edit of the buffer drops its jobs before they run
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    int stale_slices = 0;
+    guint generation = scheduler_get_generation(buffer);
+    id = scheduler_add_slice(buffer, SCHEDULER_LANE_VISIBLE, count_slices, &stale_slices, NULL);
+    gtk_text_buffer_set_text(buffer, "typed", -1);
+    assert(scheduler_get_generation(buffer) != generation);
+    assert(!scheduler_is_pending(id));
+    while (g_main_context_iteration(NULL, FALSE));
+    assert(stale_slices == 0);
+
+    // Work runs on the pool and is handed back on the main thread
+    SchedulerTestWork work = { 0 };
+    scheduler_add_work(buffer, SCHEDULER_LANE_BACKGROUND, scheduler_test_work, scheduler_test_done,
+                       &work, scheduler_test_free);
+    while (!work.freed) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    assert(g_atomic_int_get(&work.worked) && work.done);
+
+    // Cancelled work is freed without being handed back
+    SchedulerTestWork cancelled = { 0 };
+    id = scheduler_add_work(NULL, SCHEDULER_LANE_IDLE, scheduler_test_work, scheduler_test_done,
+                            &cancelled, scheduler_test_free);
+    scheduler_cancel(id);
+    assert(!scheduler_is_pending(id));
+    while (!cancelled.freed) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    assert(!cancelled.done);
+
+    g_object_unref(buffer);
+    printf("Scheduler test passed!\n");
+}
+
+static void wait_for_paste(GtkTextBuffer *buffer) {
+    while (markdown_paste_is_pending(buffer)) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+}
+
+static void test_markdown_paste(void) {
+    printf("Testing Markdown paste...\n");
+
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    gtk_text_buffer_set_text(buffer, "AB", -1);
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 1);
+    gtk_text_buffer_place_cursor(buffer, &iter);
+
+    // Inserted at the cursor as formatting, without the paragraph's line break
+    assert(markdown_paste_text(buffer, "Some **bold** text\n"));
+    assert(markdown_paste_is_pending(buffer));
+    assert(!markdown_paste_text(buffer, "again"));
+    wait_for_paste(buffer);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    char *text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "ASome bold textB") == 0);
+    g_free(text);
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "bold");
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 6);
+    assert(bold && gtk_text_iter_has_tag(&iter, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 15);
+    assert(!gtk_text_iter_has_tag(&iter, bold));
+    gtk_text_buffer_get_iter_at_mark(buffer, &iter, gtk_text_buffer_get_insert(buffer));
+    assert(gtk_text_iter_get_offset(&iter) == 15);
+
+    // A run longer than one piece arrives whole, and the paste undoes in one step
+    gchar *long_text = g_strnfill(20000, 'x');
+    assert(markdown_paste_text(buffer, long_text));
+    wait_for_paste(buffer);
+    assert(gtk_text_buffer_get_char_count(buffer) == 16 + 20000);
+    gtk_text_buffer_undo(buffer);
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+    assert(strcmp(text, "ASome bold textB") == 0);
+    g_free(text);
+
+    // Flushing inserts the rest of a paste at once, as before a save
+    assert(markdown_paste_text(buffer, long_text));
+    while (markdown_paste_is_pending(buffer) && gtk_text_buffer_get_char_count(buffer) == 16) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+    markdown_paste_flush(buffer);
+    assert(!markdown_paste_is_pending(buffer));
+    assert(gtk_text_buffer_get_char_count(buffer) == 16 + 20000);
+    while (g_main_context_iteration(NULL, FALSE));
+
+    g_free(long_text);
+    g_object_unref(buffer);
+    printf("Markdown paste test passed!\n");
+}
+
+static void test_print_pages(void) {
+    printf("Testing print pagination...\n");
+
+    GString *markdown = g_string_new("# Title\n\n");
+    for (int i = 0; i < 200; i++) {
+        g_string_append_printf(markdown, "Paragraph %d with **bold** and `code`.\n\n", i);
+    }
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    assert(import_markdown_to_buffer_cmark(buffer, markdown->str));
+
+    // Paginated in steps, then every page can be drawn
+    PrintPages *pages = print_pages_new(buffer, 300, 400);
+    int steps = 0;
+    while (!print_pages_paginate(pages, g_get_monotonic_time())) {
+        steps++;
+    }
+    assert(steps > 0);
+    assert(print_pages_get_progress(pages) == 1.0);
+    guint n_pages = print_pages_get_n_pages(pages);
+    assert(n_pages > 1);
+    guint laid_out = print_pages_get_n_laid_out(pages);
+    assert(laid_out > 200);
+    cairo_surface_t *surface = cairo_pdf_surface_create_for_stream(NULL, NULL, 300, 400);
+    cairo_t *cr = cairo_create(surface);
+    for (guint page = 0; page < n_pages; page++) {
+        print_pages_draw(pages, page, cr);
+        cairo_show_page(cr);
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+    print_pages_free(pages);
+
+    // After an edit only the changed block is laid out again
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, 2);
+    gtk_text_buffer_insert(buffer, &iter, "Edited ", -1);
+    pages = print_pages_new(buffer, 300, 400);
+    assert(print_pages_paginate(pages, 0));
+    assert(print_pages_get_n_laid_out(pages) == 1);
+    assert(print_pages_get_n_pages(pages) == n_pages);
+    print_pages_free(pages);
+
+    // The buffer is read in slices, and lines already read are read again once edited
+    RenderPlanSnapshot *snapshot = render_plan_snapshot_new(buffer);
+    assert(!render_plan_snapshot_read(snapshot, g_get_monotonic_time()));
+    assert(render_plan_snapshot_get_progress(snapshot) < 1.0);
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "Snap ", -1);
+    while (!render_plan_snapshot_read(snapshot, g_get_monotonic_time()));
+    RenderPlan *plan = render_plan_snapshot_finish(snapshot);
+    const RenderPlanRun *runs;
+    guint n_runs;
+    assert(g_str_has_prefix(render_plan_get_line(plan, 0, &runs, &n_runs), "Snap Title"));
+    assert(render_plan_get_n_lines(plan) == (guint)gtk_text_buffer_get_line_count(buffer));
+    render_plan_free(plan);
+
+    g_string_free(markdown, TRUE);
+    g_object_unref(buffer);
+    printf("Print pagination test passed!\n");
+}
+
+static gboolean is_folded_at(GtkTextBuffer *buffer, const char *text) {
+    GtkTextIter start, match;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    assert(gtk_text_iter_forward_search(&start, text, 0, &match, NULL, NULL));
+    GtkTextTag *folded = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), OUTLINE_FOLDED_TAG);
+    return folded && gtk_text_iter_has_tag(&match, folded);
+}
+
+static void test_outline(void) {
+    printf("Testing section folding...\n");
+
+    GtkTextBuffer *buffer = gtk_text_buffer_new(NULL);
+    assert(import_markdown_to_buffer_cmark(buffer, "# A\n\ntext a\n\n## B\n\ntext b\n\n# C\n\ntext c\n"));
+    assert(outline_get_n_headings(buffer) == 3);
+    assert(outline_get_heading(buffer, 1, NULL) == 2);
+
+    // A's section takes B with it but stops at C; export still has the hidden text
+    outline_set_folded(buffer, 0, TRUE);
+    assert(is_folded_at(buffer, "text a"));
+    assert(is_folded_at(buffer, "text b"));
+    assert(!is_folded_at(buffer, "A"));
+    assert(!is_folded_at(buffer, "C"));
+    char *markdown = export_buffer_to_markdown_cmark(buffer);
+    assert(strstr(markdown, "text b") != NULL);
+    g_free(markdown);
+
+    // The fold stays with its heading through edits above and in front of it
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "X", -1);
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "intro\n", -1);
+    while (g_main_context_iteration(NULL, FALSE));
+    assert(!is_folded_at(buffer, "intro"));
+    assert(is_folded_at(buffer, "text a"));
+    assert(outline_get_n_headings(buffer) == 3);
+    assert(outline_is_folded(buffer, 0));
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    assert(outline_find_section(buffer, &iter) == -1);
+
+    // Only the section being worked on stays open
+    GtkTextIter match;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    assert(gtk_text_iter_forward_search(&iter, "text c", 0, &match, NULL, NULL));
+    assert(outline_find_section(buffer, &match) == 2);
+    outline_fold_others(buffer, &match);
+    assert(outline_is_folded(buffer, 0) && outline_is_folded(buffer, 1) && !outline_is_folded(buffer, 2));
+    assert(!is_folded_at(buffer, "text c"));
+
+    // Text put into a folded section is hidden with it; opening a nested fold keeps the outer one
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    assert(gtk_text_iter_forward_search(&iter, "text a", 0, &match, NULL, NULL));
+    gtk_text_buffer_insert(buffer, &match, "reloaded ", -1);
+    assert(is_folded_at(buffer, "reloaded"));
+    outline_set_folded(buffer, 1, FALSE);
+    assert(is_folded_at(buffer, "text b"));
+    assert(outline_get_n_headings(buffer) == 3);
+
+    outline_unfold_all(buffer);
+    assert(!is_folded_at(buffer, "text a") && !is_folded_at(buffer, "text b"));
+    assert(!outline_is_folded(buffer, 0));
+
+    g_object_unref(buffer);
+    printf("Section folding test passed!\n");
+}